@@ -0,0 +1,5 @@
+# Used by the native_sanitize environment: build_flags only reach the compiler, the sanitizer runtimes have to be
+# linked as well
+Import("env")
+
+env.Append(LINKFLAGS=["-fsanitize=address,undefined"])
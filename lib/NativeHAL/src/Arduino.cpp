@@ -0,0 +1,110 @@
+/*
+ Arduino.cpp - Arduino core API for the native environment
+*/
+
+#include "Arduino.h"
+#include "native.h"
+
+static uint8_t pin_modes[NATIVE_PINS];
+
+struct Interrupt {
+    void (*handler)(void);
+    int mode;
+    bool listening;
+};
+
+static Interrupt interrupts[NATIVE_PINS];
+
+unsigned long millis() {
+    return (unsigned long)(native_clock_ns() / 1000000ULL);
+}
+
+unsigned long micros() {
+    return (unsigned long)(native_clock_ns() / 1000ULL);
+}
+
+void delay(unsigned long ms) {
+    if (native_light_sleep) {
+        native_light_sleep_ns += (uint64_t)ms * 1000000ULL;
+    }
+    native_clock_advance((uint64_t)ms * 1000000ULL);
+}
+
+void delayMicroseconds(unsigned int us) {
+    native_clock_advance((uint64_t)us * 1000ULL);
+}
+
+void yield() {
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin < NATIVE_PINS) {
+        pin_modes[pin] = mode;
+    }
+    if (mode == INPUT_PULLUP) {
+        native_pin_set(pin, HIGH, 0);
+    }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+    native_pin_set(pin, value ? HIGH : LOW, 0);
+}
+
+int digitalRead(uint8_t pin) {
+    return native_pin_value(pin);
+}
+
+/*  Interrupts run straight from the pin change, there is no concurrency in the simulation  */
+
+static void interrupt_listener(uint8_t pin, uint8_t value, void* context) {
+    (void)context;
+    Interrupt* interrupt = &interrupts[pin];
+
+    if (interrupt->handler != NULL &&
+            (interrupt->mode == CHANGE || (interrupt->mode == RISING) == (value == HIGH))) {
+        interrupt->handler();
+    }
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode) {
+    if (pin >= NATIVE_PINS) {
+        return;
+    }
+    if (!interrupts[pin].listening) {
+        native_pin_listen(pin, interrupt_listener, NULL);
+        interrupts[pin].listening = true;
+    }
+    interrupts[pin].handler = handler;
+    interrupts[pin].mode = mode;
+}
+
+void detachInterrupt(uint8_t pin) {
+    if (pin < NATIVE_PINS) {
+        interrupts[pin].handler = NULL;
+    }
+}
+
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration) {
+    (void)duration;
+    native_pin_set(pin, frequency ? HIGH : LOW, frequency);
+}
+
+void noTone(uint8_t pin) {
+    native_pin_set(pin, LOW, 0);
+}
+
+long random(long howbig) {
+    return howbig <= 0 ? 0 : ::random() % howbig;
+}
+
+long random(long howsmall, long howbig) {
+    return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall);
+}
+
+void randomSeed(unsigned long seed) {
+    srandom(seed);
+}
+
+void panic() {
+    abort();
+}
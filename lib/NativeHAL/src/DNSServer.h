@@ -0,0 +1,11 @@
+/*
+ DNSServer.h - Nothing to do in the native environment, the configuration portal is not simulated
+*/
+
+#ifndef DNSServer_h
+#define DNSServer_h
+
+class DNSServer {
+};
+
+#endif
@@ -0,0 +1,11 @@
+/*
+ ESP8266WebServer.h - Nothing to do in the native environment, the configuration portal is not simulated
+*/
+
+#ifndef ESP8266WEBSERVER_H
+#define ESP8266WEBSERVER_H
+
+class ESP8266WebServer {
+};
+
+#endif
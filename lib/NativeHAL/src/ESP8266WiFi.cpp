@@ -0,0 +1,57 @@
+/*
+ ESP8266WiFi.cpp - Wi-Fi station of the native environment
+*/
+
+#include "ESP8266WiFi.h"
+
+ESP8266WiFiClass WiFi;
+
+static uint8_t bssid[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+wl_status_t ESP8266WiFiClass::status() {
+    if (!_begun || native_clock_ns() < _associatedAt) {
+        return WL_DISCONNECTED;
+    }
+    return _found ? WL_CONNECTED : WL_NO_SSID_AVAIL;
+}
+
+/*  Without a channel and a BSSID the station scans, with them it goes straight to that AP or reports it missing  */
+
+wl_status_t ESP8266WiFiClass::begin(const char* ssid, const char* passphrase, int32_t channel,
+                                    const uint8_t* bssid_, bool connect) {
+    (void)ssid;
+    (void)passphrase;
+    if (bssid_ == NULL || channel == 0) {
+        begin();
+    } else {
+        _found = channel == native_wifi_channel && memcmp(bssid_, bssid, sizeof bssid) == 0;
+        _begun = connect;
+        _associatedAt = native_clock_ns() + (uint64_t)native_wifi_directed_ms * 1000000ULL;
+    }
+    return status();
+}
+
+wl_status_t ESP8266WiFiClass::begin() {
+    _begun = true;
+    _found = true;
+    _associatedAt = native_clock_ns() + (uint64_t)native_wifi_associate_ms * 1000000ULL;
+    return status();
+}
+
+bool ESP8266WiFiClass::config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1) {
+    (void)local_ip;
+    (void)gateway;
+    (void)subnet;
+    (void)dns1;
+    return true;
+}
+
+uint8_t* ESP8266WiFiClass::BSSID() {
+    return bssid;
+}
+
+bool ESP8266WiFiClass::disconnect(bool wifioff) {
+    (void)wifioff;
+    _begun = false;
+    return true;
+}
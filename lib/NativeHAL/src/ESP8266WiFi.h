@@ -0,0 +1,75 @@
+/*
+ ESP8266WiFi.h - Wi-Fi station of the native environment: the host network stands in for it, associated
+ native_wifi_associate_ms after begin(), or native_wifi_directed_ms after a begin() given the BSSID and channel of
+ the simulated AP
+*/
+
+#ifndef ESP8266WiFi_h
+#define ESP8266WiFi_h
+
+#include <Arduino.h>
+#include "IPAddress.h"
+#include "WiFiClient.h"
+
+typedef enum {
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_SCAN_COMPLETED = 2,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum {
+    WIFI_OFF = 0,
+    WIFI_STA = 1,
+    WIFI_AP = 2,
+    WIFI_AP_STA = 3
+} WiFiMode_t;
+
+typedef enum {
+    WIFI_NONE_SLEEP = 0,
+    WIFI_LIGHT_SLEEP = 1,
+    WIFI_MODEM_SLEEP = 2
+} WiFiSleepType_t;
+
+class ESP8266WiFiClass {
+public:
+    wl_status_t status();
+    bool mode(WiFiMode_t mode) { (void)mode; return true; }
+    wl_status_t begin(const char* ssid, const char* passphrase = NULL, int32_t channel = 0,
+                      const uint8_t* bssid = NULL, bool connect = true);
+    wl_status_t begin();
+    bool config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1 = (uint32_t)0);
+    bool disconnect(bool wifioff = false);
+    void persistent(bool persistent) { (void)persistent; }
+    bool isConnected() { return status() == WL_CONNECTED; }
+    IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+    IPAddress gatewayIP() { return IPAddress(127, 0, 0, 1); }
+    IPAddress subnetMask() { return IPAddress(255, 0, 0, 0); }
+    IPAddress dnsIP(uint8_t dns_no = 0) { (void)dns_no; return IPAddress(127, 0, 0, 1); }
+    String SSID() const { return String("native"); }
+    String psk() const { return String("native"); }
+    uint8_t* BSSID();
+    int32_t channel() { return native_wifi_channel; }
+    int32_t RSSI() { return -50; }
+
+    // Light sleep is accounted for by delay()
+    bool setSleepMode(WiFiSleepType_t type) {
+        _sleepMode = type;
+        native_light_sleep = type == WIFI_LIGHT_SLEEP;
+        return true;
+    }
+    WiFiSleepType_t getSleepMode() { return _sleepMode; }
+
+private:
+    WiFiSleepType_t _sleepMode = WIFI_MODEM_SLEEP;
+    bool _begun = false;
+    bool _found = true;          // False if begin() was given the BSSID or channel of another AP
+    uint64_t _associatedAt = 0;  // Clock when the association started by begin() completes
+};
+
+extern ESP8266WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ Esp.cpp - The ESP object of the ESP8266 core for the native environment
+*/
+
+#include <string.h>
+#include "Esp.h"
+#include "native.h"
+
+ESPClass ESP;
+
+uint8_t native_rtc_memory[RTC_USER_MEMORY_SIZE];
+
+void ESPClass::reset() {
+    native_restart();
+}
+
+void ESPClass::restart() {
+    native_restart();
+}
+
+/*  80 MHz, from the simulation clock  */
+
+uint32_t ESPClass::getCycleCount() {
+    return (uint32_t)(native_clock_ns() * 80 / 1000);
+}
+
+bool ESPClass::rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size) {
+    if (offset * 4 + size > RTC_USER_MEMORY_SIZE) {
+        return false;
+    }
+    memcpy(data, native_rtc_memory + offset * 4, size);
+    return true;
+}
+
+bool ESPClass::rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size) {
+    if (offset * 4 + size > RTC_USER_MEMORY_SIZE) {
+        return false;
+    }
+    memcpy(native_rtc_memory + offset * 4, data, size);
+    return true;
+}
@@ -0,0 +1,36 @@
+/*
+ Esp.h - The ESP object of the ESP8266 core for the native environment. A reset restarts the program and keeps
+ the RTC user memory, as on the device
+*/
+
+#ifndef ESP_H
+#define ESP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RTC_USER_MEMORY_SIZE 512 // Bytes, addressed in 4 byte blocks
+
+class ESPClass {
+public:
+    void reset();
+    void restart();
+    void wdtFeed() {}
+    void wdtEnable(uint32_t timeout_ms = 0) { (void)timeout_ms; }
+    void wdtDisable() {}
+
+    uint32_t getCycleCount();
+    uint32_t getFreeHeap() { return 40000; }
+    uint32_t getChipId() { return 0x00C0FFEE; }
+    uint8_t getCpuFreqMHz() { return 80; }
+
+    bool rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size);
+    bool rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size);
+};
+
+extern ESPClass ESP;
+
+/*  The RTC user memory, carried over native_restart()  */
+extern uint8_t native_rtc_memory[RTC_USER_MEMORY_SIZE];
+
+#endif
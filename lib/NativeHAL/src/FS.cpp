@@ -0,0 +1,130 @@
+/*
+ FS.cpp - SPIFFS for the native environment, mapped onto a directory of the host
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "FS.h"
+#include "native.h"
+
+FS SPIFFS;
+
+/*  File  */
+
+size_t File::write(const uint8_t* buffer, size_t size) {
+    return _file ? fwrite(buffer, 1, size, _file.get()) : 0;
+}
+
+int File::available() {
+    if (!_file) {
+        return 0;
+    }
+    return (int)(size() - position());
+}
+
+int File::read() {
+    return _file ? fgetc(_file.get()) : -1;
+}
+
+size_t File::read(uint8_t* buffer, size_t size) {
+    return _file ? fread(buffer, 1, size, _file.get()) : 0;
+}
+
+int File::peek() {
+    if (!_file) {
+        return -1;
+    }
+    int c = fgetc(_file.get());
+    if (c >= 0) {
+        ungetc(c, _file.get());
+    }
+    return c;
+}
+
+void File::flush() {
+    if (_file) {
+        fflush(_file.get());
+    }
+}
+
+bool File::seek(uint32_t pos, SeekMode mode) {
+    static const int whence[] = {SEEK_SET, SEEK_CUR, SEEK_END};
+
+    return _file && fseek(_file.get(), pos, whence[mode]) == 0;
+}
+
+size_t File::position() const {
+    return _file ? ftell(_file.get()) : 0;
+}
+
+size_t File::size() const {
+    struct stat st;
+
+    if (!_file) {
+        return 0;
+    }
+    fflush(_file.get());
+    return fstat(fileno(_file.get()), &st) == 0 ? st.st_size : 0;
+}
+
+/*  FS  */
+
+bool FS::begin() {
+    char root[300];
+
+    native_fs_path("", root, sizeof root);
+    return mkdir(root, 0755) == 0 || errno == EEXIST;
+}
+
+bool FS::format() {
+    char root[300];
+    char path[600];
+
+    DIR* dir = opendir(native_fs_path("", root, sizeof root));
+    if (dir == NULL) {
+        return false;
+    }
+    while (struct dirent* entry = readdir(dir)) {
+        if (entry->d_type == DT_REG) {
+            snprintf(path, sizeof path, "%s%s", root, entry->d_name);
+            unlink(path);
+        }
+    }
+    closedir(dir);
+    return true;
+}
+
+File FS::open(const char* path, const char* mode) {
+    char host_path[300];
+    char host_mode[4];
+
+    // Binary mode, the firmware stores raw records
+    snprintf(host_mode, sizeof host_mode, "%c%sb", mode[0], mode[1] == '+' ? "+" : "");
+    FILE* file = fopen(native_fs_path(path, host_path, sizeof host_path), host_mode);
+    return file ? File(file) : File();
+}
+
+bool FS::exists(const char* path) {
+    char host_path[300];
+
+    return access(native_fs_path(path, host_path, sizeof host_path), F_OK) == 0;
+}
+
+bool FS::remove(const char* path) {
+    char host_path[300];
+
+    return unlink(native_fs_path(path, host_path, sizeof host_path)) == 0;
+}
+
+bool FS::rename(const char* pathFrom, const char* pathTo) {
+    char from[300];
+    char to[300];
+
+    // SPIFFS refuses to overwrite the destination
+    if (exists(pathTo)) {
+        return false;
+    }
+    return ::rename(native_fs_path(pathFrom, from, sizeof from), native_fs_path(pathTo, to, sizeof to)) == 0;
+}
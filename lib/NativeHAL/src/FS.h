@@ -0,0 +1,60 @@
+/*
+ FS.h - SPIFFS for the native environment, mapped onto a directory of the host (native_fs_root())
+*/
+
+#ifndef FS_H
+#define FS_H
+
+#include <stdio.h>
+#include <memory>
+#include <Arduino.h>
+
+enum SeekMode {
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+};
+
+class File : public Stream {
+public:
+    File() {}
+    explicit File(FILE* file) : _file(file, fclose) {}
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    size_t read(uint8_t* buffer, size_t size);
+    size_t readBytes(char* buffer, size_t length) override { return read((uint8_t*)buffer, length); }
+    int peek() override;
+    void flush() override;
+
+    bool seek(uint32_t pos, SeekMode mode);
+    bool seek(uint32_t pos) { return seek(pos, SeekSet); }
+    size_t position() const;
+    size_t size() const;
+    void close() { _file.reset(); }
+    operator bool() const { return (bool)_file; }
+
+private:
+    std::shared_ptr<FILE> _file;
+};
+
+class FS {
+public:
+    bool begin();
+    void end() {}
+    bool format();
+    File open(const char* path, const char* mode);
+    File open(const String& path, const char* mode) { return open(path.c_str(), mode); }
+    bool exists(const char* path);
+    bool exists(const String& path) { return exists(path.c_str()); }
+    bool remove(const char* path);
+    bool remove(const String& path) { return remove(path.c_str()); }
+    bool rename(const char* pathFrom, const char* pathTo);
+};
+
+extern FS SPIFFS;
+
+#endif
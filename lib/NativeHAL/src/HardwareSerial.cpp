@@ -0,0 +1,31 @@
+/*
+ HardwareSerial.cpp - The Serial port of the native environment, written to stdout
+*/
+
+#include <stdio.h>
+#include "HardwareSerial.h"
+#include "native.h"
+
+HardwareSerial Serial;
+
+size_t HardwareSerial::write(uint8_t c) {
+    if (native_serial_enabled && c != '\r') {
+        putchar(c);
+    }
+    return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+    if (native_serial_enabled) {
+        for (size_t i = 0; i < size; i++) {
+            if (buffer[i] != '\r') {
+                putchar(buffer[i]);
+            }
+        }
+    }
+    return size;
+}
+
+void HardwareSerial::flush() {
+    fflush(stdout);
+}
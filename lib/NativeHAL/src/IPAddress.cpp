@@ -0,0 +1,54 @@
+/*
+ IPAddress.cpp - IPv4 address for the native environment
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "IPAddress.h"
+
+IPAddress::IPAddress(uint8_t first_octet, uint8_t second_octet, uint8_t third_octet, uint8_t fourth_octet) {
+    _address[0] = first_octet;
+    _address[1] = second_octet;
+    _address[2] = third_octet;
+    _address[3] = fourth_octet;
+}
+
+/*  Network byte order in memory, as on the ESP8266  */
+
+IPAddress::IPAddress(uint32_t address) {
+    memcpy(_address, &address, 4);
+}
+
+IPAddress::IPAddress(const uint8_t* address) {
+    memcpy(_address, address, 4);
+}
+
+IPAddress::operator uint32_t() const {
+    uint32_t address;
+
+    memcpy(&address, _address, 4);
+    return address;
+}
+
+bool IPAddress::fromString(const char* address) {
+    unsigned int octets[4];
+    char end;
+
+    if (sscanf(address, "%u.%u.%u.%u%c", &octets[0], &octets[1], &octets[2], &octets[3], &end) != 4) {
+        return false;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (octets[i] > 255) {
+            return false;
+        }
+        _address[i] = octets[i];
+    }
+    return true;
+}
+
+String IPAddress::toString() const {
+    char buf[16];
+
+    snprintf(buf, sizeof buf, "%u.%u.%u.%u", _address[0], _address[1], _address[2], _address[3]);
+    return String(buf);
+}
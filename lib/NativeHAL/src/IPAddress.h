@@ -0,0 +1,30 @@
+/*
+ IPAddress.h - IPv4 address for the native environment
+*/
+
+#ifndef IPAddress_h
+#define IPAddress_h
+
+#include <stdint.h>
+#include "WString.h"
+
+class IPAddress {
+public:
+    IPAddress() : _address() {}
+    IPAddress(uint8_t first_octet, uint8_t second_octet, uint8_t third_octet, uint8_t fourth_octet);
+    IPAddress(uint32_t address);
+    IPAddress(const uint8_t* address);
+
+    operator uint32_t() const;
+    bool operator==(const IPAddress& addr) const { return (uint32_t)*this == (uint32_t)addr; }
+    uint8_t operator[](int index) const { return _address[index]; }
+    uint8_t& operator[](int index) { return _address[index]; }
+
+    bool fromString(const char* address);
+    String toString() const;
+
+private:
+    uint8_t _address[4];
+};
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ Print.cpp - Base class for the character outputs in the native environment
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "Print.h"
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+
+    while (size--) {
+        if (!write(*buffer++)) {
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
+size_t Print::printf(const char* format, ...) {
+    char buf[256];
+    va_list args;
+
+    va_start(args, format);
+    int length = vsnprintf(buf, sizeof buf, format, args);
+    va_end(args);
+    if (length < 0) {
+        return 0;
+    }
+    return write(buf, (size_t)length < sizeof buf ? length : sizeof buf - 1);
+}
+
+size_t Print::print(long value, int base) {
+    if (base == DEC && value < 0) {
+        return print('-') + printNumber(-(unsigned long)value, DEC);
+    }
+    return printNumber((unsigned long)value, base);
+}
+
+size_t Print::print(unsigned long value, int base) {
+    return printNumber(value, base);
+}
+
+size_t Print::print(double value, int digits) {
+    char buf[40];
+
+    snprintf(buf, sizeof buf, "%.*f", digits, value);
+    return write(buf);
+}
+
+size_t Print::printNumber(unsigned long value, uint8_t base) {
+    char buf[8 * sizeof(long) + 1];
+    char* p = buf + sizeof buf - 1;
+
+    if (base < 2) {
+        base = 10;
+    }
+    *p = 0;
+    do {
+        unsigned long digit = value % base;
+        *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        value /= base;
+    } while (value);
+    return write(p);
+}
@@ -0,0 +1,54 @@
+/*
+ SPI.cpp - SPI bus of the native environment
+*/
+
+#include "SPI.h"
+#include "native.h"
+
+SPIClass SPI;
+
+SPIClass::SPIClass() : _clock(1000000), _devices(), _pins() {}
+
+void SPIClass::attach(SPIDevice* device, uint8_t chipSelectPin) {
+    for (int i = 0; i < SPI_BUS_DEVICES; i++) {
+        if (_devices[i] == NULL) {
+            _devices[i] = device;
+            _pins[i] = chipSelectPin;
+            native_pin_listen(chipSelectPin, chipSelect, this);
+            return;
+        }
+    }
+}
+
+void SPIClass::chipSelect(uint8_t pin, uint8_t value, void* context) {
+    SPIClass* bus = (SPIClass*)context;
+
+    for (int i = 0; i < SPI_BUS_DEVICES; i++) {
+        if (bus->_devices[i] != NULL && bus->_pins[i] == pin) {
+            bus->_devices[i]->select(value == LOW);
+        }
+    }
+}
+
+/*  The selected devices drive MISO, an idle line reads 0xFF  */
+
+uint8_t SPIClass::transfer(uint8_t data) {
+    uint8_t in = 0xFF;
+
+    native_clock_charge(8000000000ULL / _clock);
+    for (int i = 0; i < SPI_BUS_DEVICES; i++) {
+        if (_devices[i] != NULL && native_pin_value(_pins[i]) == LOW) {
+            in &= _devices[i]->transfer(data);
+        }
+    }
+    return in;
+}
+
+void SPIClass::transfer(void* buf, uint16_t count) {
+    uint8_t* p = (uint8_t*)buf;
+
+    while (count--) {
+        *p = transfer(*p);
+        p++;
+    }
+}
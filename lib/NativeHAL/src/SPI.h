@@ -0,0 +1,63 @@
+/*
+ SPI.h - SPI bus of the native environment. The simulated devices attach to it with their chip select pin and
+ answer the bytes transferred while it is low. Every byte takes its time at the bus clock
+*/
+
+#ifndef _SPI_H_INCLUDED
+#define _SPI_H_INCLUDED
+
+#include <Arduino.h>
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x01
+#define SPI_MODE2 0x02
+#define SPI_MODE3 0x03
+
+// Clock dividers of a 16 MHz AVR, as bus frequencies
+#define SPI_CLOCK_DIV2 8000000
+#define SPI_CLOCK_DIV4 4000000
+#define SPI_CLOCK_DIV8 2000000
+#define SPI_CLOCK_DIV16 1000000
+
+#define SPI_BUS_DEVICES 4
+
+class SPISettings {
+public:
+    SPISettings() : _clock(1000000) {}
+    SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) : _clock(clock) { (void)bitOrder; (void)dataMode; }
+    uint32_t _clock;
+};
+
+/*  A device on the simulated bus  */
+class SPIDevice {
+public:
+    virtual ~SPIDevice() {}
+    virtual void select(bool selected) = 0;    // Chip select edge, a transaction starts when selected
+    virtual uint8_t transfer(uint8_t data) = 0; // Byte received from the master, returns the byte sent back
+};
+
+class SPIClass {
+public:
+    SPIClass();
+    void begin() {}
+    void end() {}
+    void beginTransaction(SPISettings settings) { _clock = settings._clock; }
+    void endTransaction() {}
+    void setFrequency(uint32_t freq) { _clock = freq; }
+    uint8_t transfer(uint8_t data);
+    void transfer(void* buf, uint16_t count);
+
+    /*  Attach a simulated device to the bus behind a chip select pin  */
+    void attach(SPIDevice* device, uint8_t chipSelectPin);
+
+private:
+    static void chipSelect(uint8_t pin, uint8_t value, void* context);
+
+    uint32_t _clock;
+    SPIDevice* _devices[SPI_BUS_DEVICES];
+    uint8_t _pins[SPI_BUS_DEVICES];
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ Stream.cpp - Base class for the character inputs in the native environment
+*/
+
+#include <Arduino.h>
+#include "Stream.h"
+
+/*  Wait up to the timeout for a byte, each empty read lets a millisecond pass so the virtual clock moves  */
+
+int Stream::timedRead() {
+    unsigned long start = millis();
+
+    do {
+        int c = read();
+        if (c >= 0) {
+            return c;
+        }
+        delay(1);
+    } while (millis() - start < _timeout);
+    return -1;
+}
+
+size_t Stream::readBytes(char* buffer, size_t length) {
+    size_t count = 0;
+
+    while (count < length) {
+        int c = timedRead();
+        if (c < 0) {
+            break;
+        }
+        *buffer++ = (char)c;
+        count++;
+    }
+    return count;
+}
+
+String Stream::readString() {
+    String result;
+    int c;
+
+    while ((c = timedRead()) >= 0) {
+        result += (char)c;
+    }
+    return result;
+}
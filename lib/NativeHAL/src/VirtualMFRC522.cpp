@@ -0,0 +1,429 @@
+/*
+ VirtualMFRC522.cpp - Simulated MFRC522 reader and card for the native environment
+*/
+
+#include "VirtualMFRC522.h"
+#include "native.h"
+
+// Registers, numbered as in the datasheet (the library sends them shifted left by one)
+#define REG_COMMAND 0x01
+#define REG_COM_IEN 0x02
+#define REG_DIV_IEN 0x03
+#define REG_COM_IRQ 0x04
+#define REG_DIV_IRQ 0x05
+#define REG_ERROR 0x06
+#define REG_FIFO_DATA 0x09
+#define REG_FIFO_LEVEL 0x0A
+#define REG_CONTROL 0x0C
+#define REG_BIT_FRAMING 0x0D
+#define REG_TX_CONTROL 0x14
+#define REG_CRC_RESULT_H 0x21
+#define REG_CRC_RESULT_L 0x22
+#define REG_T_MODE 0x2A
+#define REG_T_PRESCALER 0x2B
+#define REG_T_RELOAD_H 0x2C
+#define REG_T_RELOAD_L 0x2D
+#define REG_VERSION 0x37
+
+// Commands
+#define CMD_IDLE 0x00
+#define CMD_CALC_CRC 0x03
+#define CMD_TRANSCEIVE 0x0C
+#define CMD_SOFT_RESET 0x0F
+
+// ComIrqReg bits
+#define IRQ_TX 0x40
+#define IRQ_RX 0x20
+#define IRQ_IDLE 0x10
+#define IRQ_TIMER 0x01
+
+// PICC commands
+#define PICC_REQA 0x26
+#define PICC_WUPA 0x52
+#define PICC_CT 0x88
+#define PICC_SEL_CL1 0x93
+#define PICC_HLTA 0x50
+
+#define BIT_TIME_NS 9440   // 106 kbit/s
+#define FRAME_DELAY_NS 86000
+
+/*  CRC_A of ISO 14443-3, low byte first  */
+
+static void crc_a(const uint8_t* data, size_t length, uint8_t* out) {
+    uint16_t crc = 0x6363;
+
+    for (size_t i = 0; i < length; i++) {
+        uint8_t b = data[i] ^ (uint8_t)crc;
+        b ^= b << 4;
+        crc = (crc >> 8) ^ ((uint16_t)b << 8) ^ ((uint16_t)b << 3) ^ (b >> 4);
+    }
+    out[0] = crc & 0xFF;
+    out[1] = crc >> 8;
+}
+
+VirtualMFRC522* VirtualMFRC522::_readers = NULL;
+
+VirtualMFRC522::VirtualMFRC522(uint8_t chipSelectPin, uint8_t resetPowerDownPin, uint8_t irqPin)
+    : _fifoLength(0), _fifoRead(0), _first(false), _address(0), _timerArmed(false), _timerDeadline(0),
+      _irqPin(irqPin), _irqLow(false), _nextReader(_readers), _fieldSince(0), _fieldNs(0), _cardSize(0),
+      _cardState(CARD_IDLE), _cardLevel(1), _polls(0), _selects(0) {
+    memset(_regs, 0, sizeof _regs);
+    _readers = this;
+    reset();
+    SPI.attach(this, chipSelectPin);
+    if (resetPowerDownPin < NATIVE_PINS) {
+        native_pin_listen(resetPowerDownPin, resetPin, this);
+    }
+}
+
+void VirtualMFRC522::place(const uint8_t* uid, uint8_t size) {
+    if (size != 4 && size != 7 && size != 10) {
+        return;
+    }
+    memcpy(_uid, uid, size);
+    _cardSize = size;
+    _cardState = CARD_IDLE;
+    _cardLevel = 1;
+}
+
+void VirtualMFRC522::remove() {
+    _cardSize = 0;
+}
+
+/*  Leaving power down through the reset pin is a hard reset  */
+
+void VirtualMFRC522::resetPin(uint8_t pin, uint8_t value, void* context) {
+    (void)pin;
+    if (value == HIGH) {
+        ((VirtualMFRC522*)context)->reset();
+    }
+}
+
+uint64_t VirtualMFRC522::fieldOnNs() const {
+    return _fieldNs + (fieldOn() ? native_clock_ns() - _fieldSince : 0);
+}
+
+bool VirtualMFRC522::fieldOn() const {
+    return (_regs[REG_TX_CONTROL] & 0x03) != 0;
+}
+
+/*  Account for the field time, and power the card down when the field goes away  */
+
+void VirtualMFRC522::fieldChanged(bool wasOn) {
+    if (wasOn == fieldOn()) {
+        return;
+    }
+    if (wasOn) {
+        _fieldNs += native_clock_ns() - _fieldSince;
+        _cardState = CARD_IDLE;
+    } else {
+        _fieldSince = native_clock_ns();
+    }
+}
+
+/*  Drive the IRQ pin from the interrupt request and enable bits, together with the other readers on the pin  */
+
+void VirtualMFRC522::updateIrq() {
+    if (_irqPin >= NATIVE_PINS) {
+        return;
+    }
+    bool active = (_regs[REG_COM_IRQ] & _regs[REG_COM_IEN] & 0x7F) || (_regs[REG_DIV_IRQ] & _regs[REG_DIV_IEN] & 0x14);
+    bool inverted = _regs[REG_COM_IEN] & 0x80;
+    _irqLow = active == inverted;
+
+    bool low = false;
+    for (VirtualMFRC522* reader = _readers; reader != NULL; reader = reader->_nextReader) {
+        low |= reader->_irqPin == _irqPin && reader->_irqLow;
+    }
+    native_pin_set(_irqPin, low ? LOW : HIGH, 0);
+}
+
+void VirtualMFRC522::reset() {
+    bool wasOn = fieldOn();
+
+    static const uint8_t defaults[64] = {
+        0x00, 0x20, 0x80, 0x00, 0x14, 0x00, 0x00, 0x21, 0x00, 0x00, 0x00, 0x08, 0x10, 0x00, 0x80, 0x00,
+        0x00, 0x3F, 0x00, 0x00, 0x80, 0x00, 0x10, 0x84, 0x84, 0x4D, 0x00, 0x00, 0x62, 0x00, 0x00, 0xEB,
+        0x00, 0xFF, 0xFF, 0x00, 0x26, 0x87, 0x48, 0x88, 0x20, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x92, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+    };
+
+    memcpy(_regs, defaults, sizeof _regs);
+    _fifoLength = 0;
+    _fifoRead = 0;
+    _timerArmed = false;
+    fieldChanged(wasOn);
+    updateIrq();
+}
+
+void VirtualMFRC522::select(bool selected) {
+    _first = selected;
+}
+
+/*  First byte of a transaction is the address, bit 7 set to read. Reads return the register addressed by the  */
+/*  previous byte, so a burst sends the next address while it reads                                             */
+
+uint8_t VirtualMFRC522::transfer(uint8_t data) {
+    if (_first) {
+        _first = false;
+        _address = data;
+        return 0;
+    }
+    uint8_t reg = (_address >> 1) & 0x3F;
+    if (_address & 0x80) {
+        _address = data;
+        return readRegister(reg);
+    }
+    writeRegister(reg, data);
+    return 0;
+}
+
+uint8_t VirtualMFRC522::readRegister(uint8_t reg) {
+    switch (reg) {
+        case REG_COM_IRQ:
+            if (_timerArmed) {
+                // Nothing else can end the command, wait for the timer
+                uint64_t now = native_clock_ns();
+                if (now < _timerDeadline) {
+                    native_clock_advance(_timerDeadline - now);
+                }
+                _timerArmed = false;
+                _regs[REG_COM_IRQ] |= IRQ_TIMER;
+                updateIrq();
+            }
+            return _regs[REG_COM_IRQ];
+
+        case REG_FIFO_DATA:
+            return _fifoRead < _fifoLength ? _fifo[_fifoRead++] : 0;
+
+        case REG_FIFO_LEVEL:
+            return _fifoLength - _fifoRead;
+
+        default:
+            return _regs[reg];
+    }
+}
+
+void VirtualMFRC522::writeRegister(uint8_t reg, uint8_t value) {
+    switch (reg) {
+        case REG_COMMAND:
+            _regs[REG_COMMAND] = (_regs[REG_COMMAND] & 0x30) | (value & 0x0F);
+            execute(value & 0x0F);
+            break;
+
+        case REG_COM_IRQ:
+        case REG_DIV_IRQ:
+            // Bit 7 tells whether the marked bits are set or cleared
+            if (value & 0x80) {
+                _regs[reg] |= value & 0x7F;
+            } else {
+                _regs[reg] &= ~value;
+            }
+            updateIrq();
+            break;
+
+        case REG_COM_IEN:
+        case REG_DIV_IEN:
+            _regs[reg] = value;
+            updateIrq();
+            break;
+
+        case REG_TX_CONTROL: {
+            bool wasOn = fieldOn();
+            _regs[REG_TX_CONTROL] = value;
+            fieldChanged(wasOn);
+            break;
+        }
+
+        case REG_FIFO_DATA:
+            if (_fifoLength < sizeof _fifo) {
+                _fifo[_fifoLength++] = value;
+            }
+            break;
+
+        case REG_FIFO_LEVEL:
+            if (value & 0x80) {
+                _fifoLength = 0;
+                _fifoRead = 0;
+            }
+            break;
+
+        case REG_BIT_FRAMING:
+            _regs[REG_BIT_FRAMING] = value;
+            if ((value & 0x80) && (_regs[REG_COMMAND] & 0x0F) == CMD_TRANSCEIVE) {
+                transceive();
+                _regs[REG_BIT_FRAMING] &= 0x7F;
+            }
+            break;
+
+        case REG_ERROR:
+        case REG_VERSION:
+            break;
+
+        default:
+            _regs[reg] = value;
+            break;
+    }
+}
+
+void VirtualMFRC522::execute(uint8_t command) {
+    switch (command) {
+        case CMD_IDLE:
+            _timerArmed = false;
+            break;
+
+        case CMD_CALC_CRC: {
+            uint8_t crc[2];
+            crc_a(_fifo + _fifoRead, _fifoLength - _fifoRead, crc);
+            _fifoLength = 0;
+            _fifoRead = 0;
+            _regs[REG_CRC_RESULT_L] = crc[0];
+            _regs[REG_CRC_RESULT_H] = crc[1];
+            _regs[REG_DIV_IRQ] |= 0x04;
+            updateIrq();
+            break;
+        }
+
+        case CMD_SOFT_RESET:
+            reset();
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*  Timer period: (2 * TPrescaler + 1) * (TReload + 1) / 13.56 MHz  */
+
+uint64_t VirtualMFRC522::timerPeriod() const {
+    uint64_t prescaler = ((uint64_t)(_regs[REG_T_MODE] & 0x0F) << 8) | _regs[REG_T_PRESCALER];
+    uint64_t reload = ((uint64_t)_regs[REG_T_RELOAD_H] << 8) | _regs[REG_T_RELOAD_L];
+
+    return (2 * prescaler + 1) * (reload + 1) * 1000000000ULL / 13560000ULL;
+}
+
+void VirtualMFRC522::transceive() {
+    uint8_t frame[sizeof _fifo];
+    uint8_t response[16];
+    size_t length = _fifoLength - _fifoRead;
+    uint8_t lastBits = _regs[REG_BIT_FRAMING] & 0x07;
+
+    memcpy(frame, _fifo + _fifoRead, length);
+    _fifoLength = 0;
+    _fifoRead = 0;
+    native_clock_charge(length * 9 * BIT_TIME_NS);
+    _regs[REG_COM_IRQ] |= IRQ_TX;
+    _regs[REG_ERROR] = 0;
+    updateIrq();
+
+    size_t answered = (_regs[REG_TX_CONTROL] & 0x03) == 0x03 ? answer(frame, length, lastBits, response) : 0;
+    if (answered == 0) {
+        // Silence: the timer started at the end of the transmission ends the command
+        if (_regs[REG_T_MODE] & 0x80) {
+            _timerArmed = true;
+            _timerDeadline = native_clock_ns() + timerPeriod();
+        }
+        return;
+    }
+    native_clock_charge(FRAME_DELAY_NS + answered * 9 * BIT_TIME_NS);
+    memcpy(_fifo, response, answered);
+    _fifoLength = answered;
+    _regs[REG_CONTROL] &= ~0x07;
+    _regs[REG_COM_IRQ] |= IRQ_RX;
+    updateIrq();
+}
+
+/*  UID bytes of a cascade level, with the cascade tag when the UID goes on in the next level  */
+
+void VirtualMFRC522::cascadeLevel(uint8_t level, uint8_t* part) const {
+    uint8_t first = 3 * (level - 1);
+
+    if (_cardSize - first > 4) {
+        part[0] = PICC_CT;
+        memcpy(part + 1, _uid + first, 3);
+    } else {
+        memcpy(part, _uid + first, 4);
+    }
+    part[4] = part[0] ^ part[1] ^ part[2] ^ part[3];
+}
+
+/*  Card side of ISO 14443-3: returns the length of the answer to a frame, 0 when the card stays silent  */
+
+size_t VirtualMFRC522::answer(const uint8_t* frame, size_t length, uint8_t lastBits, uint8_t* out) {
+    if (_cardSize == 0 || length == 0) {
+        return 0;
+    }
+
+    // REQA and WUPA are short frames of 7 bits
+    if (length == 1 && lastBits == 7 && (frame[0] == PICC_REQA || frame[0] == PICC_WUPA)) {
+        _polls++;
+        bool wakes = _cardState == CARD_IDLE || (frame[0] == PICC_WUPA && _cardState == CARD_HALT);
+        if (!wakes) {
+            if (_cardState != CARD_HALT) {
+                _cardState = CARD_IDLE;
+            }
+            return 0;
+        }
+        _cardState = CARD_READY;
+        _cardLevel = 1;
+        out[0] = _cardSize == 4 ? 0x04 : _cardSize == 7 ? 0x44 : 0x84; // ATQA, UID size in bits 7..6
+        out[1] = 0x00;
+        return 2;
+    }
+
+    uint8_t crc[2];
+    if (_cardState == CARD_READY && length >= 2 && frame[0] == PICC_SEL_CL1 + 2 * (_cardLevel - 1)) {
+        uint8_t part[5];
+        cascadeLevel(_cardLevel, part);
+
+        // SELECT: the whole level with its BCC and CRC_A
+        if (frame[1] == 0x70 && length == 9) {
+            crc_a(frame, 7, crc);
+            if (memcmp(frame + 2, part, 5) != 0 || frame[7] != crc[0] || frame[8] != crc[1]) {
+                _cardState = CARD_IDLE;
+                return 0;
+            }
+            if (part[0] == PICC_CT) {
+                out[0] = 0x04; // SAK: UID not complete
+                _cardLevel++;
+            } else {
+                out[0] = _cardSize == 4 ? 0x08 : 0x00;
+                _cardState = CARD_ACTIVE;
+                _selects++;
+            }
+            crc_a(out, 1, out + 1);
+            return 3;
+        }
+
+        // ANTICOLLISION: the bits of the level not sent yet, the first byte aligned as received
+        int known = ((frame[1] >> 4) - 2) * 8 + (frame[1] & 0x07);
+        if (known < 0 || known >= 40) {
+            return 0;
+        }
+        for (int bit = 0; bit < known; bit++) {
+            if (((frame[2 + bit / 8] ^ part[bit / 8]) >> (bit % 8)) & 1) {
+                return 0; // Another card's UID
+            }
+        }
+        size_t n = 0;
+        for (int i = known / 8; i < 5; i++) {
+            out[n++] = part[i];
+        }
+        out[0] &= 0xFF << (known % 8);
+        return n;
+    }
+
+    if (length == 4 && frame[0] == PICC_HLTA && frame[1] == 0 && _cardState == CARD_ACTIVE) {
+        crc_a(frame, 2, crc);
+        if (frame[2] == crc[0] && frame[3] == crc[1]) {
+            _cardState = CARD_HALT;
+            return 0;
+        }
+    }
+
+    // Any other frame sends the card back to IDLE, or leaves it halted
+    if (_cardState != CARD_HALT) {
+        _cardState = CARD_IDLE;
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ VirtualMFRC522.h - Simulated MFRC522 reader with an ISO 14443-3 type A card in front of it, for the native
+ environment.
+
+ The reader answers the register protocol of the MFRC522 library on the SPI bus: FIFO, CRC coprocessor, timer and
+ the Transceive command. The card follows the IDLE / READY / ACTIVE / HALT states, answers REQA, WUPA, the
+ anticollision and SELECT cascade for 4, 7 and 10 byte UIDs, and HLTA.
+
+ Reading ComIrqReg while the only thing left to happen is the timer lets the clock run to its expiry, so a poll
+ without a card costs the 25 ms the real reader takes and not thousands of simulated SPI reads.
+
+ The IRQ pin follows ComIrqReg and DivIrqReg masked by ComIEnReg and DivIEnReg, with the polarity set by IRqInv.
+ Readers can share the IRQ pin: the line is low while any of them drives it low, as an open drain line with its
+ pull-up would be.
+ The card is only powered while the antenna drivers are on, it starts over from IDLE every time the field comes back.
+*/
+
+#ifndef VirtualMFRC522_h
+#define VirtualMFRC522_h
+
+#include <SPI.h>
+
+class VirtualMFRC522 : public SPIDevice {
+public:
+    VirtualMFRC522(uint8_t chipSelectPin, uint8_t resetPowerDownPin, uint8_t irqPin = 0xFF);
+
+    /*  Card in front of the reader  */
+    void place(const uint8_t* uid, uint8_t size);
+    void remove();
+    bool cardPresent() const { return _cardSize != 0; }
+
+    /*  Statistics  */
+    uint32_t polls() const { return _polls; }     // REQA and WUPA commands sent
+    uint32_t selects() const { return _selects; } // Cards selected, i.e. UIDs read
+    uint64_t fieldOnNs() const;                   // Time the RF field has been on
+
+    void select(bool selected) override;
+    uint8_t transfer(uint8_t data) override;
+
+private:
+    enum CardState { CARD_IDLE, CARD_READY, CARD_ACTIVE, CARD_HALT };
+
+    static void resetPin(uint8_t pin, uint8_t value, void* context);
+    void reset();
+    uint8_t readRegister(uint8_t reg);
+    void writeRegister(uint8_t reg, uint8_t value);
+    void execute(uint8_t command);
+    void transceive();
+    size_t answer(const uint8_t* frame, size_t length, uint8_t lastBits, uint8_t* out);
+    void cascadeLevel(uint8_t level, uint8_t* part) const;
+    uint64_t timerPeriod() const;
+    bool fieldOn() const;
+    void fieldChanged(bool wasOn);
+    void updateIrq();
+
+    uint8_t _regs[64];
+    uint8_t _fifo[64];
+    uint8_t _fifoLength;
+    uint8_t _fifoRead;
+    bool _first;           // Next byte of the transaction is the address
+    uint8_t _address;
+    bool _timerArmed;
+    uint64_t _timerDeadline;
+    uint8_t _irqPin;
+    bool _irqLow;          // Level this reader drives on the IRQ pin
+    VirtualMFRC522* _nextReader;
+    static VirtualMFRC522* _readers;
+    uint64_t _fieldSince;  // Clock when the field was last switched on
+    uint64_t _fieldNs;     // Field time before that
+
+    uint8_t _uid[10];
+    uint8_t _cardSize;     // 0 without a card
+    CardState _cardState;
+    uint8_t _cardLevel;    // Cascade level being selected, from 1
+
+    uint32_t _polls;
+    uint32_t _selects;
+};
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ WString.cpp - The Arduino String class for the native environment
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "WString.h"
+
+static std::string number(unsigned long value, unsigned char base, bool negative) {
+    char digits[sizeof(unsigned long) * 8 + 2];
+    char* p = digits + sizeof digits - 1;
+
+    if (base < 2) {
+        base = 10;
+    }
+    *p = 0;
+    do {
+        unsigned long digit = value % base;
+        *--p = digit < 10 ? '0' + digit : 'a' + digit - 10;
+        value /= base;
+    } while (value);
+    if (negative) {
+        *--p = '-';
+    }
+    return p;
+}
+
+String::String(unsigned char value, unsigned char base) : s(number(value, base, false)) {}
+String::String(unsigned int value, unsigned char base) : s(number(value, base, false)) {}
+String::String(unsigned long value, unsigned char base) : s(number(value, base, false)) {}
+
+String::String(int value, unsigned char base)
+    : s(base == 10 && value < 0 ? number(-(long)value, 10, true) : number((unsigned int)value, base, false)) {}
+
+String::String(long value, unsigned char base)
+    : s(base == 10 && value < 0 ? number(-(unsigned long)value, 10, true) : number((unsigned long)value, base, false)) {}
+
+String::String(double value, unsigned char decimals) {
+    char buf[40];
+
+    snprintf(buf, sizeof buf, "%.*f", decimals, value);
+    s = buf;
+}
+
+int String::indexOf(char c, unsigned int from) const {
+    size_t found = s.find(c, from);
+    return found == std::string::npos ? -1 : (int)found;
+}
+
+int String::indexOf(const String& str, unsigned int from) const {
+    size_t found = s.find(str.s, from);
+    return found == std::string::npos ? -1 : (int)found;
+}
+
+String String::substring(unsigned int from) const {
+    return substring(from, s.size());
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+    if (from > to) {
+        unsigned int swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from >= s.size()) {
+        return String();
+    }
+    return String(s.substr(from, to - from));
+}
+
+void String::toCharArray(char* buf, unsigned int size, unsigned int index) const {
+    getBytes((unsigned char*)buf, size, index);
+}
+
+void String::getBytes(unsigned char* buf, unsigned int size, unsigned int index) const {
+    if (size == 0 || buf == NULL) {
+        return;
+    }
+    if (index >= s.size()) {
+        buf[0] = 0;
+        return;
+    }
+    size_t n = s.size() - index;
+    if (n > size - 1) {
+        n = size - 1;
+    }
+    memcpy(buf, s.data() + index, n);
+    buf[n] = 0;
+}
+
+void String::trim() {
+    size_t begin = s.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) {
+        s.clear();
+        return;
+    }
+    s = s.substr(begin, s.find_last_not_of(" \t\r\n") - begin + 1);
+}
@@ -0,0 +1,62 @@
+/*
+ WString.h - The Arduino String class for the native environment, on top of std::string
+*/
+
+#ifndef String_class_h
+#define String_class_h
+
+#include <stdlib.h>
+#include <string>
+
+class __FlashStringHelper;
+
+class String {
+public:
+    String(const char* cstr = "") : s(cstr ? cstr : "") {}
+    String(const __FlashStringHelper* str) : s(reinterpret_cast<const char*>(str)) {}
+    String(const std::string& str) : s(str) {}
+    explicit String(char c) : s(1, c) {}
+    explicit String(unsigned char value, unsigned char base = 10);
+    explicit String(int value, unsigned char base = 10);
+    explicit String(unsigned int value, unsigned char base = 10);
+    explicit String(long value, unsigned char base = 10);
+    explicit String(unsigned long value, unsigned char base = 10);
+    explicit String(double value, unsigned char decimals = 2);
+
+    unsigned int length() const { return s.size(); }
+    const char* c_str() const { return s.c_str(); }
+    bool reserve(unsigned int size) { s.reserve(size); return true; }
+
+    char charAt(unsigned int index) const { return index < s.size() ? s[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    int indexOf(char c, unsigned int from = 0) const;
+    int indexOf(const String& str, unsigned int from = 0) const;
+    String substring(unsigned int from) const;
+    String substring(unsigned int from, unsigned int to) const;
+    void toCharArray(char* buf, unsigned int size, unsigned int index = 0) const;
+    void getBytes(unsigned char* buf, unsigned int size, unsigned int index = 0) const;
+    long toInt() const { return atol(s.c_str()); }
+    void trim();
+
+    String& operator+=(const String& rhs) { s += rhs.s; return *this; }
+    String& operator+=(const char* rhs) { s += rhs ? rhs : ""; return *this; }
+    String& operator+=(char c) { s += c; return *this; }
+    String& concat(const String& rhs) { return *this += rhs; }
+
+    bool equals(const String& rhs) const { return s == rhs.s; }
+    bool operator==(const String& rhs) const { return s == rhs.s; }
+    bool operator==(const char* rhs) const { return s == (rhs ? rhs : ""); }
+    bool operator!=(const String& rhs) const { return s != rhs.s; }
+    bool operator!=(const char* rhs) const { return !(*this == rhs); }
+    bool operator<(const String& rhs) const { return s < rhs.s; }
+
+    friend String operator+(const String& lhs, const String& rhs) { return String(lhs.s + rhs.s); }
+    friend String operator+(const String& lhs, const char* rhs) { return String(lhs.s + (rhs ? rhs : "")); }
+    friend String operator+(const char* lhs, const String& rhs) { return String((lhs ? lhs : "") + rhs.s); }
+    friend String operator+(const String& lhs, char rhs) { return String(lhs.s + rhs); }
+
+private:
+    std::string s;
+};
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ WiFiClient.cpp - TCP client of the native environment, on a socket of the host
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "WiFiClient.h"
+#include "native.h"
+
+#define CONNECT_TIMEOUT_MS 1000
+#define AWAIT_LIMIT_NS 15000000000ULL // Give up waiting in lockstep after the MQTT socket timeout
+
+uint64_t WiFiClient::bytesSent = 0;
+uint64_t WiFiClient::bytesReceived = 0;
+
+static uint64_t host_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+WiFiClient::WiFiClient() : _fd(-1), _awaiting(false), _awaitingSince(0), _rxLength(0), _rxPos(0) {}
+
+WiFiClient::~WiFiClient() {
+    stop();
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port) {
+    return connect(ip.toString().c_str(), port);
+}
+
+/*  Non-blocking connect with a timeout, the real time spent is charged to the clock  */
+
+int WiFiClient::connect(const char* host, uint16_t port) {
+    struct addrinfo hints;
+    struct addrinfo* result;
+    char service[8];
+    uint64_t start = host_ns();
+
+    stop();
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof service, "%u", native_net_port ? native_net_port : port);
+    if (getaddrinfo(host, service, &hints, &result) != 0) {
+        return 0;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int ok = 0;
+    if (fd >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        if (::connect(fd, result->ai_addr, result->ai_addrlen) == 0) {
+            ok = 1;
+        } else if (errno == EINPROGRESS) {
+            struct pollfd pfd = {fd, POLLOUT, 0};
+            int error = 0;
+            socklen_t length = sizeof error;
+            ok = poll(&pfd, 1, CONNECT_TIMEOUT_MS) == 1 &&
+                 getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0;
+        }
+    }
+    freeaddrinfo(result);
+    native_clock_charge(host_ns() - start);
+
+    if (!ok) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    _fd = fd;
+    return 1;
+}
+
+size_t WiFiClient::write(const uint8_t* buf, size_t size) {
+    size_t sent = 0;
+
+    while (_fd >= 0 && sent < size) {
+        ssize_t n = send(_fd, buf + sent, size - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EAGAIN) {
+            struct pollfd pfd = {_fd, POLLOUT, 0};
+            poll(&pfd, 1, CONNECT_TIMEOUT_MS);
+            continue;
+        }
+        if (n <= 0) {
+            stop();
+            break;
+        }
+        sent += n;
+    }
+    if (sent > 0) {
+        bytesSent += sent;
+        if (!_awaiting) {
+            _awaiting = true;
+            _awaitingSince = native_clock_ns();
+        }
+    }
+    return sent;
+}
+
+/*  Read what the socket has into the receive buffer, waiting in lockstep if an answer is due. Returns false  */
+/*  when the connection is closed                                                                              */
+
+bool WiFiClient::fill() {
+    if (_fd < 0) {
+        return false;
+    }
+    if (_rxPos < _rxLength) {
+        return true;
+    }
+    if (_awaiting && !native_clock_is_realtime() && native_net_wait_us > 0 &&
+            native_clock_ns() - _awaitingSince < AWAIT_LIMIT_NS) {
+        struct pollfd pfd = {_fd, POLLIN, 0};
+        struct timespec timeout = {0, (long)native_net_wait_us * 1000};
+        uint64_t start = host_ns();
+        ppoll(&pfd, 1, &timeout, NULL);
+        native_clock_charge(host_ns() - start);
+    }
+    ssize_t n = recv(_fd, _rx, sizeof _rx, MSG_DONTWAIT);
+    if (n > 0) {
+        _rxLength = n;
+        _rxPos = 0;
+        _awaiting = false;
+        bytesReceived += n;
+        return true;
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        stop();
+        return false;
+    }
+    return true;
+}
+
+int WiFiClient::available() {
+    fill();
+    return _rxLength - _rxPos;
+}
+
+int WiFiClient::read() {
+    return available() > 0 ? _rx[_rxPos++] : -1;
+}
+
+int WiFiClient::read(uint8_t* buf, size_t size) {
+    size_t n = available();
+
+    if (n == 0) {
+        return -1;
+    }
+    if (n > size) {
+        n = size;
+    }
+    memcpy(buf, _rx + _rxPos, n);
+    _rxPos += n;
+    return n;
+}
+
+int WiFiClient::peek() {
+    return available() > 0 ? _rx[_rxPos] : -1;
+}
+
+void WiFiClient::stop() {
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+    _awaiting = false;
+    _rxLength = 0;
+    _rxPos = 0;
+}
+
+/*  Connected while the socket is open or received data is left to read  */
+
+uint8_t WiFiClient::connected() {
+    if (_rxPos < _rxLength) {
+        return 1;
+    }
+    if (_fd < 0) {
+        return 0;
+    }
+    uint8_t probe;
+    ssize_t n = recv(_fd, &probe, 1, MSG_DONTWAIT | MSG_PEEK);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        stop();
+        return 0;
+    }
+    return 1;
+}
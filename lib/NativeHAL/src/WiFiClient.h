@@ -0,0 +1,53 @@
+/*
+ WiFiClient.h - TCP client of the native environment, on a socket of the host.
+
+ Connections go to the host and port asked for, or to native_net_port when set. A read that finds nothing while
+ the client waits for an answer (data written and nothing received since) blocks up to native_net_wait_us in real
+ time, and that time is charged to the virtual clock, so the MQTT round trips to a live broker keep their order
+ with the firmware timeouts.
+*/
+
+#ifndef wificlient_h
+#define wificlient_h
+
+#include "Client.h"
+
+class WiFiClient : public Client {
+public:
+    WiFiClient();
+    ~WiFiClient();
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char* host, uint16_t port) override;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buf, size_t size) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int read(uint8_t* buf, size_t size) override;
+    int peek() override;
+    void flush() override {}
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override { return connected(); }
+    void setNoDelay(bool nodelay) { (void)nodelay; }
+
+    /*  Statistics  */
+    static uint64_t bytesSent;
+    static uint64_t bytesReceived;
+
+private:
+    WiFiClient(const WiFiClient&);
+    WiFiClient& operator=(const WiFiClient&);
+
+    bool fill();
+
+    int _fd;
+    bool _awaiting;            // Written since the last byte received
+    uint64_t _awaitingSince;   // Clock when the client started waiting
+    uint8_t _rx[1460];
+    size_t _rxLength;
+    size_t _rxPos;
+};
+
+#endif
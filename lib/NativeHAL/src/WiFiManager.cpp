@@ -0,0 +1,198 @@
+/*
+ WiFiManager.cpp - WiFiManager for the native environment
+*/
+
+#include "WiFiManager.h"
+
+WiFiManagerParameter::WiFiManagerParameter(const char* custom)
+    : _id(NULL), _placeholder(custom), _value(NULL), _length(0) {}
+
+WiFiManagerParameter::WiFiManagerParameter(const char* id, const char* placeholder, const char* defaultValue,
+                                           int length)
+    : _id(id), _placeholder(placeholder), _value(new char[length + 1]), _length(length) {
+    memset(_value, 0, length + 1);
+    if (defaultValue != NULL) {
+        strncpy(_value, defaultValue, length);
+    }
+}
+
+WiFiManagerParameter::~WiFiManagerParameter() {
+    delete[] _value;
+}
+
+WiFiManager::WiFiManager()
+    : _fastReconnect(false), _connectPending(false), _directed(false), _useLease(false), _cacheValid(false),
+      _cacheOffset(0), _fastReconnectTimeout(3000), _connectStart(0), _cache(), _timing(), _saveCallback(NULL),
+      _params(), _paramsCount(0) {}
+
+void WiFiManager::addParameter(WiFiManagerParameter* p) {
+    if (_paramsCount < WIFI_MANAGER_MAX_PARAMS) {
+        _params[_paramsCount++] = p;
+    }
+}
+
+boolean WiFiManager::autoConnect() {
+    return autoConnect("ESP-native");
+}
+
+/*  Same as the library with saved credentials: an association started by beginConnect() is waited for, any other  */
+/*  is started over. A directed association that fails falls back to a scan                                         */
+
+boolean WiFiManager::autoConnect(char const* apName, char const* apPassword) {
+    (void)apName;
+    (void)apPassword;
+    bool pending = _connectPending;
+
+    _connectPending = false;
+    if (pending && WiFi.status() == WL_CONNECTED) {
+        unsigned long elapsed = millis() - _connectStart;
+        _timing.fast = _directed;
+        (_directed ? _timing.directed : _timing.scan) = elapsed;
+        _timing.total = elapsed;
+        writeCache();
+        return true;
+    }
+    if (!pending) {
+        beginConnect();
+        _connectPending = false;
+    }
+    unsigned long scanStart = _connectStart;
+    if (_directed) {
+        wl_status_t status;
+        while ((status = WiFi.status()) == WL_DISCONNECTED && millis() - _connectStart <= _fastReconnectTimeout) {
+            delay(10);
+        }
+        _timing.directed = millis() - _connectStart;
+        if (status == WL_CONNECTED) {
+            Serial.println("*WM: Directed association done");
+            _timing.fast = true;
+            _timing.total = _timing.directed;
+            writeCache();
+            return true;
+        }
+        Serial.println("*WM: Directed association failed, scanning");
+        clearCache();
+        _timing.lease = false;
+        _directed = false;
+        scanStart = millis();
+        WiFi.begin(WiFi.SSID().c_str(), WiFi.psk().c_str());
+    }
+    while (WiFi.status() != WL_CONNECTED) {
+        delay(10);
+    }
+    Serial.println("*WM: Connected to the simulated network");
+    _timing.scan = millis() - scanStart;
+    _timing.total = millis() - _connectStart;
+    writeCache();
+    return true;
+}
+
+boolean WiFiManager::startConfigPortal(char const* apName, char const* apPassword) {
+    return autoConnect(apName, apPassword);
+}
+
+void WiFiManager::resetSettings() {
+    Serial.println("*WM: settings invalidated");
+}
+
+void WiFiManager::setFastReconnect(uint32_t rtcOffset, boolean useLease) {
+    _fastReconnect = true;
+    _cacheOffset = rtcOffset;
+    _useLease = useLease;
+}
+
+boolean WiFiManager::beginConnect() {
+    _timing = WiFiManagerTiming();
+    _connectStart = millis();
+    _connectPending = true;
+    _directed = _fastReconnect && readCache();
+    if (!_directed) {
+        WiFi.begin();
+        return true;
+    }
+    if (_useLease && (_cache.flags & WIFI_MANAGER_CACHE_LEASE)) {
+        WiFi.config(IPAddress(_cache.ip), IPAddress(_cache.gateway), IPAddress(_cache.subnet), IPAddress(_cache.dns));
+        _timing.lease = true;
+    }
+    WiFi.begin(WiFi.SSID().c_str(), WiFi.psk().c_str(), _cache.channel, _cache.bssid);
+    return true;
+}
+
+boolean WiFiManager::getFastReconnectCache(WiFiManagerCache* cache) {
+    if (!readCache()) {
+        return false;
+    }
+    *cache = _cache;
+    return true;
+}
+
+void WiFiManager::setFastReconnectCache(const WiFiManagerCache* cache) {
+    if (!readCache()) {
+        _cache = *cache;
+        _cacheValid = true;
+    }
+}
+
+/*  Same record as the library  */
+
+#define WM_CACHE_MAGIC 0x574d4331
+
+struct WiFiManagerCacheRecord {
+    uint32_t magic;
+    WiFiManagerCache cache;
+    uint32_t checksum;
+};
+
+static uint32_t cache_checksum(const WiFiManagerCache* cache) {
+    const uint8_t* bytes = (const uint8_t*)cache;
+    uint32_t hash = 2166136261UL;
+
+    for (size_t i = 0; i < sizeof(WiFiManagerCache); i++) {
+        hash ^= bytes[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+boolean WiFiManager::readCache() {
+    WiFiManagerCacheRecord record;
+
+    if (_cacheValid) {
+        return true;
+    }
+    if (!ESP.rtcUserMemoryRead(_cacheOffset, (uint32_t*)&record, sizeof record) || record.magic != WM_CACHE_MAGIC ||
+            record.checksum != cache_checksum(&record.cache)) {
+        return false;
+    }
+    _cache = record.cache;
+    _cacheValid = true;
+    return true;
+}
+
+void WiFiManager::writeCache() {
+    WiFiManagerCacheRecord record;
+
+    if (!_fastReconnect) {
+        return;
+    }
+    memset(&record, 0, sizeof record);
+    record.magic = WM_CACHE_MAGIC;
+    memcpy(record.cache.bssid, WiFi.BSSID(), sizeof record.cache.bssid);
+    record.cache.channel = WiFi.channel();
+    record.cache.flags = WIFI_MANAGER_CACHE_LEASE;
+    record.cache.ip = WiFi.localIP();
+    record.cache.gateway = WiFi.gatewayIP();
+    record.cache.subnet = WiFi.subnetMask();
+    record.cache.dns = WiFi.dnsIP();
+    record.checksum = cache_checksum(&record.cache);
+    ESP.rtcUserMemoryWrite(_cacheOffset, (uint32_t*)&record, sizeof record);
+    _cache = record.cache;
+    _cacheValid = true;
+}
+
+void WiFiManager::clearCache() {
+    uint32_t magic = 0;
+
+    ESP.rtcUserMemoryWrite(_cacheOffset, &magic, sizeof magic);
+    _cacheValid = false;
+}
@@ -0,0 +1,99 @@
+/*
+ WiFiManager.h - WiFiManager for the native environment. There is no configuration portal: autoConnect() succeeds
+ at once and the parameters keep the values the firmware gives them, i.e. the ones of its config.json. The fast
+ reconnect works as in the library, with the same cache in the RTC user memory
+*/
+
+#ifndef WiFiManager_h
+#define WiFiManager_h
+
+#include <ESP8266WiFi.h>
+
+#define WIFI_MANAGER_MAX_PARAMS 10
+#define WIFI_MANAGER_CACHE_LEASE 0x01
+
+struct WiFiManagerCache {
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t flags;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+};
+
+struct WiFiManagerTiming {
+    unsigned long directed;
+    unsigned long scan;
+    unsigned long total;
+    boolean fast;
+    boolean lease;
+};
+
+class WiFiManagerParameter {
+public:
+    WiFiManagerParameter(const char* custom);
+    WiFiManagerParameter(const char* id, const char* placeholder, const char* defaultValue, int length);
+    ~WiFiManagerParameter();
+
+    const char* getID() { return _id; }
+    const char* getValue() { return _value; }
+    const char* getPlaceholder() { return _placeholder; }
+    int getValueLength() { return _length; }
+
+private:
+    WiFiManagerParameter(const WiFiManagerParameter&);
+    WiFiManagerParameter& operator=(const WiFiManagerParameter&);
+
+    const char* _id;
+    const char* _placeholder;
+    char* _value;
+    int _length;
+};
+
+class WiFiManager {
+public:
+    WiFiManager();
+
+    boolean autoConnect();
+    boolean autoConnect(char const* apName, char const* apPassword = NULL);
+    boolean startConfigPortal(char const* apName, char const* apPassword = NULL);
+    void resetSettings();
+
+    void setTimeout(unsigned long seconds) { (void)seconds; }
+    void setConfigPortalTimeout(unsigned long seconds) { (void)seconds; }
+    void setConnectTimeout(unsigned long seconds) { (void)seconds; }
+    void setMinimumSignalQuality(int quality = 8) { (void)quality; }
+    void setDebugOutput(boolean debug) { (void)debug; }
+    void setSaveConfigCallback(void (*func)(void)) { _saveCallback = func; }
+    void addParameter(WiFiManagerParameter* p);
+
+    void setFastReconnect(uint32_t rtcOffset, boolean useLease = false);
+    void setFastReconnectTimeout(unsigned long ms) { _fastReconnectTimeout = ms; }
+    boolean beginConnect();
+    boolean getFastReconnectCache(WiFiManagerCache* cache);
+    void setFastReconnectCache(const WiFiManagerCache* cache);
+    const WiFiManagerTiming& getConnectTiming() { return _timing; }
+
+private:
+    boolean readCache();
+    void writeCache();
+    void clearCache();
+
+    boolean _fastReconnect;
+    boolean _connectPending;
+    boolean _directed;
+    boolean _useLease;
+    boolean _cacheValid;
+    uint32_t _cacheOffset;
+    unsigned long _fastReconnectTimeout;
+    unsigned long _connectStart;
+    WiFiManagerCache _cache;
+    WiFiManagerTiming _timing;
+
+    void (*_saveCallback)(void);
+    WiFiManagerParameter* _params[WIFI_MANAGER_MAX_PARAMS];
+    int _paramsCount;
+};
+
+#endif
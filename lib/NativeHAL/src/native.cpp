@@ -0,0 +1,129 @@
+/*  Simulation state shared by the shims: clock, pins and the SPIFFS root  */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "native.h"
+
+static bool realtime = false;
+static uint64_t virtual_ns = 0;
+static uint64_t realtime_origin = 0; // Host monotonic time matching a clock of 0
+
+static uint8_t pin_values[NATIVE_PINS];
+static uint16_t pin_tones[NATIVE_PINS];
+
+struct PinWatch {
+    NativePinListener listener;
+    void* context;
+};
+
+#define NATIVE_PIN_LISTENERS 8
+
+static PinWatch pin_watches[NATIVE_PINS][NATIVE_PIN_LISTENERS];
+
+static char fs_root[256] = "native_fs";
+
+uint16_t native_net_port = 0;
+uint32_t native_net_wait_us = 1000;
+uint32_t native_wifi_associate_ms = 1500;
+uint32_t native_wifi_directed_ms = 250;
+int32_t native_wifi_channel = 6;
+bool native_serial_enabled = true;
+bool native_light_sleep = false;
+uint64_t native_light_sleep_ns = 0;
+
+static uint64_t host_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*  Clock  */
+
+void native_clock_realtime(bool enabled) {
+    uint64_t now = native_clock_ns();
+
+    realtime = enabled;
+    native_clock_set(now);
+}
+
+bool native_clock_is_realtime() {
+    return realtime;
+}
+
+uint64_t native_clock_ns() {
+    return realtime ? host_ns() - realtime_origin : virtual_ns;
+}
+
+void native_clock_set(uint64_t ns) {
+    virtual_ns = ns;
+    realtime_origin = host_ns() - ns;
+}
+
+void native_clock_advance(uint64_t ns) {
+    if (!realtime) {
+        virtual_ns += ns;
+        return;
+    }
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    nanosleep(&ts, NULL);
+}
+
+void native_clock_charge(uint64_t ns) {
+    if (!realtime) {
+        virtual_ns += ns;
+    }
+}
+
+/*  GPIO  */
+
+void native_pin_listen(uint8_t pin, NativePinListener listener, void* context) {
+    if (pin >= NATIVE_PINS) {
+        return;
+    }
+    for (int i = 0; i < NATIVE_PIN_LISTENERS; i++) {
+        if (pin_watches[pin][i].listener == NULL) {
+            pin_watches[pin][i].listener = listener;
+            pin_watches[pin][i].context = context;
+            return;
+        }
+    }
+}
+
+uint8_t native_pin_value(uint8_t pin) {
+    return pin < NATIVE_PINS ? pin_values[pin] : 0;
+}
+
+uint16_t native_pin_tone(uint8_t pin) {
+    return pin < NATIVE_PINS ? pin_tones[pin] : 0;
+}
+
+/*  Called by digitalWrite() and tone()  */
+
+void native_pin_set(uint8_t pin, uint8_t value, uint16_t tone) {
+    if (pin >= NATIVE_PINS) {
+        return;
+    }
+    pin_tones[pin] = tone;
+    if (pin_values[pin] == value) {
+        return;
+    }
+    pin_values[pin] = value;
+    for (int i = 0; i < NATIVE_PIN_LISTENERS && pin_watches[pin][i].listener; i++) {
+        pin_watches[pin][i].listener(pin, value, pin_watches[pin][i].context);
+    }
+}
+
+/*  SPIFFS root  */
+
+void native_fs_root(const char* path) {
+    snprintf(fs_root, sizeof fs_root, "%s", path);
+}
+
+const char* native_fs_path(const char* path, char* out, size_t size) {
+    snprintf(out, size, "%s/%s", fs_root, path[0] == '/' ? path + 1 : path);
+    return out;
+}
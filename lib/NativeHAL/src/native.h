@@ -0,0 +1,67 @@
+/************************************************** NATIVE HAL ***************************************************/
+/*                                                                                                               */
+/* Controls of the simulated hardware the firmware runs against in the native environment. The shims below       */
+/* Arduino.h, FS.h, SPI.h, ESP8266WiFi.h and WiFiManager.h all read the same clock:                              */
+/*                                                                                                               */
+/*     - Virtual (default): time only moves when the firmware waits for something, delay(), the SPI bytes, the   */
+/*       reader timer, a blocking network read, plus a fixed cost per loop(). A day of taps runs in seconds.     */
+/*                                                                                                               */
+/*     - Real time: millis() follows the wall clock and every wait sleeps, for use against a live backend.       */
+/*                                                                                                               */
+/*****************************************************************************************************************/
+
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*  Clock, in nanoseconds since boot  */
+void native_clock_realtime(bool enabled);
+bool native_clock_is_realtime();
+uint64_t native_clock_ns();
+void native_clock_set(uint64_t ns);
+
+/*  Let time pass: the virtual clock moves forward, in real time the call sleeps  */
+void native_clock_advance(uint64_t ns);
+
+/*  Account for time spent blocked outside the simulation, a no-op in real time  */
+void native_clock_charge(uint64_t ns);
+
+/*  GPIO: the SPI devices follow their chip select and reset lines through pin listeners  */
+#define NATIVE_PINS 32
+
+typedef void (*NativePinListener)(uint8_t pin, uint8_t value, void* context);
+
+void native_pin_listen(uint8_t pin, NativePinListener listener, void* context);
+uint8_t native_pin_value(uint8_t pin);
+uint16_t native_pin_tone(uint8_t pin);
+void native_pin_set(uint8_t pin, uint8_t value, uint16_t tone); // Used by digitalWrite() and tone()
+
+/*  SPIFFS is a directory on the host  */
+void native_fs_root(const char* path);
+const char* native_fs_path(const char* path, char* out, size_t size);
+
+/*  Network: every TCP connection goes to this port when set, and an empty read of a socket waiting for an  */
+/*  answer blocks this long in real time so a live broker can keep up with the virtual clock                */
+extern uint16_t native_net_port;
+extern uint32_t native_net_wait_us;
+
+/*  Wi-Fi: time from WiFi.begin() to the station being associated with an address, after a scan or directed to the  */
+/*  BSSID and channel of the AP. The AP is on native_wifi_channel                                                   */
+extern uint32_t native_wifi_associate_ms;
+extern uint32_t native_wifi_directed_ms;
+extern int32_t native_wifi_channel;
+
+/*  Power: set while Wi-Fi is in light sleep, every delay() then counts as time asleep  */
+extern bool native_light_sleep;
+extern uint64_t native_light_sleep_ns;
+
+/*  Serial output, off with --quiet  */
+extern bool native_serial_enabled;
+
+/*  Restart the program from setup(), as ESP.reset() does on the device. The clock and the RTC user memory  */
+/*  carry over                                                                                              */
+void native_restart();
+
+#endif
@@ -0,0 +1,445 @@
+/*
+ native_main.cpp - Entry point of the native environment: runs setup() and loop() of the firmware against the
+ simulated reader for a number of simulated seconds, with cards tapped at random or from a script, and prints a
+ summary on stderr. Run with --help for the options.
+*/
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <Arduino.h>
+#include "VirtualMFRC522.h"
+#include "WiFiClient.h"
+#include "native.h"
+
+// Wiring of the firmware, the chip selects of the readers are an option
+#define READER_RST_PIN 0
+#define READER_IRQ_PIN 10
+
+#define NS_PER_S 1000000000ULL
+#define NS_PER_MS 1000000ULL
+
+struct Options {
+    const char* fs;
+    const char* server;
+    const char* id;
+    const char* key;
+    const char* script;
+    const char* readers;
+    double duration;
+    double taps_per_hour;
+    unsigned cards;
+    unsigned hold_ms;
+    unsigned loop_us;
+    unsigned long seed;
+    bool realtime;
+    uint64_t resume_ns;
+};
+
+struct Tap {
+    uint64_t at;           // Clock when the card reaches the reader
+    uint8_t uid[10];
+    uint8_t size;
+    uint32_t hold_ms;      // Time the card stays on the reader
+    uint8_t reader;        // Index of the reader in --readers
+};
+
+static Options options = {"native_fs", "127.0.0.1", "sim1", "0123456789abcdef", NULL, "2", 86400, 60, 20, 500, 100,
+                          1, false, 0};
+static char** saved_argv;
+static volatile sig_atomic_t stop_requested = 0;
+
+static std::vector<VirtualMFRC522*> readers;
+static uint64_t loops = 0;
+static uint64_t taps = 0;
+static uint64_t host_start;
+
+/*  Scenario  */
+
+static uint64_t prng_state;
+
+static uint64_t prng() {
+    prng_state ^= prng_state << 13;
+    prng_state ^= prng_state >> 7;
+    prng_state ^= prng_state << 17;
+    return prng_state;
+}
+
+static std::vector<Tap> script;
+static size_t script_next = 0;
+static std::vector<Tap> cards;
+static Tap next_tap;
+static std::vector<uint64_t> remove_at;   // Per reader
+
+/*  Next random tap: exponential gaps for the rate, one of the cards at random, on one of the readers at random  */
+
+static void random_tap(uint64_t after) {
+    double u = (prng() >> 11) * (1.0 / 9007199254740992.0);
+    double gap = -log(1.0 - u) * 3600.0 / options.taps_per_hour;
+
+    next_tap = cards[prng() % cards.size()];
+    next_tap.at = after + (uint64_t)(gap * NS_PER_S);
+    next_tap.hold_ms = options.hold_ms;
+    next_tap.reader = readers.size() > 1 ? prng() % readers.size() : 0;
+}
+
+static bool parse_uid(const char* hex, Tap* tap) {
+    size_t length = strlen(hex);
+
+    if (length != 8 && length != 14 && length != 20) {
+        return false;
+    }
+    tap->size = length / 2;
+    for (uint8_t i = 0; i < tap->size; i++) {
+        unsigned int value;
+        if (sscanf(hex + 2 * i, "%2x", &value) != 1) {
+            return false;
+        }
+        tap->uid[i] = value;
+    }
+    return true;
+}
+
+/*  Script lines: <second> <uid hex> [hold ms] [reader], # starts a comment  */
+
+static bool load_script(const char* path) {
+    FILE* file = fopen(path, "r");
+    char line[128];
+    int number = 0;
+
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    while (fgets(line, sizeof line, file)) {
+        double second;
+        char uid[32];
+        unsigned hold = options.hold_ms;
+        unsigned reader = 0;
+        Tap tap;
+
+        number++;
+        if (line[strspn(line, " \t")] == '#' || line[strspn(line, " \t\r\n")] == 0) {
+            continue;
+        }
+        if (sscanf(line, "%lf %31s %u %u", &second, uid, &hold, &reader) < 2 || !parse_uid(uid, &tap) ||
+                reader >= readers.size()) {
+            fprintf(stderr, "%s:%d: expected <second> <uid hex> [hold ms] [reader]\n", path, number);
+            fclose(file);
+            return false;
+        }
+        tap.at = (uint64_t)(second * NS_PER_S);
+        tap.hold_ms = hold;
+        tap.reader = reader;
+        script.push_back(tap);
+    }
+    fclose(file);
+    return true;
+}
+
+static void scenario_begin() {
+    prng_state = options.seed * 0x9E3779B97F4A7C15ULL + 1;
+    for (unsigned i = 0; i < options.cards; i++) {
+        Tap card;
+        card.size = 4;
+        for (int b = 0; b < 4; b++) {
+            card.uid[b] = prng() & 0xFF;
+        }
+        if (card.uid[0] == 0x88) {
+            card.uid[0] = 0x08; // Would read as a cascade tag
+        }
+        cards.push_back(card);
+    }
+    if (!cards.empty()) {
+        random_tap(0);
+    }
+    // After a restart the taps already done are skipped, the sequence stays the same
+    while (script_next < script.size() && script[script_next].at < options.resume_ns) {
+        script_next++;
+    }
+    while (script.empty() && !cards.empty() && next_tap.at < options.resume_ns) {
+        random_tap(next_tap.at);
+    }
+}
+
+/*  A tap waits while the card of the previous one is still on its reader  */
+
+static void scenario_step(uint64_t now) {
+    for (size_t i = 0; i < readers.size(); i++) {
+        if (readers[i]->cardPresent() && now >= remove_at[i]) {
+            readers[i]->remove();
+        }
+    }
+
+    const Tap* tap = NULL;
+    if (!script.empty()) {
+        if (script_next < script.size() && now >= script[script_next].at) {
+            tap = &script[script_next];
+        }
+    } else if (!cards.empty() && now >= next_tap.at) {
+        tap = &next_tap;
+    }
+    if (tap == NULL || readers[tap->reader]->cardPresent()) {
+        return;
+    }
+    if (tap != &next_tap) {
+        script_next++;
+    }
+    readers[tap->reader]->place(tap->uid, tap->size);
+    remove_at[tap->reader] = now + tap->hold_ms * NS_PER_MS;
+    taps++;
+    if (tap == &next_tap) {
+        random_tap(now);
+    }
+}
+
+/*  Provisioning: the configuration the portal would have saved  */
+
+static void write_config() {
+    char path[300];
+
+    mkdir(options.fs, 0755);
+    native_fs_path("/config.json", path, sizeof path);
+    if (access(path, F_OK) == 0) {
+        return;
+    }
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        perror(path);
+        exit(1);
+    }
+    fprintf(file, "{\"mqtt_server\":\"%s\",\"key\":\"%s\",\"nodeMCUClient\":\"%s\",\"userMQTT\":\"\","
+            "\"passwordMQTT\":\"\"}", options.server, options.key, options.id);
+    fclose(file);
+}
+
+static uint64_t host_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+static void print_summary() {
+    double simulated = (native_clock_ns() - options.resume_ns) / (double)NS_PER_S;
+    double real = (host_ns() - host_start) / (double)NS_PER_S;
+    unsigned long polls = 0;
+    unsigned long selects = 0;
+    uint64_t field_ns = 0;
+
+    for (size_t i = 0; i < readers.size(); i++) {
+        polls += readers[i]->polls();
+        selects += readers[i]->selects();
+        field_ns += readers[i]->fieldOnNs();
+    }
+    field_ns /= readers.size();
+
+    fflush(stdout);
+    fprintf(stderr, "native: %.1f s simulated in %.2f s (x%.0f), %llu loop() passes\n", simulated, real,
+            real > 0 ? simulated / real : 0, (unsigned long long)loops);
+    fprintf(stderr, "native: %llu taps, %lu polls, %lu cards read\n", (unsigned long long)taps, polls, selects);
+    for (size_t i = 0; readers.size() > 1 && i < readers.size(); i++) {
+        fprintf(stderr, "native:     reader %u: %lu polls, %lu cards read\n", (unsigned)i,
+                (unsigned long)readers[i]->polls(), (unsigned long)readers[i]->selects());
+    }
+    fprintf(stderr, "native: RF field on %.1f%% of the time, Wi-Fi in light sleep %.1f%%\n",
+            simulated > 0 ? 100 * field_ns / (double)NS_PER_S / simulated : 0,
+            simulated > 0 ? 100 * native_light_sleep_ns / (double)NS_PER_S / simulated : 0);
+    fprintf(stderr, "native: %llu bytes sent, %llu bytes received\n", (unsigned long long)WiFiClient::bytesSent,
+            (unsigned long long)WiFiClient::bytesReceived);
+}
+
+/*  ESP.reset(): the program starts again with the same options, the clock where it was and the RTC user memory  */
+
+void native_restart() {
+    static char resume[40];
+    static char rtc[2 * RTC_USER_MEMORY_SIZE + 1];
+    std::vector<char*> argv;
+
+    print_summary();
+    fprintf(stderr, "native: reset at %.3f s\n", native_clock_ns() / (double)NS_PER_S);
+    for (char** arg = saved_argv; *arg; arg++) {
+        if (strncmp(*arg, "--resume=", 9) != 0) {
+            argv.push_back(*arg);
+        }
+    }
+    snprintf(resume, sizeof resume, "--resume=%llu", (unsigned long long)native_clock_ns());
+    argv.push_back(resume);
+    argv.push_back(NULL);
+    for (int i = 0; i < RTC_USER_MEMORY_SIZE; i++) {
+        snprintf(rtc + 2 * i, 3, "%02x", native_rtc_memory[i]);
+    }
+    setenv("NATIVE_RTC_MEMORY", rtc, 1);
+    fflush(NULL);
+    execv("/proc/self/exe", argv.data());
+    perror("execv");
+    exit(1);
+}
+
+static void restore_rtc_memory() {
+    const char* rtc = getenv("NATIVE_RTC_MEMORY");
+
+    if (rtc == NULL || strlen(rtc) != 2 * RTC_USER_MEMORY_SIZE) {
+        // Power on: the RTC memory holds garbage
+        for (int i = 0; i < RTC_USER_MEMORY_SIZE; i++) {
+            native_rtc_memory[i] = random() & 0xFF;
+        }
+        return;
+    }
+    for (int i = 0; i < RTC_USER_MEMORY_SIZE; i++) {
+        unsigned int value;
+        sscanf(rtc + 2 * i, "%2x", &value);
+        native_rtc_memory[i] = value;
+    }
+    unsetenv("NATIVE_RTC_MEMORY");
+}
+
+static void on_signal(int signal) {
+    (void)signal;
+    stop_requested = 1;
+}
+
+static void usage(const char* program) {
+    printf("Usage: %s [options]\n"
+           "  --duration=S        simulated seconds to run (%.0f)\n"
+           "  --realtime          follow the wall clock, for a live backend\n"
+           "  --fs=DIR            directory holding the SPIFFS files (%s)\n"
+           "  --server=HOST       MQTT server of a new config.json (%s)\n"
+           "  --port=N            TCP port of every connection, instead of the one asked for\n"
+           "  --id=ID             nodeMCUClient of a new config.json (%s)\n"
+           "  --key=KEY           AES/HMAC key of a new config.json (%s)\n"
+           "  --cards=N           cards tapped at random (%u)\n"
+           "  --taps-per-hour=R   average rate of the random taps (%.0f)\n"
+           "  --hold-ms=MS        time a card stays on the reader (%u)\n"
+           "  --script=FILE       taps from FILE instead, lines of <second> <uid hex> [hold ms] [reader]\n"
+           "  --readers=CS,...    chip select pins of the readers on the bus, one per lane (%s)\n"
+           "  --seed=N            seed of the random taps (%lu)\n"
+           "  --loop-us=US        simulated cost of a loop() pass besides SPI and waits (%u)\n"
+           "  --net-wait-us=US    real time an empty read waits for a due answer (%u)\n"
+           "  --wifi-ms=MS        time the Wi-Fi association takes (%u)\n"
+           "  --wifi-directed-ms=MS  time it takes directed to the cached BSSID and channel (%u)\n"
+           "  --wifi-channel=N    channel of the simulated AP (%d)\n"
+           "  --quiet             no Serial output\n",
+           program, options.duration, options.fs, options.server, options.id, options.key, options.cards,
+           options.taps_per_hour, options.hold_ms, options.readers, options.seed, options.loop_us, native_net_wait_us,
+           native_wifi_associate_ms, native_wifi_directed_ms, native_wifi_channel);
+}
+
+static void parse_options(int argc, char** argv) {
+    static const struct option long_options[] = {
+        {"duration", required_argument, NULL, 'd'},
+        {"realtime", no_argument, NULL, 'r'},
+        {"fs", required_argument, NULL, 'f'},
+        {"server", required_argument, NULL, 's'},
+        {"port", required_argument, NULL, 'p'},
+        {"id", required_argument, NULL, 'i'},
+        {"key", required_argument, NULL, 'k'},
+        {"cards", required_argument, NULL, 'c'},
+        {"taps-per-hour", required_argument, NULL, 't'},
+        {"hold-ms", required_argument, NULL, 'h'},
+        {"script", required_argument, NULL, 'S'},
+        {"readers", required_argument, NULL, 'L'},
+        {"seed", required_argument, NULL, 'x'},
+        {"loop-us", required_argument, NULL, 'l'},
+        {"net-wait-us", required_argument, NULL, 'w'},
+        {"wifi-ms", required_argument, NULL, 'W'},
+        {"wifi-directed-ms", required_argument, NULL, 'D'},
+        {"wifi-channel", required_argument, NULL, 'C'},
+        {"quiet", no_argument, NULL, 'q'},
+        {"resume", required_argument, NULL, 'R'},
+        {"help", no_argument, NULL, '?'},
+        {NULL, 0, NULL, 0}
+    };
+    int c;
+
+    while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'd': options.duration = atof(optarg); break;
+            case 'r': options.realtime = true; break;
+            case 'f': options.fs = optarg; break;
+            case 's': options.server = optarg; break;
+            case 'p': native_net_port = atoi(optarg); break;
+            case 'i': options.id = optarg; break;
+            case 'k': options.key = optarg; break;
+            case 'c': options.cards = atoi(optarg); break;
+            case 't': options.taps_per_hour = atof(optarg); break;
+            case 'h': options.hold_ms = atoi(optarg); break;
+            case 'S': options.script = optarg; break;
+            case 'L': options.readers = optarg; break;
+            case 'x': options.seed = strtoul(optarg, NULL, 10); break;
+            case 'l': options.loop_us = atoi(optarg); break;
+            case 'w': native_net_wait_us = atoi(optarg); break;
+            case 'W': native_wifi_associate_ms = atoi(optarg); break;
+            case 'D': native_wifi_directed_ms = atoi(optarg); break;
+            case 'C': native_wifi_channel = atoi(optarg); break;
+            case 'q': native_serial_enabled = false; break;
+            case 'R': options.resume_ns = strtoull(optarg, NULL, 10); break;
+            default:
+                usage(argv[0]);
+                exit(c == '?' ? 0 : 1);
+        }
+    }
+    if (options.taps_per_hour <= 0) {
+        options.cards = 0;
+    }
+}
+
+/*  Before setup(), the firmware initialises the readers there. They share the reset and IRQ lines  */
+
+static bool create_readers() {
+    const char* pins = options.readers;
+
+    while (*pins != 0 && readers.size() < SPI_BUS_DEVICES) {
+        char* end;
+        long pin = strtol(pins, &end, 10);
+        if (end == pins || pin < 0 || pin >= NATIVE_PINS || pin == READER_RST_PIN || pin == READER_IRQ_PIN) {
+            break;
+        }
+        readers.push_back(new VirtualMFRC522(pin, READER_RST_PIN, READER_IRQ_PIN));
+        remove_at.push_back(0);
+        pins = *end == ',' ? end + 1 : end;
+    }
+    if (*pins != 0 || readers.empty()) {
+        fprintf(stderr, "--readers: expected chip select pins separated by commas\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    saved_argv = argv;
+    parse_options(argc, argv);
+    if (!create_readers() || (options.script != NULL && !load_script(options.script))) {
+        return 1;
+    }
+
+    native_fs_root(options.fs);
+    write_config();
+    restore_rtc_memory();
+    native_clock_set(options.resume_ns);
+    native_clock_realtime(options.realtime);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    host_start = host_ns();
+
+    scenario_begin();
+
+    uint64_t end = options.duration * NS_PER_S;
+    setup();
+    while (!stop_requested && native_clock_ns() < end) {
+        scenario_step(native_clock_ns());
+        loop();
+        loops++;
+        native_clock_advance(options.loop_us * 1000ULL);
+    }
+
+    print_summary();
+    return 0;
+}
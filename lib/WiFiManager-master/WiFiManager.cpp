@@ -239,6 +239,14 @@ boolean  WiFiManager::startConfigPortal(char const *apName, char const *apPasswo
 int WiFiManager::connectWifi(String ssid, String pass) {
   DEBUG_WM(F("Connecting as wifi client..."));
 
+  //an association started by beginConnect() is waited for and counts from its start
+  boolean pending = _connectPending;
+  _connectPending = false;
+  unsigned long start = pending ? _connectStart : millis();
+  if (!pending) {
+    _timing = {0, 0, 0, false, false};
+  }
+
   // check if we've got static_ip settings, if we do, use those.
   if (_sta_static_ip) {
     DEBUG_WM(F("Custom STA IP/GW/Subnet"));
@@ -248,21 +256,65 @@ int WiFiManager::connectWifi(String ssid, String pass) {
   //fix for auto connect racing issue
   if (WiFi.status() == WL_CONNECTED) {
     DEBUG_WM("Already connected. Bailing out.");
+    if (pending) {
+      if (_directed) {
+        _timing.fast = true;
+        _timing.directed = millis() - start;
+      } else {
+        _timing.scan = millis() - start;
+      }
+      _timing.total = millis() - start;
+      writeCache();
+    }
     return WL_CONNECTED;
   }
+  boolean scanned = false;
+  unsigned long scanStart = start;
   //check if we have ssid and pass and force those, if not, try with last saved values
   if (ssid != "") {
     WiFi.begin(ssid.c_str(), pass.c_str());
   } else {
     if (WiFi.SSID()) {
-      DEBUG_WM("Using last saved values, should be faster");
-      //trying to fix connection in progress hanging
-      ETS_UART_INTR_DISABLE();
-      wifi_station_disconnect();
-      ETS_UART_INTR_ENABLE();
-      DEBUG_WM("WifiStation Disconnected");
-      WiFi.begin();
-      DEBUG_WM("Wifi Begin");
+      if (!pending) {
+        DEBUG_WM("Using last saved values, should be faster");
+        //trying to fix connection in progress hanging
+        ETS_UART_INTR_DISABLE();
+        wifi_station_disconnect();
+        ETS_UART_INTR_ENABLE();
+        DEBUG_WM("WifiStation Disconnected");
+        beginConnect();
+        _connectPending = false;
+        start = scanStart = _connectStart;
+        DEBUG_WM("Wifi Begin");
+      }
+      if (_directed) {
+        if (waitForDirectedResult() == WL_CONNECTED) {
+          DEBUG_WM(F("Directed association done"));
+          _timing.fast = true;
+          _timing.directed = _timing.total = millis() - start;
+          writeCache();
+          return WL_CONNECTED;
+        }
+        DEBUG_WM(F("Directed association failed, scanning"));
+        _timing.directed = millis() - start;
+        clearCache();
+        if (_timing.lease) {
+          //back to DHCP
+          IPAddress none;
+          WiFi.config(none, none, none);
+          _timing.lease = false;
+        }
+        ETS_UART_INTR_DISABLE();
+        wifi_station_disconnect();
+        ETS_UART_INTR_ENABLE();
+        //the saved credentials without the BSSID the directed association was restricted to
+        WiFi.persistent(false);
+        WiFi.begin(WiFi.SSID().c_str(), WiFi.psk().c_str());
+        WiFi.persistent(true);
+        _directed = false;
+        scanStart = millis();
+      }
+      scanned = true;
     } else {
       DEBUG_WM("No saved credentials");
     }
@@ -277,6 +329,13 @@ int WiFiManager::connectWifi(String ssid, String pass) {
     //should be connected at the end of WPS
     connRes = waitForConnectResult();
   }
+  if (scanned) {
+    _timing.scan = millis() - scanStart;
+  }
+  _timing.total = millis() - start;
+  if (connRes == WL_CONNECTED) {
+    writeCache();
+  }
   return connRes;
 }
 
@@ -310,6 +369,114 @@ uint8_t WiFiManager::waitForConnectResult() {
   }
 }
 
+uint8_t WiFiManager::waitForDirectedResult() {
+  DEBUG_WM (F("Waiting for the directed association"));
+  uint8_t status;
+  while (true) {
+    status = WiFi.status();
+    //the AP is not on the cached channel any more, or the credentials are wrong
+    if (status == WL_CONNECTED || status == WL_NO_SSID_AVAIL || status == WL_CONNECT_FAILED) {
+      break;
+    }
+    if (millis() - _connectStart > _fastReconnectTimeout) {
+      DEBUG_WM (F("Directed association timed out"));
+      break;
+    }
+    delay(10);
+  }
+  return status;
+}
+
+boolean WiFiManager::beginConnect() {
+  if (WiFi.SSID() == "") {
+    return false;
+  }
+  _timing = {0, 0, 0, false, false};
+  _connectStart = millis();
+  _connectPending = true;
+  _directed = _fastReconnect && readCache();
+
+  WiFi.mode(WIFI_STA);
+  if (!_directed) {
+    WiFi.begin();
+    return true;
+  }
+  DEBUG_WM(F("Directed association to the cached BSSID, channel:"));
+  DEBUG_WM(_cache.channel);
+  if (_useLease && !_sta_static_ip && (_cache.flags & WIFI_MANAGER_CACHE_LEASE)) {
+    WiFi.config(IPAddress(_cache.ip), IPAddress(_cache.gateway), IPAddress(_cache.subnet), IPAddress(_cache.dns));
+    _timing.lease = true;
+  }
+  //not saved with the credentials, a failed attempt falls back to them
+  WiFi.persistent(false);
+  WiFi.begin(WiFi.SSID().c_str(), WiFi.psk().c_str(), _cache.channel, _cache.bssid);
+  WiFi.persistent(true);
+  return true;
+}
+
+//the cache in RTC user memory, with a checksum since the memory holds garbage after a power cut
+#define WM_CACHE_MAGIC 0x574d4331
+
+struct WiFiManagerCacheRecord {
+  uint32_t          magic;
+  WiFiManagerCache  cache;
+  uint32_t          checksum;
+};
+
+static uint32_t cacheChecksum(const WiFiManagerCache *cache) {
+  //FNV-1a
+  const uint8_t *bytes = (const uint8_t *)cache;
+  uint32_t hash = 2166136261UL;
+  for (size_t i = 0; i < sizeof(WiFiManagerCache); i++) {
+    hash ^= bytes[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+boolean WiFiManager::readCache() {
+  if (_cacheValid) {
+    return true;
+  }
+  WiFiManagerCacheRecord record;
+  if (!ESP.rtcUserMemoryRead(_cacheOffset, (uint32_t *)&record, sizeof(record)) ||
+      record.magic != WM_CACHE_MAGIC || record.checksum != cacheChecksum(&record.cache)) {
+    return false;
+  }
+  _cache = record.cache;
+  _cacheValid = true;
+  return true;
+}
+
+void WiFiManager::writeCache() {
+  if (!_fastReconnect) {
+    return;
+  }
+  WiFiManagerCacheRecord record;
+  memset(&record, 0, sizeof(record));
+  record.magic = WM_CACHE_MAGIC;
+  memcpy(record.cache.bssid, WiFi.BSSID(), sizeof(record.cache.bssid));
+  record.cache.channel = WiFi.channel();
+  //a static configuration is not a lease
+  if (!_sta_static_ip) {
+    record.cache.flags = WIFI_MANAGER_CACHE_LEASE;
+    record.cache.ip = WiFi.localIP();
+    record.cache.gateway = WiFi.gatewayIP();
+    record.cache.subnet = WiFi.subnetMask();
+    record.cache.dns = WiFi.dnsIP();
+  }
+  record.checksum = cacheChecksum(&record.cache);
+  ESP.rtcUserMemoryWrite(_cacheOffset, (uint32_t *)&record, sizeof(record));
+  _cache = record.cache;
+  _cacheValid = true;
+}
+
+void WiFiManager::clearCache() {
+  uint32_t magic = 0;
+  ESP.rtcUserMemoryWrite(_cacheOffset, &magic, sizeof(magic));
+  _cacheValid = false;
+}
+
 void WiFiManager::startWPS() {
   DEBUG_WM("START WPS");
   WiFi.beginWPSConfig();
@@ -358,6 +525,35 @@ void WiFiManager::setConnectTimeout(unsigned long seconds) {
   _connectTimeout = seconds * 1000;
 }
 
+void WiFiManager::setFastReconnect(uint32_t rtcOffset, boolean useLease) {
+  _fastReconnect = true;
+  _cacheOffset = rtcOffset;
+  _useLease = useLease;
+}
+
+void WiFiManager::setFastReconnectTimeout(unsigned long ms) {
+  _fastReconnectTimeout = ms;
+}
+
+boolean WiFiManager::getFastReconnectCache(WiFiManagerCache *cache) {
+  if (!readCache()) {
+    return false;
+  }
+  *cache = _cache;
+  return true;
+}
+
+void WiFiManager::setFastReconnectCache(const WiFiManagerCache *cache) {
+  if (!readCache()) {
+    _cache = *cache;
+    _cacheValid = true;
+  }
+}
+
+const WiFiManagerTiming& WiFiManager::getConnectTiming() {
+  return _timing;
+}
+
 void WiFiManager::setDebugOutput(boolean debug) {
   _debug = debug;
 }
@@ -36,6 +36,27 @@ const char HTTP_SAVED[] PROGMEM           = "<div>Credentials Saved<br />Trying
 const char HTTP_END[] PROGMEM             = "</div></body></html>";
 
 #define WIFI_MANAGER_MAX_PARAMS 10
+#define WIFI_MANAGER_CACHE_LEASE 0x01
+
+//where the last connection was made, for a directed association that skips the scan
+struct WiFiManagerCache {
+  uint8_t       bssid[6];
+  uint8_t       channel;
+  uint8_t       flags;      //WIFI_MANAGER_CACHE_LEASE if the addresses below can be used instead of DHCP
+  uint32_t      ip;
+  uint32_t      gateway;
+  uint32_t      subnet;
+  uint32_t      dns;
+};
+
+//time spent by the last connection, in ms
+struct WiFiManagerTiming {
+  unsigned long directed;   //directed association to the cached BSSID and channel, 0 if not tried
+  unsigned long scan;       //association with a scan, 0 if not needed
+  unsigned long total;      //from the first attempt to connected or given up
+  boolean       fast;       //true if the directed association succeeded
+  boolean       lease;      //true if the cached addresses were used instead of DHCP
+};
 
 class WiFiManagerParameter {
   public:
@@ -109,6 +130,22 @@ class WiFiManager
     void          setCustomHeadElement(const char* element);
     //if this is true, remove duplicated Access Points - defaut true
     void          setRemoveDuplicateAPs(boolean removeDuplicates);
+    //caches the BSSID and channel of each connection in RTC user memory from this block (8 blocks used) and
+    //tries a directed association with them before scanning. useLease also skips DHCP with the addresses of
+    //the last lease, only for networks that keep handing out the same address
+    void          setFastReconnect(uint32_t rtcOffset, boolean useLease = false);
+    //time given to the directed association before falling back to a scan
+    void          setFastReconnectTimeout(unsigned long ms);
+    //starts the association with the saved credentials without waiting for it, e.g. at the beginning of setup(),
+    //directed when there is a cache. autoConnect() then waits for it instead of starting over. false if there are
+    //no saved credentials
+    boolean       beginConnect();
+    //the cache, to keep it somewhere that survives a power cut. false if there is none
+    boolean       getFastReconnectCache(WiFiManagerCache *cache);
+    //uses a cache kept elsewhere when the RTC memory has none
+    void          setFastReconnectCache(const WiFiManagerCache *cache);
+    //timing of the last connection
+    const WiFiManagerTiming& getConnectTiming();
 
   private:
     std::unique_ptr<DNSServer>        dnsServer;
@@ -129,6 +166,8 @@ class WiFiManager
     unsigned long _configPortalTimeout    = 0;
     unsigned long _connectTimeout         = 0;
     unsigned long _configPortalStart      = 0;
+    unsigned long _fastReconnectTimeout   = 3000;
+    unsigned long _connectStart           = 0;
 
     IPAddress     _ap_static_ip;
     IPAddress     _ap_static_gw;
@@ -142,6 +181,15 @@ class WiFiManager
     boolean       _removeDuplicateAPs     = true;
     boolean       _shouldBreakAfterConfig = false;
     boolean       _tryWPS                 = false;
+    boolean       _fastReconnect          = false;
+    boolean       _connectPending         = false;
+    boolean       _directed               = false;
+    boolean       _useLease               = false;
+    boolean       _cacheValid             = false;
+    uint32_t      _cacheOffset            = 0;
+
+    WiFiManagerCache  _cache;
+    WiFiManagerTiming _timing             = {0, 0, 0, false, false};
 
     const char*   _customHeadElement      = "";
 
@@ -151,6 +199,10 @@ class WiFiManager
     int           status = WL_IDLE_STATUS;
     int           connectWifi(String ssid, String pass);
     uint8_t       waitForConnectResult();
+    uint8_t       waitForDirectedResult();
+    boolean       readCache();
+    void          writeCache();
+    void          clearCache();
 
     void          handleRoot();
     void          handleWifi(boolean scan);
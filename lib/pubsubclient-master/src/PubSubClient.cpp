@@ -9,6 +9,21 @@
 
 PubSubClient::PubSubClient() {
     this->_state = MQTT_DISCONNECTED;
+    this->buffer = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    this->store = NULL;
+    this->inflightCount = 0;
+    this->nextMsgId = 1;
+    this->publishPos = 0;
+    this->publishRemaining = 0;
+    this->publishOk = false;
+    this->subscriptionCount = 0;
+    this->routeCount = 0;
+    this->exactRouteCount = 0;
+    this->sessionPresent = false;
+    this->connectCallback = NULL;
+    this->connectStep = MQTT_CONNECT_IDLE;
     this->_client = NULL;
     this->stream = NULL;
     setCallback(NULL);
@@ -16,24 +31,84 @@ PubSubClient::PubSubClient() {
 
 PubSubClient::PubSubClient(Client& client) {
     this->_state = MQTT_DISCONNECTED;
+    this->buffer = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    this->store = NULL;
+    this->inflightCount = 0;
+    this->nextMsgId = 1;
+    this->publishPos = 0;
+    this->publishRemaining = 0;
+    this->publishOk = false;
+    this->subscriptionCount = 0;
+    this->routeCount = 0;
+    this->exactRouteCount = 0;
+    this->sessionPresent = false;
+    this->connectCallback = NULL;
+    this->connectStep = MQTT_CONNECT_IDLE;
     setClient(client);
     this->stream = NULL;
 }
 
 PubSubClient::PubSubClient(IPAddress addr, uint16_t port, Client& client) {
     this->_state = MQTT_DISCONNECTED;
+    this->buffer = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    this->store = NULL;
+    this->inflightCount = 0;
+    this->nextMsgId = 1;
+    this->publishPos = 0;
+    this->publishRemaining = 0;
+    this->publishOk = false;
+    this->subscriptionCount = 0;
+    this->routeCount = 0;
+    this->exactRouteCount = 0;
+    this->sessionPresent = false;
+    this->connectCallback = NULL;
+    this->connectStep = MQTT_CONNECT_IDLE;
     setServer(addr, port);
     setClient(client);
     this->stream = NULL;
 }
 PubSubClient::PubSubClient(IPAddress addr, uint16_t port, Client& client, Stream& stream) {
     this->_state = MQTT_DISCONNECTED;
+    this->buffer = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    this->store = NULL;
+    this->inflightCount = 0;
+    this->nextMsgId = 1;
+    this->publishPos = 0;
+    this->publishRemaining = 0;
+    this->publishOk = false;
+    this->subscriptionCount = 0;
+    this->routeCount = 0;
+    this->exactRouteCount = 0;
+    this->sessionPresent = false;
+    this->connectCallback = NULL;
+    this->connectStep = MQTT_CONNECT_IDLE;
     setServer(addr,port);
     setClient(client);
     setStream(stream);
 }
 PubSubClient::PubSubClient(IPAddress addr, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client& client) {
     this->_state = MQTT_DISCONNECTED;
+    this->buffer = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    this->store = NULL;
+    this->inflightCount = 0;
+    this->nextMsgId = 1;
+    this->publishPos = 0;
+    this->publishRemaining = 0;
+    this->publishOk = false;
+    this->subscriptionCount = 0;
+    this->routeCount = 0;
+    this->exactRouteCount = 0;
+    this->sessionPresent = false;
+    this->connectCallback = NULL;
+    this->connectStep = MQTT_CONNECT_IDLE;
     setServer(addr, port);
     setCallback(callback);
     setClient(client);
@@ -41,6 +116,21 @@ PubSubClient::PubSubClient(IPAddress addr, uint16_t port, MQTT_CALLBACK_SIGNATUR
 }
 PubSubClient::PubSubClient(IPAddress addr, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client& client, Stream& stream) {
     this->_state = MQTT_DISCONNECTED;
+    this->buffer = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    this->store = NULL;
+    this->inflightCount = 0;
+    this->nextMsgId = 1;
+    this->publishPos = 0;
+    this->publishRemaining = 0;
+    this->publishOk = false;
+    this->subscriptionCount = 0;
+    this->routeCount = 0;
+    this->exactRouteCount = 0;
+    this->sessionPresent = false;
+    this->connectCallback = NULL;
+    this->connectStep = MQTT_CONNECT_IDLE;
     setServer(addr,port);
     setCallback(callback);
     setClient(client);
@@ -49,18 +139,63 @@ PubSubClient::PubSubClient(IPAddress addr, uint16_t port, MQTT_CALLBACK_SIGNATUR
 
 PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, Client& client) {
     this->_state = MQTT_DISCONNECTED;
+    this->buffer = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    this->store = NULL;
+    this->inflightCount = 0;
+    this->nextMsgId = 1;
+    this->publishPos = 0;
+    this->publishRemaining = 0;
+    this->publishOk = false;
+    this->subscriptionCount = 0;
+    this->routeCount = 0;
+    this->exactRouteCount = 0;
+    this->sessionPresent = false;
+    this->connectCallback = NULL;
+    this->connectStep = MQTT_CONNECT_IDLE;
     setServer(ip, port);
     setClient(client);
     this->stream = NULL;
 }
 PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, Client& client, Stream& stream) {
     this->_state = MQTT_DISCONNECTED;
+    this->buffer = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    this->store = NULL;
+    this->inflightCount = 0;
+    this->nextMsgId = 1;
+    this->publishPos = 0;
+    this->publishRemaining = 0;
+    this->publishOk = false;
+    this->subscriptionCount = 0;
+    this->routeCount = 0;
+    this->exactRouteCount = 0;
+    this->sessionPresent = false;
+    this->connectCallback = NULL;
+    this->connectStep = MQTT_CONNECT_IDLE;
     setServer(ip,port);
     setClient(client);
     setStream(stream);
 }
 PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client& client) {
     this->_state = MQTT_DISCONNECTED;
+    this->buffer = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    this->store = NULL;
+    this->inflightCount = 0;
+    this->nextMsgId = 1;
+    this->publishPos = 0;
+    this->publishRemaining = 0;
+    this->publishOk = false;
+    this->subscriptionCount = 0;
+    this->routeCount = 0;
+    this->exactRouteCount = 0;
+    this->sessionPresent = false;
+    this->connectCallback = NULL;
+    this->connectStep = MQTT_CONNECT_IDLE;
     setServer(ip, port);
     setCallback(callback);
     setClient(client);
@@ -68,6 +203,21 @@ PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, MQTT_CALLBACK_SIGNATURE,
 }
 PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client& client, Stream& stream) {
     this->_state = MQTT_DISCONNECTED;
+    this->buffer = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    this->store = NULL;
+    this->inflightCount = 0;
+    this->nextMsgId = 1;
+    this->publishPos = 0;
+    this->publishRemaining = 0;
+    this->publishOk = false;
+    this->subscriptionCount = 0;
+    this->routeCount = 0;
+    this->exactRouteCount = 0;
+    this->sessionPresent = false;
+    this->connectCallback = NULL;
+    this->connectStep = MQTT_CONNECT_IDLE;
     setServer(ip,port);
     setCallback(callback);
     setClient(client);
@@ -76,18 +226,63 @@ PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, MQTT_CALLBACK_SIGNATURE,
 
 PubSubClient::PubSubClient(const char* domain, uint16_t port, Client& client) {
     this->_state = MQTT_DISCONNECTED;
+    this->buffer = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    this->store = NULL;
+    this->inflightCount = 0;
+    this->nextMsgId = 1;
+    this->publishPos = 0;
+    this->publishRemaining = 0;
+    this->publishOk = false;
+    this->subscriptionCount = 0;
+    this->routeCount = 0;
+    this->exactRouteCount = 0;
+    this->sessionPresent = false;
+    this->connectCallback = NULL;
+    this->connectStep = MQTT_CONNECT_IDLE;
     setServer(domain,port);
     setClient(client);
     this->stream = NULL;
 }
 PubSubClient::PubSubClient(const char* domain, uint16_t port, Client& client, Stream& stream) {
     this->_state = MQTT_DISCONNECTED;
+    this->buffer = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    this->store = NULL;
+    this->inflightCount = 0;
+    this->nextMsgId = 1;
+    this->publishPos = 0;
+    this->publishRemaining = 0;
+    this->publishOk = false;
+    this->subscriptionCount = 0;
+    this->routeCount = 0;
+    this->exactRouteCount = 0;
+    this->sessionPresent = false;
+    this->connectCallback = NULL;
+    this->connectStep = MQTT_CONNECT_IDLE;
     setServer(domain,port);
     setClient(client);
     setStream(stream);
 }
 PubSubClient::PubSubClient(const char* domain, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client& client) {
     this->_state = MQTT_DISCONNECTED;
+    this->buffer = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    this->store = NULL;
+    this->inflightCount = 0;
+    this->nextMsgId = 1;
+    this->publishPos = 0;
+    this->publishRemaining = 0;
+    this->publishOk = false;
+    this->subscriptionCount = 0;
+    this->routeCount = 0;
+    this->exactRouteCount = 0;
+    this->sessionPresent = false;
+    this->connectCallback = NULL;
+    this->connectStep = MQTT_CONNECT_IDLE;
     setServer(domain,port);
     setCallback(callback);
     setClient(client);
@@ -95,12 +290,31 @@ PubSubClient::PubSubClient(const char* domain, uint16_t port, MQTT_CALLBACK_SIGN
 }
 PubSubClient::PubSubClient(const char* domain, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client& client, Stream& stream) {
     this->_state = MQTT_DISCONNECTED;
+    this->buffer = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    this->store = NULL;
+    this->inflightCount = 0;
+    this->nextMsgId = 1;
+    this->publishPos = 0;
+    this->publishRemaining = 0;
+    this->publishOk = false;
+    this->subscriptionCount = 0;
+    this->routeCount = 0;
+    this->exactRouteCount = 0;
+    this->sessionPresent = false;
+    this->connectCallback = NULL;
+    this->connectStep = MQTT_CONNECT_IDLE;
     setServer(domain,port);
     setCallback(callback);
     setClient(client);
     setStream(stream);
 }
 
+PubSubClient::~PubSubClient() {
+    free(this->buffer);
+}
+
 boolean PubSubClient::connect(const char *id) {
     return connect(id,NULL,NULL,0,0,0,0);
 }
@@ -114,165 +328,241 @@ boolean PubSubClient::connect(const char *id, const char* willTopic, uint8_t wil
 }
 
 boolean PubSubClient::connect(const char *id, const char *user, const char *pass, const char* willTopic, uint8_t willQos, boolean willRetain, const char* willMessage) {
-    if (!connected()) {
-        int result = 0;
+    return connect(id,user,pass,willTopic,willQos,willRetain,willMessage,true);
+}
 
-        if (domain != NULL) {
-            result = _client->connect(this->domain, this->port);
-        } else {
-            result = _client->connect(this->ip, this->port);
-        }
-        if (result == 1) {
-            nextMsgId = 1;
-            // Leave room in the buffer for header and variable length field
-            uint16_t length = 5;
-            unsigned int j;
+boolean PubSubClient::connect(const char *id, const char *user, const char *pass, const char* willTopic, uint8_t willQos, boolean willRetain, const char* willMessage, boolean cleanSession) {
+    if (!beginConnect(id,user,pass,willTopic,willQos,willRetain,willMessage,cleanSession)) {
+        return false;
+    }
+    while (connectStep == MQTT_CONNECT_SENT) {
+        pollConnect();
+    }
+    return connected();
+}
+
+boolean PubSubClient::beginConnect(const char *id, const char *user, const char *pass, const char* willTopic, uint8_t willQos, boolean willRetain, const char* willMessage, boolean cleanSession) {
+    if (connectStep == MQTT_CONNECT_SENT || connected()) {
+        return true;
+    }
+    int result = 0;
+
+    connectStart = millis();
+    connectStepTo(MQTT_CONNECT_TCP);
+    if (domain != NULL) {
+        result = _client->connect(this->domain, this->port);
+    } else {
+        result = _client->connect(this->ip, this->port);
+    }
+    if (result == 1) {
+        // Leave room in the buffer for header and variable length field
+        uint16_t length = 4;
+        unsigned int j;
 
 #if MQTT_VERSION == MQTT_VERSION_3_1
-            uint8_t d[9] = {0x00,0x06,'M','Q','I','s','d','p', MQTT_VERSION};
+        uint8_t d[9] = {0x00,0x06,'M','Q','I','s','d','p', MQTT_VERSION};
 #define MQTT_HEADER_VERSION_LENGTH 9
 #elif MQTT_VERSION == MQTT_VERSION_3_1_1
-            uint8_t d[7] = {0x00,0x04,'M','Q','T','T',MQTT_VERSION};
+        uint8_t d[7] = {0x00,0x04,'M','Q','T','T',MQTT_VERSION};
 #define MQTT_HEADER_VERSION_LENGTH 7
 #endif
-            for (j = 0;j<MQTT_HEADER_VERSION_LENGTH;j++) {
-                buffer[length++] = d[j];
-            }
+        for (j = 0;j<MQTT_HEADER_VERSION_LENGTH;j++) {
+            buffer[length++] = d[j];
+        }
 
-            uint8_t v;
-            if (willTopic) {
-                v = 0x06|(willQos<<3)|(willRetain<<5);
-            } else {
-                v = 0x02;
-            }
+        uint8_t v = cleanSession ? 0x02 : 0x00;
+        if (willTopic) {
+            v = v|0x04|(willQos<<3)|(willRetain<<5);
+        }
 
-            if(user != NULL) {
-                v = v|0x80;
+        if(user != NULL) {
+            v = v|0x80;
 
-                if(pass != NULL) {
-                    v = v|(0x80>>1);
-                }
+            if(pass != NULL) {
+                v = v|(0x80>>1);
             }
+        }
 
-            buffer[length++] = v;
+        buffer[length++] = v;
 
-            buffer[length++] = ((MQTT_KEEPALIVE) >> 8);
-            buffer[length++] = ((MQTT_KEEPALIVE) & 0xFF);
-            length = writeString(id,buffer,length);
-            if (willTopic) {
-                length = writeString(willTopic,buffer,length);
-                length = writeString(willMessage,buffer,length);
-            }
+        buffer[length++] = ((MQTT_KEEPALIVE) >> 8);
+        buffer[length++] = ((MQTT_KEEPALIVE) & 0xFF);
+        length = writeString(id,buffer,length);
+        if (willTopic) {
+            length = writeString(willTopic,buffer,length);
+            length = writeString(willMessage,buffer,length);
+        }
 
-            if(user != NULL) {
-                length = writeString(user,buffer,length);
-                if(pass != NULL) {
-                    length = writeString(pass,buffer,length);
-                }
+        if(user != NULL) {
+            length = writeString(user,buffer,length);
+            if(pass != NULL) {
+                length = writeString(pass,buffer,length);
             }
+        }
 
-            write(MQTTCONNECT,buffer,length-5);
+        // The SUBSCRIBE goes in the same write, a broker that refuses
+        // the CONNECT closes the connection before reading it
+        uint8_t start = frame(MQTTCONNECT,buffer,length-4);
+        connectSubscribed = 0;
+        if (subscriptionCount > 0) {
+            connectSubscribed = subscribePacket(subscriptions,subscriptionCount,subscriptionQos,length);
+        }
+        resetPacket();
+        writeBytes(buffer+start,length-start+connectSubscribed);
 
-            lastInActivity = lastOutActivity = millis();
+        lastInActivity = lastOutActivity = millis();
+        connectStepTo(MQTT_CONNECT_SENT);
+        return true;
+    }
+    _state = MQTT_CONNECT_FAILED;
+    connectStepTo(MQTT_CONNECT_IDLE);
+    return false;
+}
 
-            while (!_client->available()) {
-                unsigned long t = millis();
-                if (t-lastInActivity >= ((int32_t) MQTT_SOCKET_TIMEOUT*1000UL)) {
-                    _state = MQTT_CONNECTION_TIMEOUT;
-                    _client->stop();
-                    return false;
-                }
-            }
-            uint8_t llen;
-            uint16_t len = readPacket(&llen);
+// Whatever has arrived of the CONNACK, the attempt ends once it is complete
+// or MQTT_SOCKET_TIMEOUT has passed without it
+void PubSubClient::pollConnect() {
+    uint8_t llen;
+    uint16_t len = readPacket(&llen);
 
-            if (len == 4) {
-                if (buffer[3] == 0) {
-                    lastInActivity = millis();
-                    pingOutstanding = false;
-                    _state = MQTT_CONNECTED;
-                    return true;
-                } else {
-                    _state = buffer[3];
-                }
-            }
+    if (len == 0) {
+        if (!_client->connected()) {
+            // Closed by the broker without an answer
+            _state = MQTT_CONNECTION_LOST;
             _client->stop();
-        } else {
-            _state = MQTT_CONNECT_FAILED;
+            connectStepTo(MQTT_CONNECT_IDLE);
+        } else if (millis()-lastInActivity >= ((int32_t) MQTT_SOCKET_TIMEOUT*1000UL)) {
+            _state = MQTT_CONNECTION_TIMEOUT;
+            _client->stop();
+            connectStepTo(MQTT_CONNECT_IDLE);
         }
-        return false;
+        return;
     }
-    return true;
+    if (len == 4 && buffer[3] == 0) {
+        lastInActivity = millis();
+        pingOutstanding = false;
+        sessionPresent = (buffer[2] & 0x01) != 0;
+        _state = MQTT_CONNECTED;
+        connectStep = MQTT_CONNECT_IDLE;
+        if (subscriptionCount > 0 && connectSubscribed == 0) {
+            // Did not fit behind the CONNECT
+            subscribe(subscriptions,subscriptionCount,subscriptionQos);
+        }
+        resend();
+        if (connectCallback) {
+            connectCallback(MQTT_CONNECT_DONE,millis()-connectStart);
+        }
+        return;
+    }
+    if (len == 4) {
+        _state = buffer[3];
+    }
+    _client->stop();
+    connectStepTo(MQTT_CONNECT_IDLE);
 }
 
-// reads a byte into result
-boolean PubSubClient::readByte(uint8_t * result) {
-   uint32_t previousMillis = millis();
-   while(!_client->available()) {
-     uint32_t currentMillis = millis();
-     if(currentMillis - previousMillis >= ((int32_t) MQTT_SOCKET_TIMEOUT * 1000)){
-       return false;
-     }
-   }
-   *result = _client->read();
-   return true;
-}
-
-// reads a byte into result[*index] and increments index
-boolean PubSubClient::readByte(uint8_t * result, uint16_t * index){
-  uint16_t current_index = *index;
-  uint8_t * write_address = &(result[current_index]);
-  if(readByte(write_address)){
-    *index = current_index + 1;
-    return true;
-  }
-  return false;
+void PubSubClient::connectStepTo(uint8_t step) {
+    connectStep = step;
+    if (connectCallback) {
+        connectCallback(step,millis()-connectStart);
+    }
+}
+
+boolean PubSubClient::connecting() {
+    return connectStep == MQTT_CONNECT_SENT;
 }
 
+// Parser states of readPacket()
+#define MQTT_READ_HEADER 0
+#define MQTT_READ_LENGTH 1
+#define MQTT_READ_BODY   2
+
+void PubSubClient::resetPacket() {
+    readState = MQTT_READ_HEADER;
+    readLength = 0;
+    readRemaining = 0;
+    readMultiplier = 1;
+    readSkip = 0;
+    readLengthLength = 0;
+}
+
+// Consumes what the client already has of the current packet, in bulk reads,
+// and returns at once when that is not all of it. Returns the length of the
+// packet when it is complete, 0 while it is not or when it was too long.
 uint16_t PubSubClient::readPacket(uint8_t* lengthLength) {
-    uint16_t len = 0;
-    if(!readByte(buffer, &len)) return 0;
+    while (readState != MQTT_READ_BODY) {
+        if (_client->available() <= 0) {
+            return 0;
+        }
+        uint8_t digit = _client->read();
+        buffer[readLength++] = digit;
+        if (readState == MQTT_READ_HEADER) {
+            readState = MQTT_READ_LENGTH;
+            continue;
+        }
+        readRemaining += (digit & 127) * readMultiplier;
+        readMultiplier *= 128;
+        if ((digit & 128) == 0) {
+            readLengthLength = readLength-1;
+            readState = MQTT_READ_BODY;
+        } else if (readLength == 5) {
+            // The remaining length takes 4 bytes at most
+            _client->stop();
+            resetPacket();
+            return 0;
+        }
+    }
+
     bool isPublish = (buffer[0]&0xF0) == MQTTPUBLISH;
-    uint32_t multiplier = 1;
-    uint16_t length = 0;
-    uint8_t digit = 0;
-    uint16_t skip = 0;
-    uint8_t start = 0;
+    uint8_t scratch[MQTT_MAX_READ_SIZE];
+    while (readRemaining > 0) {
+        int available = _client->available();
+        if (available <= 0) {
+            return 0;
+        }
+        // Into the buffer while it has room, past it the bytes are only streamed
+        uint8_t* dest = scratch;
+        uint32_t size = sizeof(scratch);
+        if (readLength < bufferSize) {
+            dest = buffer+readLength;
+            size = bufferSize-readLength;
+        }
+        if (size > (uint32_t)available) {
+            size = available;
+        }
+        if (size > readRemaining) {
+            size = readRemaining;
+        }
+        int rc = _client->read(dest,size);
+        if (rc <= 0) {
+            return 0;
+        }
 
-    do {
-        if(!readByte(&digit)) return 0;
-        buffer[len++] = digit;
-        length += (digit & 127) * multiplier;
-        multiplier *= 128;
-    } while ((digit & 128) != 0);
-    *lengthLength = len-1;
-
-    if (isPublish) {
-        // Read in topic length to calculate bytes to skip over for Stream writing
-        if(!readByte(buffer, &len)) return 0;
-        if(!readByte(buffer, &len)) return 0;
-        skip = (buffer[*lengthLength+1]<<8)+buffer[*lengthLength+2];
-        start = 2;
-        if (buffer[0]&MQTTQOS1) {
-            // skip message id
-            skip += 2;
-        }
-    }
-
-    for (uint16_t i = start;i<length;i++) {
-        if(!readByte(&digit)) return 0;
-        if (this->stream) {
-            if (isPublish && len-*lengthLength-2>skip) {
-                this->stream->write(digit);
+        uint32_t offset = readLength-readLengthLength-1; // Of dest[0] in the variable header
+        if (isPublish && offset < 2 && offset+rc >= 2) {
+            // Topic length known, and the bytes to skip over for Stream writing
+            readSkip = (buffer[readLengthLength+1]<<8)+buffer[readLengthLength+2];
+            if (buffer[0]&MQTTQOS1) {
+                // skip message id
+                readSkip += 2;
             }
         }
-        if (len < MQTT_MAX_PACKET_SIZE) {
-            buffer[len] = digit;
+        if (this->stream && isPublish) {
+            for (int i = 0;i<rc;i++) {
+                if (offset+i >= 2+(uint32_t)readSkip) {
+                    this->stream->write(dest[i]);
+                }
+            }
         }
-        len++;
+        readLength += rc;
+        readRemaining -= rc;
     }
 
-    if (!this->stream && len > MQTT_MAX_PACKET_SIZE) {
+    uint32_t len = readLength;
+    *lengthLength = readLengthLength;
+    resetPacket();
+
+    if (!this->stream && len > bufferSize) {
         len = 0; // This will cause the packet to be ignored.
     }
 
@@ -280,6 +570,9 @@ uint16_t PubSubClient::readPacket(uint8_t* lengthLength) {
 }
 
 boolean PubSubClient::loop() {
+    if (connectStep == MQTT_CONNECT_SENT) {
+        pollConnect();
+    }
     if (connected()) {
         unsigned long t = millis();
         if ((t - lastInActivity > MQTT_KEEPALIVE*1000UL) || (t - lastOutActivity > MQTT_KEEPALIVE*1000UL)) {
@@ -305,29 +598,32 @@ boolean PubSubClient::loop() {
                 lastInActivity = t;
                 uint8_t type = buffer[0]&0xF0;
                 if (type == MQTTPUBLISH) {
-                    if (callback) {
-                        uint16_t tl = (buffer[llen+1]<<8)+buffer[llen+2]; /* topic length in bytes */
+                    uint16_t tl = (buffer[llen+1]<<8)+buffer[llen+2]; /* topic length in bytes */
+                    uint16_t offset = llen+3+tl;
+                    // msgId only present for QOS>0. The buffer is free for
+                    // the handler to publish from, so read the header first.
+                    boolean qos1 = (buffer[0]&0x06) == MQTTQOS1;
+                    if (qos1) {
+                        msgId = (buffer[offset]<<8)+buffer[offset+1];
+                        offset += 2;
+                    }
+                    payload = buffer+offset;
+                    if (!dispatch((char*)buffer+llen+3,tl,payload,len-offset) && callback) {
                         memmove(buffer+llen+2,buffer+llen+3,tl); /* move topic inside buffer 1 byte to front */
                         buffer[llen+2+tl] = 0; /* end the topic as a 'C' string with \x00 */
                         char *topic = (char*) buffer+llen+2;
-                        // msgId only present for QOS>0
-                        if ((buffer[0]&0x06) == MQTTQOS1) {
-                            msgId = (buffer[llen+3+tl]<<8)+buffer[llen+3+tl+1];
-                            payload = buffer+llen+3+tl+2;
-                            callback(topic,payload,len-llen-3-tl-2);
-
-                            buffer[0] = MQTTPUBACK;
-                            buffer[1] = 2;
-                            buffer[2] = (msgId >> 8);
-                            buffer[3] = (msgId & 0xFF);
-                            _client->write(buffer,4);
-                            lastOutActivity = t;
-
-                        } else {
-                            payload = buffer+llen+3+tl;
-                            callback(topic,payload,len-llen-3-tl);
-                        }
+                        callback(topic,payload,len-offset);
+                    }
+                    if (qos1) {
+                        buffer[0] = MQTTPUBACK;
+                        buffer[1] = 2;
+                        buffer[2] = (msgId >> 8);
+                        buffer[3] = (msgId & 0xFF);
+                        _client->write(buffer,4);
+                        lastOutActivity = t;
                     }
+                } else if (type == MQTTPUBACK) {
+                    acknowledge((buffer[llen+1]<<8)+buffer[llen+2]);
                 } else if (type == MQTTPINGREQ) {
                     buffer[0] = MQTTPINGRESP;
                     buffer[1] = 0;
@@ -356,48 +652,67 @@ boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigne
 
 boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained) {
     if (connected()) {
-        if (MQTT_MAX_PACKET_SIZE < 5 + 2+strlen(topic) + plength) {
+        if (bufferSize < 5 + 2+strlen(topic) + plength) {
             // Too long
             return false;
         }
-        // Leave room in the buffer for header and variable length field
-        uint16_t length = 5;
-        length = writeString(topic,buffer,length);
-        uint16_t i;
-        for (i=0;i<plength;i++) {
-            buffer[length++] = payload[i];
+        // One write for the whole packet, a payload sent apart would wait
+        // for the ACK of the header with Nagle's algorithm
+        uint16_t length = publishHeader(MQTTPUBLISH | (retained ? 1 : 0),topic,plength);
+        memcpy(buffer+length,payload,plength);
+        return writeBytes(buffer,length+plength);
+    }
+    return false;
+}
+
+boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained, uint8_t qos) {
+    if (qos == 0) {
+        return publish(topic,payload,plength,retained);
+    }
+    if (qos != 1 || store == NULL || inflightCount >= MQTT_MAX_INFLIGHT) {
+        return false;
+    }
+    if (connected()) {
+        if (bufferSize < 5 + 2+strlen(topic) + 2 + plength) {
+            // Too long
+            return false;
         }
-        uint8_t header = MQTTPUBLISH;
-        if (retained) {
-            header |= 1;
+        uint16_t msgId = nextId();
+        uint16_t length = publishHeader(MQTTPUBLISH | MQTTQOS1 | (retained ? 1 : 0),topic,plength+2);
+        buffer[length++] = (msgId >> 8);
+        buffer[length++] = (msgId & 0xFF);
+        memcpy(buffer+length,payload,plength);
+        length += plength;
+        // Kept before it is sent, a packet that cannot be sent again is not sent
+        if (!store->put(msgId,buffer,length)) {
+            return false;
         }
-        return write(header,buffer,length-5);
+        inflight[inflightCount++] = msgId;
+        return writeBytes(buffer,length);
     }
     return false;
 }
 
 boolean PubSubClient::publish_P(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained) {
-    uint8_t llen = 0;
-    uint8_t digit;
-    unsigned int rc = 0;
-    uint16_t tlen;
-    unsigned int pos = 0;
-    unsigned int i;
-    uint8_t header;
-    unsigned int len;
-
-    if (!connected()) {
+    if (!beginPublish(topic,plength,retained)) {
         return false;
     }
+    // Copied out of PROGMEM a buffer at a time
+    for (unsigned int i = 0;i<plength;i++) {
+        write((uint8_t)pgm_read_byte_near(payload + i));
+    }
+    return endPublish();
+}
 
-    tlen = strlen(topic);
+// Fixed header, remaining length and topic of a publish at the start of the
+// buffer, returns their length. length counts the bytes after the topic, the
+// topic must fit.
+uint16_t PubSubClient::publishHeader(uint8_t header, const char* topic, unsigned int length) {
+    uint16_t pos = 0;
+    uint8_t digit;
+    uint32_t len = length + 2 + strlen(topic);
 
-    header = MQTTPUBLISH;
-    if (retained) {
-        header |= 1;
-    }
     buffer[pos++] = header;
-    len = plength + 2 + tlen;
     do {
         digit = len % 128;
         len = len / 128;
@@ -405,28 +720,79 @@ boolean PubSubClient::publish_P(const char* topic, const uint8_t* payload, unsig
             digit |= 0x80;
         }
         buffer[pos++] = digit;
-        llen++;
     } while(len>0);
+    return writeString(topic,buffer,pos);
+}
 
-    pos = writeString(topic,buffer,pos);
+boolean PubSubClient::beginPublish(const char* topic, unsigned int plength, boolean retained) {
+    if (!connected() || bufferSize < 5 + 2+strlen(topic)) {
+        return false;
+    }
+    publishPos = publishHeader(MQTTPUBLISH | (retained ? 1 : 0),topic,plength);
+    publishRemaining = plength;
+    publishOk = true;
+    return true;
+}
 
-    rc += _client->write(buffer,pos);
+// Writes are staged in the buffer behind the header. One that does not fit
+// first fills the buffer, so the header goes out with as much payload as the
+// buffer holds and never in a segment of its own, then the rest goes straight
+// from the caller's memory when it would not fit either.
+size_t PubSubClient::write(uint8_t data) {
+    return write(&data,1);
+}
 
-    for (i=0;i<plength;i++) {
-        rc += _client->write((char)pgm_read_byte_near(payload + i));
+size_t PubSubClient::write(const uint8_t* data, size_t size) {
+    if (size > publishRemaining) {
+        publishOk = false;
+        size = publishRemaining;
+    }
+    if (publishRemaining == 0 && publishPos == 0) {
+        // No publish open, or its payload already sent
+        return 0;
     }
+    size_t written = size;
+    publishRemaining -= size;
+    if (publishPos + size > bufferSize) {
+        size_t part = bufferSize - publishPos;
+        memcpy(buffer+publishPos,data,part);
+        publishPos += part;
+        data += part;
+        size -= part;
+        if (!flushPublish()) {
+            return 0;
+        }
+        if (size >= bufferSize) {
+            publishOk = writeBytes(data,size) && publishOk;
+            return publishOk ? written : 0;
+        }
+    }
+    memcpy(buffer+publishPos,data,size);
+    publishPos += size;
+    return written;
+}
 
-    lastOutActivity = millis();
+boolean PubSubClient::flushPublish() {
+    if (publishPos > 0) {
+        publishOk = writeBytes(buffer,publishPos) && publishOk;
+        publishPos = 0;
+    }
+    return publishOk;
+}
 
-    return rc == tlen + 4 + plength;
+boolean PubSubClient::endPublish() {
+    boolean rc = flushPublish() && publishRemaining == 0;
+    publishRemaining = 0;
+    return rc;
 }
 
-boolean PubSubClient::write(uint8_t header, uint8_t* buf, uint16_t length) {
+// Fixed header in front of the length bytes of the packet at buf+4, returns
+// where the packet starts
+uint8_t PubSubClient::frame(uint8_t header, uint8_t* buf, uint16_t length) {
     uint8_t lenBuf[4];
     uint8_t llen = 0;
     uint8_t digit;
     uint8_t pos = 0;
-    uint16_t rc;
     uint16_t len = length;
     do {
         digit = len % 128;
@@ -438,15 +804,26 @@ boolean PubSubClient::write(uint8_t header, uint8_t* buf, uint16_t length) {
         llen++;
     } while(len>0);
 
-    buf[4-llen] = header;
+    // Four bytes before the packet, its length fits in three as long as the
+    // buffer is no larger than 65535 bytes
+    buf[3-llen] = header;
     for (int i=0;i<llen;i++) {
-        buf[5-llen+i] = lenBuf[i];
+        buf[4-llen+i] = lenBuf[i];
     }
+    return 3-llen;
+}
+
+boolean PubSubClient::write(uint8_t header, uint8_t* buf, uint16_t length) {
+    uint8_t start = frame(header,buf,length);
+    return writeBytes(buf+start,length+4-start);
+}
 
+boolean PubSubClient::writeBytes(const uint8_t* buf, size_t length) {
 #ifdef MQTT_MAX_TRANSFER_SIZE
-    uint8_t* writeBuf = buf+(4-llen);
-    uint16_t bytesRemaining = length+1+llen;  //Match the length type
-    uint8_t bytesToWrite;
+    const uint8_t* writeBuf = buf;
+    size_t bytesRemaining = length;
+    uint16_t bytesToWrite;
+    size_t rc;
     boolean result = true;
     while((bytesRemaining > 0) && result) {
         bytesToWrite = (bytesRemaining > MQTT_MAX_TRANSFER_SIZE)?MQTT_MAX_TRANSFER_SIZE:bytesRemaining;
@@ -455,11 +832,12 @@ boolean PubSubClient::write(uint8_t header, uint8_t* buf, uint16_t length) {
         bytesRemaining -= rc;
         writeBuf += rc;
     }
+    lastOutActivity = millis();
     return result;
 #else
-    rc = _client->write(buf+(4-llen),length+1+llen);
+    size_t rc = length > 0 ? _client->write(buf,length) : 0;
     lastOutActivity = millis();
-    return (rc == 1+llen+length);
+    return (rc == length);
 #endif
 }
 
@@ -468,44 +846,60 @@ boolean PubSubClient::subscribe(const char* topic) {
 }
 
 boolean PubSubClient::subscribe(const char* topic, uint8_t qos) {
-    if (qos < 0 || qos > 1) {
-        return false;
-    }
-    if (MQTT_MAX_PACKET_SIZE < 9 + strlen(topic)) {
-        // Too long
+    return subscribe(&topic,1,qos);
+}
+
+boolean PubSubClient::subscribe(const char* const* topics, uint8_t count, uint8_t qos) {
+    if (qos > 1) {
         return false;
     }
     if (connected()) {
-        // Leave room in the buffer for header and variable length field
-        uint16_t length = 5;
-        nextMsgId++;
-        if (nextMsgId == 0) {
-            nextMsgId = 1;
+        uint16_t length = subscribePacket(topics,count,qos,0);
+        if (length == 0) {
+            // Too long
+            return false;
         }
-        buffer[length++] = (nextMsgId >> 8);
-        buffer[length++] = (nextMsgId & 0xFF);
-        length = writeString((char*)topic, buffer,length);
-        buffer[length++] = qos;
-        return write(MQTTSUBSCRIBE|MQTTQOS1,buffer,length-5);
+        return writeBytes(buffer,length);
     }
     return false;
 }
 
+// SUBSCRIBE to every topic at buffer+pos, returns its length or 0 if it does
+// not fit in the buffer
+uint16_t PubSubClient::subscribePacket(const char* const* topics, uint8_t count, uint8_t qos, uint16_t pos) {
+    // Room in front for the header and variable length field
+    uint32_t needed = 4 + 2;
+    for (uint8_t i = 0; i < count; i++) {
+        needed += 2 + strlen(topics[i]) + 1;
+    }
+    if (count == 0 || pos + needed > bufferSize) {
+        return 0;
+    }
+    uint16_t msgId = nextId();
+    uint16_t length = pos + 4;
+    buffer[length++] = (msgId >> 8);
+    buffer[length++] = (msgId & 0xFF);
+    for (uint8_t i = 0; i < count; i++) {
+        length = writeString(topics[i],buffer,length);
+        buffer[length++] = qos;
+    }
+    uint8_t start = frame(MQTTSUBSCRIBE|MQTTQOS1,buffer+pos,length-pos-4);
+    memmove(buffer+pos,buffer+pos+start,length-pos-start);
+    return length-pos-start;
+}
+
 boolean PubSubClient::unsubscribe(const char* topic) {
-    if (MQTT_MAX_PACKET_SIZE < 9 + strlen(topic)) {
+    if (bufferSize < 9 + strlen(topic)) {
         // Too long
         return false;
     }
     if (connected()) {
-        uint16_t length = 5;
-        nextMsgId++;
-        if (nextMsgId == 0) {
-            nextMsgId = 1;
-        }
-        buffer[length++] = (nextMsgId >> 8);
-        buffer[length++] = (nextMsgId & 0xFF);
+        uint16_t length = 4;
+        uint16_t msgId = nextId();
+        buffer[length++] = (msgId >> 8);
+        buffer[length++] = (msgId & 0xFF);
         length = writeString(topic, buffer,length);
-        return write(MQTTUNSUBSCRIBE|MQTTQOS1,buffer,length-5);
+        return write(MQTTUNSUBSCRIBE|MQTTQOS1,buffer,length-4);
     }
     return false;
 }
@@ -515,10 +909,66 @@ void PubSubClient::disconnect() {
     buffer[1] = 0;
     _client->write(buffer,2);
     _state = MQTT_DISCONNECTED;
+    connectStep = MQTT_CONNECT_IDLE;
     _client->stop();
     lastInActivity = lastOutActivity = millis();
 }
 
+void PubSubClient::acknowledge(uint16_t msgId) {
+    for (uint8_t i = 0; i < inflightCount; i++) {
+        if (inflight[i] == msgId) {
+            store->remove(msgId);
+            inflightCount--;
+            memmove(inflight+i,inflight+i+1,(inflightCount-i)*sizeof(inflight[0]));
+            return;
+        }
+    }
+}
+
+// A message id that is not 0 and not waiting for its PUBACK. Kept across
+// reconnects, a publish sent again still holds its id
+uint16_t PubSubClient::nextId() {
+    boolean used;
+    do {
+        nextMsgId++;
+        if (nextMsgId == 0) {
+            nextMsgId = 1;
+        }
+        used = false;
+        for (uint8_t i = 0; i < inflightCount; i++) {
+            used = used || inflight[i] == nextMsgId;
+        }
+    } while (used);
+    return nextMsgId;
+}
+
+void PubSubClient::clearInflight() {
+    for (uint8_t i = 0; i < inflightCount; i++) {
+        store->remove(inflight[i]);
+    }
+    inflightCount = 0;
+}
+
+// The publishes of the previous connection still waiting for their PUBACK,
+// in their order and with the DUP flag
+void PubSubClient::resend() {
+    uint8_t i = 0;
+    while (i < inflightCount) {
+        uint16_t length = store->get(inflight[i],buffer,bufferSize);
+        if (length == 0) {
+            // Lost by the store, nothing to send again
+            inflightCount--;
+            memmove(inflight+i,inflight+i+1,(inflightCount-i)*sizeof(inflight[0]));
+            continue;
+        }
+        buffer[0] |= MQTTDUP;
+        if (!writeBytes(buffer,length)) {
+            return;
+        }
+        i++;
+    }
+}
+
 uint16_t PubSubClient::writeString(const char* string, uint8_t* buf, uint16_t pos) {
     const char* idp = string;
     uint16_t i = 0;
@@ -535,7 +985,8 @@ uint16_t PubSubClient::writeString(const char* string, uint8_t* buf, uint16_t po
 
 boolean PubSubClient::connected() {
     boolean rc;
-    if (_client == NULL ) {
+    if (_client == NULL || connectStep != MQTT_CONNECT_IDLE) {
+        // Not before the CONNACK
         rc = false;
     } else {
         rc = (int)_client->connected();
@@ -573,6 +1024,11 @@ PubSubClient& PubSubClient::setCallback(MQTT_CALLBACK_SIGNATURE) {
     return *this;
 }
 
+PubSubClient& PubSubClient::setConnectCallback(MQTT_CONNECT_CALLBACK_SIGNATURE) {
+    this->connectCallback = connectCallback;
+    return *this;
+}
+
 PubSubClient& PubSubClient::setClient(Client& client){
     this->_client = &client;
     return *this;
@@ -583,6 +1039,234 @@ PubSubClient& PubSubClient::setStream(Stream& stream){
     return *this;
 }
 
+PubSubClient& PubSubClient::setStore(PubSubStore& store) {
+    this->store = &store;
+    return *this;
+}
+
+// FNV-1a, enough to tell the routes of a client apart before comparing bytes
+static uint32_t topicHash(const char* topic, uint16_t length) {
+    uint32_t hash = 2166136261UL;
+    for (uint16_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)topic[i]) * 16777619UL;
+    }
+    return hash;
+}
+
+// Whether the topic matches the filter from pos on, the bytes before it
+// matching already
+static boolean topicMatches(const char* filter, const char* topic, uint16_t length, uint16_t pos) {
+    const char* f = filter+pos;
+    uint16_t t = pos;
+    while (*f) {
+        if (*f == '#') {
+            return true;
+        }
+        if (*f == '+') {
+            while (t < length && topic[t] != '/') {
+                t++;
+            }
+            f++;
+        } else if (t < length && topic[t] == *f) {
+            f++;
+            t++;
+        } else {
+            // "a/#" also matches its parent "a"
+            return t == length && f[0] == '/' && f[1] == '#';
+        }
+    }
+    return t == length;
+}
+
+boolean PubSubClient::route(const char* filter, MQTT_ROUTE_SIGNATURE) {
+    if (routeCount >= MQTT_MAX_ROUTES || filter == NULL || filter[0] == 0 || !handler) {
+        return false;
+    }
+    size_t length = strlen(filter);
+    if (length > 0xFFFF) {
+        return false;
+    }
+    size_t prefix = length;
+    for (size_t i = 0; i < length; i++) {
+        char c = filter[i];
+        if (c == '+' || c == '#') {
+            // A wildcard takes a whole level, # only the last one
+            if ((i > 0 && filter[i-1] != '/') || (c == '+' && i+1 < length && filter[i+1] != '/') ||
+                (c == '#' && i+1 != length)) {
+                return false;
+            }
+            if (prefix == length) {
+                // The / before a # is not needed, "a/#" matches "a" too
+                prefix = (c == '#' && i > 0) ? i-1 : i;
+            }
+        }
+    }
+
+    PubSubRoute r;
+    r.filter = filter;
+    r.length = length;
+    r.prefix = prefix;
+    r.hash = topicHash(filter,length);
+    r.handler = handler;
+    uint8_t pos = routeCount;
+    if (prefix == length) {
+        // After the exact routes of a lower or the same length and hash, so
+        // the first one given wins
+        pos = exactRouteCount;
+        while (pos > 0 && (routes[pos-1].length > r.length ||
+                           (routes[pos-1].length == r.length && routes[pos-1].hash > r.hash))) {
+            pos--;
+        }
+        exactRouteCount++;
+    }
+    for (uint8_t i = routeCount; i > pos; i--) {
+        routes[i] = routes[i-1];
+    }
+    routes[pos] = r;
+    routeCount++;
+    return true;
+}
+
+boolean PubSubClient::dispatch(const char* topic, uint16_t topicLength, uint8_t* payload, unsigned int length) {
+    if (exactRouteCount > 0) {
+        uint32_t hash = topicHash(topic,topicLength);
+        // First exact route not before the topic in the order of the table
+        uint8_t low = 0;
+        uint8_t high = exactRouteCount;
+        while (low < high) {
+            uint8_t mid = (low+high)/2;
+            if (routes[mid].length < topicLength || (routes[mid].length == topicLength && routes[mid].hash < hash)) {
+                low = mid+1;
+            } else {
+                high = mid;
+            }
+        }
+        for (; low < exactRouteCount && routes[low].length == topicLength && routes[low].hash == hash; low++) {
+            if (memcmp(routes[low].filter,topic,topicLength) == 0) {
+                routes[low].handler(topic,topicLength,payload,length);
+                return true;
+            }
+        }
+    }
+    for (uint8_t i = exactRouteCount; i < routeCount; i++) {
+        PubSubRoute& r = routes[i];
+        // Wildcards at the start of a filter do not match the $ topics
+        if (topicLength > 0 && topic[0] == '$' && (r.filter[0] == '+' || r.filter[0] == '#')) {
+            continue;
+        }
+        if (r.prefix <= topicLength && memcmp(r.filter,topic,r.prefix) == 0 &&
+            topicMatches(r.filter,topic,topicLength,r.prefix)) {
+            r.handler(topic,topicLength,payload,length);
+            return true;
+        }
+    }
+    return false;
+}
+
+boolean PubSubClient::setBufferSize(uint16_t size) {
+    if (size == 0) {
+        return false;
+    }
+    uint8_t* newBuffer = (uint8_t*)realloc(this->buffer, size);
+    if (newBuffer == NULL) {
+        // The old buffer is still there and still in use
+        return false;
+    }
+    this->buffer = newBuffer;
+    this->bufferSize = size;
+    return true;
+}
+
+uint16_t PubSubClient::getBufferSize() {
+    return this->bufferSize;
+}
+
+PubSubClient& PubSubClient::setSubscriptions(const char* const* topics, uint8_t count, uint8_t qos) {
+    this->subscriptions = topics;
+    this->subscriptionCount = count;
+    this->subscriptionQos = qos;
+    return *this;
+}
+
+boolean PubSubClient::getSessionPresent() {
+    return this->sessionPresent;
+}
+
+uint8_t PubSubClient::getInflight() {
+    return this->inflightCount;
+}
+
 int PubSubClient::state() {
     return this->_state;
 }
+
+PubSubMemoryStore::PubSubMemoryStore() {
+    this->count = 0;
+    this->spill = NULL;
+}
+
+PubSubMemoryStore::PubSubMemoryStore(PubSubStore* spill) {
+    this->count = 0;
+    this->spill = spill;
+}
+
+// Index of the packet of msgId and its offset in data, -1 if it is not here
+int PubSubMemoryStore::find(uint16_t msgId, uint16_t* offset) {
+    *offset = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        if (ids[i] == msgId) {
+            return i;
+        }
+        *offset += lengths[i];
+    }
+    return -1;
+}
+
+uint16_t PubSubMemoryStore::used() {
+    uint16_t total = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        total += lengths[i];
+    }
+    return total;
+}
+
+boolean PubSubMemoryStore::put(uint16_t msgId, const uint8_t* packet, uint16_t length) {
+    uint16_t end = used();
+    if (count < MQTT_MAX_INFLIGHT && length <= MQTT_STORE_SIZE - end) {
+        memcpy(data+end,packet,length);
+        ids[count] = msgId;
+        lengths[count] = length;
+        count++;
+        return true;
+    }
+    return spill != NULL && spill->put(msgId,packet,length);
+}
+
+uint16_t PubSubMemoryStore::get(uint16_t msgId, uint8_t* packet, uint16_t size) {
+    uint16_t offset;
+    int i = find(msgId,&offset);
+    if (i < 0) {
+        return spill != NULL ? spill->get(msgId,packet,size) : 0;
+    }
+    if (lengths[i] > size) {
+        return 0;
+    }
+    memcpy(packet,data+offset,lengths[i]);
+    return lengths[i];
+}
+
+void PubSubMemoryStore::remove(uint16_t msgId) {
+    uint16_t offset;
+    int i = find(msgId,&offset);
+    if (i < 0) {
+        if (spill != NULL) {
+            spill->remove(msgId);
+        }
+        return;
+    }
+    // The packets behind move down, the free space is always at the end
+    memmove(data+offset,data+offset+lengths[i],used()-offset-lengths[i]);
+    count--;
+    memmove(ids+i,ids+i+1,(count-i)*sizeof(ids[0]));
+    memmove(lengths+i,lengths+i+1,(count-i)*sizeof(lengths[0]));
+}
@@ -21,7 +21,8 @@
 #define MQTT_VERSION MQTT_VERSION_3_1_1
 #endif
 
-// MQTT_MAX_PACKET_SIZE : Maximum packet size
+// MQTT_MAX_PACKET_SIZE : Maximum packet size, the initial size of the buffer
+//  that setBufferSize() changes at runtime
 #ifndef MQTT_MAX_PACKET_SIZE
 #define MQTT_MAX_PACKET_SIZE 128
 #endif
@@ -36,6 +37,27 @@
 #define MQTT_SOCKET_TIMEOUT 15
 #endif
 
+// MQTT_MAX_READ_SIZE : largest read() asked of the network client at once when
+//  receiving the part of a packet that does not fit in the buffer
+#ifndef MQTT_MAX_READ_SIZE
+#define MQTT_MAX_READ_SIZE 32
+#endif
+
+// MQTT_MAX_INFLIGHT : QoS 1 publishes waiting for their PUBACK at the same time
+#ifndef MQTT_MAX_INFLIGHT
+#define MQTT_MAX_INFLIGHT 4
+#endif
+
+// MQTT_STORE_SIZE : bytes of RAM a PubSubMemoryStore keeps those publishes in
+#ifndef MQTT_STORE_SIZE
+#define MQTT_STORE_SIZE 512
+#endif
+
+// MQTT_MAX_ROUTES : topic filters that can be given their own handler, see route()
+#ifndef MQTT_MAX_ROUTES
+#define MQTT_MAX_ROUTES 8
+#endif
+
 // MQTT_MAX_TRANSFER_SIZE : limit how much data is passed to the network client
 //  in each write call. Needed for the Arduino Wifi Shield. Leave undefined to
 //  pass the entire MQTT packet in each write call.
@@ -53,6 +75,12 @@
 #define MQTT_CONNECT_BAD_CREDENTIALS 4
 #define MQTT_CONNECT_UNAUTHORIZED    5
 
+// Steps of a connection attempt, given to the connect callback
+#define MQTT_CONNECT_IDLE    0  // No attempt under way: it failed, see state()
+#define MQTT_CONNECT_TCP     1  // Opening the network connection
+#define MQTT_CONNECT_SENT    2  // CONNECT sent, waiting for the CONNACK
+#define MQTT_CONNECT_DONE    3  // Connected, subscriptions and waiting publishes sent again
+
 #define MQTTCONNECT     1 << 4  // Client request to connect to Server
 #define MQTTCONNACK     2 << 4  // Connect Acknowledgment
 #define MQTTPUBLISH     3 << 4  // Publish message
@@ -72,27 +100,117 @@
 #define MQTTQOS0        (0 << 1)
 #define MQTTQOS1        (1 << 1)
 #define MQTTQOS2        (2 << 1)
+#define MQTTDUP         (1 << 3)
 
 #ifdef ESP8266
 #include <functional>
 #define MQTT_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int)> callback
+#define MQTT_CONNECT_CALLBACK_SIGNATURE std::function<void(uint8_t, unsigned long)> connectCallback
+#define MQTT_ROUTE_SIGNATURE std::function<void(const char*, uint16_t, uint8_t*, unsigned int)> handler
 #else
 #define MQTT_CALLBACK_SIGNATURE void (*callback)(char*, uint8_t*, unsigned int)
+#define MQTT_CONNECT_CALLBACK_SIGNATURE void (*connectCallback)(uint8_t, unsigned long)
+#define MQTT_ROUTE_SIGNATURE void (*handler)(const char*, uint16_t, uint8_t*, unsigned int)
 #endif
 
+// Topic filter and its handler, compiled when it is registered: the length
+// and hash of a filter without wildcards, the literal bytes before the first
+// wildcard of the others
+struct PubSubRoute {
+   const char* filter;
+   uint16_t length;
+   uint16_t prefix;
+   uint32_t hash;
+   MQTT_ROUTE_SIGNATURE;
+};
+
+// Where the QoS 1 publishes wait for their PUBACK, kept as the packets that
+// are sent again with the DUP flag after a reconnect
+class PubSubStore {
+public:
+   virtual ~PubSubStore() {}
+   // Keep the packet of msgId, false if there is no room for it
+   virtual boolean put(uint16_t msgId, const uint8_t* packet, uint16_t length) = 0;
+   // Copy the packet of msgId, returns its length or 0 if it is not kept or
+   // larger than size
+   virtual uint16_t get(uint16_t msgId, uint8_t* packet, uint16_t size) = 0;
+   virtual void remove(uint16_t msgId) = 0;
+};
+
+// Packets in MQTT_STORE_SIZE bytes of RAM. The ones that do not fit go to the
+// spill store when there is one, e.g. in flash
+class PubSubMemoryStore : public PubSubStore {
+private:
+   uint8_t data[MQTT_STORE_SIZE];
+   uint16_t ids[MQTT_MAX_INFLIGHT];      // In the order of their packets in data
+   uint16_t lengths[MQTT_MAX_INFLIGHT];
+   uint8_t count;
+   PubSubStore* spill;
+   int find(uint16_t msgId, uint16_t* offset);
+   uint16_t used();
+public:
+   PubSubMemoryStore();
+   PubSubMemoryStore(PubSubStore* spill);
+   virtual boolean put(uint16_t msgId, const uint8_t* packet, uint16_t length);
+   virtual uint16_t get(uint16_t msgId, uint8_t* packet, uint16_t size);
+   virtual void remove(uint16_t msgId);
+};
+
 class PubSubClient {
 private:
    Client* _client;
-   uint8_t buffer[MQTT_MAX_PACKET_SIZE];
+   uint8_t* buffer;
+   uint16_t bufferSize;
    uint16_t nextMsgId;
    unsigned long lastOutActivity;
    unsigned long lastInActivity;
    bool pingOutstanding;
    MQTT_CALLBACK_SIGNATURE;
+   // Connection attempt: step reached, when it began and the size of the
+   // SUBSCRIBE sent with the CONNECT
+   MQTT_CONNECT_CALLBACK_SIGNATURE;
+   uint8_t connectStep;
+   unsigned long connectStart;
+   uint16_t connectSubscribed;
+   void connectStepTo(uint8_t step);
+   void pollConnect();
+   // Packet being received, kept across calls so a partial packet never blocks
+   uint8_t readState;
+   uint32_t readLength;     // Bytes of the packet received so far
+   uint32_t readRemaining;  // Remaining length of the fixed header, then bytes still to come
+   uint32_t readMultiplier;
+   uint16_t readSkip;       // Topic and message id of a streamed publish
+   uint8_t readLengthLength;
+   void resetPacket();
    uint16_t readPacket(uint8_t*);
-   boolean readByte(uint8_t * result);
-   boolean readByte(uint8_t * result, uint16_t * index);
+   uint8_t frame(uint8_t header, uint8_t* buf, uint16_t length);
    boolean write(uint8_t header, uint8_t* buf, uint16_t length);
+   boolean writeBytes(const uint8_t* buf, size_t length);
+   uint16_t publishHeader(uint8_t header, const char* topic, unsigned int length);
+   boolean flushPublish();
+   // Streamed publish: bytes staged in the buffer and bytes still expected
+   uint16_t publishPos;
+   uint32_t publishRemaining;
+   boolean publishOk;
+   // QoS 1 publishes waiting for their PUBACK, oldest first
+   PubSubStore* store;
+   uint16_t inflight[MQTT_MAX_INFLIGHT];
+   uint8_t inflightCount;
+   void acknowledge(uint16_t msgId);
+   uint16_t nextId();
+   // Topics subscribed again with every connect
+   const char* const* subscriptions;
+   uint8_t subscriptionCount;
+   uint8_t subscriptionQos;
+   boolean sessionPresent;
+   // Routes without wildcards first, sorted by length and hash, then the
+   // others in the order they were given
+   PubSubRoute routes[MQTT_MAX_ROUTES];
+   uint8_t routeCount;
+   uint8_t exactRouteCount;
+   boolean dispatch(const char* topic, uint16_t topicLength, uint8_t* payload, unsigned int length);
+   uint16_t subscribePacket(const char* const* topics, uint8_t count, uint8_t qos, uint16_t pos);
+   void resend();
    uint16_t writeString(const char* string, uint8_t* buf, uint16_t pos);
    IPAddress ip;
    const char* domain;
@@ -114,29 +232,72 @@ public:
    PubSubClient(const char*, uint16_t, Client& client, Stream&);
    PubSubClient(const char*, uint16_t, MQTT_CALLBACK_SIGNATURE,Client& client);
    PubSubClient(const char*, uint16_t, MQTT_CALLBACK_SIGNATURE,Client& client, Stream&);
+   ~PubSubClient();
 
    PubSubClient& setServer(IPAddress ip, uint16_t port);
    PubSubClient& setServer(uint8_t * ip, uint16_t port);
    PubSubClient& setServer(const char * domain, uint16_t port);
    PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE);
+   // Called with every step of a connection attempt and the milliseconds
+   // since it began
+   PubSubClient& setConnectCallback(MQTT_CONNECT_CALLBACK_SIGNATURE);
    PubSubClient& setClient(Client& client);
    PubSubClient& setStream(Stream& stream);
+   PubSubClient& setStore(PubSubStore& store);
+   // Topics subscribed with every connect(), in one SUBSCRIBE sent right
+   // behind the CONNECT without waiting for the CONNACK. The strings must
+   // outlive the client.
+   PubSubClient& setSubscriptions(const char* const* topics, uint8_t count, uint8_t qos);
+   // Hand the messages whose topic matches filter, which may hold + and #
+   // wildcards, to handler instead of the callback. The handler gets the
+   // topic and the payload where they lie in the buffer: the topic is not
+   // NUL terminated. The first route given wins when several wildcard filters
+   // match, a filter without wildcards wins over them. Fails when the filter
+   // is not valid or MQTT_MAX_ROUTES are given already. The filter must
+   // outlive the client.
+   boolean route(const char* filter, MQTT_ROUTE_SIGNATURE);
+   boolean setBufferSize(uint16_t size);
+   uint16_t getBufferSize();
 
    boolean connect(const char* id);
    boolean connect(const char* id, const char* user, const char* pass);
    boolean connect(const char* id, const char* willTopic, uint8_t willQos, boolean willRetain, const char* willMessage);
    boolean connect(const char* id, const char* user, const char* pass, const char* willTopic, uint8_t willQos, boolean willRetain, const char* willMessage);
+   // With cleanSession false the broker keeps the subscriptions and the QoS 1
+   // messages of the client while it is away, see getSessionPresent()
+   boolean connect(const char* id, const char* user, const char* pass, const char* willTopic, uint8_t willQos, boolean willRetain, const char* willMessage, boolean cleanSession);
+   // Same as connect() without waiting for the CONNACK: loop() collects it,
+   // see connecting() and setConnectCallback(). Only opening the network
+   // connection blocks, as the Client interface has no other way.
+   boolean beginConnect(const char* id, const char* user, const char* pass, const char* willTopic, uint8_t willQos, boolean willRetain, const char* willMessage, boolean cleanSession);
+   boolean connecting();
    void disconnect();
    boolean publish(const char* topic, const char* payload);
    boolean publish(const char* topic, const char* payload, boolean retained);
    boolean publish(const char* topic, const uint8_t * payload, unsigned int plength);
    boolean publish(const char* topic, const uint8_t * payload, unsigned int plength, boolean retained);
+   // QoS 1 needs a store, see setStore(). Fails when MQTT_MAX_INFLIGHT publishes
+   // are still waiting for their PUBACK
+   boolean publish(const char* topic, const uint8_t * payload, unsigned int plength, boolean retained, uint8_t qos);
    boolean publish_P(const char* topic, const uint8_t * payload, unsigned int plength, boolean retained);
+   // Publish a payload of plength bytes given in any number of write() calls,
+   // it need not fit in the buffer. No other call on the client in between.
+   boolean beginPublish(const char* topic, unsigned int plength, boolean retained);
+   size_t write(uint8_t);
+   size_t write(const uint8_t *buffer, size_t size);
+   boolean endPublish();
    boolean subscribe(const char* topic);
    boolean subscribe(const char* topic, uint8_t qos);
+   boolean subscribe(const char* const* topics, uint8_t count, uint8_t qos);
    boolean unsubscribe(const char* topic);
    boolean loop();
    boolean connected();
+   uint8_t getInflight();
+   // Forget the QoS 1 publishes still waiting for their PUBACK, they are not
+   // sent again after the next connect
+   void clearInflight();
+   // Whether the broker still had the session of the client at the last connect
+   boolean getSessionPresent();
    int state();
 };
 
@@ -11,6 +11,15 @@ void callback(char* topic, byte* payload, unsigned int length) {
   // handle message arrived
 }
 
+uint8_t steps[8];
+int stepCount = 0;
+
+void connectCallback(uint8_t step, unsigned long) {
+  if (stepCount < 8) {
+    steps[stepCount++] = step;
+  }
+}
+
 
 int test_connect_fails_no_network() {
     IT("fails to connect if underlying client doesn't connect");
@@ -253,6 +262,163 @@ int test_connect_disconnect_connect() {
     END_IT
 }
 
+int test_connect_persistent_session() {
+    IT("connects without a clean session");
+    ShimClient shimClient;
+
+    shimClient.setAllowConnect(true);
+    byte connect[] = {0x10,0x18,0x0,0x4,0x4d,0x51,0x54,0x54,0x4,0x0,0x0,0xf,0x0,0xc,0x63,0x6c,0x69,0x65,0x6e,0x74,0x5f,0x74,0x65,0x73,0x74,0x31};
+    byte connack[] = { 0x20, 0x02, 0x01, 0x00 };
+
+    shimClient.expect(connect,26);
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    IS_FALSE(client.getSessionPresent());
+
+    int rc = client.connect((char*)"client_test1",NULL,NULL,0,0,0,0,false);
+    IS_TRUE(rc);
+    IS_FALSE(shimClient.error());
+    IS_TRUE(client.getSessionPresent());
+
+    END_IT
+}
+
+int test_connect_subscriptions() {
+    IT("sends the subscriptions in the same write as the connect packet");
+    ShimClient shimClient;
+
+    shimClient.setAllowConnect(true);
+    byte connect[] = {0x10,0x18,0x0,0x4,0x4d,0x51,0x54,0x54,0x4,0x2,0x0,0xf,0x0,0xc,0x63,0x6c,0x69,0x65,0x6e,0x74,0x5f,0x74,0x65,0x73,0x74,0x31,
+                      0x82,0xb,0x0,0x2,0x0,0x1,0x61,0x1,0x0,0x2,0x62,0x63,0x1};
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    byte suback[] = { 0x90, 0x04, 0x00, 0x02, 0x01, 0x01 };
+
+    shimClient.expect(connect,39);
+    shimClient.respond(connack,4);
+    shimClient.respond(suback,6);
+
+    const char* topics[] = { "a", "bc" };
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setSubscriptions(topics,2,1);
+
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+    IS_EQUAL(shimClient.writes(), 1);
+    IS_FALSE(shimClient.error());
+
+    rc = client.loop();
+    IS_TRUE(rc);
+
+    END_IT
+}
+
+int test_connect_subscriptions_too_long() {
+    IT("subscribes after the connack when the subscriptions do not fit");
+    ShimClient shimClient;
+
+    shimClient.setAllowConnect(true);
+    byte connect[] = {0x10,0x18,0x0,0x4,0x4d,0x51,0x54,0x54,0x4,0x2,0x0,0xf,0x0,0xc,0x63,0x6c,0x69,0x65,0x6e,0x74,0x5f,0x74,0x65,0x73,0x74,0x31};
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+
+    shimClient.expect(connect,26);
+    shimClient.respond(connack,4);
+
+    //                                  0        1         2         3         4         5         6         7         8         9         0
+    const char* topics[] = { "1234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890" };
+    byte subscribe[110] = { 0x82,0x69,0x0,0x2,0x0,0x64 };
+    memcpy(subscribe+6,topics[0],100);
+    subscribe[106] = 0;
+    shimClient.expect(subscribe,107);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setSubscriptions(topics,1,0);
+
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+    IS_EQUAL(shimClient.writes(), 2);
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_connect_async() {
+    IT("connects without waiting for the connack");
+    ShimClient shimClient;
+
+    shimClient.setAllowConnect(true);
+    byte connect[] = {0x10,0x18,0x0,0x4,0x4d,0x51,0x54,0x54,0x4,0x2,0x0,0xf,0x0,0xc,0x63,0x6c,0x69,0x65,0x6e,0x74,0x5f,0x74,0x65,0x73,0x74,0x31};
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.expect(connect,26);
+
+    stepCount = 0;
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setConnectCallback(connectCallback);
+
+    int rc = client.beginConnect((char*)"client_test1",NULL,NULL,0,0,0,0,true);
+    IS_TRUE(rc);
+    IS_TRUE(client.connecting());
+    IS_FALSE(client.connected());
+    IS_FALSE(client.loop());
+    IS_TRUE(client.connecting());
+
+    shimClient.respond(connack,4);
+    rc = client.loop();
+    IS_TRUE(rc);
+    IS_FALSE(client.connecting());
+    IS_TRUE(client.connected());
+    IS_TRUE(client.state() == MQTT_CONNECTED);
+
+    IS_EQUAL(stepCount, 3);
+    IS_EQUAL(steps[0], MQTT_CONNECT_TCP);
+    IS_EQUAL(steps[1], MQTT_CONNECT_SENT);
+    IS_EQUAL(steps[2], MQTT_CONNECT_DONE);
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_connect_async_fails_no_network() {
+    IT("reports a failed network connection to the connect callback");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(false);
+
+    stepCount = 0;
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setConnectCallback(connectCallback);
+
+    int rc = client.beginConnect((char*)"client_test1",NULL,NULL,0,0,0,0,true);
+    IS_FALSE(rc);
+    IS_FALSE(client.connecting());
+    IS_TRUE(client.state() == MQTT_CONNECT_FAILED);
+
+    IS_EQUAL(stepCount, 2);
+    IS_EQUAL(steps[0], MQTT_CONNECT_TCP);
+    IS_EQUAL(steps[1], MQTT_CONNECT_IDLE);
+
+    END_IT
+}
+
+int test_connect_async_closed() {
+    IT("ends the attempt when the connection closes before the connack");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    stepCount = 0;
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setConnectCallback(connectCallback);
+
+    int rc = client.beginConnect((char*)"client_test1",NULL,NULL,0,0,0,0,true);
+    IS_TRUE(rc);
+    shimClient.setConnected(false);
+    IS_FALSE(client.loop());
+    IS_FALSE(client.connecting());
+    IS_TRUE(client.state() == MQTT_CONNECTION_LOST);
+    IS_EQUAL(steps[stepCount-1], MQTT_CONNECT_IDLE);
+
+    END_IT
+}
+
 int main()
 {
     SUITE("Connect");
@@ -269,5 +435,11 @@ int main()
     test_connect_with_will();
     test_connect_with_will_username_password();
     test_connect_disconnect_connect();
+    test_connect_persistent_session();
+    test_connect_subscriptions();
+    test_connect_subscriptions_too_long();
+    test_connect_async();
+    test_connect_async_fails_no_network();
+    test_connect_async_closed();
     FINISH
 }
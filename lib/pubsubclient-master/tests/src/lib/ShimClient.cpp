@@ -18,6 +18,8 @@ ShimClient::ShimClient() {
     this->_error = false;
     this->expectAnything = true;
     this->_received = 0;
+    this->_reads = 0;
+    this->_writes = 0;
     this->_expectedPort = 0;
 }
 
@@ -56,6 +58,7 @@ int ShimClient::connect(const char *host, uint16_t port)  {
 }
 size_t ShimClient::write(uint8_t b)  {
     this->_received += 1;
+    this->_writes += 1;
     TRACE(std::hex << (unsigned int)b);
     if (!this->expectAnything) {
         if (this->expectBuffer->available()) {
@@ -73,6 +76,7 @@ size_t ShimClient::write(uint8_t b)  {
 }
 size_t ShimClient::write(const uint8_t *buf, size_t size)  {
     this->_received += size;
+    this->_writes += 1;
     TRACE( "[" << std::dec << (unsigned int)(size) << "] ");
     uint16_t i=0;
     for (;i<size;i++) {
@@ -97,13 +101,20 @@ size_t ShimClient::write(const uint8_t *buf, size_t size)  {
     return size;
 }
 int ShimClient::available()  {
-    return this->responseBuffer->available();
+    return this->responseBuffer->remaining();
+}
+int ShimClient::read()  {
+    this->_reads += 1;
+    return this->responseBuffer->next();
 }
-int ShimClient::read()  { return this->responseBuffer->next(); }
 int ShimClient::read(uint8_t *buf, size_t size) {
+    this->_reads += 1;
+    if (size > this->responseBuffer->remaining()) {
+        size = this->responseBuffer->remaining();
+    }
     uint16_t i = 0;
     for (;i<size;i++) {
-        buf[i] = this->read();
+        buf[i] = this->responseBuffer->next();
     }
     return size;
 }
@@ -142,6 +153,14 @@ uint16_t ShimClient::received() {
     return this->_received;
 }
 
+uint16_t ShimClient::reads() {
+    return this->_reads;
+}
+
+uint16_t ShimClient::writes() {
+    return this->_writes;
+}
+
 void ShimClient::expectConnect(IPAddress ip, uint16_t port) {
     this->_expectedIP = ip;
     this->_expectedPort = port;
@@ -146,6 +146,157 @@ int test_publish_too_long() {
     END_IT
 }
 
+int test_publish_one_write() {
+    IT("publishes in a single write");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte publish[] = {0x30,0xe,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x70,0x61,0x79,0x6c,0x6f,0x61,0x64};
+    shimClient.expect(publish,16);
+
+    uint16_t writes = shimClient.writes();
+    rc = client.publish((char*)"topic",(char*)"payload");
+    IS_TRUE(rc);
+    IS_EQUAL(shimClient.writes()-writes, 1);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_buffer_size() {
+    IT("publishes more than MQTT_MAX_PACKET_SIZE once the buffer is larger");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    IS_EQUAL(client.getBufferSize(), MQTT_MAX_PACKET_SIZE);
+    IS_FALSE(client.setBufferSize(0));
+    IS_EQUAL(client.getBufferSize(), MQTT_MAX_PACKET_SIZE);
+    IS_TRUE(client.setBufferSize(256));
+    IS_EQUAL(client.getBufferSize(), 256);
+
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    const char* payload = "123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890";
+    byte publish[129] = {0x30,0x7f,0x0,0x5,0x74,0x6f,0x70,0x69,0x63};
+    memcpy(publish+9,payload,120);
+    shimClient.expect(publish,129);
+
+    rc = client.publish((char*)"topic",(char*)payload);
+    IS_TRUE(rc);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_stream() {
+    IT("publishes a payload larger than the buffer in pieces");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte payload[300];
+    for (int i=0;i<300;i++) {
+        payload[i] = i;
+    }
+    byte publish[310] = {0x31,0xb3,0x2,0x0,0x5,0x74,0x6f,0x70,0x69,0x63};
+    memcpy(publish+10,payload,300);
+    shimClient.expect(publish,310);
+
+    uint16_t writes = shimClient.writes();
+    rc = client.beginPublish((char*)"topic",300,true);
+    IS_TRUE(rc);
+    IS_EQUAL(client.write(payload[0]), 1);
+    IS_EQUAL(client.write(payload+1,19), 19);
+    IS_EQUAL(client.write(payload+20,260), 260);
+    IS_EQUAL(client.write(payload+280,20), 20);
+    rc = client.endPublish();
+    IS_TRUE(rc);
+    // The header with the first 118 bytes in a full buffer, the other 162 of
+    // the large write straight from the caller, the last 20 staged again
+    IS_EQUAL(shimClient.writes()-writes, 3);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_stream_short() {
+    IT("publish in pieces fails when the payload is short");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte publish[] = {0x30,0xc,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x1,0x2,0x3};
+    shimClient.expect(publish,12);
+
+    byte payload[] = { 0x01,0x02,0x03 };
+    rc = client.beginPublish((char*)"topic",5,false);
+    IS_TRUE(rc);
+    IS_EQUAL(client.write(payload,3), 3);
+    rc = client.endPublish();
+    IS_FALSE(rc);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_stream_not_open() {
+    IT("write outside a publish in pieces writes nothing");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    byte payload[] = { 0x01,0x02,0x03 };
+    IS_EQUAL(client.write(payload,3), 0);
+
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte publish[] = {0x30,0xa,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x1,0x2,0x3};
+    shimClient.expect(publish,12);
+
+    rc = client.beginPublish((char*)"topic",3,false);
+    IS_TRUE(rc);
+    IS_EQUAL(client.write(payload,3), 3);
+    rc = client.endPublish();
+    IS_TRUE(rc);
+    IS_EQUAL(client.write(payload,3), 0);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
 int test_publish_P() {
     IT("publishes using PROGMEM");
     ShimClient shimClient;
@@ -175,6 +326,235 @@ int test_publish_P() {
 
 
 
+int test_publish_qos1() {
+    IT("publishes at QoS 1 until the PUBACK");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubMemoryStore store;
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setStore(store);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte payload[] = { 0x01,0x02,0x03,0x0,0x05 };
+    byte publish[] = {0x32,0xe,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x0,0x2,0x1,0x2,0x3,0x0,0x5};
+    shimClient.expect(publish,16);
+
+    rc = client.publish((char*)"topic",payload,5,false,1);
+    IS_TRUE(rc);
+    IS_EQUAL(client.getInflight(), 1);
+
+    byte puback[] = { 0x40, 0x02, 0x00, 0x02 };
+    shimClient.respond(puback,4);
+    rc = client.loop();
+    IS_TRUE(rc);
+    IS_EQUAL(client.getInflight(), 0);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_qos1_no_store() {
+    IT("publish at QoS 1 fails without a store");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte payload[] = { 0x01,0x02,0x03,0x0,0x05 };
+    rc = client.publish((char*)"topic",payload,5,false,1);
+    IS_FALSE(rc);
+    IS_EQUAL(client.getInflight(), 0);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_qos1_window() {
+    IT("publish at QoS 1 fails while the in-flight window is full");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubMemoryStore store;
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setStore(store);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte payload[] = { 0x01,0x02,0x03,0x0,0x05 };
+    for (int i=0;i<MQTT_MAX_INFLIGHT;i++) {
+        rc = client.publish((char*)"topic",payload,5,false,1);
+        IS_TRUE(rc);
+    }
+    rc = client.publish((char*)"topic",payload,5,false,1);
+    IS_FALSE(rc);
+
+    // Any of them can be acknowledged first
+    byte puback[] = { 0x40, 0x02, 0x00, 0x03 };
+    shimClient.respond(puback,4);
+    client.loop();
+    IS_EQUAL(client.getInflight(), MQTT_MAX_INFLIGHT-1);
+    rc = client.publish((char*)"topic",payload,5,false,1);
+    IS_TRUE(rc);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_qos1_resend() {
+    IT("publishes again with DUP after a reconnect");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubMemoryStore store;
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setStore(store);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte payload[] = { 0x01,0x02,0x03,0x0,0x05 };
+    rc = client.publish((char*)"topic",payload,5,true,1);
+    IS_TRUE(rc);
+
+    // Connection lost before the PUBACK
+    shimClient.setConnected(false);
+    IS_FALSE(client.connected());
+
+    byte connect[] = {0x10,0x18,0x0,0x4,0x4d,0x51,0x54,0x54,0x4,0x2,0x0,0xf,0x0,0xc,0x63,0x6c,0x69,0x65,0x6e,0x74,0x5f,0x74,0x65,0x73,0x74,0x31};
+    byte publish[] = {0x3b,0xe,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x0,0x2,0x1,0x2,0x3,0x0,0x5};
+    shimClient.expect(connect,26);
+    shimClient.expect(publish,16);
+    shimClient.respond(connack,4);
+
+    rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+    IS_EQUAL(client.getInflight(), 1);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_qos1_ids() {
+    IT("keeps message ids across a reconnect and skips the ones in flight");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubMemoryStore store;
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setStore(store);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte payload[] = { 0x01,0x02,0x03,0x0,0x05 };
+    rc = client.publish((char*)"topic",payload,5,false,1);
+    IS_TRUE(rc);
+
+    shimClient.setConnected(false);
+    shimClient.respond(connack,4);
+    rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+    IS_EQUAL(client.getInflight(), 1);
+
+    // Message id 2 is still waiting for its PUBACK
+    byte subscribe[] = {0x82,0xa,0x0,0x3,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x0};
+    shimClient.expect(subscribe,12);
+    rc = client.subscribe((char*)"topic");
+    IS_TRUE(rc);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_qos1_clear() {
+    IT("does not publish again the messages cleared before a reconnect");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubMemoryStore store;
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setStore(store);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte payload[] = { 0x01,0x02,0x03,0x0,0x05 };
+    rc = client.publish((char*)"topic",payload,5,false,1);
+    IS_TRUE(rc);
+
+    shimClient.setConnected(false);
+    client.clearInflight();
+    IS_EQUAL(client.getInflight(), 0);
+    byte packet[MQTT_MAX_PACKET_SIZE];
+    IS_EQUAL(store.get(2,packet,sizeof(packet)), 0);
+
+    byte connect[] = {0x10,0x18,0x0,0x4,0x4d,0x51,0x54,0x54,0x4,0x2,0x0,0xf,0x0,0xc,0x63,0x6c,0x69,0x65,0x6e,0x74,0x5f,0x74,0x65,0x73,0x74,0x31};
+    shimClient.expect(connect,26);
+    shimClient.respond(connack,4);
+    rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_store_spill() {
+    IT("keeps the packets that do not fit in RAM in the spill store");
+    PubSubMemoryStore spill;
+    PubSubMemoryStore store(&spill);
+
+    byte big[MQTT_STORE_SIZE];
+    byte packet[MQTT_STORE_SIZE];
+    for (int i=0;i<MQTT_STORE_SIZE;i++) {
+        big[i] = i;
+    }
+    IS_TRUE(store.put(1,big,MQTT_STORE_SIZE-10));
+    IS_TRUE(store.put(2,big,10));
+    IS_TRUE(store.put(3,big+1,20));
+
+    IS_EQUAL(store.get(3,packet,sizeof(packet)), 20);
+    IS_TRUE(memcmp(packet,big+1,20) == 0);
+    IS_EQUAL(store.get(3,packet,19), 0);
+
+    // Room again once the first one is gone, the one behind it moved down
+    store.remove(1);
+    IS_EQUAL(store.get(1,packet,sizeof(packet)), 0);
+    IS_EQUAL(store.get(2,packet,sizeof(packet)), 10);
+    IS_TRUE(memcmp(packet,big,10) == 0);
+    IS_TRUE(store.put(4,big,30));
+    store.remove(3);
+    IS_EQUAL(store.get(3,packet,sizeof(packet)), 0);
+    IS_EQUAL(spill.get(4,packet,sizeof(packet)), 0);
+    IS_EQUAL(store.get(4,packet,sizeof(packet)), 30);
+
+    END_IT
+}
+
 int main()
 {
     SUITE("Publish");
@@ -185,6 +565,18 @@ int main()
     test_publish_not_connected();
     test_publish_too_long();
     test_publish_P();
+    test_publish_one_write();
+    test_publish_buffer_size();
+    test_publish_stream();
+    test_publish_stream_short();
+    test_publish_stream_not_open();
+    test_publish_qos1();
+    test_publish_qos1_no_store();
+    test_publish_qos1_window();
+    test_publish_qos1_resend();
+    test_publish_qos1_ids();
+    test_publish_qos1_clear();
+    test_publish_store_spill();
 
     FINISH
 }
@@ -3,6 +3,7 @@
 #include "Buffer.h"
 #include "BDDTest.h"
 #include "trace.h"
+#include <ctime>
 
 
 byte server[] = { 172, 16, 0, 2 };
@@ -26,6 +27,42 @@ void callback(char* topic, byte* payload, unsigned int length) {
     lastLength = length;
 }
 
+int route_called = 0;
+const char* routeTopic;
+uint16_t routeTopicLength;
+uint8_t* routePayload;
+unsigned int routeLength;
+
+void route_a(const char* topic, uint16_t topicLength, byte* payload, unsigned int length) {
+    route_called = 1;
+    routeTopic = topic;
+    routeTopicLength = topicLength;
+    routePayload = payload;
+    routeLength = length;
+}
+
+void route_b(const char*, uint16_t, byte*, unsigned int) {
+    route_called = 2;
+}
+
+void route_c(const char*, uint16_t, byte*, unsigned int) {
+    route_called = 3;
+}
+
+// QoS 0 publish of a topic and payload shorter than 128 bytes together
+void respond_publish(ShimClient& shimClient, const char* topic, const char* payload) {
+    byte packet[130];
+    size_t tl = strlen(topic);
+    size_t pl = strlen(payload);
+    packet[0] = 0x30;
+    packet[1] = 2+tl+pl;
+    packet[2] = 0;
+    packet[3] = tl;
+    memcpy(packet+4,topic,tl);
+    memcpy(packet+4+tl,payload,pl);
+    shimClient.respond(packet,4+tl+pl);
+}
+
 int test_receive_callback() {
     IT("receives a callback message");
     reset_callback();
@@ -235,6 +272,282 @@ int test_receive_qos1() {
     END_IT
 }
 
+int test_receive_split_message() {
+    IT("receives a message split across loop calls");
+    reset_callback();
+
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte publish[] = {0x30,0xe,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x70,0x61,0x79,0x6c,0x6f,0x61,0x64};
+    shimClient.respond(publish,1);
+
+    rc = client.loop();
+    IS_TRUE(rc);
+    IS_FALSE(callback_called);
+
+    shimClient.respond(publish+1,8);
+
+    rc = client.loop();
+    IS_TRUE(rc);
+    IS_FALSE(callback_called);
+
+    shimClient.respond(publish+9,7);
+
+    rc = client.loop();
+    IS_TRUE(rc);
+
+    IS_TRUE(callback_called);
+    IS_TRUE(strcmp(lastTopic,"topic")==0);
+    IS_TRUE(memcmp(lastPayload,"payload",7)==0);
+    IS_TRUE(lastLength == 7);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_receive_partial_message_without_waiting() {
+    IT("returns at once from a partial message");
+    reset_callback();
+
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte publish[] = {0x30,0xe,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x70,0x61,0x79,0x6c,0x6f,0x61,0x64};
+    shimClient.respond(publish,5);
+
+    time_t start = time(0);
+    rc = client.loop();
+
+    IS_TRUE(rc);
+    IS_TRUE(time(0)-start < 2);
+    IS_FALSE(callback_called);
+    IS_TRUE(client.connected());
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_receive_in_bulk() {
+    IT("reads a message in bulk");
+    reset_callback();
+
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    int length = 109;
+    byte publish[] = {0x30,0x6b,0x0,0x5,0x74,0x6f,0x70,0x69,0x63};
+    byte bigPublish[length];
+    memset(bigPublish,'A',length);
+    memcpy(bigPublish,publish,9);
+    shimClient.respond(bigPublish,length);
+
+    uint16_t reads = shimClient.reads();
+    rc = client.loop();
+
+    IS_TRUE(rc);
+
+    IS_TRUE(callback_called);
+    IS_TRUE(strcmp(lastTopic,"topic")==0);
+    IS_TRUE(lastLength == 100);
+    IS_TRUE(memcmp(lastPayload,bigPublish+9,lastLength)==0);
+    // The fixed header a byte at a time, then the rest of the packet at once
+    IS_TRUE(shimClient.reads()-reads <= 3);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_receive_one_message_per_loop() {
+    IT("receives back to back messages one loop each");
+    reset_callback();
+
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte publish1[] = {0x30,0xe,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x70,0x61,0x79,0x6c,0x6f,0x61,0x64};
+    byte publish2[] = {0x30,0xa,0x0,0x5,0x6f,0x74,0x68,0x65,0x72,0x6d,0x73,0x67};
+    shimClient.respond(publish1,16);
+    shimClient.respond(publish2,12);
+
+    rc = client.loop();
+    IS_TRUE(rc);
+    IS_TRUE(callback_called);
+    IS_TRUE(strcmp(lastTopic,"topic")==0);
+    IS_TRUE(lastLength == 7);
+
+    reset_callback();
+    rc = client.loop();
+    IS_TRUE(rc);
+    IS_TRUE(callback_called);
+    IS_TRUE(strcmp(lastTopic,"other")==0);
+    IS_TRUE(memcmp(lastPayload,"msg",3)==0);
+    IS_TRUE(lastLength == 3);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_receive_route() {
+    IT("routes a message to the handler of its topic in place");
+    reset_callback();
+    route_called = 0;
+
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    IS_TRUE(client.route("other",route_b));
+    IS_TRUE(client.route("topic",route_a));
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte publish[] = {0x30,0xe,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x70,0x61,0x79,0x6c,0x6f,0x61,0x64};
+    shimClient.respond(publish,16);
+
+    rc = client.loop();
+    IS_TRUE(rc);
+
+    IS_FALSE(callback_called);
+    IS_TRUE(route_called == 1);
+    IS_TRUE(routeTopicLength == 5);
+    IS_TRUE(memcmp(routeTopic,"topic",5)==0);
+    // Neither moved nor NUL terminated: the payload follows the topic
+    IS_TRUE((uint8_t*)routeTopic+5 == routePayload);
+    IS_TRUE(memcmp(routePayload,"payload",7)==0);
+    IS_TRUE(routeLength == 7);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_receive_route_wildcards() {
+    IT("routes a message by the wildcards of the filters");
+    reset_callback();
+
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    IS_TRUE(client.route("a/+/c",route_a));
+    IS_TRUE(client.route("a/#",route_b));
+    IS_TRUE(client.route("a/b/c/d",route_c));
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    const char* topics[] = {"a/b/c", "a//c", "a/b/c/d", "a/b/cd", "a/b", "a", "ab/c", "$a/b/c"};
+    int expected[] = {1, 1, 3, 2, 2, 2, 0, 0};
+    for (int i = 0; i < 8; i++) {
+        respond_publish(shimClient,topics[i],"x");
+    }
+    for (int i = 0; i < 8; i++) {
+        route_called = 0;
+        reset_callback();
+        rc = client.loop();
+        IS_TRUE(rc);
+        IS_TRUE(route_called == expected[i]);
+        IS_TRUE(callback_called == (expected[i] == 0));
+    }
+    IS_TRUE(strcmp(lastTopic,"$a/b/c")==0);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_receive_route_qos1() {
+    IT("acknowledges a routed qos1 message");
+    route_called = 0;
+
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, shimClient);
+    IS_TRUE(client.route("+",route_a));
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte publish[] = {0x32,0x10,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x12,0x34,0x70,0x61,0x79,0x6c,0x6f,0x61,0x64};
+    shimClient.respond(publish,18);
+
+    byte puback[] = {0x40,0x2,0x12,0x34};
+    shimClient.expect(puback,4);
+
+    rc = client.loop();
+    IS_TRUE(rc);
+
+    IS_TRUE(route_called == 1);
+    IS_TRUE(routeTopicLength == 5);
+    IS_TRUE(memcmp(routePayload,"payload",7)==0);
+    IS_TRUE(routeLength == 7);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_route_invalid() {
+    IT("refuses invalid filters and routes beyond the table");
+
+    ShimClient shimClient;
+    PubSubClient client(server, 1883, shimClient);
+
+    IS_FALSE(client.route("",route_a));
+    IS_FALSE(client.route("a/#/b",route_a));
+    IS_FALSE(client.route("a+",route_a));
+    IS_FALSE(client.route("a/+b",route_a));
+    IS_FALSE(client.route("a#",route_a));
+    IS_FALSE(client.route("a",NULL));
+    for (int i = 0; i < MQTT_MAX_ROUTES; i++) {
+        IS_TRUE(client.route("a/+",route_a));
+    }
+    IS_FALSE(client.route("b",route_a));
+
+    END_IT
+}
+
 int main()
 {
     SUITE("Receive");
@@ -244,6 +557,14 @@ int main()
     test_receive_oversized_message();
     test_receive_oversized_stream_message();
     test_receive_qos1();
+    test_receive_split_message();
+    test_receive_partial_message_without_waiting();
+    test_receive_in_bulk();
+    test_receive_one_message_per_loop();
+    test_receive_route();
+    test_receive_route_wildcards();
+    test_receive_route_qos1();
+    test_route_invalid();
 
     FINISH
 }
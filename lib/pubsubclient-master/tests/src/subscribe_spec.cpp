@@ -124,6 +124,34 @@ int test_subscribe_too_long() {
 }
 
 
+int test_subscribe_several() {
+    IT("subscribes to several topics in one packet");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte subscribe[] = { 0x82,0x13,0x0,0x2,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x1,0x0,0x6,0x74,0x6f,0x70,0x69,0x63,0x32,0x1 };
+    shimClient.expect(subscribe,21);
+    byte suback[] = { 0x90,0x4,0x0,0x2,0x1,0x1 };
+    shimClient.respond(suback,6);
+
+    const char* topics[] = { "topic", "topic2" };
+    uint16_t writes = shimClient.writes();
+    rc = client.subscribe(topics,2,1);
+    IS_TRUE(rc);
+    IS_EQUAL(shimClient.writes()-writes, 1);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
 int test_unsubscribe() {
     IT("unsubscribes");
     ShimClient shimClient;
@@ -171,6 +199,7 @@ int main()
     test_subscribe_not_connected();
     test_subscribe_invalid_qos();
     test_subscribe_too_long();
+    test_subscribe_several();
     test_unsubscribe();
     test_unsubscribe_not_connected();
     FINISH
@@ -0,0 +1,333 @@
+#include <FS.h>
+#include <Crypto.h>
+#include <new>
+#include "allowlist.h"
+
+#define ALLOWLIST_FILE "/allowlist.bin"
+#define ALLOWLIST_TMP_FILE "/allowlist.tmp"
+#define ALLOWLIST_OLD_FILE "/allowlist.old" // Snapshot being replaced, SPIFFS cannot rename over a file
+#define ALLOWLIST_MAGIC 0x32534c41 // "ALS2"
+
+struct AllowListHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+};
+
+static const byte* hmac_key;
+static unsigned int hmac_key_length;
+
+/*  Snapshot in use  */
+
+static File list_file;
+static uint32_t list_count = 0;
+static uint32_t list_version = 0;
+static bool loaded = false;
+static uint64_t fences[ALLOWLIST_MAX_ENTRIES / ALLOWLIST_PAGE]; // First hash of every page
+static uint8_t bloom[ALLOWLIST_BLOOM_BITS / 8];
+static uint32_t bloom_bits = ALLOWLIST_BLOOM_BITS; // Part of the filter used by the snapshot, a power of two
+static uint8_t bloom_hashes = 1;
+
+/*  Snapshot being received  */
+
+static File tmp_file;
+static bool receiving = false;
+static AllowListHeader incoming;
+static uint32_t received;       // Entries received so far
+static uint64_t last_hash;      // Last entry received, to check the order
+static uint32_t hmac_storage[(sizeof(SHA256HMAC) + 3) / 4]; // HMAC of the snapshot, built in place for every new one
+
+static SHA256HMAC& signature() {
+    return *reinterpret_cast<SHA256HMAC*>(hmac_storage);
+}
+
+static uint32_t read_u32(const byte* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t read_u64(const byte* p) {
+    return (uint64_t)read_u32(p) | ((uint64_t)read_u32(p + 4) << 32);
+}
+
+static uint64_t hash_uid(const byte* uid, byte uid_size) {
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (byte i = 0; i < uid_size; i++) {
+        hash = (hash ^ uid[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*  Bloom filter positions derived from the two halves of the entry hash, bloom_hashes of them  */
+
+static uint32_t bloom_index(uint64_t hash, uint8_t i) {
+    return ((uint32_t)hash + i * ((uint32_t)(hash >> 32) | 1)) & (bloom_bits - 1);
+}
+
+static void bloom_add(uint64_t hash) {
+    for (uint8_t i = 0; i < bloom_hashes; i++) {
+        uint32_t bit = bloom_index(hash, i);
+        bloom[bit >> 3] |= 1 << (bit & 7);
+    }
+}
+
+static bool bloom_test(uint64_t hash) {
+    for (uint8_t i = 0; i < bloom_hashes; i++) {
+        uint32_t bit = bloom_index(hash, i);
+        if (!(bloom[bit >> 3] & (1 << (bit & 7)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*  Open the stored snapshot and build the page index and the Bloom filter  */
+
+static bool load() {
+    AllowListHeader header;
+    uint64_t page[ALLOWLIST_PAGE];
+
+    if (list_file) {
+        list_file.close();
+    }
+    loaded = false;
+    if (!SPIFFS.exists(ALLOWLIST_FILE)) {
+        return false;
+    }
+    list_file = SPIFFS.open(ALLOWLIST_FILE, "r");
+    if (!list_file) {
+        return false;
+    }
+    if (list_file.read((uint8_t*)&header, sizeof header) != sizeof header || header.magic != ALLOWLIST_MAGIC ||
+            header.count > ALLOWLIST_MAX_ENTRIES || list_file.size() != sizeof header + header.count * 8) {
+        Serial.println("Allow-list file corrupted");
+        list_file.close();
+        return false;
+    }
+
+    // ALLOWLIST_BLOOM_BITS_PER_ENTRY bits per entry up to the whole filter, and the fewest false positives with
+    // ln 2 hash functions per bit of the filter and entry
+    bloom_bits = 64;
+    while (bloom_bits < header.count * ALLOWLIST_BLOOM_BITS_PER_ENTRY && bloom_bits < ALLOWLIST_BLOOM_BITS) {
+        bloom_bits <<= 1;
+    }
+    memset(bloom, 0, bloom_bits / 8);
+    uint32_t hashes = header.count > 0 ?
+        (bloom_bits * 69 + header.count * 50) / (header.count * 100) : ALLOWLIST_BLOOM_HASHES;
+    bloom_hashes = hashes < 1 ? 1 : hashes > ALLOWLIST_BLOOM_HASHES ? ALLOWLIST_BLOOM_HASHES : hashes;
+    for (uint32_t first = 0; first < header.count; first += ALLOWLIST_PAGE) {
+        uint32_t n = header.count - first < ALLOWLIST_PAGE ? header.count - first : ALLOWLIST_PAGE;
+        if (list_file.read((uint8_t*)page, n * 8) != n * 8) {
+            list_file.close();
+            return false;
+        }
+        fences[first / ALLOWLIST_PAGE] = page[0];
+        for (uint32_t i = 0; i < n; i++) {
+            bloom_add(page[i]);
+        }
+    }
+
+    list_count = header.count;
+    list_version = header.version;
+    loaded = true;
+    Serial.print("Allow-list loaded, version ");
+    Serial.print(header.version);
+    Serial.print(" entries ");
+    Serial.println(list_count);
+    return true;
+}
+
+/*  Stop receiving a snapshot. Removing the temporary file allocates, so a rejected chunk keeps it: the next   */
+/*  snapshot truncates it and allowlist_begin() removes it                                                     */
+
+static void drop_snapshot(const char* reason) {
+    Serial.print("Allow-list snapshot rejected: ");
+    Serial.println(reason);
+    if (tmp_file) {
+        tmp_file.close();
+    }
+    receiving = false;
+}
+
+static void abort_snapshot(const char* reason) {
+    drop_snapshot(reason);
+    SPIFFS.remove(ALLOWLIST_TMP_FILE);
+}
+
+/*  Put the verified temporary file in place of the current snapshot, which is kept until the new one is there  */
+
+static bool install() {
+    if (list_file) {
+        list_file.close();
+    }
+    loaded = false;
+    SPIFFS.remove(ALLOWLIST_OLD_FILE);
+    if (SPIFFS.exists(ALLOWLIST_FILE) && !SPIFFS.rename(ALLOWLIST_FILE, ALLOWLIST_OLD_FILE)) {
+        return false;
+    }
+    if (!SPIFFS.rename(ALLOWLIST_TMP_FILE, ALLOWLIST_FILE)) {
+        SPIFFS.rename(ALLOWLIST_OLD_FILE, ALLOWLIST_FILE);
+        return false;
+    }
+    SPIFFS.remove(ALLOWLIST_OLD_FILE);
+    return true;
+}
+
+/*  Whether the temporary file holds the whole snapshot announced in incoming  */
+
+static bool verify_tmp() {
+    AllowListHeader header;
+    File file = SPIFFS.open(ALLOWLIST_TMP_FILE, "r");
+
+    if (!file) {
+        return false;
+    }
+    bool ok = file.size() == sizeof header + incoming.count * 8 &&
+        file.read((uint8_t*)&header, sizeof header) == sizeof header &&
+        memcmp(&header, &incoming, sizeof header) == 0;
+    file.close();
+    return ok;
+}
+
+void allowlist_begin(const byte* key, unsigned int key_length) {
+    hmac_key = key;
+    hmac_key_length = key_length;
+    // A reset in the middle of install() leaves the previous snapshot under the old name
+    if (!SPIFFS.exists(ALLOWLIST_FILE) && SPIFFS.exists(ALLOWLIST_OLD_FILE)) {
+        SPIFFS.rename(ALLOWLIST_OLD_FILE, ALLOWLIST_FILE);
+    }
+    SPIFFS.remove(ALLOWLIST_OLD_FILE);
+    SPIFFS.remove(ALLOWLIST_TMP_FILE);
+    load();
+}
+
+void allowlist_receive(const byte* payload, unsigned int length) {
+    if (length == 0) {
+        return;
+    }
+
+    switch (payload[0]) {
+        case 'B':
+            if (length != 9) {
+                return;
+            }
+            if (receiving) {
+                abort_snapshot("restarted");
+            }
+            incoming.magic = ALLOWLIST_MAGIC;
+            incoming.version = read_u32(payload + 1);
+            incoming.count = read_u32(payload + 5);
+            if (incoming.count > ALLOWLIST_MAX_ENTRIES) {
+                abort_snapshot("too large");
+                return;
+            }
+            if (loaded && incoming.version <= list_version) {
+                abort_snapshot("not newer");
+                return;
+            }
+            tmp_file = SPIFFS.open(ALLOWLIST_TMP_FILE, "w");
+            if (!tmp_file || tmp_file.write((const uint8_t*)&incoming, sizeof incoming) != sizeof incoming) {
+                abort_snapshot("cannot write");
+                return;
+            }
+            new (hmac_storage) SHA256HMAC(hmac_key, hmac_key_length);
+            signature().doUpdate(payload + 1, 8);
+            received = 0;
+            receiving = true;
+            break;
+
+        case 'D':
+            if (!receiving) {
+                return;
+            }
+            if (length < 5 || (length - 5) % 8 != 0 || read_u32(payload + 1) != received ||
+                    received + (length - 5) / 8 > incoming.count) {
+                drop_snapshot("bad chunk");
+                return;
+            }
+            for (unsigned int i = 5; i < length; i += 8) {
+                uint64_t hash = read_u64(payload + i);
+                if (received > 0 && hash <= last_hash) {
+                    drop_snapshot("not sorted");
+                    return;
+                }
+                last_hash = hash;
+                if (tmp_file.write((const uint8_t*)&hash, 8) != 8) {
+                    drop_snapshot("cannot write");
+                    return;
+                }
+                received++;
+            }
+            signature().doUpdate(payload + 5, length - 5);
+            break;
+
+        case 'E':
+            if (!receiving) {
+                return;
+            }
+            if (length != 1 + SHA256HMAC_SIZE || received != incoming.count) {
+                abort_snapshot("incomplete");
+                return;
+            }
+            if (!signature().matches(payload + 1)) {
+                abort_snapshot("bad signature");
+                return;
+            }
+            tmp_file.close();
+            if (!verify_tmp()) {
+                abort_snapshot("cannot write");
+                return;
+            }
+            receiving = false;
+            if (!install()) {
+                Serial.println("Allow-list snapshot not installed, keeping the previous one");
+                SPIFFS.remove(ALLOWLIST_TMP_FILE);
+            }
+            load();
+            break;
+    }
+}
+
+AllowListResult allowlist_lookup(const byte* uid, byte uid_size) {
+    uint64_t page[ALLOWLIST_PAGE];
+
+    if (!loaded) {
+        return ALLOWLIST_UNKNOWN;
+    }
+    uint64_t hash = hash_uid(uid, uid_size);
+    if (list_count == 0 || !bloom_test(hash) || hash < fences[0]) {
+        return ALLOWLIST_DENIED;
+    }
+
+    // Last page whose first hash is not greater than the hash
+    uint32_t pages = (list_count + ALLOWLIST_PAGE - 1) / ALLOWLIST_PAGE;
+    uint32_t low = 0, high = pages - 1;
+    while (low < high) {
+        uint32_t mid = (low + high + 1) / 2;
+        if (fences[mid] <= hash) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    uint32_t first = low * ALLOWLIST_PAGE;
+    uint32_t n = list_count - first < ALLOWLIST_PAGE ? list_count - first : ALLOWLIST_PAGE;
+    if (!list_file.seek(sizeof(AllowListHeader) + first * 8, SeekSet) ||
+            list_file.read((uint8_t*)page, n * 8) != n * 8) {
+        return ALLOWLIST_UNKNOWN;
+    }
+
+    int32_t lo = 0, hi = n - 1;
+    while (lo <= hi) {
+        int32_t mid = (lo + hi) / 2;
+        if (page[mid] == hash) {
+            return ALLOWLIST_ALLOWED;
+        } else if (page[mid] < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return ALLOWLIST_DENIED;
+}
@@ -0,0 +1,54 @@
+/************************************************ LOCAL ALLOW-LIST ***********************************************/
+/*                                                                                                               */
+/* Snapshot of the cards allowed by the backend, used to give an immediate local signal on every tap while the   */
+/* access message goes to the backend, which still takes the final decision.                                    */
+/*                                                                                                               */
+/* The backend pushes the snapshot on rfid/<nodeMCUClient>/allowlist as a sequence of binary messages, all the   */
+/* integers little-endian:                                                                                       */
+/*                                                                                                               */
+/*     - 'B' version(4) count(4): Start of a snapshot with count entries                                         */
+/*                                                                                                               */
+/*     - 'D' offset(4) hash(8) ...: Next entries of the snapshot, offset is the index of the first one           */
+/*                                                                                                               */
+/*     - 'E' hmac(32): HMAC-SHA256 with the device key of version, count and every hash, in this order           */
+/*                                                                                                               */
+/* Each entry is the 64-bit FNV-1a hash of the raw UID bytes and the entries must be sorted in ascending order.  */
+/* A snapshot is only accepted with a version greater than the one installed, so an older signed snapshot cannot */
+/* bring back revoked cards. A verified snapshot is stored in /allowlist.bin. In RAM the device only keeps the   */
+/* first hash of every page of ALLOWLIST_PAGE entries and a Bloom filter, so a lookup rejects most unknown cards */
+/* without touching the flash and otherwise reads a single page.                                                 */
+/*                                                                                                               */
+/* The Bloom filter takes ALLOWLIST_BLOOM_BITS_PER_ENTRY bits per entry of the snapshot, rounded up to a power   */
+/* of two and at most ALLOWLIST_BLOOM_BITS, and its number of hash functions follows: 7 up to about 1600         */
+/* entries, where about 1% of the unknown cards still read a page, falling to 2 at 5000 entries (about 20%) and  */
+/* 1 from about 7500. The lookups of the large snapshots stay exact, more unknown cards only cost a read.        */
+/*                                                                                                               */
+/*****************************************************************************************************************/
+
+#ifndef ALLOWLIST_H
+#define ALLOWLIST_H
+
+#include <Arduino.h>
+
+#define ALLOWLIST_MAX_ENTRIES 32768 // Largest snapshot accepted, 8 bytes of RAM every ALLOWLIST_PAGE entries
+#define ALLOWLIST_PAGE 128          // Entries read from flash on a lookup, 1 KB of stack
+#define ALLOWLIST_BLOOM_BITS 16384  // Largest Bloom filter, a power of two, 2 KB of RAM
+#define ALLOWLIST_BLOOM_BITS_PER_ENTRY 10 // Bloom filter bits per entry of a snapshot, below the largest filter
+#define ALLOWLIST_BLOOM_HASHES 7    // Most hash functions of the Bloom filter, used for the small snapshots
+
+enum AllowListResult {
+    ALLOWLIST_UNKNOWN,  // No snapshot available
+    ALLOWLIST_DENIED,
+    ALLOWLIST_ALLOWED
+};
+
+/*  Load the stored snapshot, SPIFFS must be mounted. The key is used to verify the next snapshots  */
+void allowlist_begin(const byte* key, unsigned int key_length);
+
+/*  Handle one message of the allowlist topic  */
+void allowlist_receive(const byte* payload, unsigned int length);
+
+/*  Look up a card in the snapshot  */
+AllowListResult allowlist_lookup(const byte* uid, byte uid_size);
+
+#endif
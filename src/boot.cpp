@@ -0,0 +1,51 @@
+#include "boot.h"
+
+struct BootPhase {
+    const char* name;
+    unsigned long end;  // micros() at the end of the phase
+};
+
+static BootPhase phases[BOOT_PHASES];
+static uint8_t count = 0;
+static bool reported = false;
+
+void boot_phase(const char* name) {
+    if (reported || count == BOOT_PHASES) {
+        return;
+    }
+    phases[count].name = name;
+    phases[count].end = micros();
+    count++;
+}
+
+void boot_print() {
+    unsigned long start = 0;
+
+    Serial.println("Boot phases (us):");
+    for (uint8_t i = 0; i < count; i++) {
+        Serial.print("    ");
+        Serial.print(phases[i].name);
+        Serial.print(": ");
+        Serial.println(phases[i].end - start);
+        start = phases[i].end;
+    }
+}
+
+int boot_report(char* out, size_t size) {
+    unsigned long start = 0;
+    int length = snprintf(out, size, "boot1");
+
+    for (uint8_t i = 0; i < count && length < (int)size; i++) {
+        length += snprintf(out + length, size - length, ";%s:%lu", phases[i].name, phases[i].end - start);
+        start = phases[i].end;
+    }
+    if (length < (int)size) {
+        length += snprintf(out + length, size - length, ";total:%lu", start);
+    }
+    reported = true;
+    return length < (int)size ? length : (int)size - 1;
+}
+
+bool boot_reported() {
+    return reported;
+}
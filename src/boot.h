@@ -0,0 +1,30 @@
+/************************************************* BOOT PROFILER *************************************************/
+/*                                                                                                               */
+/* Duration of every phase of the boot, from the reset to the first card that can be sent to the backend.        */
+/* Each call to boot_phase() ends the phase of that name, which started where the previous one ended, or at the  */
+/* reset for the first one. The phases are printed on Serial and reported once on the metrics topic:             */
+/*                                                                                                               */
+/*     boot1;<phase>:<us>;<phase>:<us>;...;total:<us>                                                            */
+/*                                                                                                               */
+/*****************************************************************************************************************/
+
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <Arduino.h>
+
+#define BOOT_PHASES 12
+
+/*  End the current phase, ignored once the boot has been reported  */
+void boot_phase(const char* name);
+
+/*  Print the phases so far on Serial  */
+void boot_print();
+
+/*  Write the report of the phases into out, returns its length. No phase is recorded after this  */
+int boot_report(char* out, size_t size);
+
+/*  True once boot_report() has been called  */
+bool boot_reported();
+
+#endif
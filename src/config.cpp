@@ -0,0 +1,136 @@
+#include <FS.h>
+#include <ArduinoJson.h>
+#include "config.h"
+#include "crc.h"
+
+#define CONFIG_FILE "/config.bin"
+#define CONFIG_JSON_FILE "/config.json"
+#define CONFIG_MAGIC 0x43464731 // "CFG1"
+#define WIFI_FILE "/wifi.bin"
+#define WIFI_MAGIC 0x57494631   // "WIF1"
+
+struct ConfigRecord {
+    uint32_t magic;
+    uint8_t version;
+    DeviceConfig config;
+    uint8_t reserved;           // Keeps the CRC aligned
+    uint16_t crc;               // CRC-16 of the fields above
+};
+
+struct WiFiRecord {
+    uint32_t magic;
+    WiFiManagerCache cache;
+    uint16_t reserved;
+    uint16_t crc;               // CRC-16 of the fields above
+};
+
+void config_copy_field(char* out, size_t size, const char* value) {
+    strncpy(out, value != NULL ? value : "", size - 1);
+    out[size - 1] = 0;
+}
+
+bool config_load(DeviceConfig* config) {
+    ConfigRecord record;
+
+    File file = SPIFFS.open(CONFIG_FILE, "r");
+    if (!file) {
+        return false;
+    }
+    size_t length = file.read((uint8_t*)&record, sizeof record);
+    file.close();
+    if (length != sizeof record || record.magic != CONFIG_MAGIC || record.version != CONFIG_VERSION ||
+            record.crc != crc16((const uint8_t*)&record, offsetof(ConfigRecord, crc))) {
+        return false;
+    }
+    *config = record.config;
+    return true;
+}
+
+bool config_import(DeviceConfig* config) {
+    File file = SPIFFS.open(CONFIG_JSON_FILE, "r");
+    if (!file) {
+        return false;
+    }
+    size_t size = file.size();
+    std::unique_ptr<char[]> text(new char[size + 1]);
+    text[file.readBytes(text.get(), size)] = 0;
+    file.close();
+
+    DynamicJsonBuffer jsonBuffer;
+    JsonObject& json = jsonBuffer.parseObject(text.get());
+    if (!json.success()) {
+        return false;
+    }
+    config_copy_field(config->mqtt_server, sizeof config->mqtt_server, json["mqtt_server"]);
+    config_copy_field(config->key, sizeof config->key, json["key"]);
+    config_copy_field(config->nodeMCUClient, sizeof config->nodeMCUClient, json["nodeMCUClient"]);
+    config_copy_field(config->userMQTT, sizeof config->userMQTT, json["userMQTT"]);
+    config_copy_field(config->passwordMQTT, sizeof config->passwordMQTT, json["passwordMQTT"]);
+    return true;
+}
+
+bool config_save(const DeviceConfig* config) {
+    ConfigRecord record;
+
+    memset(&record, 0, sizeof record);
+    record.magic = CONFIG_MAGIC;
+    record.version = CONFIG_VERSION;
+    record.config = *config;
+    record.crc = crc16((const uint8_t*)&record, offsetof(ConfigRecord, crc));
+
+    File file = SPIFFS.open(CONFIG_FILE, "w");
+    if (!file) {
+        return false;
+    }
+    bool written = file.write((const uint8_t*)&record, sizeof record) == sizeof record;
+    file.close();
+
+    // Export for the tools that read or edit the JSON
+    DynamicJsonBuffer jsonBuffer;
+    JsonObject& json = jsonBuffer.createObject();
+    json["mqtt_server"] = config->mqtt_server;
+    json["key"] = config->key;
+    json["nodeMCUClient"] = config->nodeMCUClient;
+    json["userMQTT"] = config->userMQTT;
+    json["passwordMQTT"] = config->passwordMQTT;
+    File jsonFile = SPIFFS.open(CONFIG_JSON_FILE, "w");
+    if (jsonFile) {
+        json.printTo(jsonFile);
+        jsonFile.close();
+    }
+    return written;
+}
+
+bool config_load_wifi(WiFiManagerCache* cache) {
+    WiFiRecord record;
+
+    File file = SPIFFS.open(WIFI_FILE, "r");
+    if (!file) {
+        return false;
+    }
+    size_t length = file.read((uint8_t*)&record, sizeof record);
+    file.close();
+    if (length != sizeof record || record.magic != WIFI_MAGIC ||
+            record.crc != crc16((const uint8_t*)&record, offsetof(WiFiRecord, crc))) {
+        return false;
+    }
+    *cache = record.cache;
+    return true;
+}
+
+bool config_save_wifi(const WiFiManagerCache* cache) {
+    WiFiRecord record;
+
+    memset(&record, 0, sizeof record);
+    record.magic = WIFI_MAGIC;
+    record.cache = *cache;
+    record.crc = crc16((const uint8_t*)&record, offsetof(WiFiRecord, crc));
+
+    File file = SPIFFS.open(WIFI_FILE, "w");
+    if (!file) {
+        return false;
+    }
+    bool written = file.write((const uint8_t*)&record, sizeof record) == sizeof record;
+    file.close();
+    return written;
+}
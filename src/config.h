@@ -0,0 +1,50 @@
+/************************************************* DEVICE CONFIG *************************************************/
+/*                                                                                                               */
+/* Settings entered in the WiFiManager portal. They are stored in /config.bin as a fixed-size record with a      */
+/* magic number, a version and a CRC, read straight into DeviceConfig at boot without any parsing:              */
+/*                                                                                                               */
+/*     magic(4) version(1) mqtt_server(15) key(20) nodeMCUClient(15) userMQTT(15) passwordMQTT(15) 0(1) crc(2)   */
+/*                                                                                                               */
+/* /config.json is only an import / export format: it is read when /config.bin is missing or damaged, and        */
+/* written together with /config.bin whenever the settings change.                                               */
+/*                                                                                                               */
+/* /wifi.bin keeps the WiFiManager fast reconnect cache (BSSID, channel and lease of the last connection) the    */
+/* same way, for the boots after a power cut when the copy in the RTC memory is lost.                            */
+/*                                                                                                               */
+/*****************************************************************************************************************/
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <Arduino.h>
+#include <WiFiManager.h>
+
+#define CONFIG_VERSION 1
+
+struct DeviceConfig {
+    char mqtt_server[15];   // Domain of the MQTT server
+    char key[20];           // Password for AES encryption and HMAC authentication
+    char nodeMCUClient[15]; // Device ID for the MQTT communication
+    char userMQTT[15];      // Username for this device at the MQTT communication
+    char passwordMQTT[15];  // Password for this device at the MQTT communication
+};
+
+/*  Copy a value into a config field, truncated and always terminated. NULL gives an empty field  */
+void config_copy_field(char* out, size_t size, const char* value);
+
+/*  Read /config.bin, returns false if it is missing or damaged. SPIFFS must be mounted  */
+bool config_load(DeviceConfig* config);
+
+/*  Read /config.json, returns false if it is missing or cannot be parsed  */
+bool config_import(DeviceConfig* config);
+
+/*  Write /config.bin and export /config.json  */
+bool config_save(const DeviceConfig* config);
+
+/*  Read /wifi.bin, returns false if it is missing or damaged  */
+bool config_load_wifi(WiFiManagerCache* cache);
+
+/*  Write /wifi.bin  */
+bool config_save_wifi(const WiFiManagerCache* cache);
+
+#endif
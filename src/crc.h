@@ -0,0 +1,15 @@
+/**************************************************** CRC-16 *****************************************************/
+/*                                                                                                               */
+/* CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF) guarding the records kept in SPIFFS and in the    */
+/* RTC memory.                                                                                                   */
+/*                                                                                                               */
+/*****************************************************************************************************************/
+
+#ifndef CRC_H
+#define CRC_H
+
+#include <Arduino.h>
+
+uint16_t crc16(const uint8_t* data, size_t length);
+
+#endif
@@ -0,0 +1,195 @@
+#include "feedback.h"
+#include "pitches.h"
+
+#define STEPS(pattern) pattern, sizeof(pattern) / sizeof(FeedbackStep)
+
+struct FeedbackPattern {
+    int code;
+    const FeedbackStep* steps;
+    uint8_t count;
+};
+
+/*  100: Setup melody, every note is followed by a pause of 30% of its length  */
+
+static const FeedbackStep pattern_melody[] = {
+    {FEEDBACK_GREEN, NOTE_C4, 250}, {FEEDBACK_GREEN, 0, 75},
+    {FEEDBACK_GREEN, NOTE_G3, 125}, {FEEDBACK_GREEN, 0, 37},
+    {FEEDBACK_GREEN, NOTE_G3, 125}, {FEEDBACK_GREEN, 0, 37},
+    {FEEDBACK_GREEN, NOTE_A3, 250}, {FEEDBACK_GREEN, 0, 75},
+    {FEEDBACK_GREEN, NOTE_G3, 250}, {FEEDBACK_GREEN, 0, 75},
+    {FEEDBACK_GREEN, 0, 250}, {FEEDBACK_GREEN, 0, 75},
+    {FEEDBACK_GREEN, NOTE_B3, 250}, {FEEDBACK_GREEN, 0, 75},
+    {FEEDBACK_GREEN, NOTE_C4, 250}, {FEEDBACK_GREEN, 0, 75}
+};
+
+/*  101: Setup Success  */
+
+static const FeedbackStep pattern_setup[] = {
+    {FEEDBACK_GREEN, 1930, 150}, {FEEDBACK_GREEN, 1630, 150}, {FEEDBACK_GREEN, 1930, 100},
+    {FEEDBACK_GREEN, 0, 1000}, {0, 0, 250}
+};
+
+/*  103: Tap stored offline, it will be sent when the broker is back  */
+
+static const FeedbackStep pattern_stored[] = {
+    {FEEDBACK_GREEN | FEEDBACK_RED, 1630, 100}, {0, 0, 250}
+};
+
+/*  201: Success (Check-in)  */
+
+static const FeedbackStep pattern_check_in[] = {
+    {FEEDBACK_GREEN, 1630, 150}, {FEEDBACK_GREEN, 1930, 100}, {FEEDBACK_GREEN, 0, 1000}, {0, 0, 250}
+};
+
+/*  202: Success (Check-out)  */
+
+static const FeedbackStep pattern_check_out[] = {
+    {FEEDBACK_GREEN, 1930, 150}, {FEEDBACK_GREEN, 1630, 100}, {FEEDBACK_GREEN, 0, 1000}, {0, 0, 250}
+};
+
+/*  210: Allowed by the local allow-list, waiting for the backend  */
+
+static const FeedbackStep pattern_local_allowed[] = {
+    {FEEDBACK_GREEN, 1930, 60}, {FEEDBACK_GREEN, 0, 100}
+};
+
+/*  401: Unauthorized  */
+
+static const FeedbackStep pattern_unauthorized[] = {
+    {FEEDBACK_RED, 0, 500}, {0, 0, 500}, {FEEDBACK_RED, 0, 150}, {0, 0, 150}
+};
+
+/*  404: Response not found  */
+
+static const FeedbackStep pattern_not_found[] = {
+    {FEEDBACK_RED, 2030, 150}, {FEEDBACK_RED, 2030, 100}, {FEEDBACK_RED, 0, 1000}, {0, 0, 250}
+};
+
+/*  410: Denied by the local allow-list, waiting for the backend  */
+
+static const FeedbackStep pattern_local_denied[] = {
+    {FEEDBACK_RED, 0, 160}
+};
+
+/*  503: MQTT broker unreachable  */
+
+static const FeedbackStep pattern_unreachable[] = {
+    {FEEDBACK_RED, 0, 500}, {0, 0, 500}
+};
+
+/*  504: Timed out waiting ACK  */
+
+static const FeedbackStep pattern_timeout[] = {
+    {FEEDBACK_RED, 0, 250}, {0, 0, 250}, {FEEDBACK_RED, 0, 250}, {0, 0, 250}
+};
+
+static const FeedbackPattern patterns[] = {
+    {100, STEPS(pattern_melody)},
+    {101, STEPS(pattern_setup)},
+    {103, STEPS(pattern_stored)},
+    {201, STEPS(pattern_check_in)},
+    {202, STEPS(pattern_check_out)},
+    {210, STEPS(pattern_local_allowed)},
+    {401, STEPS(pattern_unauthorized)},
+    {404, STEPS(pattern_not_found)},
+    {410, STEPS(pattern_local_denied)},
+    {503, STEPS(pattern_unreachable)},
+    {504, STEPS(pattern_timeout)}
+};
+
+struct FeedbackChannel {
+    uint8_t red_led;
+    uint8_t green_led;
+    uint8_t beep;
+    const FeedbackPattern* current; // Pattern being played, NULL when idle
+    uint8_t step;                   // Index of the step being played
+    unsigned long step_start;       // millis() when the step started
+};
+
+static FeedbackChannel channels[FEEDBACK_CHANNELS];
+static uint8_t channel_count = 0;
+
+/*  Apply the LEDs and tone of a step, or switch everything off when step is NULL  */
+
+static void apply_step(const FeedbackChannel* channel, const FeedbackStep* s) {
+    uint8_t leds = s ? s->leds : 0;
+
+    digitalWrite(channel->green_led, (leds & FEEDBACK_GREEN) ? HIGH : LOW);
+    digitalWrite(channel->red_led, (leds & FEEDBACK_RED) ? HIGH : LOW);
+    if (s && s->tone) {
+        tone(channel->beep, s->tone);
+    } else {
+        noTone(channel->beep);
+    }
+}
+
+static const FeedbackPattern* find_pattern(int response_code) {
+    for (unsigned int i = 0; i < sizeof(patterns) / sizeof(FeedbackPattern); i++) {
+        if (patterns[i].code == response_code) {
+            return &patterns[i];
+        }
+    }
+    return NULL;
+}
+
+static void start_pattern(FeedbackChannel* channel, const FeedbackPattern* pattern) {
+    channel->current = pattern;
+    channel->step = 0;
+    channel->step_start = millis();
+    apply_step(channel, &pattern->steps[0]);
+}
+
+void feedback_begin(uint8_t red_pin, uint8_t green_pin, uint8_t beep_pin) {
+    if (channel_count == FEEDBACK_CHANNELS) {
+        return;
+    }
+    FeedbackChannel* channel = &channels[channel_count++];
+    channel->red_led = red_pin;
+    channel->green_led = green_pin;
+    channel->beep = beep_pin;
+    channel->current = NULL;
+}
+
+void feedback_play(int response_code) {
+    const FeedbackPattern* pattern = find_pattern(response_code);
+
+    for (uint8_t i = 0; pattern != NULL && i < channel_count; i++) {
+        start_pattern(&channels[i], pattern);
+    }
+}
+
+void feedback_play_on(uint8_t channel, int response_code) {
+    const FeedbackPattern* pattern = find_pattern(response_code);
+
+    if (pattern != NULL && channel < channel_count) {
+        start_pattern(&channels[channel], pattern);
+    }
+}
+
+void feedback_update() {
+    unsigned long now = millis();
+
+    for (uint8_t i = 0; i < channel_count; i++) {
+        FeedbackChannel* channel = &channels[i];
+
+        // Catch up on every step that has already ended, in case the loop was slow
+        while (channel->current && now - channel->step_start >= channel->current->steps[channel->step].duration) {
+            channel->step_start += channel->current->steps[channel->step].duration;
+            if (++channel->step == channel->current->count) {
+                channel->current = NULL;
+                apply_step(channel, NULL);
+            } else {
+                apply_step(channel, &channel->current->steps[channel->step]);
+            }
+        }
+    }
+}
+
+bool feedback_busy() {
+    for (uint8_t i = 0; i < channel_count; i++) {
+        if (channels[i].current != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,44 @@
+/********************************************* FEEDBACK PATTERN PLAYER *******************************************/
+/*                                                                                                               */
+/* Non-blocking player for the LED and buzzer patterns that signal the response codes. A pattern is a list of    */
+/* steps, each one sets the LEDs and the buzzer tone and holds them for a number of milliseconds. The player is  */
+/* advanced from loop() with feedback_update(), so MQTT and the card reader keep running while a pattern plays.  */
+/*                                                                                                               */
+/* Every channel has its own LEDs, buzzer and player, so the lanes of a multi-reader node signal their taps      */
+/* independently. Device-wide events (broker unreachable, setup) play on every channel.                          */
+/*                                                                                                               */
+/*****************************************************************************************************************/
+
+#ifndef FEEDBACK_H
+#define FEEDBACK_H
+
+#include <Arduino.h>
+
+#define FEEDBACK_GREEN 0x01 // Green LED on during the step
+#define FEEDBACK_RED 0x02   // Red LED on during the step
+
+#define FEEDBACK_CHANNELS 4 // Sets of LEDs and buzzer at most
+
+struct FeedbackStep {
+    uint8_t leds;      // FEEDBACK_GREEN / FEEDBACK_RED mask
+    uint16_t tone;     // Buzzer frequency in Hz, 0 for silence
+    uint16_t duration; // Step length in milliseconds
+};
+
+/*  Set the pins of a channel, channels are numbered from 0 in the order they are added  */
+void feedback_begin(uint8_t red_pin, uint8_t green_pin, uint8_t beep_pin);
+
+/*  Start the pattern of a response code on every channel, replacing the ones being played. Unknown codes are      */
+/*  ignored                                                                                                         */
+void feedback_play(int response_code);
+
+/*  Same on a single channel  */
+void feedback_play_on(uint8_t channel, int response_code);
+
+/*  Advance the current patterns, to be called on every loop  */
+void feedback_update();
+
+/*  True while a pattern is being played on any channel  */
+bool feedback_busy();
+
+#endif
@@ -0,0 +1,49 @@
+#include "heapcheck.h"
+
+#ifdef HEAP_CHECK
+
+volatile uint32_t heap_allocations = 0;
+volatile uint8_t heap_uncounted = 0;
+
+extern "C" {
+    void* __real_malloc(size_t size);
+    void* __real_realloc(void* ptr, size_t size);
+    void* __real_calloc(size_t count, size_t size);
+
+    void* __wrap_malloc(size_t size) {
+        if (heap_uncounted == 0) {
+            heap_allocations++;
+        }
+        return __real_malloc(size);
+    }
+
+    void* __wrap_realloc(void* ptr, size_t size) {
+        if (heap_uncounted == 0) {
+            heap_allocations++;
+        }
+        return __real_realloc(ptr, size);
+    }
+
+    void* __wrap_calloc(size_t count, size_t size) {
+        if (heap_uncounted == 0) {
+            heap_allocations++;
+        }
+        return __real_calloc(count, size);
+    }
+}
+
+void heap_check(const char* path, uint32_t before) {
+    uint32_t allocations = heap_allocations - before;
+
+    if (allocations != 0) {
+        Serial.print("HEAP CHECK: ");
+        Serial.print(path);
+        Serial.print(" path made ");
+        Serial.print(allocations);
+        Serial.println(" allocations");
+        Serial.flush();
+        panic();
+    }
+}
+
+#endif
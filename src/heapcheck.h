@@ -0,0 +1,50 @@
+/************************************************** HEAP CHECK ***************************************************/
+/*                                                                                                               */
+/* Counts the calls to malloc, realloc and calloc so the card and message paths can be checked to run without    */
+/* heap allocations: the first path that allocates halts the firmware with a panic. Enabled by the               */
+/* nodemcuv2_heapcheck and native_heapcheck environments, which define HEAP_CHECK and link with --wrap for the    */
+/* three functions. Without HEAP_CHECK the macros compile to nothing.                                             */
+/*                                                                                                               */
+/* lwIP allocates a pbuf for every send, the network writes made through NetworkClient are not counted.          */
+/*                                                                                                               */
+/*****************************************************************************************************************/
+
+#ifndef HEAPCHECK_H
+#define HEAPCHECK_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#ifdef HEAP_CHECK
+
+extern volatile uint32_t heap_allocations;
+extern volatile uint8_t heap_uncounted;    // Allocations are not counted while above zero
+
+/*  Report the allocations made since before and panic, if any  */
+void heap_check(const char* path, uint32_t before);
+
+#define HOT_PATH_BEGIN() uint32_t hot_path_allocations = heap_allocations
+#define HOT_PATH_END(path) heap_check(path, hot_path_allocations)
+
+class NetworkClient : public WiFiClient {
+public:
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buf, size_t size) override {
+        heap_uncounted++;
+        size_t written = WiFiClient::write(buf, size);
+        heap_uncounted--;
+        return written;
+    }
+    using WiFiClient::write;
+};
+
+#else
+
+#define HOT_PATH_BEGIN()
+#define HOT_PATH_END(path)
+
+typedef WiFiClient NetworkClient;
+
+#endif
+
+#endif
@@ -0,0 +1,111 @@
+#include <ESP8266WiFi.h>
+#include "idle.h"
+
+#define COM_IEN_RX 0xA0        // IRqInv: the pin is active low, RxIEn: raised when the ATQA is received
+#define COM_IEN_NONE 0x80      // Nothing routed to the pin
+#define DIV_IEN_PUSH_PULL 0x80 // IRQPushPull: the pin is driven both ways
+#define DIV_IEN_OPEN_DRAIN 0x00 // Only driven low, for a pin shared by several readers
+#define COM_IRQ_CLEAR 0x7F
+#define ERROR_FRAMING 0x13     // ProtocolErr, ParityErr, BufferOvfl
+
+static MFRC522* readers = NULL;
+static uint8_t count = 0;
+static bool idle = false;
+static unsigned long burst_start = 0;     // millis() of the last burst
+static WiFiSleepType_t active_sleep_mode; // Wi-Fi sleep mode outside of the idle mode
+static volatile bool irq = false;
+
+ICACHE_RAM_ATTR static void reader_irq() {
+    irq = true;
+}
+
+void idle_begin(MFRC522* pcds, uint8_t count_, uint8_t irq_pin) {
+    readers = pcds;
+    count = count_;
+    for (uint8_t i = 0; i < count; i++) {
+        readers[i].PCD_WriteRegister(MFRC522::DivIEnReg, count > 1 ? DIV_IEN_OPEN_DRAIN : DIV_IEN_PUSH_PULL);
+        readers[i].PCD_WriteRegister(MFRC522::ComIEnReg, COM_IEN_NONE);
+    }
+    pinMode(irq_pin, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(irq_pin), reader_irq, FALLING);
+}
+
+/*  Stop the transceive started by the burst and clear its interrupt  */
+
+static void end_burst(MFRC522* reader) {
+    reader->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+    reader->PCD_WriteRegister(MFRC522::ComIEnReg, COM_IEN_NONE);
+    reader->PCD_WriteRegister(MFRC522::ComIrqReg, COM_IRQ_CLEAR);
+    irq = false;
+}
+
+/*  REQA on one reader with its field on for the burst only, true if a card answered  */
+
+static bool burst(MFRC522* reader) {
+    reader->PCD_AntennaOn();
+    delay(IDLE_SETTLE_MS);
+
+    // REQA as in the MinimalInterrupt example: only the reception is routed to the IRQ pin
+    reader->PCD_WriteRegister(MFRC522::ComIrqReg, COM_IRQ_CLEAR);
+    irq = false;
+    reader->PCD_WriteRegister(MFRC522::ComIEnReg, COM_IEN_RX);
+    reader->PCD_WriteRegister(MFRC522::FIFOLevelReg, 0x80);
+    reader->PCD_WriteRegister(MFRC522::FIFODataReg, MFRC522::PICC_CMD_REQA);
+    reader->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Transceive);
+    reader->PCD_WriteRegister(MFRC522::BitFramingReg, 0x87); // StartSend, 7 bits
+
+    for (uint8_t i = 0; i < IDLE_LISTEN_MS && !irq; i++) {
+        delay(1);
+    }
+
+    bool answered = irq && (reader->PCD_ReadRegister(MFRC522::ErrorReg) & ERROR_FRAMING) == 0;
+    end_burst(reader);
+    if (!answered) {
+        reader->PCD_AntennaOff();
+    }
+    return answered;
+}
+
+int idle_detect() {
+    if (!idle) {
+        active_sleep_mode = WiFi.getSleepMode();
+        WiFi.setSleepMode(WIFI_LIGHT_SLEEP);
+        // Every field off, each burst switches on its own
+        for (uint8_t i = 0; i < count; i++) {
+            readers[i].PCD_AntennaOff();
+        }
+        idle = true;
+    }
+    burst_start = millis();
+
+    for (uint8_t i = 0; i < count; i++) {
+        if (burst(&readers[i])) {
+            idle_wake();
+            return i;
+        }
+    }
+    return -1;
+}
+
+void idle_sleep() {
+    unsigned long elapsed = millis() - burst_start;
+
+    if (elapsed < IDLE_PERIOD_MS) {
+        delay(IDLE_PERIOD_MS - elapsed);
+    }
+}
+
+void idle_wake() {
+    if (!idle) {
+        return;
+    }
+    idle = false;
+    for (uint8_t i = 0; i < count; i++) {
+        readers[i].PCD_AntennaOn();
+    }
+    WiFi.setSleepMode(active_sleep_mode);
+}
+
+bool idle_active() {
+    return idle;
+}
@@ -0,0 +1,42 @@
+/********************************************** IDLE CARD DETECTION **********************************************/
+/*                                                                                                               */
+/* Low power alternative to calling PICC_IsNewCardPresent() on every loop while nobody is at the reader. Every    */
+/* IDLE_PERIOD_MS the RF field is switched on for a single REQA, and the answer is awaited on the IRQ pin of the  */
+/* MFRC522 (RxIRq routed through ComIEnReg, push-pull output set in DivIEnReg) instead of polling ComIrqReg over  */
+/* SPI. Between two bursts the field is off and the ESP8266 waits in delay() with Wi-Fi in light sleep, which     */
+/* keeps the association and the MQTT connection. A card that answers is left in the READY state, so the next    */
+/* step is PICC_ReadCardSerial() and not another REQA.                                                           */
+/*                                                                                                               */
+/* With several readers (lanes.h) the bursts run one reader after the other, only one field is on at a time.     */
+/* Their IRQ outputs share the pin as open drain outputs, wired-OR on the pull-up, and only the reader of the     */
+/* burst has the reception routed to it.                                                                         */
+/*                                                                                                               */
+/*****************************************************************************************************************/
+
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <Arduino.h>
+#include "MFRC522.h"
+
+#define IDLE_PERIOD_MS 100     // Time between two REQA bursts, the longest a card waits to be noticed
+#define IDLE_SETTLE_MS 5       // Field on before the REQA, ISO 14443-3 gives the card 5 ms to power up
+#define IDLE_LISTEN_MS 2       // Time to wait for the ATQA, it comes about 100 us after the REQA
+
+/*  Set the readers, count of them, and the pin their IRQ outputs are wired to  */
+void idle_begin(MFRC522* readers, uint8_t count, uint8_t irq_pin);
+
+/*  Run one REQA burst on every reader, entering the idle mode if needed. Returns the first reader a card answered,  */
+/*  the device is then back in the active mode, or -1                                                               */
+int idle_detect();
+
+/*  Wait until the next burst is due, in light sleep  */
+void idle_sleep();
+
+/*  Leave the idle mode: field on and the Wi-Fi sleep mode the device had before. Does nothing if not idle  */
+void idle_wake();
+
+/*  True between the first burst and idle_wake()  */
+bool idle_active();
+
+#endif
@@ -0,0 +1,148 @@
+#include <FS.h>
+#include "journal.h"
+#include "crc.h"
+
+#define JOURNAL_FILE "/journal.bin"
+#define JOURNAL_ACK_FILE "/journal.ack"
+
+struct JournalAck {
+    uint32_t seq;
+    uint16_t crc;
+};
+
+static File journal_file;      // Kept open, opening a file allocates from the heap
+static File ack_file;
+static uint32_t next_seq = 1;  // Sequence number of the next tap
+static uint32_t acked_seq = 0; // Last sequence number delivered to the backend
+static bool ready = false;
+
+static uint16_t record_crc(const JournalRecord* record) {
+    return crc16((const uint8_t*)record, offsetof(JournalRecord, crc));
+}
+
+/*  Read the record stored in a slot, returns false if the slot is empty or torn  */
+
+static bool read_slot(File& file, uint32_t slot, JournalRecord* record) {
+    if (!file.seek(slot * sizeof(JournalRecord), SeekSet)) {
+        return false;
+    }
+    if (file.read((uint8_t*)record, sizeof(JournalRecord)) != sizeof(JournalRecord)) {
+        return false;
+    }
+    return record->seq != 0 && record->uid_size <= JOURNAL_UID_SIZE && record->crc == record_crc(record);
+}
+
+bool journal_begin() {
+    JournalRecord record;
+
+    if (!SPIFFS.exists(JOURNAL_FILE)) {
+        // Preallocate every slot so records are always written in place
+        File file = SPIFFS.open(JOURNAL_FILE, "w");
+        if (!file) {
+            Serial.println("Failed to create journal");
+            return false;
+        }
+        memset(&record, 0, sizeof record);
+        for (uint32_t i = 0; i < JOURNAL_CAPACITY; i++) {
+            file.write((const uint8_t*)&record, sizeof record);
+        }
+        file.close();
+    }
+
+    ack_file = SPIFFS.open(JOURNAL_ACK_FILE, SPIFFS.exists(JOURNAL_ACK_FILE) ? "r+" : "w+");
+    if (!ack_file) {
+        return false;
+    }
+    JournalAck value;
+    if (ack_file.read((uint8_t*)&value, sizeof value) == sizeof value &&
+            value.crc == crc16((const uint8_t*)&value.seq, sizeof value.seq)) {
+        acked_seq = value.seq;
+    }
+
+    // The next sequence number follows the newest record, even if it was already delivered
+    journal_file = SPIFFS.open(JOURNAL_FILE, "r+");
+    if (!journal_file) {
+        return false;
+    }
+    next_seq = acked_seq + 1;
+    for (uint32_t i = 0; i < JOURNAL_CAPACITY; i++) {
+        if (read_slot(journal_file, i, &record) && record.seq >= next_seq) {
+            next_seq = record.seq + 1;
+        }
+    }
+
+    ready = true;
+    Serial.print("Journal ready, pending taps: ");
+    Serial.println(journal_pending());
+    return true;
+}
+
+bool journal_append(const byte* uid, byte uid_size, uint32_t uptime, uint8_t door) {
+    JournalRecord record;
+
+    if (!ready) {
+        return false;
+    }
+    memset(&record, 0, sizeof record);
+    record.seq = next_seq;
+    record.uptime = uptime;
+    record.uid_size = uid_size > JOURNAL_UID_SIZE ? JOURNAL_UID_SIZE : uid_size;
+    memcpy(record.uid, uid, record.uid_size);
+    record.door = door;
+    record.crc = record_crc(&record);
+
+    bool written = journal_file.seek((record.seq % JOURNAL_CAPACITY) * sizeof record, SeekSet) &&
+        journal_file.write((const uint8_t*)&record, sizeof record) == sizeof record;
+    journal_file.flush();
+
+    if (written) {
+        next_seq++;
+    }
+    return written;
+}
+
+uint8_t journal_peek(JournalRecord* records, uint8_t max) {
+    uint8_t count = 0;
+    uint32_t seq = acked_seq + 1;
+
+    if (!ready || seq >= next_seq) {
+        return 0;
+    }
+    // Records older than the ring capacity have been overwritten
+    if (next_seq - seq > JOURNAL_CAPACITY) {
+        seq = next_seq - JOURNAL_CAPACITY;
+    }
+
+    for (; seq < next_seq && count < max; seq++) {
+        if (read_slot(journal_file, seq % JOURNAL_CAPACITY, &records[count]) && records[count].seq == seq) {
+            count++;
+        }
+    }
+    if (count == 0) {
+        // Every pending slot is torn, they are skipped or the replay would read them again on every call
+        Serial.print("Journal records unreadable, skipped up to ");
+        Serial.println(seq - 1);
+        journal_ack(seq - 1);
+    }
+    return count;
+}
+
+void journal_ack(uint32_t seq) {
+    JournalAck value;
+
+    if (seq <= acked_seq || seq >= next_seq) {
+        return;
+    }
+    acked_seq = seq;
+    value.seq = seq;
+    value.crc = crc16((const uint8_t*)&value.seq, sizeof value.seq);
+
+    ack_file.seek(0, SeekSet);
+    ack_file.write((const uint8_t*)&value, sizeof value);
+    ack_file.flush();
+}
+
+uint32_t journal_pending() {
+    uint32_t pending = next_seq - 1 - acked_seq;
+    return pending > JOURNAL_CAPACITY ? JOURNAL_CAPACITY : pending;
+}
@@ -0,0 +1,45 @@
+/*********************************************** OFFLINE TAP JOURNAL *********************************************/
+/*                                                                                                               */
+/* Ring buffer of card taps stored in SPIFFS while the MQTT broker is unreachable. Every record carries a         */
+/* monotonic sequence number, the uptime of the tap and a CRC, and lives in a fixed slot (seq % capacity) of     */
+/* /journal.bin, so a power cut can at most tear the record being written. The last sequence number delivered    */
+/* to the backend is kept in /journal.ack; if that file is lost the pending records are replayed, and the        */
+/* backend can drop the duplicates by sequence number. When more than JOURNAL_CAPACITY taps are pending the      */
+/* oldest ones are overwritten.                                                                                  */
+/*                                                                                                               */
+/*****************************************************************************************************************/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <Arduino.h>
+
+#define JOURNAL_CAPACITY 64 // Number of taps kept while offline
+#define JOURNAL_UID_SIZE 10 // Maximum UID size of a PICC
+
+struct JournalRecord {
+    uint32_t seq;                   // Monotonic sequence number, 0 marks an empty slot
+    uint32_t uptime;                // millis() when the card was read
+    uint8_t uid_size;
+    uint8_t uid[JOURNAL_UID_SIZE];
+    uint8_t door;                   // Door ID of the lane, 0 for none. Was padding, zero in older records
+    uint16_t crc;                   // CRC-16 of the fields above
+};
+
+/*  Open or create the journal, SPIFFS must be mounted  */
+bool journal_begin();
+
+/*  Store a tap, returns false if it could not be written  */
+bool journal_append(const byte* uid, byte uid_size, uint32_t uptime, uint8_t door);
+
+/*  Copy up to max of the oldest pending records, returns how many were copied. Unreadable records are left out, */
+/*  and marked as delivered when none of the pending ones can be read                                            */
+uint8_t journal_peek(JournalRecord* records, uint8_t max);
+
+/*  Mark every record up to seq as delivered  */
+void journal_ack(uint32_t seq);
+
+/*  Number of records waiting to be delivered  */
+uint32_t journal_pending();
+
+#endif
@@ -0,0 +1,148 @@
+#include "lanes.h"
+
+#define COM_IRQ_RX 0x20
+#define COM_IRQ_ERR 0x02
+#define COM_IRQ_TIMER 0x01
+#define COM_IRQ_CLEAR 0x7F
+#define ERROR_FRAMING 0x13     // ProtocolErr, ParityErr, BufferOvfl, a collision still means a card is there
+#define LIBRARY_RELOAD 1000    // Timer reload set by PCD_Init(), 25 ms
+
+static MFRC522* lanes = NULL;
+static uint8_t count = 0;
+static uint8_t ready = 0;        // Lanes that answered in the last round and have not been handed out yet
+static uint8_t next = 0;         // First lane to look at, so no lane is served twice before the others
+static uint8_t long_timer = 0;   // Lanes with the library timeout, to be shortened before the next round
+
+static void set_reload(MFRC522* reader, uint16_t reload) {
+    reader->PCD_WriteRegister(MFRC522::TReloadRegH, reload >> 8);
+    reader->PCD_WriteRegister(MFRC522::TReloadRegL, reload & 0xFF);
+}
+
+/*  Start a REQA without waiting for the answer, as PICC_RequestA() does it  */
+
+static void start_reqa(MFRC522* reader) {
+    reader->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+    reader->PCD_WriteRegister(MFRC522::ComIrqReg, COM_IRQ_CLEAR);
+    reader->PCD_WriteRegister(MFRC522::FIFOLevelReg, 0x80);
+    reader->PCD_WriteRegister(MFRC522::FIFODataReg, MFRC522::PICC_CMD_REQA);
+    reader->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Transceive);
+    reader->PCD_WriteRegister(MFRC522::BitFramingReg, 0x87); // StartSend, 7 bits
+}
+
+/*  Same checks as PICC_IsNewCardPresent(): a two byte ATQA, or a collision between several cards  */
+
+static bool answered(MFRC522* reader) {
+    return (reader->PCD_ReadRegister(MFRC522::ErrorReg) & ERROR_FRAMING) == 0 &&
+           reader->PCD_ReadRegister(MFRC522::FIFOLevelReg) == 2 &&
+           (reader->PCD_ReadRegister(MFRC522::ControlReg) & 0x07) == 0;
+}
+
+/*  Take the next lane of the ready set, round robin  */
+
+static int take_ready() {
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t lane = (next + i) % count;
+        if (ready & (1 << lane)) {
+            ready &= ~(1 << lane);
+            next = (lane + 1) % count;
+            return lane;
+        }
+    }
+    return -1;
+}
+
+void lanes_begin(MFRC522* readers, const LaneConfig* config, uint8_t count_, uint8_t rst_pin) {
+    lanes = readers;
+    count = count_ > LANE_MAX ? LANE_MAX : count_;
+    for (uint8_t i = 0; i < count; i++) {
+        // The first one pulls the shared reset line high, the others get a soft reset
+        lanes[i].PCD_Init(config[i].cs_pin, rst_pin);
+        // ValuesAfterColl, cleared once here instead of before every REQA
+        lanes[i].PCD_ClearRegisterBitMask(MFRC522::CollReg, 0x80);
+        set_reload(&lanes[i], LANE_LISTEN_TICKS);
+    }
+    ready = 0;
+    long_timer = 0;
+}
+
+uint8_t lanes_count() {
+    return count;
+}
+
+int lanes_poll() {
+    if (ready != 0) {
+        return take_ready();
+    }
+
+    for (uint8_t i = 0; i < count; i++) {
+        if (long_timer & (1 << i)) {
+            set_reload(&lanes[i], LANE_LISTEN_TICKS);
+        }
+        start_reqa(&lanes[i]);
+    }
+    long_timer = 0;
+
+    // Collect the answers, each lane is done at its ATQA, an error or the end of its short timer
+    uint8_t waiting = (1 << count) - 1;
+    unsigned long start = micros();
+    while (waiting != 0 && micros() - start < LANE_ROUND_US) {
+        for (uint8_t i = 0; i < count; i++) {
+            if (!(waiting & (1 << i))) {
+                continue;
+            }
+            byte irq = lanes[i].PCD_ReadRegister(MFRC522::ComIrqReg);
+            if (irq & (COM_IRQ_RX | COM_IRQ_ERR | COM_IRQ_TIMER)) {
+                waiting &= ~(1 << i);
+                if ((irq & COM_IRQ_RX) && answered(&lanes[i])) {
+                    ready |= 1 << i;
+                }
+            }
+        }
+    }
+    return take_ready();
+}
+
+bool lanes_read(uint8_t lane) {
+    if (lane >= count) {
+        return false;
+    }
+    if (!(long_timer & (1 << lane))) {
+        set_reload(&lanes[lane], LIBRARY_RELOAD);
+        long_timer |= 1 << lane;
+    }
+    return lanes[lane].PICC_ReadCardSerial();
+}
+
+/*  HLTA has no answer, the short timer ends it instead of the library timeout  */
+
+void lanes_halt(uint8_t lane) {
+    if (lane >= count) {
+        return;
+    }
+    set_reload(&lanes[lane], LANE_LISTEN_TICKS);
+    long_timer &= ~(1 << lane);
+    lanes[lane].PICC_HaltA();
+}
+
+bool lanes_present(uint8_t lane, const MFRC522::Uid* uid) {
+    byte atqa[2];
+    byte size = sizeof atqa;
+
+    if (lane >= count) {
+        return false;
+    }
+    set_reload(&lanes[lane], LANE_LISTEN_TICKS);
+    long_timer &= ~(1 << lane);
+
+    // Other cards woken up with it go back to IDLE at the SELECT, the next round sees them again
+    MFRC522::StatusCode status = lanes[lane].PICC_WakeupA(atqa, &size);
+    if (status != MFRC522::STATUS_OK && status != MFRC522::STATUS_COLLISION) {
+        return false;
+    }
+    MFRC522::Uid known = *uid;
+    bool selected = lanes[lane].PICC_Select(&known, known.size * 8) == MFRC522::STATUS_OK;
+    if (selected) {
+        lanes[lane].PICC_HaltA();
+    }
+    return selected;
+}
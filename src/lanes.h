@@ -0,0 +1,53 @@
+/************************************************** READER LANES *************************************************/
+/*                                                                                                               */
+/* Several MFRC522 on the same SPI bus, one per entry / exit lane, as in the ReadUidMultiReader example: they    */
+/* share SCK, MOSI, MISO and the reset line, each one has its own chip select.                                   */
+/*                                                                                                               */
+/* Polling them one after the other with PICC_IsNewCardPresent() costs the 25 ms timeout of every empty lane, so  */
+/* the time to notice a card would grow with the number of lanes. lanes_poll() runs a round instead: the REQA is  */
+/* started on every lane without waiting, then the answers are collected. The timer that ends an unanswered REQA  */
+/* is shortened to LANE_LISTEN_TICKS for the round, an ATQA comes about 100 us after the REQA, so a round takes   */
+/* about a millisecond whatever the number of lanes. The library timeout is put back before a card is selected.  */
+/*                                                                                                               */
+/* Lanes that answered in the same round are handed out one per call, their cards wait in the READY state.       */
+/*                                                                                                               */
+/* A card that has been read is halted, so the rounds only see new cards. lanes_present() tells whether it is     */
+/* still in the field by waking it up and selecting it by its UID, it is halted again right after.               */
+/*                                                                                                               */
+/*****************************************************************************************************************/
+
+#ifndef LANES_H
+#define LANES_H
+
+#include <Arduino.h>
+#include "MFRC522.h"
+
+#define LANE_MAX 4             // Readers on the bus at most
+#define LANE_LISTEN_TICKS 40   // Timer reload of a REQA in a round, 25 us ticks
+#define LANE_ROUND_US 2000     // Longest a round waits for the answers, in case a reader does not respond at all
+
+struct LaneConfig {
+    uint8_t cs_pin;     // Chip select of the reader
+    uint8_t door;       // Door ID sent with the taps of the lane, 0 for none
+    uint8_t feedback;   // Feedback channel that signals the taps of the lane
+};
+
+/*  Initialise the readers, count of them, each with the chip select of its lane and the shared reset line  */
+void lanes_begin(MFRC522* readers, const LaneConfig* config, uint8_t count, uint8_t rst_pin);
+
+/*  Number of lanes  */
+uint8_t lanes_count();
+
+/*  Return a lane with a card in front of it, running a new round when none is left from the last one, or -1  */
+int lanes_poll();
+
+/*  Select the card of a lane that answered, in lanes_poll() or in idle_detect(), into the uid of its reader  */
+bool lanes_read(uint8_t lane);
+
+/*  Halt the card just read on a lane, it no longer answers the rounds while it stays in the field  */
+void lanes_halt(uint8_t lane);
+
+/*  Wake up the halted card of a lane, select it by its UID and halt it again, true if it answered  */
+bool lanes_present(uint8_t lane, const MFRC522::Uid* uid);
+
+#endif
@@ -0,0 +1,84 @@
+#include "latency.h"
+
+struct LatencyHistogram {
+    uint16_t buckets[LATENCY_BUCKETS]; // Saturate instead of wrapping
+    uint16_t count;
+    uint32_t max;
+};
+
+static const char* const stage_names[LATENCY_STAGES] = {
+    "detect", "select", "encrypt", "publish", "backend", "tap"
+};
+
+static LatencyHistogram histograms[LATENCY_STAGES];
+
+/*  Index of the bucket of a sample, the position of its highest bit  */
+
+static uint8_t bucket_of(unsigned long us) {
+    uint8_t bucket = 0;
+
+    while (us > 1 && bucket < LATENCY_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void latency_record(LatencyStage stage, unsigned long us) {
+    LatencyHistogram* histogram = &histograms[stage];
+    uint8_t bucket = bucket_of(us);
+
+    if (histogram->buckets[bucket] != 0xFFFF) {
+        histogram->buckets[bucket]++;
+    }
+    if (histogram->count != 0xFFFF) {
+        histogram->count++;
+    }
+    if (us > histogram->max) {
+        histogram->max = us;
+    }
+}
+
+uint32_t latency_samples() {
+    uint32_t samples = 0;
+
+    for (int i = 0; i < LATENCY_STAGES; i++) {
+        samples += histograms[i].count;
+    }
+    return samples;
+}
+
+int latency_report(char* out, size_t size) {
+    int length = snprintf(out, size, "lat1");
+
+    for (int i = 0; i < LATENCY_STAGES; i++) {
+        LatencyHistogram* histogram = &histograms[i];
+        int first = 0;
+        int last = LATENCY_BUCKETS - 1;
+
+        if (histogram->count == 0) {
+            continue;
+        }
+        while (histogram->buckets[first] == 0) {
+            first++;
+        }
+        while (histogram->buckets[last] == 0) {
+            last--;
+        }
+
+        int field = snprintf(out + length, size - length, ";%s:%u:%lu:%d:", stage_names[i], histogram->count,
+                             (unsigned long)histogram->max, first);
+        for (int bucket = first; bucket <= last && length + field < (int)size; bucket++) {
+            field += snprintf(out + length + field, size - length - field, bucket == first ? "%u" : ",%u",
+                              histogram->buckets[bucket]);
+        }
+        if (length + field >= (int)size) {
+            // Does not fit, kept for the next report
+            out[length] = 0;
+            continue;
+        }
+        length += field;
+        memset(histogram, 0, sizeof *histogram);
+    }
+    return length;
+}
@@ -0,0 +1,41 @@
+/************************************************ TAP LATENCY METRICS ********************************************/
+/*                                                                                                               */
+/* Log-scale histograms of the time spent in every stage of a tap, measured with micros(). Bucket i counts the   */
+/* samples of 2^i to 2^(i+1) - 1 microseconds (bucket 0 also holds 0), the last bucket everything above. The     */
+/* histograms live in RAM and are emptied every time they are reported, so each report covers the taps since the */
+/* previous one. Report format, one field per stage with samples:                                                */
+/*                                                                                                               */
+/*     lat1;<stage>:<count>:<max us>:<first bucket>:<count>,<count>,...;<stage>:...                              */
+/*                                                                                                               */
+/* where the counts run from the first to the last non-empty bucket. Stages that do not fit in the output stay   */
+/* for the next report.                                                                                          */
+/*                                                                                                               */
+/*****************************************************************************************************************/
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <Arduino.h>
+
+#define LATENCY_BUCKETS 24 // The last one starts at 2^23 us, 8.4 s
+
+enum LatencyStage {
+    LATENCY_DETECT,   // PICC_IsNewCardPresent() finding a card
+    LATENCY_SELECT,   // PICC_ReadCardSerial()
+    LATENCY_ENCRYPT,  // Encryption of the access message
+    LATENCY_PUBLISH,  // client.publish() of the access message
+    LATENCY_BACKEND,  // From the access message sent to its response arriving in callback()
+    LATENCY_TAP,      // From the card detection to the start of the feedback of the response
+    LATENCY_STAGES
+};
+
+/*  Add a sample of a stage, in microseconds  */
+void latency_record(LatencyStage stage, unsigned long us);
+
+/*  Number of samples waiting to be reported  */
+uint32_t latency_samples();
+
+/*  Write the report of the stages with samples into out and empty them, returns its length  */
+int latency_report(char* out, size_t size);
+
+#endif
@@ -2,7 +2,7 @@
 /*                                                                                                               */
 /* This is the Arduino-based code necessary to implement the RFID data sending through MQTT to the Python client */
 /*                                                                                                               */
-/* The config.json file stored in the SPIFFS system has the following elements:                                  */
+/* The configuration stored in the SPIFFS system (config.h) has the following elements:                          */
 /*                                                                                                               */
 /*     - mqtt_server: Domain of the MQTT server                                                                  */
 /*                                                                                                               */
@@ -14,6 +14,42 @@
 /*                                                                                                               */
 /*     - passwordMQTT: Password for this device at the MQTT communication                                        */
 /*                                                                                                               */
+/* Topic layout: the device advertises its own topic root (rfid/<nodeMCUClient>) in the INIT message and         */
+/* subscribes to rfid/<nodeMCUClient>/{response,ack,reset}. Messages on these topics carry the bare payload,     */
+/* without the "nodeMCUClient###" prefix. The shared response/ack/reset topics are kept as a fallback for        */
+/* backends that do not understand the device topics, and are dropped as soon as the first message arrives on    */
+/* the device topics.                                                                                            */
+/*                                                                                                               */
+/* Access messages carry a correlation ID (nodeMCUClient###cipher###id). A backend that answers id:code allows   */
+/* several access messages to wait for their response at the same time and keeps the session open; a bare code   */
+/* answers the oldest request and ends the session, as before.                                                   */
+/*                                                                                                               */
+/* The time spent in every stage of a tap is kept in histograms (latency.h), published on the "metrics" topic    */
+/* every METRICS_PERIOD_MS and whenever a message arrives on rfid/<nodeMCUClient>/metrics.                       */
+/*                                                                                                               */
+/* An authenticated session is kept in the RTC memory (session.h) and resumed with a single RESUME message after  */
+/* a reconnect or a reset, the INIT / HMAC handshake is only needed when the backend no longer knows it.          */
+/*                                                                                                               */
+/* After IDLE_AFTER_MS without taps or messages the reader switches to short REQA bursts with the RF field off    */
+/* and Wi-Fi in light sleep between them (idle.h), and goes back to continuous polling as soon as a card answers. */
+/*                                                                                                               */
+/* One node can drive several readers on the SPI bus, one per entry / exit lane (lanes.h), polled in interleaved  */
+/* rounds. Every lane has its own door ID, sent with its access messages and offline taps, its own dedupe and    */
+/* in-flight requests, and its own feedback channel.                                                             */
+/*                                                                                                               */
+/* A tap is one presentation of a card (presence.h): the card is halted once read and sent once however long it  */
+/* stays on the reader, and a card shown again within PRESENCE_COOLDOWN_MS after it left is not sent again.      */
+/*                                                                                                               */
+/* Access messages and offline batches are published at QoS 1, kept in RAM until the broker has them; at QoS 0   */
+/* when MQTT_MAX_INFLIGHT of them are already waiting for the broker. They are not sent again after a reconnect: */
+/* they are encrypted with the session of their connection, and the request timeouts and the journal send them   */
+/* again with the session the RESUME or the new handshake sets up. Taps survive a reset only in the journal.     */
+/*                                                                                                               */
+/* The MQTT session is persistent (clean session off), and the subscriptions go in one SUBSCRIBE written with the */
+/* CONNECT, so a reconnect takes a single round trip. Failed attempts back off exponentially with jitter. Only    */
+/* opening the TCP connection blocks: the CONNACK is waited for in loop(), with the reader still running. The     */
+/* subscriptions are at QoS 0, so the broker keeps no messages for the node while it is away.                     */
+/*                                                                                                               */
 /*****************************************************************************************************************/
  
 
@@ -29,13 +65,24 @@
 #include <AES_config.h>
 #include <AES.h>
 #include <Crypto.h>
-#include <ArduinoJson.h>          //https://github.com/bblanchon/ArduinoJson
 #include <SPI.h>
 #include "MFRC522.h"
-#include "pitches.h"
+#include "feedback.h"
+#include "journal.h"
+#include "allowlist.h"
+#include "wire.h"
+#include "heapcheck.h"
+#include "latency.h"
+#include "session.h"
+#include "idle.h"
+#include "config.h"
+#include "boot.h"
+#include "lanes.h"
+#include "presence.h"
 
 #define RST_PIN 0 // RST-PIN for RC522 - RFID 
 #define SS_PIN 2  // SDA-PIN for RC522 - RFID  
+#define IRQ_PIN 10 // IRQ-PIN for RC522 - RFID, SD3: needs the DIO flash mode, see platformio.ini
 #define RESET_PIN 16  // -> CHANGE TO D3 - GPIO0
 #define RED_LED 4
 #define GREEN_LED 5
@@ -43,71 +90,161 @@
 
 #define KEY_LENGTH 16 
 
+// Readers, one per lane: chip select, door ID (0 for none, the messages are then those of a single reader) and
+// feedback channel, then the LED and buzzer pins of every channel. A node with several lanes overrides them in the
+// build flags, e.g. -D'READER_LANES={{2, 1, 0}, {16, 2, 0}}'
+#ifndef READER_LANES
+#define READER_LANES {{SS_PIN, 0, 0}}
+#endif
+#ifndef FEEDBACK_PINS
+#define FEEDBACK_PINS {{RED_LED, GREEN_LED, BEEP}}
+#endif
+
+#define TOPIC_ROOT "rfid/" // Root of the per-device topics: rfid/<nodeMCUClient>/<topic>
+
 /*****************************************************************************************************************/
 
 /************************************************ GLOBAL VARIABLES ***********************************************/
 
-/*  Counters and flags  */
+/*  Protocol state machine  */
+
+#define ACK_TIMEOUT_MS 5000       // Time to wait for an ACK to the INIT or HMAC messages before retrying
+#define ACK_MAX_RETRIES 3         // Number of ACK timeouts before resetting the device
+#define RESPONSE_TIMEOUT_MS 5000  // Time to wait for the response to an access message before resending it
+#define READ_GUARD_MS 1250        // Minimum time between the last protocol message and the next card read, only
+                                  // without pipelining
+#define MQTT_RETRY_MIN_MS 500     // Wait after the first failed MQTT connection attempt, doubled after every other
+#define MQTT_RETRY_MAX_MS 30000   // up to this, each wait shortened by a random part of up to half
+#define SESSION_LIFETIME_MS 1800000 // Time without answers after which a session is not resumed, the backend may end
+                                    // it before
+#define SESSION_SAVE_MS 10000     // Time between updates of the session lifetime in the RTC memory
+#define IDLE_AFTER_MS 10000       // Time without taps or messages before the reader goes to the low power mode
+#define WIFI_CACHE_RTC_OFFSET 32  // First RTC user memory block of the WiFiManager fast reconnect cache, 8 blocks
+                                  // after the 32 used by OTA updates, the stored session follows
+
+enum ProtocolState {
+    STATE_IDLE,              // No session, INIT has to be sent
+    STATE_INIT_SENT,         // Waiting for the ACK with the session ID
+    STATE_AUTH_SENT,         // Waiting for the ACK to the HMAC
+    STATE_RESUME_SENT,       // Waiting for the ACK to the RESUME of the stored session
+    STATE_READY              // Authenticated, reading cards
+};
+
+ProtocolState state = STATE_IDLE;
+unsigned long state_since = 0;  // millis() when the current state was entered
+unsigned long last_event = 0;   // millis() of the last protocol message, used to space card reads
+int ack_retries = 0;            // Consecutive ACK timeouts
+bool session_valid = false;     // True while iv_py and authCode hold a session that can be resumed
+unsigned long session_expires = 0; // millis() when the session stops being resumed
+unsigned long session_saved = 0;   // millis() of the last update of the stored session
+
+/*  In-flight access requests  */
+
+#define ACCESS_SLOTS 4            // Access messages waiting for their response at the same time
+#define ACCESS_MAX_RETRIES 2      // Times an access message is resent before it is considered lost
+
+struct AccessRequest {
+    uint16_t id;                  // Correlation ID sent with the access message and echoed in the response, 0 if free
+    byte uid[10];
+    byte uid_size;
+    uint8_t retries;
+    unsigned long sent;           // millis() when the message was last sent
+    unsigned long detected_us;    // micros() when the card detection started, for the latency metrics
+    unsigned long sent_us;        // micros() when the message was last sent
+    uint8_t lane;
+};
 
-int cnt = 0; // Counter used to assure that one RFID card can't be considered twice in a time interval
-int cnt_ack = 0; // Counter used to manage the possibility of the Python client to be disconnected
-int cnt_response = 0; // Counter used to manage the possibility of losing response message
-int timeout = 1000; // Timeout value
+uint16_t next_access_id = 1;
+unsigned long last_access = 0;    // millis() when the last access message of any lane was sent
+bool pipelining = false;          // True once the backend echoes the correlation IDs, until then one request at a time
 
-int flag_init = 1; // Flag that allows to manage the starting and end of a session
-int flag_ack = 0; // Flag to manage the ACK counter
-int flag_response = 0; // Timeout to consider message lost
-int flag_auth = 1;
+/*  Latency metrics  */
 
-/*  Variables for the config.json file  */
+#define METRICS_PERIOD_MS 600000  // Time between two latency reports
+#define METRICS_MAX_LENGTH 480    // Longest report, leaves room for the MQTT header and topic in the packet
 
-char mqtt_server[15];
-char key[20];
-char nodeMCUClient[15];
-char userMQTT[15];
-char passwordMQTT[15];
+unsigned long last_metrics = 0;   // millis() when the last latency report was sent
+bool metrics_requested = false;   // A latency report was asked for on the metrics topic
+unsigned long detect_us = 0;      // micros() when the detection of the card being handled started
+unsigned long message_us = 0;     // micros() when the message being handled arrived
+
+/*  Device configuration  */
+
+DeviceConfig config;
 
 /*  AES-HMAC-Base64 variables  */
 
 byte key_hmac[KEY_LENGTH]={0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 byte authCode[SHA256HMAC_SIZE];
-char authCodeb64[200];
-char rfid_b64[200];
-AES aes;
+char authCodeb64[45]; // Base64 of the HMAC, 44 characters and the NUL
+AES aes; // Key schedule expanded once per session
 char iv_py[20]; // This variable stores the session ID sent from the Python client, to compute the HMAC and it is also used as IV for the AES encryption
+byte session_iv[N_BLOCK]; // Session ID as IV, copied for every message since CBC overwrites the IV it is given
+byte cipher_buffer[288]; // Base64 of the largest plaintext (an offline batch) padded to AES blocks, encrypted in place
 unsigned int sessionIdLength = 16;
 char comp_info[100];
 
 /*  Buffers  */
 
 char buf[512];
-char buf_init[20];
+char buf_init[64];
 char buf_hmac[256];
 char buf_access[256];
 
-/* notes in the melody: */
+/*  Offline journal  */
 
-int melody[] = {
-    NOTE_C4, NOTE_G3, NOTE_G3, NOTE_A3, NOTE_G3, 0, NOTE_B3, NOTE_C4
-};
+#define JOURNAL_BATCH 4                 // Taps replayed per offline message
+#define JOURNAL_ACK_TIMEOUT_MS 5000     // Time to wait for the backend to confirm a batch before resending it
 
-/* note durations: 4 = quarter note, 8 = eighth note, etc.: */
+char buf_batch[400];
+uint32_t journal_batch_seq = 0;         // Last sequence number of the batch waiting for confirmation, 0 if none
+unsigned long journal_batch_sent = 0;   // millis() when that batch was sent
+unsigned long last_connect_attempt = 0; // millis() of the last MQTT connection attempt
+unsigned long connect_backoff = MQTT_RETRY_MIN_MS; // Wait after the next failed attempt, before the jitter
+unsigned long connect_wait = 0;         // Wait before the next attempt, 0 after a connection
 
-int noteDurations[] = {
-    4, 8, 8, 4, 4, 4, 4, 4
-};
+/*  Per-device topics  */
+
+char topic_root[25];     // rfid/<nodeMCUClient>/
+char topic_response[35];
+char topic_ack[35];
+char topic_reset[35];
+char topic_allowlist[35];
+char topic_metrics[35];
+// RESUME message: ID, session ID, Base64 HMAC and topic root, separated by "###", then wire<version>
+char buf_resume[sizeof config.nodeMCUClient + sizeof iv_py + sizeof authCodeb64 + sizeof topic_root + 4 * 3 +
+                sizeof "wire255"];
+bool device_topics = false; // True once the backend has answered on the per-device topics
+
+#define DEVICE_SUBSCRIPTIONS 5
+const char* subscriptions[] = {topic_response, topic_ack, topic_reset, topic_allowlist, topic_metrics,
+                               "response", "ack", "reset"}; // The device topics, then the shared ones
+bool wire_binary = false;   // True while the backend talks the binary wire format, the device answers in kind
 
 /*  Other variables  */
 
 WiFiManager wifiManager;
-MFRC522 mfrc522(SS_PIN, RST_PIN);   // Create MFRC522 instance
-WiFiClient espClient;
+WiFiManagerCache wifi_cache;        // Fast reconnect cache as loaded at boot, saved to flash when it changes
+NetworkClient espClient;
 PubSubClient client(espClient);
+PubSubMemoryStore outbox;           // QoS 1 messages waiting for their PUBACK
 const int mqtt_port = 1883;
-char rfidstr[15];
-bool shouldSaveConfig = true;
-String currentCard = "";
-String currentCardOld = "";
+bool shouldSaveConfig = false;
+
+/*  Lanes  */
+
+struct LaneState {
+    AccessRequest in_flight[ACCESS_SLOTS];
+    MFRC522::Uid held;            // Card read while another lane waited for its response, size 0 for none
+};
+
+const LaneConfig lane_config[] = READER_LANES;
+const uint8_t feedback_pins[][3] = FEEDBACK_PINS;   // Red LED, green LED and buzzer of every channel
+
+#define LANE_COUNT (sizeof lane_config / sizeof lane_config[0])
+
+MFRC522 readers[LANE_COUNT];     // One MFRC522 instance per lane, initialised by lanes_begin()
+LaneState lane_state[LANE_COUNT];
 
 /*****************************************************************************************************************/
 
@@ -127,260 +264,813 @@ void CharToByte(char* chars, byte* bytes, unsigned int count) {
         bytes[i] = (byte)chars[i];
 }
 
-/*  Function utilized to carry out the encryption process --> out = Base64(AES(Base64(in)))  */
+/*  Function used to move the protocol state machine, the timeouts of every state count from here  */
 
-void encrypt_rfid(char rfidstr[], char iv_py[]) {
-    byte cipher_rfid[1000];
+void set_state(ProtocolState new_state) {
+    state = new_state;
+    state_since = millis();
+}
 
-    int len = base64_encode(rfid_b64, rfidstr, strlen(rfidstr));
-    aes.do_aes_encrypt((byte *)rfid_b64, len, cipher_rfid, (byte *)key, 128, (byte *)iv_py);
-    base64_encode(rfid_b64, (char *)cipher_rfid, aes.get_size());
+/*  Function used to copy the current session into the RTC memory, with the time it can still be resumed  */
+
+void save_session(unsigned long now) {
+    StoredSession stored;
+
+    memcpy(stored.id, iv_py, sizeof stored.id);
+    memcpy(stored.auth, authCode, sizeof stored.auth);
+    stored.flags = (pipelining ? SESSION_PIPELINING : 0) | (device_topics ? SESSION_DEVICE_TOPICS : 0);
+    stored.lifetime = (long)(session_expires - now) > 0 ? session_expires - now : 0;
+    session_store(&stored);
+    session_saved = now;
+}
+
+/*  Function used to drop the session, the next step is a full INIT / HMAC handshake  */
+
+void end_session() {
+    if (session_valid) {
+        session_valid = false;
+        session_clear();
+    }
+    set_state(STATE_IDLE);
 }
 
-/*  Routine employed to read the buffer where the RFID ID is stored and transform it to ASCII code  */
+/*  Function used to prepare the AES context for a new session: the key schedule is expanded here and not on every  */
+/*  message, and the session ID is kept as the IV of every message                                                  */
+
+void start_cipher() {
+    aes.set_key((byte *)config.key, 128);
+    memcpy(session_iv, iv_py, N_BLOCK);
+}
 
-void dump_byte_array(byte *buffer, byte bufferSize) {
-    String rfid;
-    char s[100];
+/*  Function used to encrypt length bytes already in out, PKCS#7 padded and in place, returns the padded length  */
 
-    for (byte i = 0; i < bufferSize; i++) {
-        // Convert from byte to Hexadecimal
-        sprintf(s, "%s%x", buffer[i] < 0x10 ? "0" : "", mfrc522.uid.uidByte[i]);
-        // Concatenate msg
-        strcat(&rfidstr[i] , s);
+int encrypt_raw(byte* out, int length) {
+    byte iv[N_BLOCK];
+
+    int padded = (length / N_BLOCK + 1) * N_BLOCK;
+    memset(out + length, padded - length, padded - length);
+    memcpy(iv, session_iv, N_BLOCK);
+    aes.cbc_encrypt(out, out, padded / N_BLOCK, iv);
+    return padded;
+}
+
+/*  Function used to pick up the session stored before the last reset, if any  */
+
+void restore_session() {
+    StoredSession stored;
+
+    if (!session_load(&stored)) {
+        return;
     }
+    memcpy(iv_py, stored.id, sizeof stored.id);
+    memcpy(authCode, stored.auth, sizeof stored.auth);
+    pipelining = stored.flags & SESSION_PIPELINING;
+    device_topics = stored.flags & SESSION_DEVICE_TOPICS;
+    session_expires = millis() + stored.lifetime;
+    session_valid = true;
+    start_cipher();
+    Serial.print("Stored session found: ");
+    Serial.println(iv_py);
+}
 
-    currentCard = rfidstr;
-    Serial.println("RFID: " + String(rfidstr));
+/*  Function utilized to carry out the encryption process --> out = Base64(AES(Base64(in))), returns the length of out  */
 
-    rfid = String(rfidstr).substring(strlen(rfidstr)-8,strlen(rfidstr));
+int encrypt_text(char* in, int length, char* out) {
+    // Inner Base64 written straight into the block buffer and encrypted in place
+    int size = base64_encode((char *)cipher_buffer, in, length);
+    int padded = encrypt_raw(cipher_buffer, size);
+    return base64_encode(out, (char *)cipher_buffer, padded);
 }
 
-/* Function used to print response using LEDs and Buzzer */
+/*  Routine employed to transform a byte buffer (e.g. the RFID ID) to lowercase hexadecimal ASCII, out must hold  */
+/*  2 * size + 1 characters                                                                                       */
 
-void response(int response_code) {
-    switch(response_code) {
-        case 100:
-            // 100: Setup melody
-            // iterate over the notes of the melody:
-            for (int thisNote = 0; thisNote < 8; thisNote++) {
-                // to calculate the note duration, take one second divided by the note type.
-                //e.g. quarter note = 1000 / 4, eighth note = 1000/8, etc.
-                int noteDuration = 1000 / noteDurations[thisNote];
-                digitalWrite(GREEN_LED, HIGH);
-                tone(BEEP, melody[thisNote], noteDuration);
-
-                // to distinguish the notes, set a minimum time between them.
-                // the note's duration + 30% seems to work well:
-                int pauseBetweenNotes = noteDuration * 1.30;
-                delay(pauseBetweenNotes);
-                digitalWrite(GREEN_LED, LOW);
-                // stop the tone playing:
-                noTone(BEEP);
+void dump_byte_array(const byte* buffer, byte size, char* out) {
+    static const char digits[] = "0123456789abcdef";
+
+    for (byte i = 0; i < size; i++) {
+        *out++ = digits[buffer[i] >> 4];
+        *out++ = digits[buffer[i] & 0xf];
+    }
+    *out = 0;
+}
+
+/*  Function used to encrypt a card UID, in the hexadecimal form expected by the backend, into out  */
+
+int encrypt_rfid(const byte* uid, byte uid_size, char* out) {
+    char hex[2 * 10 + 1];
+
+    dump_byte_array(uid, uid_size, hex);
+    return encrypt_text(hex, 2 * uid_size, out);
+}
+
+/*  Function used to copy a MQTT payload into comp_info as a C string, truncating it if needed  */
+
+void copy_payload(const byte* payload, unsigned int length) {
+    if (length >= sizeof comp_info) {
+        length = sizeof comp_info - 1;
+    }
+    memcpy(comp_info, payload, length);
+    comp_info[length] = 0;
+}
+
+/*  Function used to find the in-flight request of a card on a lane, or a free slot of the lane when uid is NULL  */
+
+AccessRequest* find_request(uint8_t lane, const byte* uid, byte uid_size) {
+    AccessRequest* in_flight = lane_state[lane].in_flight;
+
+    for (int i = 0; i < ACCESS_SLOTS; i++) {
+        if (uid == NULL) {
+            if (in_flight[i].id == 0) {
+                return &in_flight[i];
             }
-            break;
+        } else if (in_flight[i].id != 0 && in_flight[i].uid_size == uid_size &&
+                   memcmp(in_flight[i].uid, uid, uid_size) == 0) {
+            return &in_flight[i];
+        }
+    }
+    return NULL;
+}
 
-        case 101:
-            // 101: Setup Success
-            digitalWrite(GREEN_LED, HIGH);
-            tone(BEEP, 1930);
-            delay(150);
-            tone(BEEP, 1630);
-            delay(150);
-            tone(BEEP, 1930);
-            delay(100);
-            noTone(BEEP);
-            delay(1000);
-            digitalWrite(GREEN_LED, LOW);
-            delay(250);
-            break;
-            
-        case 201:
-            // 201: Success (Check-in)
-            digitalWrite(GREEN_LED, HIGH);
-            tone(BEEP, 1630);
-            delay(150);
-            tone(BEEP, 1930);
-            delay(100);
-            noTone(BEEP);
-            delay(1000);
-            digitalWrite(GREEN_LED, LOW);
-            delay(250);
-            break;
+/*  Function used to find the in-flight request answered by a response, the oldest one of any lane if the response  */
+/*  has no ID                                                                                                        */
 
-        case 202:
-            // 202: Success (Check-out)
-            digitalWrite(GREEN_LED, HIGH);
-            tone(BEEP, 1930);
-            delay(150);
-            tone(BEEP, 1630);
-            delay(100);
-            noTone(BEEP);
-            delay(1000);
-            digitalWrite(GREEN_LED, LOW);
-            delay(250);
-            break;
+AccessRequest* find_answered(uint16_t id) {
+    AccessRequest* oldest = NULL;
+
+    for (unsigned int lane = 0; lane < LANE_COUNT; lane++) {
+        AccessRequest* in_flight = lane_state[lane].in_flight;
+
+        for (int i = 0; i < ACCESS_SLOTS; i++) {
+            if (in_flight[i].id == 0) {
+                continue;
+            }
+            if (id != 0 && in_flight[i].id == id) {
+                return &in_flight[i];
+            }
+            if (id == 0 && (oldest == NULL || (long)(in_flight[i].sent - oldest->sent) < 0)) {
+                oldest = &in_flight[i];
+            }
+        }
+    }
+    return oldest;
+}
+
+/*  Function used to find a slot for a new request of a lane. Until the backend echoes correlation IDs only one  */
+/*  request can be waiting for its response, on any lane                                                         */
+
+AccessRequest* free_request(uint8_t lane) {
+    return (pipelining || find_answered(0) == NULL) ? find_request(lane, NULL, 0) : NULL;
+}
+
+/*  Function used to publish a tap at QoS 1, or at QoS 0 while the client has no room for another one  */
+
+bool publish_tap(const char* topic, const byte* payload, unsigned int length) {
+    return client.publish(topic, payload, length, false, 1) || client.publish(topic, payload, length);
+}
+
+/*  Function used to encrypt and send the access message of a request, with the current session  */
+
+void send_access(AccessRequest* request) {
+    uint8_t door = lane_config[request->lane].door;
+
+    if (wire_binary) {
+        byte body[1 + 2 * N_BLOCK];
+
+        // The door ID goes before the ciphertext, only on nodes that have one
+        unsigned long start = micros();
+        int offset = door != 0 ? 1 : 0;
+        body[0] = door;
+        memcpy(body + offset, request->uid, request->uid_size);
+        int size = encrypt_raw(body + offset, request->uid_size);
+        int length = wire_encode((byte *)buf_access, sizeof buf_access, WIRE_ACCESS, config.nodeMCUClient,
+                                 request->id, body, offset + size, key_hmac, KEY_LENGTH);
+        latency_record(LATENCY_ENCRYPT, micros() - start);
+        Serial.print("Binary access sent: ");
+        Serial.println(request->id);
+        start = micros();
+        publish_tap("access", (byte *)buf_access, length);
+        request->sent_us = micros();
+        latency_record(LATENCY_PUBLISH, request->sent_us - start);
+        request->sent = millis();
+        return;
+    }
+
+    // The ciphertext is encoded straight into the message buffer
+    unsigned long start = micros();
+    int length = snprintf(buf_access, sizeof buf_access, "%s###", config.nodeMCUClient);
+    length += encrypt_rfid(request->uid, request->uid_size, buf_access + length);
+    length += snprintf(buf_access + length, sizeof buf_access - length, "###%u", request->id);
+    if (door != 0) {
+        snprintf(buf_access + length, sizeof buf_access - length, "###%u", door);
+    }
+    latency_record(LATENCY_ENCRYPT, micros() - start);
+
+    Serial.print("Message sent: ");
+    Serial.println(buf_access);
+    start = micros();
+    publish_tap("access", (byte *)buf_access, strlen(buf_access));
+    request->sent_us = micros();
+    latency_record(LATENCY_PUBLISH, request->sent_us - start);
+    request->sent = millis();
+}
+
+/* Function used to print response using LEDs and Buzzer, the pattern plays in the background from loop() */
+
+void response(int response_code) {
+    feedback_play(response_code);
+}
+
+/*  Same on the feedback channel of a lane only  */
+
+void response_on(uint8_t lane, int response_code) {
+    feedback_play_on(lane_config[lane].feedback, response_code);
+}
+
+/*  Function used to publish the latency histograms on the metrics topic, they start empty again once sent  */
+
+void send_metrics() {
+    int length = snprintf(buf, sizeof buf, "%s###", config.nodeMCUClient);
+
+    latency_report(buf + length, METRICS_MAX_LENGTH - length);
+    if (client.publish("metrics", buf)) {
+        Serial.println("Latency metrics sent");
+    }
+    last_metrics = millis();
+    metrics_requested = false;
+}
+
+/*  Function used to print how the Wi-Fi connection at boot was spent  */
+
+void print_wifi_timing() {
+    const WiFiManagerTiming& timing = wifiManager.getConnectTiming();
+
+    Serial.print("Wi-Fi (ms): directed ");
+    Serial.print(timing.directed);
+    Serial.print(timing.fast ? " ok" : " -");
+    Serial.print(", scan ");
+    Serial.print(timing.scan);
+    Serial.print(", total ");
+    Serial.println(timing.total);
+}
+
+/*  Function used to publish the boot phases on the metrics topic, once the first session is ready  */
+
+void send_boot_report() {
+    boot_phase("session");
+    boot_print();
+    int length = snprintf(buf, sizeof buf, "%s###", config.nodeMCUClient);
+    boot_report(buf + length, METRICS_MAX_LENGTH - length);
+    client.publish("metrics", buf);
+}
+
+/*  Function used to start connecting the nodeMCU to the MQTT server. Only opening the TCP connection blocks, the  */
+/*  CONNACK is collected by client.loop() and the attempt ends in mqtt_connect_step(), so cards can still be read  */
+/*  and journaled while the broker is unreachable                                                                 */
 
-        case 400:
+void conectMqtt() {
+    if (client.connecting() || (last_connect_attempt != 0 && millis() - last_connect_attempt < connect_wait)) {
+        return;
+    }
+    last_connect_attempt = millis();
+
+    // Subscribed in the same write as the CONNECT, the shared topics only while the backend is not known to use the
+    // per-device topics yet. At QoS 0 the broker queues nothing for the session while the node is away: an old ACK or
+    // response would be taken for an answer to the handshake or request now in progress
+    client.setSubscriptions(subscriptions, device_topics ? DEVICE_SUBSCRIPTIONS : sizeof subscriptions /
+                            sizeof subscriptions[0], 0);
+
+    Serial.println("ConnectingMQTT ...");
+    client.beginConnect(config.nodeMCUClient, config.userMQTT, config.passwordMQTT, NULL, 0, false, NULL, false);
+}
+
+/*  Function called by the MQTT client at every step of a connection attempt, ms since the attempt began  */
+
+void mqtt_connect_step(uint8_t step, unsigned long ms) {
+    switch (step) {
+        case MQTT_CONNECT_TCP:
+            // Sent again with the DUP flag they would go before the RESUME or INIT, with a stale IV
+            client.clearInflight();
             break;
 
-        case 401:
-            // 401: Unauthorized;
-            digitalWrite(RED_LED, HIGH);
-            delay(500);
-            digitalWrite(RED_LED, LOW);
-            delay(500);
-            digitalWrite(RED_LED, HIGH);
-            delay(150);
-            digitalWrite(RED_LED, LOW);
-            delay(150);
+        case MQTT_CONNECT_SENT:
+            Serial.print("CONNECT sent, ms: ");
+            Serial.println(ms);
             break;
 
-        case 404:
-            // 404: Response not found;
-            digitalWrite(RED_LED, HIGH);
-            tone(BEEP, 2030);
-            delay(150);
-            tone(BEEP, 2030);
-            delay(100);
-            noTone(BEEP);
-            delay(1000);
-            digitalWrite(RED_LED, LOW);
-            delay(250);
+        case MQTT_CONNECT_DONE:
+            Serial.print(client.getSessionPresent() ? "Connected, session kept, ms: " : "Connected, ms: ");
+            Serial.println(ms);
+            boot_phase("mqtt");
+            connect_backoff = MQTT_RETRY_MIN_MS;
+            connect_wait = 0;
+            // The backend may have lost the session during the outage
+            journal_batch_seq = 0;
+            set_state(STATE_IDLE);
             break;
 
-        case 504:
-            // 504: Timed out waiting ACK;
-            digitalWrite(RED_LED, HIGH);
-            delay(250);
-            digitalWrite(RED_LED, LOW);
-            delay(250);
-            digitalWrite(RED_LED, HIGH);
-            delay(250);
-            digitalWrite(RED_LED, LOW);
-            delay(250);
+        case MQTT_CONNECT_IDLE:
+            // A fleet that lost the same broker does not come back in step
+            connect_wait = connect_backoff - random(connect_backoff / 2 + 1);
+            connect_backoff = connect_backoff * 2 < MQTT_RETRY_MAX_MS ? connect_backoff * 2 : MQTT_RETRY_MAX_MS;
+            Serial.print("Error");
+            Serial.println(client.state());
+            Serial.print("Retry in ms: ");
+            Serial.println(connect_wait);
+            response(503);
             break;
     }
 }
 
-/*  Function used to connect the nodeMCU to the MQTT server  */
+/*  Function used to replay the taps stored while offline, in batches of JOURNAL_BATCH taps. The batch is      */
+/*  encrypted like the access messages --> Base64(AES(Base64(seq,uptime,uid;...)))                              */
 
-void conectMqtt() {
-    while (!client.connected()) {
-        Serial.print("ConnectingMQTT ...");
-        if (client.connect(nodeMCUClient,userMQTT,passwordMQTT)){  //"esp8266","mqtt_rfid","password"
-            Serial.println("Connected");
-            // Subscribing to topics
-            client.subscribe("response");
-            client.subscribe("ack");
-            client.subscribe("reset");
-        } else {
-            digitalWrite(RED_LED, HIGH);
-            Serial.print("Error");
-            Serial.println(client.state());
-            Serial.println("Retry in 5 seconds");
+void send_journal_batch() {
+    JournalRecord records[JOURNAL_BATCH];
+    char plain[JOURNAL_BATCH * 52];
+    int length = 0;
+
+    uint8_t count = journal_peek(records, JOURNAL_BATCH);
+    if (count == 0) {
+        return;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        length += snprintf(plain + length, sizeof plain - length, "%lu,%lu,",
+                           (unsigned long)records[i].seq, (unsigned long)records[i].uptime);
+        dump_byte_array(records[i].uid, records[i].uid_size, plain + length);
+        length += 2 * records[i].uid_size;
+        if (records[i].door != 0) {
+            length += snprintf(plain + length, sizeof plain - length, ",%u", records[i].door);
         }
-        delay(500);
-        digitalWrite(RED_LED, LOW);
-        delay(500);
+        plain[length++] = ';';
+    }
+    plain[length] = 0;
+
+    int prefix = snprintf(buf_batch, sizeof buf_batch, "%s###", config.nodeMCUClient);
+    encrypt_text(plain, length, buf_batch + prefix);
+
+    if (publish_tap("offline", (byte *)buf_batch, strlen(buf_batch))) {
+        Serial.print("Offline batch sent, taps: ");
+        Serial.println(count);
+        journal_batch_seq = records[count - 1].seq;
+        journal_batch_sent = millis();
     }
 }
 
-/*  Callback called when a MQTT message arrives, to distinguish bewteen topics to make distinct actions  */
+/*  Functions used to act on a message addressed to this device, one per kind of message: response, ack and reset  */
+
+typedef void (*MessageHandler)(char* msg);
+
+void handle_response(char* msg) {
+    Serial.println("Response message received, printing action...");
 
-void callback(char* topic, byte* payload, unsigned int length) {
-  
-    String mensagem = "";
+    // The response is <id>:<code> when the backend echoes the correlation ID, otherwise only <code>
+    char* separator = strchr(msg, ':');
+    uint16_t id = 0;
+    if (separator != NULL) {
+        *separator = 0;
+        id = atoi(msg);
+        msg = separator + 1;
+        pipelining = true;
+    }
+    // Transaction finished
+    AccessRequest* request = find_answered(id);
+    if (request != NULL) {
+        request->id = 0;
+        latency_record(LATENCY_BACKEND, message_us - request->sent_us);
+    }
+
+    // Printing response, backends without correlation IDs end the session with every response
+    if (separator == NULL) {
+        end_session();
+    } else {
+        session_expires = millis() + SESSION_LIFETIME_MS;
+    }
+    // On the lane of the request, or everywhere when the request is not known any more
+    if (request != NULL) {
+        response_on(request->lane, atoi(msg));
+    } else {
+        response(atoi(msg));
+    }
+    if (request != NULL) {
+        latency_record(LATENCY_TAP, micros() - request->detected_us);
+    }
+}
+
+void handle_ack(char* msg) {
     SHA256HMAC hmac(key_hmac, KEY_LENGTH);
+
+    ack_retries = 0;
+    // Types of ACK response
+    if (strcmp(msg, "sessionExpired") == 0){
+        Serial.println("Session has expired, restarting init process...");
+        end_session();
+    } else if (strcmp(msg, "authenticationFailed") == 0){
+        Serial.println("Authentication process failed, trying again...");
+        end_session();
+    } else if (strcmp(msg, "authenticationSuccessful") == 0){
+        // Only the answer to the HMAC or the RESUME in progress
+        if (state != STATE_AUTH_SENT && state != STATE_RESUME_SENT) {
+            Serial.println("Unexpected authentication ACK ignored");
+            return;
+        }
+        // Logic when authenticated
+        if (state == STATE_RESUME_SENT) {
+            Serial.println("Session resumed");
+        } else {
+            Serial.println("Authentication process succeed");
+            session_valid = true;
+            session_expires = millis() + SESSION_LIFETIME_MS;
+        }
+        // response(200);
+        set_state(STATE_READY);
+        save_session(millis());
+    } else if (strncmp(msg, "stored:", 7) == 0){
+        // The backend has stored the offline taps up to this sequence number
+        uint32_t seq = strtoul(msg + 7, NULL, 10);
+        Serial.print("Offline taps stored up to ");
+        Serial.println(seq);
+        journal_ack(seq);
+        if (seq >= journal_batch_seq) {
+            journal_batch_seq = 0;
+        }
+    } else if (strcmp(msg, "notAuthenticated") == 0){
+        Serial.println("Not authenticated... restarting");
+        end_session();
+    } else {
+        if (state == STATE_INIT_SENT && strlen(msg) == sessionIdLength) {
+            Serial.println("Init ACK received with session ID");
+
+            strcpy(iv_py,msg);
+            start_cipher();
+
+            hmac.doUpdate(iv_py,strlen(iv_py));
+            hmac.doFinal(authCode);
+
+            Serial.print("AUTH CODE: ");
+
+            for (byte i=0; i < SHA256HMAC_SIZE; i++) {
+                Serial.print("0123456789abcdef"[authCode[i]>>4]);
+                Serial.print("0123456789abcdef"[authCode[i]&0xf]);
+            }
+            Serial.println();
+
+            // Encode authCode (sessionId after HMAC encryption) and publish to hmac channel
+            Serial.println("Going for authentication");
+            if (wire_binary) {
+                int length = wire_encode((byte *)buf_hmac, sizeof buf_hmac, WIRE_HMAC, config.nodeMCUClient, 0,
+                                         authCode, SHA256HMAC_SIZE, key_hmac, KEY_LENGTH);
+                client.publish("hmac", (byte *)buf_hmac, length);
+            } else {
+                base64_encode(authCodeb64, (char *)authCode, SHA256HMAC_SIZE);
+                snprintf(buf_hmac, sizeof buf_hmac, "%s###%s", config.nodeMCUClient, (char *)authCodeb64);
+                client.publish("hmac", buf_hmac);
+            }
+            set_state(STATE_AUTH_SENT);
+        } else {
+            Serial.println("Unidentified ACK message");
+            end_session();
+        }
+    }
+}
+
+void handle_reset(char*) {
+    Serial.println("Resetting system parameters...");
+    end_session();
+    wifiManager.resetSettings();
+    delay(3000);
+    ESP.reset();
+    delay(5000);
+}
+
+/*  Function used to turn a binary frame into the text message it stands for, in comp_info, and the handler of its  */
+/*  kind. Returns false if the frame is not valid or not for this device                                          */
+
+bool decode_frame(byte* payload, unsigned int length, MessageHandler* handler) {
+    WireFrame frame;
+
+    if (!wire_decode(payload, length, &frame, key_hmac, KEY_LENGTH) ||
+            frame.id_length != strlen(config.nodeMCUClient) ||
+            memcmp(frame.id, config.nodeMCUClient, frame.id_length) != 0) {
+        Serial.println("Binary message not for this device");
+        return false;
+    }
+
+    if (frame.type == WIRE_RESPONSE && frame.body_length == 2) {
+        *handler = handle_response;
+        snprintf(comp_info, sizeof comp_info, "%u:%u", frame.seq, (frame.body[0] << 8) | frame.body[1]);
+    } else if (frame.type == WIRE_ACK && frame.body_length >= 1) {
+        *handler = handle_ack;
+        switch (frame.body[0]) {
+            case WIRE_ACK_SESSION:
+                if (frame.body_length != 1 + sessionIdLength) {
+                    return false;
+                }
+                memcpy(comp_info, frame.body + 1, sessionIdLength);
+                comp_info[sessionIdLength] = 0;
+                break;
+            case WIRE_ACK_AUTH_OK:
+                strcpy(comp_info, "authenticationSuccessful");
+                break;
+            case WIRE_ACK_AUTH_FAILED:
+                strcpy(comp_info, "authenticationFailed");
+                break;
+            case WIRE_ACK_SESSION_EXPIRED:
+                strcpy(comp_info, "sessionExpired");
+                break;
+            case WIRE_ACK_NOT_AUTHENTICATED:
+                strcpy(comp_info, "notAuthenticated");
+                break;
+            case WIRE_ACK_STORED:
+                if (frame.body_length != 5) {
+                    return false;
+                }
+                snprintf(comp_info, sizeof comp_info, "stored:%lu", ((unsigned long)frame.body[1] << 24) |
+                         ((unsigned long)frame.body[2] << 16) | ((unsigned long)frame.body[3] << 8) | frame.body[4]);
+                break;
+            default:
+                return false;
+        }
+    } else {
+        Serial.println("Unidentified binary message");
+        return false;
+    }
+
+    wire_binary = true;
+    return true;
+}
+
+/*  Function used to act on a message of a per-device topic: the payload is the bare message, no ID check needed  */
+
+void device_message(const char* kind, MessageHandler handler, byte* payload, unsigned int length) {
+    // The payload lives in the client buffer, copy it before sending anything
+    if (length > 0 && payload[0] == WIRE_VERSION) {
+        if (!decode_frame(payload, length, &handler)) {
+            return;
+        }
+    } else {
+        copy_payload(payload, length);
+        wire_binary = false;
+    }
+
+    Serial.print("Message received (Topic: ");
+    Serial.print(kind);
+    Serial.print(" Payload: ");
+    Serial.println(comp_info);
+
+    if (!device_topics) {
+        // The backend speaks the per-device layout, stop receiving the traffic of the other readers
+        Serial.println("Backend uses device topics, leaving shared topics");
+        device_topics = true;
+        client.unsubscribe("response");
+        client.unsubscribe("ack");
+        client.unsubscribe("reset");
+    }
+
+    last_event = millis();
+    handler(comp_info);
+}
+
+/*  Function used to act on a message of a shared topic, <device ID>###<message> or a binary frame naming the device  */
+
+void shared_message(MessageHandler handler, byte* payload, unsigned int length) {
     char * id;
     char * msg;
 
-    // Convert msg from byte to string and then to CharArray
-    for (unsigned int i = 0; i < length; i++) {
-        mensagem += (char)payload[i];
+    if (length > 0 && payload[0] == WIRE_VERSION) {
+        if (decode_frame(payload, length, &handler)) {
+            last_event = millis();
+            handler(comp_info);
+        }
+        return;
     }
-    mensagem.toCharArray(comp_info, sizeof comp_info);
+
+    // Convert msg from byte to CharArray
+    copy_payload(payload, length);
 
     // Get device ID and payload message
     id = strtok (comp_info, "###");
     msg = strtok (NULL, "###");
 
-    if(strcmp(id, nodeMCUClient) == 0){
+    if(id != NULL && msg != NULL && strcmp(id, config.nodeMCUClient) == 0){
 
         Serial.print("Message received (DeviceID: ");
         Serial.print(id);
         Serial.print(" Payload: ");
         Serial.println(msg);
-        // Response message received transaction with currentCard finished
-        currentCardOld = currentCard;
-        currentCard = "";
-
-        if(strcmp(topic, "response") == 0){
-            Serial.println("Response message received, printing action...");
-
-            // Setting counter to zero and printing response
-            cnt = 0;
-            flag_init = 1;
-            flag_auth = 1;
-            response(atoi(msg));
-        } else if(strcmp(topic, "ack") == 0){
-            // Types of ACK response
-            if (strcmp(msg, "sessionExpired") == 0){
-                Serial.println("Session has expired, restarting init process...");
-                flag_init = 1;
-                flag_auth = 1;
-            } else if (strcmp(msg, "authenticationFailed") == 0){
-                Serial.println("Authentication process failed, trying again...");
-                flag_init = 1;
-                flag_auth = 1;
-            } else if (strcmp(msg, "authenticationSuccessful") == 0){
-                // Logic when authenticated
-                Serial.println("Authentication process succeed");
-                // response(200);
-                flag_auth = 0;
-            } else if (strcmp(msg, "notAuthenticated") == 0){
-                Serial.println("Not authenticated... restarting");
-                flag_init = 1;
-                flag_auth = 1;
-            } else {
-                if (strlen(msg) == sessionIdLength) {
-                    Serial.println("Init ACK received with session ID");
+        wire_binary = false;
+        last_event = millis();
+        handler(msg);
+
+    } else {
+        Serial.print("Message not for this device: ");
+        Serial.println(id != NULL ? id : "");
+    }
+}
+
+/*  MQTT routes, one handler per subscribed topic, see setup(). Topic and payload are views into the client buffer,  */
+/*  the topic is not NUL terminated. The receive path must not allocate from the heap                               */
+
+void route_response(const char*, uint16_t, byte* payload, unsigned int length) {
+    message_us = micros();
+    HOT_PATH_BEGIN();
+    device_message("response", handle_response, payload, length);
+    HOT_PATH_END("receive");
+}
+
+void route_ack(const char*, uint16_t, byte* payload, unsigned int length) {
+    message_us = micros();
+    HOT_PATH_BEGIN();
+    device_message("ack", handle_ack, payload, length);
+    HOT_PATH_END("receive");
+}
 
-                    strcpy(iv_py,msg);
+void route_reset(const char*, uint16_t, byte* payload, unsigned int length) {
+    message_us = micros();
+    HOT_PATH_BEGIN();
+    device_message("reset", handle_reset, payload, length);
+    HOT_PATH_END("receive");
+}
 
-                    hmac.doUpdate(iv_py,strlen(iv_py));
-                    hmac.doFinal(authCode);
+void route_shared_response(const char*, uint16_t, byte* payload, unsigned int length) {
+    message_us = micros();
+    HOT_PATH_BEGIN();
+    shared_message(handle_response, payload, length);
+    HOT_PATH_END("receive");
+}
 
-                    Serial.print("AUTH CODE: ");
+void route_shared_ack(const char*, uint16_t, byte* payload, unsigned int length) {
+    message_us = micros();
+    HOT_PATH_BEGIN();
+    shared_message(handle_ack, payload, length);
+    HOT_PATH_END("receive");
+}
 
-                    for (byte i=0; i < SHA256HMAC_SIZE; i++) {
-                        Serial.print("0123456789abcdef"[authCode[i]>>4]);
-                        Serial.print("0123456789abcdef"[authCode[i]&0xf]);
+void route_shared_reset(const char*, uint16_t, byte* payload, unsigned int length) {
+    message_us = micros();
+    HOT_PATH_BEGIN();
+    shared_message(handle_reset, payload, length);
+    HOT_PATH_END("receive");
+}
+
+void route_allowlist(const char*, uint16_t, byte* payload, unsigned int length) {
+    // Allow-list snapshots are binary and handled apart. Only their data chunks are checked: the start and end of a
+    // snapshot open, rename and reload files, which allocate
+    message_us = micros();
+    if (length == 0 || payload[0] != 'D') {
+        allowlist_receive(payload, length);
+        return;
+    }
+    HOT_PATH_BEGIN();
+    allowlist_receive(payload, length);
+    HOT_PATH_END("receive");
+}
+
+void route_metrics(const char*, uint16_t, byte*, unsigned int) {
+    // Any message on the metrics topic asks for a latency report, sent from loop(): the client buffer still holds
+    // the message being received
+    message_us = micros();
+    HOT_PATH_BEGIN();
+    metrics_requested = true;
+    HOT_PATH_END("receive");
+}
+
+/*  Function used to advance the protocol state machine, returns true when cards can be sent to the backend  */
+
+bool protocol_step(unsigned long now) {
+    switch (state) {
+        case STATE_IDLE:
+            if (session_valid && (long)(session_expires - now) > 0) {
+                // Resume step, one round trip instead of the INIT / HMAC handshake
+                base64_encode(authCodeb64, (char *)authCode, SHA256HMAC_SIZE);
+                int length = snprintf(buf_resume, sizeof buf_resume, "%s###%s###%s###%s###wire%d",
+                                      config.nodeMCUClient, iv_py, authCodeb64, topic_root, WIRE_VERSION);
+                // A cut-off HMAC or topic root cannot be resumed, a new session is started instead
+                if (length > 0 && length < (int)sizeof buf_resume) {
+                    client.publish("resume", buf_resume);
+                    Serial.println("Resume message sent, waiting ACK");
+                    set_state(STATE_RESUME_SENT);
+                    return false;
+                }
+                Serial.println("Resume message too long");
+            }
+            if (session_valid) {
+                end_session();
+            }
+            // Init step
+            client.publish("init", buf_init);
+            Serial.println("Init message sent, waiting ACK");
+            set_state(STATE_INIT_SENT);
+            return false;
+
+        case STATE_RESUME_SENT:
+            // A backend without session resumption never answers, it is not counted as a lost ACK
+            if (now - state_since >= ACK_TIMEOUT_MS) {
+                Serial.println("Resume not answered, starting a new session");
+                end_session();
+            }
+            return false;
+
+        case STATE_INIT_SENT:
+        case STATE_AUTH_SENT:
+            // Until authentication process succeeds the device will not be able to read any card
+            if (now - state_since >= ACK_TIMEOUT_MS) {
+                // If ACK is not received we try to resend it two times and the reset the ESP
+                ack_retries++;
+                Serial.print("ACK timeout: ");
+                Serial.println(ack_retries);
+                response(504);
+                if (ack_retries >= ACK_MAX_RETRIES) {
+                    ESP.reset();
+                }
+                set_state(STATE_IDLE);
+            }
+            return false;
+
+        case STATE_READY:
+            // Keep the stored lifetime current, a watchdog reset gives no chance to save it
+            if (now - session_saved >= SESSION_SAVE_MS) {
+                save_session(now);
+            }
+
+            // When we send the RFID ID we may lose the response message, so every request has a timeout
+            for (unsigned int lane = 0; lane < LANE_COUNT; lane++) {
+                AccessRequest* in_flight = lane_state[lane].in_flight;
+
+                for (int i = 0; i < ACCESS_SLOTS; i++) {
+                    if (in_flight[i].id == 0 || now - in_flight[i].sent < RESPONSE_TIMEOUT_MS) {
+                        continue;
+                    }
+                    if (in_flight[i].retries < ACCESS_MAX_RETRIES) {
+                        in_flight[i].retries++;
+                        Serial.print("Response timeout, resending access ");
+                        Serial.println(in_flight[i].id);
+                        send_access(&in_flight[i]);
+                    } else {
+                        Serial.println("Timeout hitted... A response message has been lost");
+                        in_flight[i].id = 0;
                     }
-                    Serial.println();
-                    flag_init = 0;
-                } else {
-                    Serial.println("Unidentified ACK message");
-                    flag_init = 1;
-                    flag_auth = 1;
                 }
             }
-            cnt = 0;
-            cnt_ack = 0;
-            flag_ack = 0;
-        } else if(strcmp(topic, "reset") == 0){
-            Serial.println("Resetting system parameters...");
-            wifiManager.resetSettings();
-            delay(3000);
-            ESP.reset();
-            delay(5000);
+
+            // Replay the taps stored while offline, one batch at a time
+            if (journal_batch_seq != 0 && now - journal_batch_sent >= JOURNAL_ACK_TIMEOUT_MS) {
+                journal_batch_seq = 0;
+            }
+            if (journal_batch_seq == 0 && journal_pending() > 0) {
+                send_journal_batch();
+            }
+            break;
+    }
+    return true;
+}
+
+/*  Function used to act on the card just read on a lane, sending it to the backend or storing it while offline  */
+
+void handle_tap(uint8_t lane, const MFRC522::Uid* uid, unsigned long now, bool online) {
+    LaneState* state = &lane_state[lane];
+
+    // Optimistic signal from the local allow-list, the backend response still has the final word
+    AllowListResult local = allowlist_lookup(uid->uidByte, uid->size);
+
+    if (!online) {
+        // Keep the tap until the broker is back, it is replayed after the next handshake
+        if (journal_append(uid->uidByte, uid->size, now, lane_config[lane].door)) {
+            Serial.println("Broker unreachable, tap stored offline");
+            response_on(lane, local == ALLOWLIST_ALLOWED ? 210 : local == ALLOWLIST_DENIED ? 410 : 103);
         } else {
-            Serial.println("Topic not handled in this code... Please contact your system administrator");
+            response_on(lane, 404);
         }
+        last_event = now;
+        return;
+    }
 
-        flag_response = 0;
+    // The card is halted and will not be read again, a tap that cannot be sent yet is held until a request is free
+    if (find_request(lane, uid->uidByte, uid->size) != NULL) {
+        return;
+    }
+    AccessRequest* request = free_request(lane);
+    if (request == NULL) {
+        state->held = *uid;
+        return;
+    }
+    state->held.size = 0;
 
-    } else Serial.println("Message not for this device: " + mensagem);
+    // Sent message to MQTT server
+    request->id = next_access_id++;
+    if (next_access_id == 0) {
+        next_access_id = 1;
+    }
+    memcpy(request->uid, uid->uidByte, uid->size);
+    request->uid_size = uid->size;
+    request->retries = 0;
+    request->detected_us = detect_us;
+    request->lane = lane;
+    send_access(request);
+    last_access = now;
+    if (local != ALLOWLIST_UNKNOWN) {
+        response_on(lane, local == ALLOWLIST_ALLOWED ? 210 : 410);
+    }
 }
 
 /*****************************************************************************************************************/
@@ -389,67 +1079,77 @@ void callback(char* topic, byte* payload, unsigned int length) {
 
 void setup() {
     // put your setup code here, to run once:
+    boot_phase("core");
     Serial.begin(115200);
     Serial.println();
-    // wifiManager.resetSettings();
-    pinMode(RESET_PIN, INPUT);
-    pinMode(RED_LED, OUTPUT);
-    pinMode(GREEN_LED, OUTPUT);
-    SPI.begin();           // Init SPI bus
-    mfrc522.PCD_Init();    // Init MFRC522
-    Serial.println("MFRC522 Initialized");
 
-    // read configuration from FS json
+    // read configuration from FS
     Serial.print("Mounting File System.......");
-
-    if (SPIFFS.begin()) {
+    bool mounted = SPIFFS.begin();
+    if (mounted) {
         Serial.println("OK");
-        if (SPIFFS.exists("/config.json")) {
-            //file exists, reading and loading
-            Serial.println("Reading configuration file.....");
-            File configFile = SPIFFS.open("/config.json", "r");
-            if (configFile) {
-                Serial.println("Configuration file opened");
-                size_t size = configFile.size();
-                // Allocate a buffer to store contents of the file.
-                std::unique_ptr<char[]> buf(new char[size]);
-
-                configFile.readBytes(buf.get(), size);
-                DynamicJsonBuffer jsonBuffer;
-                JsonObject& json = jsonBuffer.parseObject(buf.get());
-                json.printTo(Serial);
-                if (json.success()) {
-                    Serial.println("JSON Parsed Successfully");
-                    strcpy(mqtt_server, json["mqtt_server"]);
-                    strcpy(key, json["key"]);
-                    strcpy(nodeMCUClient, json["nodeMCUClient"]);
-                    strcpy(userMQTT, json["userMQTT"]);
-                    strcpy(passwordMQTT, json["passwordMQTT"]);
-                } else {
-                    Serial.println("JSON Parse Failed");
-                }
-            }
-        }
+        boot_phase("fs");
     } else {
         Serial.println("FAILED");
     }
+
+    // Association with the credentials saved by the SDK goes on in the background while the reader and the
+    // settings are prepared, autoConnect() waits for it. It goes straight to the AP and channel of the last
+    // connection when they are known, from the RTC memory or else from flash, and only scans when they are not or
+    // the AP moved. The addresses still come from DHCP
+    wifiManager.setFastReconnect(WIFI_CACHE_RTC_OFFSET);
+    if (!wifiManager.getFastReconnectCache(&wifi_cache) && mounted && config_load_wifi(&wifi_cache)) {
+        wifiManager.setFastReconnectCache(&wifi_cache);
+    }
+    wifiManager.beginConnect();
+
+    // wifiManager.resetSettings();
+    pinMode(RESET_PIN, INPUT);
+    for (unsigned int i = 0; i < sizeof feedback_pins / sizeof feedback_pins[0]; i++) {
+        pinMode(feedback_pins[i][0], OUTPUT);
+        pinMode(feedback_pins[i][1], OUTPUT);
+        feedback_begin(feedback_pins[i][0], feedback_pins[i][1], feedback_pins[i][2]);
+    }
+    SPI.begin();           // Init SPI bus
+    lanes_begin(readers, lane_config, LANE_COUNT, RST_PIN);    // Init MFRC522 of every lane
+    idle_begin(readers, LANE_COUNT, IRQ_PIN);
+    presence_begin(PRESENCE_COOLDOWN_MS);
+    Serial.print("MFRC522 Initialized, lanes: ");
+    Serial.println(LANE_COUNT);
+    boot_phase("reader");
+
+    if (mounted) {
+        if (config_load(&config)) {
+            Serial.println("Configuration record loaded");
+        } else if (config_import(&config)) {
+            // First boot after an update or a damaged record, the JSON is converted once
+            Serial.println("Configuration imported from JSON");
+            shouldSaveConfig = true;
+        } else {
+            Serial.println("No configuration found");
+        }
+        boot_phase("config");
+        // Taps stored while offline survive reboots
+        journal_begin();
+        boot_phase("journal");
+    }
     // end read
 
-    Serial.println(mqtt_server);
-    Serial.println(key);
-    Serial.println(nodeMCUClient);
-    Serial.println(userMQTT);
-    Serial.println(passwordMQTT);
+    Serial.println(config.mqtt_server);
+    Serial.println(config.key);
+    Serial.println(config.nodeMCUClient);
+    Serial.println(config.userMQTT);
+    Serial.println(config.passwordMQTT);
 
     // The extra parameters to be configured (can be either global or just in the setup)
     // After connecting, parameter.getValue() will get you the configured value
     // id/name placeholder/prompt default length
 
-    WiFiManagerParameter custom_mqtt_server("mqtt_server", "MQTT Server", mqtt_server, 14);
-    WiFiManagerParameter custom_key("key", "AES key", key, 19);
-    WiFiManagerParameter custom_nodeMCUClient("nodeMCUClient", "NodeMCU Client", nodeMCUClient, 14);
-    WiFiManagerParameter custom_userMQTT("userMQTT", "MQTT Username", userMQTT, 14);
-    WiFiManagerParameter custom_passwordMQTT("passwordMQTT", "MQTT Password", passwordMQTT, 14);
+    WiFiManagerParameter custom_mqtt_server("mqtt_server", "MQTT Server", config.mqtt_server, 14);
+    WiFiManagerParameter custom_key("key", "AES key", config.key, 19);
+    WiFiManagerParameter custom_nodeMCUClient("nodeMCUClient", "NodeMCU Client", config.nodeMCUClient, 14);
+    WiFiManagerParameter custom_userMQTT("userMQTT", "MQTT Username", config.userMQTT, 14);
+    WiFiManagerParameter custom_passwordMQTT("passwordMQTT", "MQTT Password", config.passwordMQTT, 14);
 
     // WiFiManager
     // Local intialization. Once its business is done, there is no need to keep it around
@@ -494,45 +1194,45 @@ void setup() {
 
     // If you get here you have connected to the WiFi
     Serial.println("Connected to WIFI");
+    boot_phase("wifi");
+    print_wifi_timing();
+
+    // Keep the AP of this connection for the boots after a power cut, flash is only written when it changes
+    WiFiManagerCache current;
+    if (wifiManager.getFastReconnectCache(&current) && memcmp(&current, &wifi_cache, sizeof current) != 0) {
+        wifi_cache = current;
+        config_save_wifi(&wifi_cache);
+    }
 
     // Read updated parameters
 
-    strcpy(mqtt_server, custom_mqtt_server.getValue());
-    strcpy(key, custom_key.getValue());
-    strcpy(nodeMCUClient, custom_nodeMCUClient.getValue());
-    strcpy(userMQTT, custom_userMQTT.getValue());
-    strcpy(passwordMQTT, custom_passwordMQTT.getValue());
+    DeviceConfig entered;
+    config_copy_field(entered.mqtt_server, sizeof entered.mqtt_server, custom_mqtt_server.getValue());
+    config_copy_field(entered.key, sizeof entered.key, custom_key.getValue());
+    config_copy_field(entered.nodeMCUClient, sizeof entered.nodeMCUClient, custom_nodeMCUClient.getValue());
+    config_copy_field(entered.userMQTT, sizeof entered.userMQTT, custom_userMQTT.getValue());
+    config_copy_field(entered.passwordMQTT, sizeof entered.passwordMQTT, custom_passwordMQTT.getValue());
+    if (memcmp(&entered, &config, sizeof config) != 0) {
+        config = entered;
+        shouldSaveConfig = true;
+    }
 
-    // Save the custom parameters to FS
+    // Save the custom parameters to FS, only when they changed so a normal boot does not write the flash
     if (shouldSaveConfig) {
         Serial.println("Saving configuration");
-        DynamicJsonBuffer jsonBuffer;
-        JsonObject& json = jsonBuffer.createObject();
-
-        json["mqtt_server"] = mqtt_server;
-        json["key"] = key;//"M1k3y1sdAb3St0n3";
-        json["nodeMCUClient"] = nodeMCUClient;
-        json["userMQTT"] = userMQTT;
-        json["passwordMQTT"] = passwordMQTT;
-
-//        Serial.println("+++++++++++++++++");
-//
-//        Serial.println(nodeMCUClient);
-//        Serial.println(userMQTT);
-//        Serial.println(passwordMQTT);
-
-        File configFile = SPIFFS.open("/config.json", "w");
-        if (!configFile) {
+        if (!config_save(&config)) {
             Serial.println("Failed to open config file for writing");
         }
-
-        json.prettyPrintTo(Serial);
-        json.printTo(configFile);
-        configFile.close();
         //end save
     }
 //    Serial.println((char*)key_hmac);
-    CharToByte(key, key_hmac, KEY_LENGTH);
+    CharToByte(config.key, key_hmac, KEY_LENGTH);
+
+    // Session kept in the RTC memory through the last reset
+    restore_session();
+
+    // Local allow-list, the snapshots are verified with the device key
+    allowlist_begin(key_hmac, KEY_LENGTH);
 
 //    Serial.println("KEY HMAC + KEY: **********");
 //    Serial.println((char*)key_hmac);
@@ -545,20 +1245,42 @@ void setup() {
 //    Serial.println(WiFi.SSID());
 
     // Set mqtt server data
-    client.setServer(mqtt_server, mqtt_port);
+    client.setServer(config.mqtt_server, mqtt_port);
 
-    client.setCallback(callback);
+    client.setConnectCallback(mqtt_connect_step);
+    client.setStore(outbox);
 
     Serial.println(F("Ready!"));
 
     Serial.println("#############################################################################");
 
-    cnt = 0;
-
-    snprintf(buf_init, sizeof buf_init, "%s###%s", nodeMCUClient, "INIT");
+    last_event = millis();
+    last_metrics = millis();
+
+    // Per-device topics, advertised to the backend in the INIT message
+    snprintf(topic_root, sizeof topic_root, "%s%s/", TOPIC_ROOT, config.nodeMCUClient);
+    snprintf(topic_response, sizeof topic_response, "%sresponse", topic_root);
+    snprintf(topic_ack, sizeof topic_ack, "%sack", topic_root);
+    snprintf(topic_reset, sizeof topic_reset, "%sreset", topic_root);
+    snprintf(topic_allowlist, sizeof topic_allowlist, "%sallowlist", topic_root);
+    snprintf(topic_metrics, sizeof topic_metrics, "%smetrics", topic_root);
+    client.route(topic_response, route_response);
+    client.route(topic_ack, route_ack);
+    client.route(topic_reset, route_reset);
+    client.route(topic_allowlist, route_allowlist);
+    client.route(topic_metrics, route_metrics);
+    client.route("response", route_shared_response);
+    client.route("ack", route_shared_ack);
+    client.route("reset", route_shared_reset);
+
+    // The last field offers the binary wire format
+    snprintf(buf_init, sizeof buf_init, "%s###%s###%s###wire%d", config.nodeMCUClient, "INIT", topic_root,
+             WIRE_VERSION);
 
     response(101);
 
+    boot_phase("setup");
+    boot_print();
 }
 
 /*****************************************************************************************************************/
@@ -566,99 +1288,85 @@ void setup() {
 /************************************************* LOOP FUNCTION *************************************************/
 
 void loop() {
-    if (!client.connected()) {
-        Serial.println("Client not connected to MQTT, trying to reconnect...");
-        conectMqtt();
-    }
+    feedback_update();
 
-    client.loop();
+    bool online = client.connected();
 
-    // Enter here if flag_init = 1 --> Init step
-    if (flag_init){
-        client.publish("init", buf_init);
-        flag_init = 0;
-        Serial.println("Init message sent, waiting ACK");
-        flag_ack = 1;
+    if (!online) {
+        // Cards are read and journaled while the connection is set up
+        if (client.connecting()) {
+            client.loop();
+        } else {
+            conectMqtt();
+        }
+        online = client.connected();
     }
 
-    // Enter here if flag_ack = 1 device is waiting for an acknowledgment (ack) message
-    if (flag_ack){
-        cnt_ack = cnt_ack + 1;
-    }
-    // If ACK is not received we try to resend it two times and the reset the ESP
-    if (cnt_ack%100 == 0 && cnt_ack != 0){
-        Serial.println("ACK Counter: " + String(cnt_ack));
-        response(504);
-        flag_init = 1;
-        flag_auth = 1;
-        if (cnt_ack == 300) {
-            ESP.reset();
+    unsigned long now = millis();
+
+    if (online) {
+        client.loop();
+        if (metrics_requested || (now - last_metrics >= METRICS_PERIOD_MS && latency_samples() > 0)) {
+            send_metrics();
+        }
+        if (!protocol_step(now)) {
+            return;
+        }
+        if (!boot_reported()) {
+            send_boot_report();
         }
     }
 
-    if (cnt < 101) {
-        cnt = cnt + 1;
-    }
-    if (cnt%50 == 0){
-        Serial.println("Current RFID: " + String(currentCard));
+    // Follow the cards already read until they leave
+    int left = presence_step(now);
+    if (left >= 0) {
+        Serial.print("Card left lane ");
+        Serial.println(left);
     }
 
-    // When we send the RFID ID we may lose the response message, so we set a timeout
-    if (flag_response) {
-        cnt_response += 1;
-        if (cnt_response > timeout) {
-            Serial.println("Timeout hitted... A response message has been lost");
-            currentCardOld = currentCard;
-            currentCard = "";
-            flag_response = 0;
-        }
+    // Wait between card reads, only without pipelining
+    if (!pipelining && now - last_event < READ_GUARD_MS) {
+        return;
     }
 
-    // Enter here if flag_ack = 0 (device has already received ack from init step) and flag_auth = 0 (device has not been
-    // authenticated yet) --> Authentication step
-    if (!flag_ack && flag_auth) {
-        Serial.println("Going for authentication");
-        // Encode authCode (sessionId after HMAC encryption) and publish to hmac channel
-        base64_encode(authCodeb64, (char *)authCode, SHA256HMAC_SIZE);
-        snprintf(buf_hmac, sizeof buf_hmac, "%s###%s", nodeMCUClient, (char *)authCodeb64);
-        client.publish("hmac", buf_hmac);
-        flag_auth = 0;
-        flag_ack = 1;
-        // Until authentication process succeeds the device will not be able to read any card
-        delay(50);
-        return;
+    // Taps held until a request is free go first
+    for (unsigned int i = 0; online && i < LANE_COUNT; i++) {
+        if (lane_state[i].held.size != 0 && free_request(i) != NULL) {
+            handle_tap(i, &lane_state[i].held, now, online);
+            return;
+        }
     }
 
-    // Look for new cards
-    if ( ! mfrc522.PICC_IsNewCardPresent()) {
-        delay(50);
-        return;
+    // Look for new cards on every lane, while nobody is around with low power bursts and a sleep until the next ones
+    int lane;
+    detect_us = micros();
+    if (now - last_event >= IDLE_AFTER_MS && now - last_access >= IDLE_AFTER_MS && !feedback_busy() &&
+            find_answered(0) == NULL && !presence_any()) {
+        lane = idle_detect();
+        if (lane < 0) {
+            idle_sleep();
+            return;
+        }
+    } else {
+        idle_wake();
+        lane = lanes_poll();
+        if (lane < 0) {
+            return;
+        }
     }
+    unsigned long select_us = micros();
+    latency_record(LATENCY_DETECT, select_us - detect_us);
     // Select one of the cards
-    if ( ! mfrc522.PICC_ReadCardSerial()) {
-        delay(50);
+    if ( ! lanes_read(lane)) {
         return;
     }
-
-    if (cnt > 25 && !flag_response) { // this cnt allows to make a wait between card reads
-        // Encrypt RFID ID to be sent over access channel
-        dump_byte_array(mfrc522.uid.uidByte, mfrc522.uid.size); // Here we set the value for currentCard
-        encrypt_rfid(rfidstr, iv_py);
-
-        // Sent message to MQTT server
-        if(currentCard != currentCardOld || cnt > 60){ // this cnt allows to set the time between card reads for the same card
-            Serial.println("Message sent: " + String(rfid_b64));
-            snprintf(buf_access, sizeof buf_access, "%s###%s", nodeMCUClient, rfid_b64);
-            client.publish("access", buf_access);
-            flag_response = 1;
-        } else {
-            currentCard = "";
-        }
-        // Memory reset
-        memset(rfid_b64, 0, sizeof(rfid_b64));
-        memset(rfidstr, 0, sizeof(rfidstr));
-        memset(buf_hmac, 0, sizeof(buf_hmac));
-        memset(buf_access, 0, sizeof(buf_access));
+    latency_record(LATENCY_SELECT, micros() - select_us);
+    if (!presence_arrived(lane, &readers[lane].uid, now)) {
+        return;
     }
 
+    // The tap path must not allocate from the heap
+    HOT_PATH_BEGIN();
+    handle_tap(lane, &readers[lane].uid, now, online);
+    HOT_PATH_END("tap");
 }
@@ -0,0 +1,117 @@
+#include "presence.h"
+#include "lanes.h"
+
+struct Tracked {
+    MFRC522::Uid uid;
+    bool present;
+    uint8_t misses;         // Checks without an answer in a row
+    unsigned long checked;  // millis() of the last check
+    unsigned long seen;     // millis() of the last answer
+};
+
+struct Recent {
+    uint8_t lane;
+    uint8_t size;           // 0 for a free entry
+    byte uid[10];
+    unsigned long seen;     // millis() when the card was last known to be in the field
+};
+
+static Tracked tracked[LANE_MAX];
+static Recent recent[PRESENCE_RECENT];
+static unsigned long cooldown = PRESENCE_COOLDOWN_MS;
+
+static bool same_uid(const MFRC522::Uid* a, const byte* uid, byte size) {
+    return a->size == size && memcmp(a->uidByte, uid, size) == 0;
+}
+
+static Recent* find_recent(uint8_t lane, const byte* uid, byte size) {
+    for (uint8_t i = 0; i < PRESENCE_RECENT; i++) {
+        if (recent[i].size == size && recent[i].lane == lane && memcmp(recent[i].uid, uid, size) == 0) {
+            return &recent[i];
+        }
+    }
+    return NULL;
+}
+
+/*  Note when a card was last seen, in a free entry or in place of the least recently seen one  */
+
+static void remember(uint8_t lane, const MFRC522::Uid* uid, unsigned long seen) {
+    Recent* entry = find_recent(lane, uid->uidByte, uid->size);
+
+    for (uint8_t i = 0; entry == NULL && i < PRESENCE_RECENT; i++) {
+        if (recent[i].size == 0) {
+            entry = &recent[i];
+        }
+    }
+    if (entry == NULL) {
+        entry = &recent[0];
+        for (uint8_t i = 1; i < PRESENCE_RECENT; i++) {
+            if ((long)(recent[i].seen - entry->seen) < 0) {
+                entry = &recent[i];
+            }
+        }
+    }
+    entry->lane = lane;
+    entry->size = uid->size;
+    memcpy(entry->uid, uid->uidByte, uid->size);
+    entry->seen = seen;
+}
+
+void presence_begin(unsigned long cooldown_ms) {
+    cooldown = cooldown_ms;
+    memset(tracked, 0, sizeof tracked);
+    memset(recent, 0, sizeof recent);
+}
+
+bool presence_arrived(uint8_t lane, const MFRC522::Uid* uid, unsigned long now) {
+    if (lane >= LANE_MAX) {
+        return true;
+    }
+    Tracked* card = &tracked[lane];
+    lanes_halt(lane);
+
+    // Another card read on the lane takes the place of the tracked one, that was still there a moment ago
+    bool again = card->present && same_uid(&card->uid, uid->uidByte, uid->size);
+    if (card->present && !again) {
+        remember(lane, &card->uid, now);
+    }
+    Recent* entry = find_recent(lane, uid->uidByte, uid->size);
+    again = again || (entry != NULL && now - entry->seen < cooldown);
+
+    card->uid = *uid;
+    card->present = true;
+    card->misses = 0;
+    card->checked = now;
+    card->seen = now;
+    remember(lane, uid, now);
+    return !again;
+}
+
+int presence_step(unsigned long now) {
+    for (uint8_t lane = 0; lane < lanes_count() && lane < LANE_MAX; lane++) {
+        Tracked* card = &tracked[lane];
+
+        if (!card->present || now - card->checked < PRESENCE_CHECK_MS) {
+            continue;
+        }
+        card->checked = now;
+        if (lanes_present(lane, &card->uid)) {
+            card->misses = 0;
+            card->seen = now;
+        } else if (++card->misses >= PRESENCE_MISSES) {
+            card->present = false;
+            remember(lane, &card->uid, card->seen);
+            return lane;
+        }
+    }
+    return -1;
+}
+
+bool presence_any() {
+    for (uint8_t lane = 0; lane < LANE_MAX; lane++) {
+        if (tracked[lane].present) {
+            return true;
+        }
+    }
+    return false;
+}
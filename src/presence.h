@@ -0,0 +1,43 @@
+/************************************************* CARD PRESENCE *************************************************/
+/*                                                                                                               */
+/* Tracks the card in front of every lane at the RF level, so a tap is one presentation of a card and not one    */
+/* read of it. The card read on a lane is halted (lanes.h): it no longer answers the REQA rounds while it stays   */
+/* in the field, and every PRESENCE_CHECK_MS it is woken up with WUPA and selected by its UID to check it is      */
+/* still there. After PRESENCE_MISSES checks without an answer it has left. A card left on the reader is sent   */
+/* once, and the next card shown by somebody else is seen at the next round whatever the one before was.         */
+/*                                                                                                               */
+/* The field has to stay on for a halted card to stay halted, so the idle bursts wait until every card has left. */
+/*                                                                                                               */
+/* Recent cards are kept in a small LRU list with the last time they were seen. A card shown again within the    */
+/* cooldown after it left, or woken up by the check of another card on the same lane, is the same presentation.  */
+/*                                                                                                               */
+/*****************************************************************************************************************/
+
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include <Arduino.h>
+#include "MFRC522.h"
+
+#define PRESENCE_CHECK_MS 100      // Time between two checks of a halted card
+#define PRESENCE_RECENT 8          // Cards in the LRU list
+#ifndef PRESENCE_MISSES
+#define PRESENCE_MISSES 3          // Checks without an answer before a card has left
+#endif
+#ifndef PRESENCE_COOLDOWN_MS
+#define PRESENCE_COOLDOWN_MS 1000  // Time after a card left during which it is not a new presentation
+#endif
+
+/*  Set the cooldown of the cards that left, and forget every card  */
+void presence_begin(unsigned long cooldown_ms);
+
+/*  Card read on a lane: halt it and track it. True if it arrived, false if it is the same presentation  */
+bool presence_arrived(uint8_t lane, const MFRC522::Uid* uid, unsigned long now);
+
+/*  Check the cards that are due, returns a lane whose card has left or -1  */
+int presence_step(unsigned long now);
+
+/*  True while a card is tracked on any lane  */
+bool presence_any();
+
+#endif
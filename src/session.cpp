@@ -0,0 +1,44 @@
+#include "session.h"
+#include "crc.h"
+
+#define SESSION_MAGIC 0x53455331 // "SES1"
+
+struct SessionRecord {
+    uint32_t magic;
+    StoredSession session;
+    uint32_t crc;                // CRC-16 of the fields above, 32 bits to keep the record a whole number of blocks
+};
+
+bool session_load(StoredSession* session) {
+    SessionRecord record;
+
+    if (!ESP.rtcUserMemoryRead(SESSION_RTC_OFFSET, (uint32_t*)&record, sizeof record)) {
+        return false;
+    }
+    if (record.magic != SESSION_MAGIC || record.crc != crc16((const uint8_t*)&record, offsetof(SessionRecord, crc)) ||
+            strnlen(record.session.id, sizeof record.session.id) != SESSION_ID_LENGTH) {
+        return false;
+    }
+    *session = record.session;
+    return true;
+}
+
+void session_store(const StoredSession* session) {
+    SessionRecord record;
+
+    // Padding included in the CRC, it has to be deterministic
+    memset(&record, 0, sizeof record);
+    record.magic = SESSION_MAGIC;
+    memcpy(record.session.id, session->id, sizeof record.session.id);
+    memcpy(record.session.auth, session->auth, sizeof record.session.auth);
+    record.session.flags = session->flags;
+    record.session.lifetime = session->lifetime;
+    record.crc = crc16((const uint8_t*)&record, offsetof(SessionRecord, crc));
+    ESP.rtcUserMemoryWrite(SESSION_RTC_OFFSET, (uint32_t*)&record, sizeof record);
+}
+
+void session_clear() {
+    uint32_t magic = 0;
+
+    ESP.rtcUserMemoryWrite(SESSION_RTC_OFFSET, &magic, sizeof magic);
+}
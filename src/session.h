@@ -0,0 +1,44 @@
+/*********************************************** RESUMABLE SESSION **********************************************/
+/*                                                                                                               */
+/* Keeps the authenticated session in the RTC user memory, which survives ESP.reset() and watchdog resets but    */
+/* not a power cut. After a reset or a reconnect the device sends a RESUME message with the stored session ID     */
+/* and HMAC instead of the INIT / HMAC handshake, and can read cards again after a single round trip:            */
+/*                                                                                                               */
+/*     resume: nodeMCUClient###sessionID###Base64(HMAC(sessionID))###rfid/<nodeMCUClient>/###wire<version>       */
+/*                                                                                                               */
+/* The backend answers on the ack topic with authenticationSuccessful if the session is still open, or with      */
+/* sessionExpired / notAuthenticated, after which the device starts over with INIT. A backend that does not      */
+/* answer at all is treated the same way.                                                                        */
+/*                                                                                                               */
+/*****************************************************************************************************************/
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <Arduino.h>
+
+#define SESSION_RTC_OFFSET 40   // First RTC user memory block of the stored session, after the 32 blocks of OTA
+                                // updates and the 8 of the WiFiManager cache
+#define SESSION_ID_LENGTH 16
+#define SESSION_AUTH_SIZE 32    // HMAC-SHA256 of the session ID
+
+#define SESSION_PIPELINING 0x01 // The backend echoes the correlation IDs
+#define SESSION_DEVICE_TOPICS 0x02 // The backend answers on the per-device topics
+
+struct StoredSession {
+    char id[SESSION_ID_LENGTH + 1];
+    byte auth[SESSION_AUTH_SIZE];
+    uint8_t flags;              // SESSION_PIPELINING / SESSION_DEVICE_TOPICS mask
+    uint32_t lifetime;          // Milliseconds left before the device stops trying to resume it
+};
+
+/*  Read the stored session, returns false if there is none or the RTC memory holds garbage  */
+bool session_load(StoredSession* session);
+
+/*  Store a session, replacing the previous one  */
+void session_store(const StoredSession* session);
+
+/*  Forget the stored session  */
+void session_clear();
+
+#endif
@@ -0,0 +1,62 @@
+#include <Crypto.h>
+#include "wire.h"
+
+/*  Truncated HMAC-SHA256 of a buffer  */
+
+static void wire_mac(const byte* data, int length, byte* mac, const byte* key, unsigned int key_length) {
+    SHA256HMAC hmac(key, key_length);
+    byte digest[SHA256HMAC_SIZE];
+
+    hmac.doUpdate(data, length);
+    hmac.doFinal(digest);
+    memcpy(mac, digest, WIRE_MAC_SIZE);
+}
+
+bool wire_equal(const byte* a, const byte* b, int length) {
+    // Compare every byte so the time does not depend on where they differ
+    byte diff = 0;
+    for (int i = 0; i < length; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+int wire_encode(byte* out, int size, uint8_t type, const char* id, uint16_t seq, const byte* body, int body_length,
+                const byte* key, unsigned int key_length) {
+    int id_length = strlen(id);
+    int length = 3 + id_length + 2 + body_length;
+
+    if (id_length > 255 || length + WIRE_MAC_SIZE > size) {
+        return 0;
+    }
+    out[0] = WIRE_VERSION;
+    out[1] = type;
+    out[2] = id_length;
+    memcpy(out + 3, id, id_length);
+    out[3 + id_length] = seq >> 8;
+    out[4 + id_length] = seq & 0xFF;
+    memcpy(out + 5 + id_length, body, body_length);
+    wire_mac(out, length, out + length, key, key_length);
+    return length + WIRE_MAC_SIZE;
+}
+
+bool wire_decode(const byte* in, int length, WireFrame* frame, const byte* key, unsigned int key_length) {
+    byte mac[WIRE_MAC_SIZE];
+
+    if (length < 3 + 2 + WIRE_MAC_SIZE || in[0] != WIRE_VERSION || length < 3 + in[2] + 2 + WIRE_MAC_SIZE) {
+        return false;
+    }
+    int signed_length = length - WIRE_MAC_SIZE;
+    wire_mac(in, signed_length, mac, key, key_length);
+    if (!wire_equal(mac, in + signed_length, WIRE_MAC_SIZE)) {
+        return false;
+    }
+
+    frame->type = in[1];
+    frame->id_length = in[2];
+    frame->id = (const char*)in + 3;
+    frame->seq = (in[3 + frame->id_length] << 8) | in[4 + frame->id_length];
+    frame->body = in + 5 + frame->id_length;
+    frame->body_length = signed_length - 5 - frame->id_length;
+    return true;
+}
@@ -0,0 +1,68 @@
+/************************************************ BINARY WIRE FORMAT *********************************************/
+/*                                                                                                               */
+/* Compact alternative to the "nodeMCUClient###payload" text messages. Every frame is:                           */
+/*                                                                                                               */
+/*     version(1) type(1) id_length(1) id(id_length) seq(2) body(...) mac(WIRE_MAC_SIZE)                         */
+/*                                                                                                               */
+/* seq is big-endian; for access and response frames it is the correlation ID of the request. The MAC is the    */
+/* HMAC-SHA256 of everything before it with the device key, truncated to WIRE_MAC_SIZE bytes. Bodies:           */
+/*                                                                                                               */
+/*     - WIRE_HMAC: the 32 bytes of the HMAC of the session ID                                                   */
+/*                                                                                                               */
+/*     - WIRE_ACCESS: AES-CBC of the raw UID bytes, PKCS#7 padded, with the session ID as IV. Nodes with several */
+/*       lanes put the door ID (1) before it, the body length is then not a multiple of the AES block           */
+/*                                                                                                               */
+/*     - WIRE_ACK: status(1), followed by the 16 characters of the session ID for WIRE_ACK_SESSION or by the     */
+/*       big-endian sequence number (4) for WIRE_ACK_STORED                                                      */
+/*                                                                                                               */
+/*     - WIRE_RESPONSE: response code (2, big-endian)                                                            */
+/*                                                                                                               */
+/* The device offers the format in its INIT message and answers in binary once the backend does. The version    */
+/* byte is never a printable character, so both formats can share the same topics.                              */
+/*                                                                                                               */
+/*****************************************************************************************************************/
+
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <Arduino.h>
+
+#define WIRE_VERSION 0x01
+#define WIRE_MAC_SIZE 8
+
+enum WireType {
+    WIRE_HMAC = 1,
+    WIRE_ACCESS = 2,
+    WIRE_ACK = 3,
+    WIRE_RESPONSE = 4
+};
+
+enum WireAckStatus {
+    WIRE_ACK_SESSION = 0,          // Init ACK with session ID
+    WIRE_ACK_AUTH_OK = 1,          // authenticationSuccessful
+    WIRE_ACK_AUTH_FAILED = 2,      // authenticationFailed
+    WIRE_ACK_SESSION_EXPIRED = 3,  // sessionExpired
+    WIRE_ACK_NOT_AUTHENTICATED = 4,// notAuthenticated
+    WIRE_ACK_STORED = 5            // stored:<seq>
+};
+
+struct WireFrame {
+    uint8_t type;
+    const char* id;        // Device ID, not NUL terminated
+    uint8_t id_length;
+    uint16_t seq;
+    const byte* body;
+    uint16_t body_length;
+};
+
+/*  Compare two buffers in a time that only depends on the length, for MACs and other secrets  */
+bool wire_equal(const byte* a, const byte* b, int length);
+
+/*  Build a frame into out, returns its length or 0 if it does not fit  */
+int wire_encode(byte* out, int size, uint8_t type, const char* id, uint16_t seq, const byte* body, int body_length,
+                const byte* key, unsigned int key_length);
+
+/*  Parse and authenticate a frame, the fields of frame point into in  */
+bool wire_decode(const byte* in, int length, WireFrame* frame, const byte* key, unsigned int key_length);
+
+#endif
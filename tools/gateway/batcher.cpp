@@ -0,0 +1,53 @@
+/*
+ batcher.cpp - Events on their way to the backend
+*/
+
+#include "batcher.h"
+
+Batcher::Batcher(Mqtt& mqtt, Counters& counters, const std::string& topic, size_t size, uint64_t wait_ms)
+    : _mqtt(mqtt), _counters(counters), _topic(topic), _size(size), _waitMs(wait_ms), _count(0), _since(0) {}
+
+void Batcher::add(const std::vector<std::string>& events, const std::vector<Message>& after) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for (size_t i = 0; i < events.size(); i++) {
+        if (_count == 0) {
+            _since = monotonic_ms();
+        }
+        _lines += events[i];
+        _lines += '\n';
+        _count++;
+        if (_count >= _size) {
+            publish();
+        }
+    }
+    _after.insert(_after.end(), after.begin(), after.end());
+    if (_count == 0 && !_after.empty()) {
+        publish();
+    }
+}
+
+void Batcher::flush(bool force) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_count > 0 && (force || monotonic_ms() - _since >= _waitMs)) {
+        publish();
+    }
+}
+
+/*  With the mutex held  */
+
+void Batcher::publish() {
+    if (_count > 0) {
+        _mqtt.publish(_topic, _lines);
+        _counters.events += _count;
+        _counters.batches++;
+    }
+    for (size_t i = 0; i < _after.size(); i++) {
+        _mqtt.publish(_after[i].topic, _after[i].payload);
+        _counters.replies++;
+    }
+    _lines.clear();
+    _count = 0;
+    _after.clear();
+}
@@ -0,0 +1,43 @@
+/*
+ batcher.h - Events on their way to the backend, one line each, published as a single message once the batch is full
+ or its oldest event has waited long enough. The messages held back with the events, the stored ACKs of offline
+ batches, go out right after the batch that carries them.
+*/
+
+#ifndef GATEWAY_BATCHER_H
+#define GATEWAY_BATCHER_H
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "mqtt.h"
+#include "sessions.h"
+
+class Batcher {
+public:
+    Batcher(Mqtt& mqtt, Counters& counters, const std::string& topic, size_t size, uint64_t wait_ms);
+
+    /*  Add the events and held back messages of one device message, publishes the batch if it is full  */
+    void add(const std::vector<std::string>& events, const std::vector<Message>& after);
+
+    /*  Publish the batch if its oldest event is older than the wait, or anyway when force is set  */
+    void flush(bool force);
+
+private:
+    void publish();
+
+    Mqtt& _mqtt;
+    Counters& _counters;
+    std::string _topic;
+    size_t _size;
+    uint64_t _waitMs;
+
+    std::mutex _mutex;          // Held while publishing too, so the batches go out in the order they were filled
+    std::string _lines;
+    size_t _count;
+    uint64_t _since;            // When the first event of the batch came in
+    std::vector<Message> _after;
+};
+
+#endif
@@ -0,0 +1,314 @@
+/*
+ gateway.cpp - Access gateway between the readers and the backend: takes over the init, hmac, resume, access and
+ offline topics, runs the handshake, checks the HMACs and decrypts the taps with the firmware's own crypto code, and
+ forwards the decoded taps to the backend in batches on the events topic. The backend answers with decision lines
+ on the decisions topic, which the gateway turns into responses for the devices. Run with --help for the options.
+
+ One thread reads the broker connection and hands every message to the worker owning its device, picked from a
+ hash of the device ID, so the work spreads over the cores while the messages of a device keep their order.
+*/
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include "batcher.h"
+#include "sessions.h"
+#include "../../src/wire.h"
+
+#define RECONNECT_MIN_MS 500
+#define RECONNECT_MAX_MS 30000
+
+struct Options {
+    const char* host;
+    const char* port;
+    const char* client_id;
+    const char* keys;
+    unsigned workers;
+    unsigned batch;
+    unsigned batch_ms;
+    const char* events;
+    const char* decisions;
+    unsigned stats;
+};
+
+static Options options = {"localhost", "1883", "rfid-gateway", NULL, 0, 64, 20, "gateway/events",
+                          "gateway/decisions", 10};
+static const char* device_topics[] = {"init", "hmac", "resume", "access", "offline"};
+static volatile sig_atomic_t stopping = 0;
+
+/*  Workers  */
+
+class Worker {
+public:
+    Worker(Counters& counters, Mqtt& mqtt, Batcher& batcher)
+        : _sessions(counters), _mqtt(mqtt), _batcher(batcher), _counters(counters), _stop(false) {}
+
+    Sessions& sessions() { return _sessions; }
+
+    void start() { _thread = std::thread(&Worker::run, this); }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _ready.notify_one();
+        _thread.join();
+    }
+
+    /*  Device message, or a decision line when the topic is empty  */
+    void push(const std::string& topic, const std::string& payload) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _queue.push_back(Message());
+            _queue.back().topic = topic;
+            _queue.back().payload = payload;
+        }
+        _ready.notify_one();
+    }
+
+private:
+    void run() {
+        std::deque<Message> jobs;
+
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _ready.wait(lock, [this]() { return _stop || !_queue.empty(); });
+                if (_queue.empty()) {
+                    return;
+                }
+                jobs.swap(_queue);
+            }
+            for (size_t i = 0; i < jobs.size(); i++) {
+                Outcome out;
+                if (jobs[i].topic.empty()) {
+                    _sessions.decide(jobs[i].payload, out);
+                } else {
+                    _sessions.handle(jobs[i].topic, jobs[i].payload, out);
+                }
+                for (size_t r = 0; r < out.replies.size(); r++) {
+                    _mqtt.publish(out.replies[r].topic, out.replies[r].payload);
+                    _counters.replies++;
+                }
+                if (!out.events.empty() || !out.after.empty()) {
+                    _batcher.add(out.events, out.after);
+                }
+            }
+            jobs.clear();
+        }
+    }
+
+    Sessions _sessions;
+    Mqtt& _mqtt;
+    Batcher& _batcher;
+    Counters& _counters;
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _ready;
+    std::deque<Message> _queue;
+    bool _stop;
+};
+
+static std::vector<Worker*> workers;
+
+static Worker& owner(const std::string& id) {
+    return *workers[std::hash<std::string>()(id) % workers.size()];
+}
+
+/*  Device ID of a message: in the header of a binary frame, before the first ### of a text message  */
+
+static void dispatch(const std::string& topic, const uint8_t* payload, size_t length) {
+    if (topic == options.decisions) {
+        std::istringstream lines(std::string((const char*)payload, length));
+        std::string line;
+        while (std::getline(lines, line)) {
+            if (!line.empty()) {
+                owner(line.substr(0, line.find(','))).push("", line);
+            }
+        }
+        return;
+    }
+
+    std::string message((const char*)payload, length);
+    if (length >= 3 && payload[0] == WIRE_VERSION) {
+        if (length >= 3 + (size_t)payload[2]) {
+            owner(message.substr(3, payload[2])).push(topic, message);
+        }
+        return;
+    }
+    size_t separator = message.find("###");
+    if (separator != std::string::npos) {
+        owner(message.substr(0, separator)).push(topic, message);
+    }
+}
+
+/*  Keys file: one "<device ID> <key>" per line, # starts a comment  */
+
+static bool load_keys(const char* path) {
+    std::ifstream file(path);
+    std::string line;
+    unsigned count = 0;
+
+    if (!file) {
+        fprintf(stderr, "gateway: cannot read %s\n", path);
+        return false;
+    }
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string id;
+        std::string key;
+        if (!(fields >> id) || id[0] == '#') {
+            continue;
+        }
+        if (!(fields >> key) || key.size() != KEY_LENGTH) {
+            fprintf(stderr, "gateway: %s: the key of %s needs %d characters\n", path, id.c_str(), KEY_LENGTH);
+            return false;
+        }
+        owner(id).sessions().provision(id, key.c_str());
+        count++;
+    }
+    fprintf(stderr, "gateway: %u devices, %zu workers\n", count, workers.size());
+    return true;
+}
+
+/*  Options  */
+
+static void usage(const char* program) {
+    printf("Usage: %s --keys=FILE [options]\n"
+           "  --keys=FILE         device IDs and their keys, one \"<id> <key>\" per line\n"
+           "  --host=HOST         MQTT broker (%s)\n"
+           "  --port=PORT         (%s)\n"
+           "  --client-id=ID      (%s)\n"
+           "  --workers=N         threads doing the crypto, the number of cores when not given\n"
+           "  --batch=N           events per message to the backend (%u)\n"
+           "  --batch-ms=MS       longest an event waits for its batch to fill (%u)\n"
+           "  --events=TOPIC      where the batches go (%s)\n"
+           "  --decisions=TOPIC   where the backend answers (%s)\n"
+           "  --stats=S           counters on stderr every S seconds, 0 for none (%u)\n",
+           program, options.host, options.port, options.client_id, options.batch, options.batch_ms, options.events,
+           options.decisions, options.stats);
+}
+
+static void parse_options(int argc, char** argv) {
+    static const struct option long_options[] = {
+        {"keys", required_argument, NULL, 'k'},
+        {"host", required_argument, NULL, 'h'},
+        {"port", required_argument, NULL, 'p'},
+        {"client-id", required_argument, NULL, 'i'},
+        {"workers", required_argument, NULL, 'w'},
+        {"batch", required_argument, NULL, 'b'},
+        {"batch-ms", required_argument, NULL, 'm'},
+        {"events", required_argument, NULL, 'e'},
+        {"decisions", required_argument, NULL, 'd'},
+        {"stats", required_argument, NULL, 's'},
+        {"help", no_argument, NULL, '?'},
+        {NULL, 0, NULL, 0}
+    };
+    int c;
+
+    while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'k': options.keys = optarg; break;
+            case 'h': options.host = optarg; break;
+            case 'p': options.port = optarg; break;
+            case 'i': options.client_id = optarg; break;
+            case 'w': options.workers = atoi(optarg); break;
+            case 'b': options.batch = atoi(optarg); break;
+            case 'm': options.batch_ms = atoi(optarg); break;
+            case 'e': options.events = optarg; break;
+            case 'd': options.decisions = optarg; break;
+            case 's': options.stats = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                exit(c == '?' ? 0 : 1);
+        }
+    }
+    if (options.keys == NULL) {
+        usage(argv[0]);
+        exit(1);
+    }
+    if (options.workers == 0) {
+        options.workers = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+    }
+    if (options.batch == 0) {
+        options.batch = 1;
+    }
+}
+
+static void on_signal(int) {
+    stopping = 1;
+}
+
+static void print_stats(const Counters& counters) {
+    fprintf(stderr, "gateway: %llu messages, %llu replies, %llu events in %llu batches, %llu rejected, "
+            "%llu unknown\n", (unsigned long long)counters.messages, (unsigned long long)counters.replies,
+            (unsigned long long)counters.events, (unsigned long long)counters.batches,
+            (unsigned long long)counters.rejected, (unsigned long long)counters.unknown);
+}
+
+int main(int argc, char** argv) {
+    parse_options(argc, argv);
+
+    Counters counters;
+    Mqtt mqtt;
+    Batcher batcher(mqtt, counters, options.events, options.batch, options.batch_ms);
+
+    for (unsigned i = 0; i < options.workers; i++) {
+        workers.push_back(new Worker(counters, mqtt, batcher));
+    }
+    if (!load_keys(options.keys)) {
+        return 1;
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->start();
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    // The sessions live in the workers, a new connection to the broker keeps them
+    uint64_t backoff = RECONNECT_MIN_MS;
+    uint64_t next_stats = monotonic_ms() + options.stats * 1000;
+    while (!stopping) {
+        if (!mqtt.connected()) {
+            if (!mqtt.connect(options.host, options.port, options.client_id)) {
+                fprintf(stderr, "gateway: cannot connect to %s:%s, retrying in %llu ms\n", options.host,
+                        options.port, (unsigned long long)backoff);
+                usleep(backoff * 1000);
+                backoff = std::min<uint64_t>(backoff * 2, RECONNECT_MAX_MS);
+                continue;
+            }
+            backoff = RECONNECT_MIN_MS;
+            for (size_t i = 0; i < sizeof device_topics / sizeof device_topics[0]; i++) {
+                mqtt.subscribe(device_topics[i]);
+            }
+            mqtt.subscribe(options.decisions);
+            fprintf(stderr, "gateway: connected to %s:%s\n", options.host, options.port);
+        }
+        mqtt.loop(options.batch_ms > 0 ? options.batch_ms : 1, dispatch);
+        batcher.flush(false);
+        if (options.stats > 0 && monotonic_ms() >= next_stats) {
+            print_stats(counters);
+            next_stats += options.stats * 1000;
+        }
+    }
+
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->stop();
+        delete workers[i];
+    }
+    batcher.flush(true);
+    print_stats(counters);
+    mqtt.disconnect();
+    return 0;
+}
@@ -0,0 +1,245 @@
+/*
+ mqtt.cpp - Minimal MQTT 3.1.1 client for the gateway
+*/
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "mqtt.h"
+
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_SUBSCRIBE 0x82
+#define MQTT_PINGREQ 0xC0
+#define MQTT_DISCONNECT 0xE0
+
+uint64_t monotonic_ms() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+Mqtt::Mqtt() : _socket(-1), _nextId(1), _lastSend(0) {}
+
+Mqtt::~Mqtt() {
+    disconnect();
+}
+
+/*  Fixed header: the type and the remaining length, 7 bits per byte  */
+
+static void begin_packet(std::vector<uint8_t>& packet, uint8_t type, size_t remaining) {
+    packet.reserve(5 + remaining);
+    packet.push_back(type);
+    do {
+        uint8_t digit = remaining % 128;
+        remaining /= 128;
+        packet.push_back(remaining > 0 ? digit | 0x80 : digit);
+    } while (remaining > 0);
+}
+
+static void put_string(std::vector<uint8_t>& packet, const char* text, size_t length) {
+    packet.push_back(length >> 8);
+    packet.push_back(length & 0xFF);
+    packet.insert(packet.end(), text, text + length);
+}
+
+bool Mqtt::connect(const char* host, const char* port, const char* client_id) {
+    struct addrinfo hints;
+    struct addrinfo* addresses;
+
+    disconnect();
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &addresses) != 0) {
+        return false;
+    }
+    int fd = -1;
+    for (struct addrinfo* address = addresses; address != NULL && fd < 0; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd >= 0 && ::connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        return false;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    {
+        // The workers read it under the lock when they publish
+        std::lock_guard<std::mutex> lock(_writeMutex);
+        _socket = fd;
+    }
+
+    size_t id_length = strlen(client_id);
+    std::vector<uint8_t> packet;
+    begin_packet(packet, MQTT_CONNECT, 10 + 2 + id_length);
+    put_string(packet, "MQTT", 4);
+    packet.push_back(4);                    // Protocol level 3.1.1
+    packet.push_back(0x02);                 // Clean session
+    packet.push_back(MQTT_KEEPALIVE_S >> 8);
+    packet.push_back(MQTT_KEEPALIVE_S & 0xFF);
+    put_string(packet, client_id, id_length);
+
+    uint8_t type;
+    std::vector<uint8_t> body;
+    if (!send(packet) || !readPacket(MQTT_KEEPALIVE_S * 1000, &type, body) || (type & 0xF0) != MQTT_CONNACK ||
+            body.size() < 2 || body[1] != 0) {
+        disconnect();
+        return false;
+    }
+    return true;
+}
+
+void Mqtt::disconnect() {
+    std::lock_guard<std::mutex> lock(_writeMutex);
+
+    if (_socket >= 0) {
+        uint8_t packet[2] = {MQTT_DISCONNECT, 0};
+        ::send(_socket, packet, sizeof packet, MSG_NOSIGNAL);
+        close(_socket);
+        _socket = -1;
+    }
+    _in.clear();
+}
+
+bool Mqtt::send(const std::vector<uint8_t>& packet) {
+    std::lock_guard<std::mutex> lock(_writeMutex);
+    size_t sent = 0;
+
+    while (_socket >= 0 && sent < packet.size()) {
+        ssize_t n = ::send(_socket, packet.data() + sent, packet.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            // The loop notices the closed socket on its next read
+            shutdown(_socket, SHUT_RDWR);
+            return false;
+        }
+        sent += n;
+    }
+    _lastSend = monotonic_ms();
+    return sent == packet.size();
+}
+
+bool Mqtt::subscribe(const char* filter) {
+    size_t filter_length = strlen(filter);
+    std::vector<uint8_t> packet;
+
+    begin_packet(packet, MQTT_SUBSCRIBE, 2 + 2 + filter_length + 1);
+    packet.push_back(_nextId >> 8);
+    packet.push_back(_nextId & 0xFF);
+    if (++_nextId == 0) {
+        _nextId = 1;
+    }
+    put_string(packet, filter, filter_length);
+    packet.push_back(0);                    // QoS 0
+    return send(packet);
+}
+
+bool Mqtt::publish(const std::string& topic, const uint8_t* payload, size_t length) {
+    std::vector<uint8_t> packet;
+
+    begin_packet(packet, MQTT_PUBLISH, 2 + topic.size() + length);
+    put_string(packet, topic.data(), topic.size());
+    packet.insert(packet.end(), payload, payload + length);
+    return send(packet);
+}
+
+/*  Next complete packet, from the bytes already read or from the socket  */
+
+bool Mqtt::readPacket(int timeout_ms, uint8_t* type, std::vector<uint8_t>& body) {
+    uint64_t deadline = monotonic_ms() + timeout_ms;
+
+    while (_socket >= 0) {
+        // Remaining length, up to 4 bytes after the type
+        size_t remaining = 0;
+        size_t header = 0;
+        bool complete = false;
+        for (size_t i = 1; i < _in.size() && i <= 4; i++) {
+            remaining |= (size_t)(_in[i] & 0x7F) << (7 * (i - 1));
+            if ((_in[i] & 0x80) == 0) {
+                header = i + 1;
+                complete = true;
+                break;
+            }
+        }
+        if (complete && remaining > MQTT_MAX_PACKET) {
+            disconnect();
+            return false;
+        }
+        if (complete && _in.size() >= header + remaining) {
+            *type = _in[0];
+            body.assign(_in.begin() + header, _in.begin() + header + remaining);
+            _in.erase(_in.begin(), _in.begin() + header + remaining);
+            return true;
+        }
+
+        uint64_t now = monotonic_ms();
+        if (now >= deadline) {
+            return false;
+        }
+        struct pollfd fd = {_socket, POLLIN, 0};
+        int ready = poll(&fd, 1, (int)(deadline - now));
+        if (ready < 0 && errno != EINTR) {
+            disconnect();
+            return false;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        uint8_t buffer[4096];
+        ssize_t n = recv(_socket, buffer, sizeof buffer, 0);
+        if (n <= 0) {
+            disconnect();
+            return false;
+        }
+        _in.insert(_in.end(), buffer, buffer + n);
+    }
+    return false;
+}
+
+bool Mqtt::loop(int timeout_ms, const Callback& callback) {
+    uint8_t type;
+    std::vector<uint8_t> body;
+
+    // Everything already waiting, then at most timeout_ms for more
+    while (readPacket(timeout_ms, &type, body)) {
+        timeout_ms = 0;
+        if ((type & 0xF0) == MQTT_PUBLISH && (type & 0x06) == 0 && body.size() >= 2) {
+            size_t topic_length = (body[0] << 8) | body[1];
+            if (2 + topic_length <= body.size()) {
+                std::string topic((const char*)body.data() + 2, topic_length);
+                callback(topic, body.data() + 2 + topic_length, body.size() - 2 - topic_length);
+            }
+        }
+        // SUBACK and PINGRESP need nothing, the subscriptions are QoS 0
+    }
+    if (_socket < 0) {
+        return false;
+    }
+
+    uint64_t last_send;
+    {
+        std::lock_guard<std::mutex> lock(_writeMutex);
+        last_send = _lastSend;
+    }
+    if (monotonic_ms() - last_send >= MQTT_KEEPALIVE_S * 1000 / 2) {
+        std::vector<uint8_t> packet;
+        begin_packet(packet, MQTT_PINGREQ, 0);
+        return send(packet);
+    }
+    return true;
+}
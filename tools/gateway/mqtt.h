@@ -0,0 +1,55 @@
+/*
+ mqtt.h - Minimal MQTT 3.1.1 client over a plain TCP socket, all the gateway needs from the broker: CONNECT with a
+ clean session, SUBSCRIBE and PUBLISH at QoS 0 and the keepalive. loop() runs on one thread and hands the incoming
+ messages to the callback, publish() can be called from any thread.
+*/
+
+#ifndef GATEWAY_MQTT_H
+#define GATEWAY_MQTT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define MQTT_KEEPALIVE_S 30
+#define MQTT_MAX_PACKET 65536     // Longer packets from the broker close the connection
+
+class Mqtt {
+public:
+    typedef std::function<void(const std::string& topic, const uint8_t* payload, size_t length)> Callback;
+
+    Mqtt();
+    ~Mqtt();
+
+    /*  Open the connection and wait for the CONNACK, false on any failure  */
+    bool connect(const char* host, const char* port, const char* client_id);
+    void disconnect();
+    bool connected() const { return _socket >= 0; }
+
+    bool subscribe(const char* filter);
+    bool publish(const std::string& topic, const uint8_t* payload, size_t length);
+    bool publish(const std::string& topic, const std::string& payload) {
+        return publish(topic, (const uint8_t*)payload.data(), payload.size());
+    }
+
+    /*  Wait up to timeout_ms for packets and hand the messages to the callback, false once disconnected  */
+    bool loop(int timeout_ms, const Callback& callback);
+
+private:
+    bool send(const std::vector<uint8_t>& packet);
+    bool readPacket(int timeout_ms, uint8_t* type, std::vector<uint8_t>& body);
+
+    int _socket;
+    uint16_t _nextId;
+    std::mutex _writeMutex;       // Serializes the packets written by the workers and the loop
+    uint64_t _lastSend;           // Monotonic ms, for the keepalive
+    std::vector<uint8_t> _in;     // Bytes read and not parsed yet
+};
+
+/*  Monotonic clock in milliseconds  */
+uint64_t monotonic_ms();
+
+#endif
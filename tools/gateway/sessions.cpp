@@ -0,0 +1,405 @@
+/*
+ sessions.cpp - One shard of the gateway's session table
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <Crypto.h>
+#include "sessions.h"
+#include "../../src/wire.h"
+
+#define UID_MAX_SIZE 10
+#define OFFLINE_MAX_LENGTH 288    // Decrypted offline batch, longer ones are rejected by decrypt_text()
+
+Sessions::Sessions(Counters& counters) : _counters(counters) {}
+
+void Sessions::provision(const std::string& id, const char* key) {
+    Device& device = _devices[id];
+
+    snprintf(device.key, sizeof device.key, "%s", key);
+    device.session[0] = 0;
+    device.authenticated = false;
+    device.binary = false;
+    device.aes.set_key((byte*)device.key, 128);
+}
+
+Sessions::Device* Sessions::find(const std::string& id) {
+    std::unordered_map<std::string, Device>::iterator it = _devices.find(id);
+
+    if (it == _devices.end()) {
+        _counters.unknown++;
+        return NULL;
+    }
+    return &it->second;
+}
+
+/*  Split a message on ###, as the firmware and the Python backend do  */
+
+static size_t split(char* message, char** parts, size_t max) {
+    size_t count = 0;
+
+    while (count < max) {
+        parts[count++] = message;
+        char* separator = strstr(message, "###");
+        if (separator == NULL) {
+            break;
+        }
+        *separator = 0;
+        message = separator + 3;
+    }
+    return count;
+}
+
+static void to_hex(const uint8_t* data, size_t length, char* out) {
+    for (size_t i = 0; i < length; i++) {
+        out[2 * i] = "0123456789abcdef"[data[i] >> 4];
+        out[2 * i + 1] = "0123456789abcdef"[data[i] & 0xF];
+    }
+    out[2 * length] = 0;
+}
+
+static bool is_uid_hex(const char* hex, int length) {
+    if (length != 8 && length != 14 && length != 20) {
+        return false;
+    }
+    for (int i = 0; i < length; i++) {
+        if (strchr("0123456789abcdefABCDEF", hex[i]) == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*  Replies go to the device topics when the device advertised them, to the shared ones with <id>### otherwise.  */
+/*  Binary frames carry the device ID themselves and go out as they are                                         */
+
+Message Sessions::addressed(Device& device, const std::string& id, const char* kind, const std::string& payload,
+                            bool frame) {
+    Message message;
+
+    if (!device.root.empty()) {
+        message.topic = device.root + kind;
+        message.payload = payload;
+    } else {
+        message.topic = kind;
+        message.payload = frame ? payload : id + "###" + payload;
+    }
+    return message;
+}
+
+/*  ACK with a status, the session ID or stored:<seq>, as text or as a WIRE_ACK frame  */
+
+Message Sessions::ack(Device& device, const std::string& id, const char* status) {
+    static const struct {
+        const char* text;
+        uint8_t status;
+    } statuses[] = {
+        {"authenticationSuccessful", WIRE_ACK_AUTH_OK},
+        {"authenticationFailed", WIRE_ACK_AUTH_FAILED},
+        {"sessionExpired", WIRE_ACK_SESSION_EXPIRED},
+        {"notAuthenticated", WIRE_ACK_NOT_AUTHENTICATED}
+    };
+
+    if (!device.binary) {
+        return addressed(device, id, "ack", status, false);
+    }
+
+    byte body[1 + SESSION_ID_LENGTH];
+    int body_length = 1;
+    body[0] = WIRE_ACK_SESSION;
+    if (strncmp(status, "stored:", 7) == 0) {
+        unsigned long seq = strtoul(status + 7, NULL, 10);
+        body[0] = WIRE_ACK_STORED;
+        body[1] = seq >> 24;
+        body[2] = seq >> 16;
+        body[3] = seq >> 8;
+        body[4] = seq;
+        body_length = 5;
+    } else {
+        for (size_t i = 0; i < sizeof statuses / sizeof statuses[0]; i++) {
+            if (strcmp(status, statuses[i].text) == 0) {
+                body[0] = statuses[i].status;
+            }
+        }
+        if (body[0] == WIRE_ACK_SESSION) {
+            memcpy(body + 1, status, SESSION_ID_LENGTH);
+            body_length += SESSION_ID_LENGTH;
+        }
+    }
+    return frame(device, id, WIRE_ACK, 0, body, body_length, "ack");
+}
+
+Message Sessions::frame(Device& device, const std::string& id, uint8_t type, uint16_t seq, const byte* body,
+                        int body_length, const char* kind) {
+    byte out[64];
+
+    int length = wire_encode(out, sizeof out, type, id.c_str(), seq, body, body_length, (const byte*)device.key,
+                             KEY_LENGTH);
+    return addressed(device, id, kind, std::string((const char*)out, length), true);
+}
+
+/*  New session ID, 16 letters and digits like the Python backend's  */
+
+void Sessions::startSession(Device& device, const char* root, const char* wire) {
+    static const char letters[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+
+    for (int i = 0; i < SESSION_ID_LENGTH; i++) {
+        device.session[i] = letters[_random() % (sizeof letters - 1)];
+    }
+    device.session[SESSION_ID_LENGTH] = 0;
+    device.authenticated = false;
+    device.root = root != NULL && strncmp(root, TOPIC_ROOT, strlen(TOPIC_ROOT)) == 0 ? root : "";
+    device.binary = wire != NULL && strncmp(wire, "wire", 4) == 0 && atoi(wire + 4) == WIRE_VERSION;
+}
+
+void Sessions::handle(const std::string& kind, const std::string& payload, Outcome& out) {
+    _counters.messages++;
+    if (!payload.empty() && (uint8_t)payload[0] == WIRE_VERSION) {
+        handleFrame(payload, out);
+    } else {
+        handleText(kind, payload, out);
+    }
+}
+
+void Sessions::handleText(const std::string& kind, const std::string& payload, Outcome& out) {
+    std::string buffer(payload);
+    char* parts[5];
+    size_t count = split(&buffer[0], parts, 5);
+
+    Device* device = count >= 2 ? find(parts[0]) : NULL;
+    if (device == NULL) {
+        return;
+    }
+    std::string id(parts[0]);
+
+    if (kind == "init") {
+        // <id>###INIT###<root>###wire<version>
+        startSession(*device, count > 2 ? parts[2] : NULL, count > 3 ? parts[3] : NULL);
+        out.replies.push_back(ack(*device, id, device->session));
+    } else if (kind == "hmac") {
+        char expected[64];
+
+        if (device->session[0] == 0) {
+            out.replies.push_back(ack(*device, id, "sessionExpired"));
+            return;
+        }
+        auth_code(device->key, device->session, expected);
+        device->authenticated = strlen(parts[1]) == strlen(expected) &&
+                                wire_equal((const byte*)expected, (const byte*)parts[1], strlen(expected));
+        if (!device->authenticated) {
+            _counters.rejected++;
+        }
+        out.replies.push_back(ack(*device, id, device->authenticated ? "authenticationSuccessful" :
+                                  "authenticationFailed"));
+    } else if (kind == "resume") {
+        // <id>###<session ID>###<HMAC>###<root>###wire<version>, only the session still open here resumes
+        char expected[64];
+
+        bool valid = count >= 3 && device->authenticated && strlen(parts[1]) == strlen(device->session) &&
+                     wire_equal((const byte*)device->session, (const byte*)parts[1], strlen(device->session));
+        if (valid) {
+            auth_code(device->key, device->session, expected);
+            valid = strlen(parts[2]) == strlen(expected) &&
+                    wire_equal((const byte*)expected, (const byte*)parts[2], strlen(expected));
+        }
+        if (!valid) {
+            out.replies.push_back(ack(*device, id, "sessionExpired"));
+            return;
+        }
+        device->root = count > 3 && strncmp(parts[3], TOPIC_ROOT, strlen(TOPIC_ROOT)) == 0 ? parts[3] : "";
+        device->binary = count > 4 && strncmp(parts[4], "wire", 4) == 0 && atoi(parts[4] + 4) == WIRE_VERSION;
+        out.replies.push_back(ack(*device, id, "authenticationSuccessful"));
+    } else if (kind == "access") {
+        // <id>###<ciphertext>###<correlation ID>###<door>
+        char hex[64];
+
+        if (!device->authenticated) {
+            _counters.rejected++;
+            out.replies.push_back(ack(*device, id, "notAuthenticated"));
+            return;
+        }
+        int length = decrypt_text(device->aes, device->session, parts[1], strlen(parts[1]), hex, sizeof hex);
+        if (length < 0 || !is_uid_hex(hex, length)) {
+            _counters.rejected++;
+            return;
+        }
+        hex[length] = 0;
+        access(id, count > 2 ? atoi(parts[2]) : 0, count > 3 ? atoi(parts[3]) : 0, hex, out);
+    } else if (kind == "offline") {
+        // <id>###<ciphertext of seq,uptime,uid[,door];...>
+        char records[OFFLINE_MAX_LENGTH];
+
+        if (!device->authenticated) {
+            _counters.rejected++;
+            out.replies.push_back(ack(*device, id, "notAuthenticated"));
+            return;
+        }
+        int length = decrypt_text(device->aes, device->session, parts[1], strlen(parts[1]), records,
+                                  sizeof records);
+        if (length < 0) {
+            _counters.rejected++;
+            return;
+        }
+        records[length] = 0;
+        offline(*device, id, records, out);
+    }
+}
+
+/*  AES-CBC of the raw UID with the session ID as IV, PKCS#7 padded  */
+
+static int decrypt_raw(AES& aes, const char* session, const byte* in, int length, byte* out) {
+    byte iv[N_BLOCK];
+
+    if (length == 0 || length % N_BLOCK != 0 || length > 2 * N_BLOCK) {
+        return -1;
+    }
+    memcpy(iv, session, N_BLOCK);
+    aes.cbc_decrypt((byte*)in, out, length / N_BLOCK, iv);
+    int pad = out[length - 1];
+    if (pad < 1 || pad > N_BLOCK) {
+        return -1;
+    }
+    for (int i = length - pad; i < length; i++) {
+        if (out[i] != pad) {
+            return -1;
+        }
+    }
+    return length - pad;
+}
+
+void Sessions::handleFrame(const std::string& payload, Outcome& out) {
+    const byte* in = (const byte*)payload.data();
+    WireFrame frame;
+
+    // The device ID is readable before the MAC, which needs the key of that device
+    if (payload.size() < 3 || payload.size() < 3 + (size_t)in[2]) {
+        _counters.rejected++;
+        return;
+    }
+    std::string id((const char*)in + 3, in[2]);
+    Device* device = find(id);
+    if (device == NULL) {
+        return;
+    }
+    if (!wire_decode(in, payload.size(), &frame, (const byte*)device->key, KEY_LENGTH)) {
+        _counters.rejected++;
+        return;
+    }
+    device->binary = true;
+
+    if (frame.type == WIRE_HMAC) {
+        SHA256HMAC hmac((const byte*)device->key, KEY_LENGTH);
+        byte expected[SHA256HMAC_SIZE];
+
+        if (device->session[0] == 0) {
+            out.replies.push_back(ack(*device, id, "sessionExpired"));
+            return;
+        }
+        hmac.doUpdate(device->session, SESSION_ID_LENGTH);
+        hmac.doFinal(expected);
+        device->authenticated = frame.body_length == SHA256HMAC_SIZE &&
+                                wire_equal(expected, frame.body, SHA256HMAC_SIZE);
+        if (!device->authenticated) {
+            _counters.rejected++;
+        }
+        out.replies.push_back(ack(*device, id, device->authenticated ? "authenticationSuccessful" :
+                                  "authenticationFailed"));
+    } else if (frame.type == WIRE_ACCESS) {
+        byte uid[2 * N_BLOCK];
+        char hex[2 * UID_MAX_SIZE + 1];
+
+        if (!device->authenticated) {
+            _counters.rejected++;
+            out.replies.push_back(ack(*device, id, "notAuthenticated"));
+            return;
+        }
+        // A door ID before the ciphertext makes the body one byte longer than the AES blocks
+        int offset = frame.body_length % N_BLOCK == 1 ? 1 : 0;
+        int size = decrypt_raw(device->aes, device->session, frame.body + offset, frame.body_length - offset, uid);
+        if (size != 4 && size != 7 && size != 10) {
+            _counters.rejected++;
+            return;
+        }
+        to_hex(uid, size, hex);
+        access(id, frame.seq, offset ? frame.body[0] : 0, hex, out);
+    } else {
+        _counters.rejected++;
+    }
+}
+
+/*  access,<device>,<correlation ID>,<door>,<uid>  */
+
+void Sessions::access(const std::string& id, uint16_t request, uint8_t door, const char* hex, Outcome& out) {
+    char line[96];
+
+    snprintf(line, sizeof line, "access,%s,%u,%u,%s", id.c_str(), request, door, hex);
+    out.events.push_back(line);
+}
+
+/*  offline,<device>,<seq>,<door>,<uid>,<uptime> for every record, then the stored ACK of the last one  */
+
+void Sessions::offline(Device& device, const std::string& id, char* records, Outcome& out) {
+    char line[128];
+    unsigned long last = 0;
+    char* save;
+
+    for (char* record = strtok_r(records, ";", &save); record != NULL; record = strtok_r(NULL, ";", &save)) {
+        char* fields[4] = {NULL, NULL, NULL, NULL};
+        size_t count = 0;
+        char* field_save;
+        for (char* field = strtok_r(record, ",", &field_save); field != NULL && count < 4;
+                field = strtok_r(NULL, ",", &field_save)) {
+            fields[count++] = field;
+        }
+        if (count < 3 || !is_uid_hex(fields[2], strlen(fields[2]))) {
+            _counters.rejected++;
+            continue;
+        }
+        last = strtoul(fields[0], NULL, 10);
+        snprintf(line, sizeof line, "offline,%s,%lu,%u,%s,%s", id.c_str(), last,
+                 count > 3 ? (unsigned)atoi(fields[3]) : 0, fields[2], fields[1]);
+        out.events.push_back(line);
+    }
+    if (last != 0) {
+        char status[32];            // "stored:" and any unsigned long
+        snprintf(status, sizeof status, "stored:%lu", last);
+        out.after.push_back(ack(device, id, status));
+    }
+}
+
+void Sessions::decide(const std::string& line, Outcome& out) {
+    char id[64];
+    unsigned request;
+    int code;
+
+    if (sscanf(line.c_str(), "%63[^,],%u,%d", id, &request, &code) != 3) {
+        _counters.rejected++;
+        return;
+    }
+    Device* device = find(id);
+    if (device == NULL) {
+        return;
+    }
+    if (!device->authenticated) {
+        // The session ended while the backend was deciding, the device sends the tap again
+        _counters.rejected++;
+        return;
+    }
+
+    if (device->binary) {
+        byte body[2] = {(byte)(code >> 8), (byte)code};
+        out.replies.push_back(frame(*device, id, WIRE_RESPONSE, request, body, sizeof body, "response"));
+        return;
+    }
+    char response[24];
+    if (request == 0) {
+        // Devices without correlation IDs end the session with every response
+        snprintf(response, sizeof response, "%d", code);
+        device->authenticated = false;
+        device->session[0] = 0;
+    } else {
+        snprintf(response, sizeof response, "%u:%d", request, code);
+    }
+    out.replies.push_back(addressed(*device, id, "response", response, false));
+}
@@ -0,0 +1,85 @@
+/*
+ sessions.h - One shard of the gateway's session table. Every device is owned by exactly one worker, picked from a
+ hash of its ID, so its shard is only ever touched by that worker's thread and needs no locking: the messages of a
+ device are handled in the order they arrived, and the events it produces reach the backend in that order too.
+
+ A shard hands out the session IDs, checks the HMACs, decrypts the access messages and the offline batches, and
+ turns the decisions of the backend into responses, in the text or the binary wire format the device speaks.
+*/
+
+#ifndef GATEWAY_SESSIONS_H
+#define GATEWAY_SESSIONS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../loadgen/protocol.h"
+
+struct Counters {
+    std::atomic<uint64_t> messages;   // Device messages handled
+    std::atomic<uint64_t> replies;    // ACKs and responses published
+    std::atomic<uint64_t> events;     // Taps forwarded to the backend
+    std::atomic<uint64_t> batches;
+    std::atomic<uint64_t> rejected;   // Bad HMAC, MAC or ciphertext, or no session
+    std::atomic<uint64_t> unknown;    // Devices without a key
+
+    Counters() : messages(0), replies(0), events(0), batches(0), rejected(0), unknown(0) {}
+};
+
+struct Message {
+    std::string topic;
+    std::string payload;              // Binary frames included, not NUL terminated
+};
+
+/*  What handling a message produced: replies to publish now, events for the backend, and messages to publish  */
+/*  only once the batch holding the events is out, the stored ACK of an offline batch                          */
+struct Outcome {
+    std::vector<Message> replies;
+    std::vector<std::string> events;
+    std::vector<Message> after;
+};
+
+class Sessions {
+public:
+    explicit Sessions(Counters& counters);
+
+    /*  Register the key of a device, before the workers start  */
+    void provision(const std::string& id, const char* key);
+
+    /*  A message from a device on one of the shared topics (init, hmac, resume, access, offline)  */
+    void handle(const std::string& kind, const std::string& payload, Outcome& out);
+
+    /*  A decision line of the backend: <device>,<correlation ID>,<code>  */
+    void decide(const std::string& line, Outcome& out);
+
+private:
+    struct Device {
+        char key[KEY_LENGTH + 1];
+        char session[SESSION_ID_LENGTH + 1];
+        std::string root;             // Topic root advertised in the INIT, empty for the shared topics
+        bool authenticated;
+        bool binary;                  // Offered the binary wire format
+        AES aes;
+    };
+
+    void handleText(const std::string& kind, const std::string& payload, Outcome& out);
+    void handleFrame(const std::string& payload, Outcome& out);
+    void access(const std::string& id, uint16_t request, uint8_t door, const char* hex, Outcome& out);
+    void offline(Device& device, const std::string& id, char* records, Outcome& out);
+    void startSession(Device& device, const char* root, const char* wire);
+    Message addressed(Device& device, const std::string& id, const char* kind, const std::string& payload,
+                      bool frame);
+    Message ack(Device& device, const std::string& id, const char* status);
+    Message frame(Device& device, const std::string& id, uint8_t type, uint16_t seq, const byte* body,
+                  int body_length, const char* kind);
+    Device* find(const std::string& id);
+
+    Counters& _counters;
+    std::random_device _random;
+    std::unordered_map<std::string, Device> _devices;
+};
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ backend.cpp - Stand-in for the backend behind the broker
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "backend.h"
+
+Backend::Backend(Scheduler& scheduler, Broker& broker, uint64_t seed, int64_t cost_us, bool legacy)
+    : _scheduler(scheduler), _broker(broker), _prng(seed), _costUs(cost_us), _legacy(legacy) {}
+
+void Backend::begin() {
+    _broker.subscribe(this, "init");
+    _broker.subscribe(this, "hmac");
+    _broker.subscribe(this, "access");
+}
+
+void Backend::provision(const char* id, const char* key) {
+    Device& device = _devices[id];
+
+    snprintf(device.key, sizeof device.key, "%s", key);
+    device.session[0] = 0;
+    device.authenticated = false;
+    device.aes.set_key((byte*)device.key, 128);
+}
+
+/*  Split a message on ###, as the Python backend does  */
+
+static size_t split(char* message, char** parts, size_t max) {
+    size_t count = 0;
+
+    while (count < max) {
+        parts[count++] = message;
+        char* separator = strstr(message, "###");
+        if (separator == NULL) {
+            break;
+        }
+        *separator = 0;
+        message = separator + 3;
+    }
+    return count;
+}
+
+/*  Replies go out once the worker is done with the message, on the device topics or on the shared ones  */
+
+void Backend::reply(Device& device, const char* id, const char* kind, const char* payload, Replies& replies) {
+    if (device.root.empty()) {
+        replies.push_back(std::make_pair(std::string(kind), std::string(id) + "###" + payload));
+    } else {
+        replies.push_back(std::make_pair(device.root + kind, std::string(payload)));
+    }
+}
+
+void Backend::deliver(const char* topic, const uint8_t* payload, size_t length) {
+    uint64_t start = cpu_ns();
+    std::string message((const char*)payload, length);
+    Replies replies;
+
+    handle(topic, &message[0], replies);
+
+    uint64_t cost = _costUs >= 0 ? (uint64_t)_costUs : (cpu_ns() - start) / 1000;
+    uint64_t done = _server.serve(_scheduler.now(), cost);
+    Broker* broker = &_broker;
+    for (size_t i = 0; i < replies.size(); i++) {
+        std::pair<std::string, std::string> out = replies[i];
+        _scheduler.at(done, [broker, out]() { broker->publish(out.first.c_str(), out.second.c_str()); });
+    }
+}
+
+void Backend::handle(const char* kind, char* message, Replies& replies) {
+    char* parts[4];
+    size_t count = split(message, parts, 4);
+
+    std::map<std::string, Device>::iterator it = _devices.find(parts[0]);
+    if (it == _devices.end() || count < 2) {
+        return;
+    }
+    Device& device = it->second;
+    const char* id = parts[0];
+
+    if (strcmp(kind, "init") == 0) {
+        static const char letters[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+
+        for (int i = 0; i < SESSION_ID_LENGTH; i++) {
+            device.session[i] = letters[_prng.below(sizeof letters - 1)];
+        }
+        device.session[SESSION_ID_LENGTH] = 0;
+        device.authenticated = false;
+        device.root = count > 2 && !_legacy ? parts[2] : "";
+        reply(device, id, "ack", device.session, replies);
+    } else if (strcmp(kind, "hmac") == 0) {
+        char expected[64];
+
+        if (device.session[0] == 0) {
+            reply(device, id, "ack", "sessionExpired", replies);
+            return;
+        }
+        auth_code(device.key, device.session, expected);
+        device.authenticated = strcmp(expected, parts[1]) == 0;
+        reply(device, id, "ack", device.authenticated ? "authenticationSuccessful" : "authenticationFailed", replies);
+    } else if (strcmp(kind, "access") == 0) {
+        char uid[64];
+        char response[16];
+
+        if (!device.authenticated) {
+            reply(device, id, "ack", "notAuthenticated", replies);
+            return;
+        }
+        int length = decrypt_text(device.aes, device.session, parts[1], strlen(parts[1]), uid, sizeof uid);
+        int code = length == 8 || length == 14 || length == 20 ? 200 : 400;
+        if (_legacy || count < 3) {
+            snprintf(response, sizeof response, "%d", code);
+            device.authenticated = false;
+            device.session[0] = 0;
+        } else {
+            snprintf(response, sizeof response, "%s:%d", parts[2], code);
+        }
+        reply(device, id, "response", response, replies);
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ backend.h - Stand-in for the backend behind the broker: hands out session IDs, checks the HMAC of every device
+ with its key, decrypts every access message and answers it. The work is done for real with the firmware's crypto
+ code, by a single worker whose cost is either measured or fixed. With legacy set it answers like a backend from
+ before the device topics and correlation IDs: on the shared topics, and ending the session with every response.
+*/
+
+#ifndef LOADGEN_BACKEND_H
+#define LOADGEN_BACKEND_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "broker.h"
+#include "protocol.h"
+
+class Backend : public Endpoint {
+public:
+    /*  cost_us below 0 measures the handling instead of charging a fixed cost per message  */
+    Backend(Scheduler& scheduler, Broker& broker, uint64_t seed, int64_t cost_us, bool legacy);
+
+    /*  Subscribe to the topics the devices publish on  */
+    void begin();
+
+    /*  Register the key of a device, as the provisioning would  */
+    void provision(const char* id, const char* key);
+
+    void deliver(const char* topic, const uint8_t* payload, size_t length) override;
+
+    uint64_t busy() const { return _server.busy(); }
+
+private:
+    struct Device {
+        char key[KEY_LENGTH + 1];
+        char session[SESSION_ID_LENGTH + 1];
+        std::string root;     // Topic root advertised in the INIT, empty for the shared topics
+        bool authenticated;
+        AES aes;
+    };
+    typedef std::vector<std::pair<std::string, std::string> > Replies;
+
+    void handle(const char* kind, char* message, Replies& replies);
+    void reply(Device& device, const char* id, const char* kind, const char* payload, Replies& replies);
+
+    Scheduler& _scheduler;
+    Broker& _broker;
+    Prng _prng;
+    int64_t _costUs;
+    bool _legacy;
+    Server _server;
+    std::map<std::string, Device> _devices;
+};
+
+#endif
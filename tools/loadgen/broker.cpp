@@ -0,0 +1,163 @@
+/*
+ broker.cpp - In-process stand-in for the MQTT broker
+*/
+
+#include <string.h>
+#include <algorithm>
+#include "broker.h"
+
+Broker::Broker(Scheduler& scheduler, Report& report, uint32_t net_us, int64_t cost_us)
+    : _scheduler(scheduler), _report(report), _netUs(net_us), _costUs(cost_us) {}
+
+static size_t length_bytes(size_t length) {
+    return length < 128 ? 1 : length < 16384 ? 2 : length < 2097152 ? 3 : 4;
+}
+
+void Broker::count(const char* type, size_t bytes) {
+    TypeStats& stats = _report.types[type];
+
+    stats.count++;
+    stats.bytes += bytes;
+}
+
+/*  CONNECT of PubSubClient without user and password, protocol level 4, and its CONNACK  */
+
+void Broker::connect(const char* client_id) {
+    size_t remaining = 10 + 2 + strlen(client_id);
+
+    count("connect", 1 + length_bytes(remaining) + remaining + 4);
+}
+
+void Broker::subscribe(Endpoint* client, const char* filter) {
+    size_t remaining = 2 + 2 + strlen(filter) + 1;
+
+    if (strchr(filter, '+') != NULL || strchr(filter, '#') != NULL) {
+        _wildcards.push_back(std::make_pair(std::string(filter), client));
+    } else {
+        _exact[filter].push_back(client);
+    }
+    count("subscribe", 1 + length_bytes(remaining) + remaining + 5);
+}
+
+void Broker::unsubscribe(Endpoint* client, const char* filter) {
+    size_t remaining = 2 + 2 + strlen(filter);
+
+    std::map<std::string, std::vector<Endpoint*> >::iterator it = _exact.find(filter);
+    if (it != _exact.end()) {
+        it->second.erase(std::remove(it->second.begin(), it->second.end(), client), it->second.end());
+        if (it->second.empty()) {
+            _exact.erase(it);
+        }
+    }
+    _wildcards.erase(std::remove(_wildcards.begin(), _wildcards.end(), std::make_pair(std::string(filter), client)),
+                     _wildcards.end());
+    count("unsubscribe", 1 + length_bytes(remaining) + remaining + 4);
+}
+
+void Broker::ping() {
+    count("pingreq", 4);
+}
+
+/*  Same PUBLISH packet as PubSubClient::publish() at QoS 0  */
+
+void Broker::publish(const char* topic, const uint8_t* payload, size_t length) {
+    size_t topic_length = strlen(topic);
+    size_t remaining = 2 + topic_length + length;
+    Packet packet(new std::vector<uint8_t>());
+
+    packet->reserve(1 + length_bytes(remaining) + remaining);
+    packet->push_back(0x30);
+    do {
+        uint8_t digit = remaining % 128;
+        remaining /= 128;
+        packet->push_back(remaining > 0 ? digit | 0x80 : digit);
+    } while (remaining > 0);
+    packet->push_back(topic_length >> 8);
+    packet->push_back(topic_length & 0xFF);
+    packet->insert(packet->end(), topic, topic + topic_length);
+    packet->insert(packet->end(), payload, payload + length);
+
+    TypeStats& stats = _report.type(topic);
+    stats.count++;
+    stats.bytes += packet->size();
+
+    uint64_t published = _scheduler.now();
+    _scheduler.after(_netUs, [this, packet, published]() { route(packet, published); });
+}
+
+void Broker::publish(const char* topic, const char* payload) {
+    publish(topic, (const uint8_t*)payload, strlen(payload));
+}
+
+/*  MQTT topic filter: + matches one level, # the rest of the topic  */
+
+bool Broker::matches(const char* filter, const char* topic) {
+    while (*filter != 0) {
+        if (*filter == '#') {
+            return true;
+        }
+        if (*filter == '+') {
+            while (*topic != 0 && *topic != '/') {
+                topic++;
+            }
+            filter++;
+            continue;
+        }
+        if (*filter != *topic) {
+            return false;
+        }
+        filter++;
+        topic++;
+    }
+    return *topic == 0;
+}
+
+/*  Parse the packet as it arrives, find the subscribers, and send it on once the worker gets to it  */
+
+void Broker::route(Packet packet, uint64_t published) {
+    uint64_t start = cpu_ns();
+
+    const uint8_t* p = packet->data() + 1;
+    size_t remaining = 0;
+    for (int shift = 0; ; shift += 7) {
+        remaining |= (size_t)(*p & 0x7F) << shift;
+        if (!(*p++ & 0x80)) {
+            break;
+        }
+    }
+    size_t topic_length = (p[0] << 8) | p[1];
+    std::shared_ptr<std::string> topic(new std::string((const char*)p + 2, topic_length));
+    const uint8_t* payload = p + 2 + topic_length;
+    size_t length = remaining - 2 - topic_length;
+
+    std::vector<Endpoint*> targets;
+    std::map<std::string, std::vector<Endpoint*> >::iterator it = _exact.find(*topic);
+    if (it != _exact.end()) {
+        targets = it->second;
+    }
+    for (size_t i = 0; i < _wildcards.size(); i++) {
+        if (matches(_wildcards[i].first.c_str(), topic->c_str())) {
+            targets.push_back(_wildcards[i].second);
+        }
+    }
+
+    uint64_t route_ns = cpu_ns() - start;
+    uint64_t done = _server.serve(_scheduler.now(), _costUs >= 0 ? (uint64_t)_costUs : route_ns / 1000);
+    TypeStats& stats = _report.type(topic->c_str());
+    size_t offset = payload - packet->data();
+
+    for (size_t i = 0; i < targets.size(); i++) {
+        Endpoint* target = targets[i];
+
+        stats.bytes += packet->size();
+        _scheduler.at(done + _netUs, [this, target, packet, topic, offset, length, published, route_ns]() {
+            TypeStats& stats = _report.type(topic->c_str());
+            uint64_t start = cpu_ns();
+
+            stats.delivery_us.add(_scheduler.now() - published);
+            _report.deliveries++;
+            target->deliver(topic->c_str(), packet->data() + offset, length);
+            stats.cpu_ns.add(route_ns + cpu_ns() - start);
+        });
+    }
+}
@@ -0,0 +1,60 @@
+/*
+ broker.h - In-process stand-in for the MQTT broker, so the load generator needs no external service. Messages are
+ encoded as the QoS 0 PUBLISH packets PubSubClient sends, parsed back and routed to the subscriptions, exact topics
+ or filters with + and #. Every packet crosses the network delay on its way in and out, and the routing is done by
+ a single worker whose cost is either measured or fixed.
+*/
+
+#ifndef LOADGEN_BROKER_H
+#define LOADGEN_BROKER_H
+
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "sim.h"
+#include "stats.h"
+
+class Endpoint {
+public:
+    virtual ~Endpoint() {}
+
+    /*  A message routed to this endpoint, at the current time of the scheduler  */
+    virtual void deliver(const char* topic, const uint8_t* payload, size_t length) = 0;
+};
+
+class Broker {
+public:
+    /*  cost_us below 0 measures the routing instead of charging a fixed cost per message  */
+    Broker(Scheduler& scheduler, Report& report, uint32_t net_us, int64_t cost_us);
+
+    /*  Control packets, counted with their answers  */
+    void connect(const char* client_id);
+    void subscribe(Endpoint* client, const char* filter);
+    void unsubscribe(Endpoint* client, const char* filter);
+    void ping();
+
+    /*  Publish now, the packet reaches the broker after the network delay  */
+    void publish(const char* topic, const uint8_t* payload, size_t length);
+    void publish(const char* topic, const char* payload);
+
+    uint64_t busy() const { return _server.busy(); }
+
+private:
+    typedef std::shared_ptr<std::vector<uint8_t> > Packet;
+
+    void route(Packet packet, uint64_t published);
+    void count(const char* type, size_t bytes);
+    static bool matches(const char* filter, const char* topic);
+
+    Scheduler& _scheduler;
+    Report& _report;
+    uint32_t _netUs;
+    int64_t _costUs;
+    Server _server;
+    std::map<std::string, std::vector<Endpoint*> > _exact;
+    std::vector<std::pair<std::string, Endpoint*> > _wildcards;
+};
+
+#endif
@@ -0,0 +1,224 @@
+/*
+ loadgen.cpp - Fleet load generator: thousands of simulated readers speaking the protocol of src/main.cpp to the
+ in-process broker and backend stand-ins, in virtual time. Taps follow a Poisson process per reader, with bursts
+ that multiply the rate for a while, and the report gives the throughput and the latency percentiles per message
+ type. Run with --help for the options.
+*/
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "backend.h"
+#include "broker.h"
+#include "reader.h"
+
+#define MAX_BURSTS 8
+
+struct Burst {
+    double start;         // Seconds
+    double length;
+    double factor;        // Multiplies the tap rate of every reader
+};
+
+struct Options {
+    unsigned readers;
+    double duration;
+    double taps_per_hour;
+    double ramp;
+    unsigned cards;
+    unsigned net_us;
+    long broker_us;
+    long backend_us;
+    bool legacy;
+    unsigned long seed;
+    Burst bursts[MAX_BURSTS];
+    unsigned burst_count;
+};
+
+static Options options = {1000, 3600, 60, 60, 5000, 500, -1, -1, false, 1, {}, 0};
+
+/*  Taps  */
+
+struct Card {
+    uint8_t uid[7];
+    uint8_t size;
+};
+
+static std::vector<Card> cards;
+
+static double rate_factor(double second) {
+    double factor = 1;
+
+    for (unsigned i = 0; i < options.burst_count; i++) {
+        const Burst& burst = options.bursts[i];
+        if (second >= burst.start && second < burst.start + burst.length && burst.factor > factor) {
+            factor = burst.factor;
+        }
+    }
+    return factor;
+}
+
+static double max_factor() {
+    double factor = 1;
+
+    for (unsigned i = 0; i < options.burst_count; i++) {
+        if (options.bursts[i].factor > factor) {
+            factor = options.bursts[i].factor;
+        }
+    }
+    return factor;
+}
+
+/*  Next tap of a reader: candidates at the highest rate, kept with the ratio of the rate at their time, so the   */
+/*  taps of a reader only depend on its own random source                                                         */
+
+static void schedule_tap(Scheduler& scheduler, Reader* reader, Prng* prng) {
+    double mean = 3600.0 / (options.taps_per_hour * max_factor());
+    uint64_t at = scheduler.now() + (uint64_t)(prng->exponential(mean) * US_PER_S);
+
+    scheduler.at(at, [&scheduler, reader, prng]() {
+        double second = scheduler.now() / (double)US_PER_S;
+        if (prng->uniform() * max_factor() < rate_factor(second)) {
+            const Card& card = cards[prng->below(cards.size())];
+            reader->tap(card.uid, card.size);
+        }
+        schedule_tap(scheduler, reader, prng);
+    });
+}
+
+static void make_cards() {
+    Prng prng(options.seed);
+
+    for (unsigned i = 0; i < options.cards; i++) {
+        Card card;
+        card.size = prng.below(4) == 0 ? 7 : 4;
+        for (uint8_t b = 0; b < card.size; b++) {
+            card.uid[b] = prng.next() & 0xFF;
+        }
+        if (card.uid[0] == 0x88) {
+            card.uid[0] = 0x08; // Would read as a cascade tag
+        }
+        cards.push_back(card);
+    }
+}
+
+/*  Options  */
+
+static void usage(const char* program) {
+    printf("Usage: %s [options]\n"
+           "  --readers=N         simulated readers (%u)\n"
+           "  --duration=S        simulated seconds to run (%.0f)\n"
+           "  --taps-per-hour=R   average tap rate of every reader (%.0f)\n"
+           "  --burst=S:L:F       from second S, for L seconds, F times the tap rate, up to %d of them\n"
+           "  --ramp=S            readers connect at random over the first S seconds (%.0f)\n"
+           "  --cards=N           cards the taps are drawn from (%u)\n"
+           "  --net-us=US         one-way network delay between a client and the broker (%u)\n"
+           "  --broker-us=US      fixed routing cost per message, measured when not given\n"
+           "  --backend-us=US     fixed handling cost per message, measured when not given\n"
+           "  --legacy            backend without device topics and correlation IDs\n"
+           "  --seed=N            seed of the taps, keys and session IDs (%lu)\n",
+           program, options.readers, options.duration, options.taps_per_hour, MAX_BURSTS, options.ramp,
+           options.cards, options.net_us, options.seed);
+}
+
+static void parse_options(int argc, char** argv) {
+    static const struct option long_options[] = {
+        {"readers", required_argument, NULL, 'n'},
+        {"duration", required_argument, NULL, 'd'},
+        {"taps-per-hour", required_argument, NULL, 't'},
+        {"burst", required_argument, NULL, 'b'},
+        {"ramp", required_argument, NULL, 'r'},
+        {"cards", required_argument, NULL, 'c'},
+        {"net-us", required_argument, NULL, 'N'},
+        {"broker-us", required_argument, NULL, 'B'},
+        {"backend-us", required_argument, NULL, 'K'},
+        {"legacy", no_argument, NULL, 'l'},
+        {"seed", required_argument, NULL, 'x'},
+        {"help", no_argument, NULL, '?'},
+        {NULL, 0, NULL, 0}
+    };
+    int c;
+
+    while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'n': options.readers = atoi(optarg); break;
+            case 'd': options.duration = atof(optarg); break;
+            case 't': options.taps_per_hour = atof(optarg); break;
+            case 'b': {
+                Burst burst;
+                if (options.burst_count == MAX_BURSTS ||
+                        sscanf(optarg, "%lf:%lf:%lf", &burst.start, &burst.length, &burst.factor) != 3) {
+                    fprintf(stderr, "--burst: expected start:length:factor, up to %d of them\n", MAX_BURSTS);
+                    exit(1);
+                }
+                options.bursts[options.burst_count++] = burst;
+                break;
+            }
+            case 'r': options.ramp = atof(optarg); break;
+            case 'c': options.cards = atoi(optarg); break;
+            case 'N': options.net_us = atoi(optarg); break;
+            case 'B': options.broker_us = atol(optarg); break;
+            case 'K': options.backend_us = atol(optarg); break;
+            case 'l': options.legacy = true; break;
+            case 'x': options.seed = strtoul(optarg, NULL, 10); break;
+            default:
+                usage(argv[0]);
+                exit(c == '?' ? 0 : 1);
+        }
+    }
+    if (options.readers == 0 || options.cards == 0) {
+        fprintf(stderr, "--readers and --cards need at least one\n");
+        exit(1);
+    }
+}
+
+static double host_seconds() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+    parse_options(argc, argv);
+    make_cards();
+
+    Scheduler scheduler;
+    Report report;
+    Broker broker(scheduler, report, options.net_us, options.broker_us);
+    Backend backend(scheduler, broker, options.seed, options.backend_us, options.legacy);
+    std::vector<Reader*> readers;
+    std::vector<Prng*> prngs;
+
+    backend.begin();
+    for (unsigned i = 0; i < options.readers; i++) {
+        Reader* reader = new Reader(scheduler, broker, report, i, options.seed);
+        Prng* prng = new Prng(options.seed * 1000003ULL + i);
+
+        backend.provision(reader->id(), reader->key());
+        // Cards are presented once the reader is up
+        scheduler.at((uint64_t)(prng->uniform() * options.ramp * US_PER_S), [&scheduler, reader, prng]() {
+            reader->start();
+            if (options.taps_per_hour > 0) {
+                schedule_tap(scheduler, reader, prng);
+            }
+        });
+        readers.push_back(reader);
+        prngs.push_back(prng);
+    }
+
+    double start = host_seconds();
+    uint64_t end = (uint64_t)(options.duration * US_PER_S);
+    while (scheduler.step(end)) {
+    }
+    report.print(stdout, options.duration, host_seconds() - start, broker.busy(), backend.busy());
+
+    for (size_t i = 0; i < readers.size(); i++) {
+        delete readers[i];
+        delete prngs[i];
+    }
+    return 0;
+}
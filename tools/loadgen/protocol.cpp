@@ -0,0 +1,61 @@
+/*
+ protocol.cpp - Encodings of the reader / backend protocol, as encrypt_text() and the HMAC step of src/main.cpp
+*/
+
+#include <string.h>
+#include <Crypto.h>
+#include <ebase64.h>
+#include "protocol.h"
+
+int encrypt_text(AES& aes, const char* session, const char* in, int length, char* out) {
+    byte block[288];
+    byte iv[N_BLOCK];
+
+    int size = base64_encode((char*)block, (char*)in, length);
+    int padded = (size / N_BLOCK + 1) * N_BLOCK;
+    memset(block + size, padded - size, padded - size);
+    memcpy(iv, session, N_BLOCK);
+    aes.cbc_encrypt(block, block, padded / N_BLOCK, iv);
+    return base64_encode(out, (char*)block, padded);
+}
+
+int decrypt_text(AES& aes, const char* session, const char* in, int length, char* out, int capacity) {
+    byte block[288];
+    char encoded[400];
+    byte iv[N_BLOCK];
+
+    if (length <= 0 || base64_dec_len((char*)in, length) > (int)sizeof block || length >= (int)sizeof encoded) {
+        return -1;
+    }
+    memcpy(encoded, in, length);
+    int size = base64_decode((char*)block, encoded, length);
+    if (size <= 0 || size % N_BLOCK != 0) {
+        return -1;
+    }
+    memcpy(iv, session, N_BLOCK);
+    aes.cbc_decrypt(block, block, size / N_BLOCK, iv);
+    int pad = block[size - 1];
+    if (pad < 1 || pad > N_BLOCK) {
+        return -1;
+    }
+    for (int i = size - pad; i < size; i++) {
+        if (block[i] != pad) {
+            return -1;
+        }
+    }
+    // Checked before decoding, the ciphertext comes from the network: at most 3 bytes per 4 characters, 2 for a
+    // partial group, and the NUL base64_decode() writes after them
+    if ((size - pad) / 4 * 3 + 2 >= capacity) {
+        return -1;
+    }
+    return base64_decode(out, (char*)block, size - pad);
+}
+
+int auth_code(const char* key, const char* session, char* out) {
+    SHA256HMAC hmac((const byte*)key, KEY_LENGTH);
+    byte code[SHA256HMAC_SIZE];
+
+    hmac.doUpdate(session, strlen(session));
+    hmac.doFinal(code);
+    return base64_encode(out, (char*)code, SHA256HMAC_SIZE);
+}
@@ -0,0 +1,45 @@
+/*
+ protocol.h - The reader / backend protocol as src/main.cpp speaks it, for both ends of the load generator and for
+ the gateway: the timeouts of the firmware, and the INIT / HMAC / ACCESS encodings built on the same AES, SHA256HMAC
+ and base64 code.
+
+     init     <id>###INIT###rfid/<id>/###wire<version>
+     ack      <session ID, 16 characters>                  on rfid/<id>/ack
+     hmac     <id>###Base64(HMAC-SHA256(key, session ID))
+     ack      authenticationSuccessful | authenticationFailed | sessionExpired | notAuthenticated
+     access   <id>###Base64(AES-CBC(Base64(uid hex)))###<correlation ID>   key and session ID as IV
+     response <correlation ID>:<code>                      on rfid/<id>/response
+
+ A backend without device topics answers on the shared ack and response topics with <id>### before the payload,
+ and a response without a correlation ID ends the session.
+*/
+
+#ifndef LOADGEN_PROTOCOL_H
+#define LOADGEN_PROTOCOL_H
+
+#include <stdint.h>
+#include <AES.h>
+
+// Timeouts and limits of src/main.cpp
+#define ACK_TIMEOUT_MS 5000
+#define ACK_MAX_RETRIES 3
+#define RESPONSE_TIMEOUT_MS 5000
+#define ACCESS_SLOTS 4
+#define ACCESS_MAX_RETRIES 2
+#define READ_GUARD_MS 1250
+#define KEEPALIVE_MS 15000        // MQTT_KEEPALIVE of PubSubClient
+#define SESSION_ID_LENGTH 16
+#define KEY_LENGTH 16
+#define TOPIC_ROOT "rfid/"
+
+/*  Base64(AES-CBC(Base64(in))), PKCS#7 padded, with the session ID as IV, returns the length written to out  */
+int encrypt_text(AES& aes, const char* session, const char* in, int length, char* out);
+
+/*  The reverse, returns the length of the plaintext in out or -1 if the padding is wrong or the plaintext and its
+    NUL do not fit in capacity bytes  */
+int decrypt_text(AES& aes, const char* session, const char* in, int length, char* out, int capacity);
+
+/*  Base64 of the HMAC-SHA256 of the session ID, the key is the AES key  */
+int auth_code(const char* key, const char* session, char* out);
+
+#endif
@@ -0,0 +1,344 @@
+/*
+ reader.cpp - One simulated reader of the fleet
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reader.h"
+#include "../../src/wire.h"
+
+static const char* shared_topics[] = {"response", "ack", "reset"};
+static const char* device_topics[] = {"response", "ack", "reset", "allowlist", "metrics"};
+
+Reader::Reader(Scheduler& scheduler, Broker& broker, Report& report, unsigned index, uint64_t seed)
+    : _scheduler(scheduler), _broker(broker), _report(report), _state(STATE_IDLE), _ackRetries(0), _ackTimer(0),
+      _stateSince(0), _lastEvent(0), _lastTraffic(0), _pipelining(false), _deviceTopics(false),
+      _drainScheduled(false), _connected(false), _nextId(1) {
+    Prng prng(seed ^ (0xC0FFEEULL + index));
+
+    snprintf(_id, sizeof _id, "rdr%u", index);
+    for (int i = 0; i < KEY_LENGTH; i++) {
+        _key[i] = "0123456789abcdef"[prng.below(16)];
+    }
+    _key[KEY_LENGTH] = 0;
+    snprintf(_root, sizeof _root, "%s%s/", TOPIC_ROOT, _id);
+    _session[0] = 0;
+    memset(_requests, 0, sizeof _requests);
+}
+
+void Reader::publish(const char* topic, const char* payload) {
+    _lastTraffic = _scheduler.now();
+    _broker.publish(topic, payload);
+}
+
+void Reader::subscribeShared(bool subscribe) {
+    for (size_t i = 0; i < sizeof shared_topics / sizeof shared_topics[0]; i++) {
+        if (subscribe) {
+            _broker.subscribe(this, shared_topics[i]);
+        } else {
+            _broker.unsubscribe(this, shared_topics[i]);
+        }
+    }
+}
+
+/*  conectMqtt(): the device topics, and the shared ones until the backend is known to use the device topics  */
+
+void Reader::start() {
+    char topic[48];
+
+    _broker.connect(_id);
+    for (size_t i = 0; i < sizeof device_topics / sizeof device_topics[0]; i++) {
+        snprintf(topic, sizeof topic, "%s%s", _root, device_topics[i]);
+        _broker.subscribe(this, topic);
+    }
+    if (!_deviceTopics) {
+        subscribeShared(true);
+    }
+    _connected = true;
+    _lastTraffic = _scheduler.now();
+    sendInit();
+    keepAlive();
+}
+
+void Reader::sendInit() {
+    char message[96];
+
+    snprintf(message, sizeof message, "%s###INIT###%s###wire%d", _id, _root, WIRE_VERSION);
+    publish("init", message);
+    _report.handshakes++;
+    _state = STATE_INIT_SENT;
+    _stateSince = _scheduler.now();
+    armAck();
+}
+
+/*  ACK timeout: a new handshake, and after ACK_MAX_RETRIES of them a reset  */
+
+void Reader::armAck() {
+    uint32_t timer = ++_ackTimer;
+
+    _scheduler.after(ACK_TIMEOUT_MS * US_PER_MS, [this, timer]() {
+        if (timer != _ackTimer || !_connected || (_state != STATE_INIT_SENT && _state != STATE_AUTH_SENT)) {
+            return;
+        }
+        if (++_ackRetries >= ACK_MAX_RETRIES) {
+            reset();
+            return;
+        }
+        sendInit();
+    });
+}
+
+/*  ESP.reset(): the connection and its subscriptions are gone, the taps and requests with it  */
+
+void Reader::reset() {
+    char topic[48];
+
+    _report.resets++;
+    for (size_t i = 0; i < sizeof device_topics / sizeof device_topics[0]; i++) {
+        snprintf(topic, sizeof topic, "%s%s", _root, device_topics[i]);
+        _broker.unsubscribe(this, topic);
+    }
+    if (!_deviceTopics) {
+        subscribeShared(false);
+    }
+    for (int i = 0; i < ACCESS_SLOTS; i++) {
+        if (_requests[i].id != 0) {
+            _report.lost++;
+            _requests[i].id = 0;
+        }
+    }
+    _report.dropped += _pending.size();
+    _pending.clear();
+    _connected = false;
+    _state = STATE_IDLE;
+    _ackRetries = 0;
+    _ackTimer++;
+    _pipelining = false;
+    _deviceTopics = false;
+    _scheduler.after(READER_BOOT_MS * US_PER_MS, [this]() { start(); });
+}
+
+/*  PINGREQ when nothing went out for the keepalive interval  */
+
+void Reader::keepAlive() {
+    _scheduler.after(KEEPALIVE_MS * US_PER_MS, [this]() {
+        if (!_connected) {
+            return;
+        }
+        if (_scheduler.now() - _lastTraffic >= KEEPALIVE_MS * US_PER_MS) {
+            _broker.ping();
+            _lastTraffic = _scheduler.now();
+        }
+        keepAlive();
+    });
+}
+
+/*  device_message() and shared_message(): device topics carry the bare payload, shared topics <id>###<payload>  */
+
+void Reader::deliver(const char* topic, const uint8_t* payload, size_t length) {
+    char message[128];
+
+    if (!_connected) {
+        return;
+    }
+    if (length >= sizeof message) {
+        length = sizeof message - 1;
+    }
+    memcpy(message, payload, length);
+    message[length] = 0;
+
+    size_t root_length = strlen(_root);
+    if (strncmp(topic, _root, root_length) == 0) {
+        if (!_deviceTopics) {
+            _deviceTopics = true;
+            subscribeShared(false);
+        }
+        handle(topic + root_length, message);
+        return;
+    }
+
+    char* separator = strstr(message, "###");
+    if (separator == NULL || (size_t)(separator - message) != strlen(_id) || strncmp(message, _id, strlen(_id)) != 0) {
+        return; // Message for another reader
+    }
+    handle(topic, separator + 3);
+}
+
+void Reader::handle(const char* kind, const char* message) {
+    uint64_t now = _scheduler.now();
+
+    _lastEvent = now;
+    _lastTraffic = now;
+
+    if (strcmp(kind, "response") == 0) {
+        const char* separator = strchr(message, ':');
+        uint16_t id = 0;
+        if (separator != NULL) {
+            id = atoi(message);
+            _pipelining = true;
+        }
+        Request* request = answered(id);
+        if (request != NULL) {
+            request->id = 0;
+            _report.answered++;
+            _report.tap_us.add(now - request->tap.at);
+        }
+        if (separator == NULL) {
+            // Backends without correlation IDs end the session with every response
+            _report.failures++;
+            sendInit();
+            return;
+        }
+        drain();
+    } else if (strcmp(kind, "ack") == 0) {
+        _ackRetries = 0;
+        if (strcmp(message, "sessionExpired") == 0 || strcmp(message, "authenticationFailed") == 0 ||
+                strcmp(message, "notAuthenticated") == 0) {
+            _report.failures++;
+            sendInit();
+        } else if (strcmp(message, "authenticationSuccessful") == 0) {
+            if (_state == STATE_AUTH_SENT) {
+                _report.auth_us.add(now - _stateSince);
+            }
+            _state = STATE_READY;
+            _stateSince = now;
+            _ackTimer++;
+            drain();
+        } else if (_state == STATE_INIT_SENT && strlen(message) == SESSION_ID_LENGTH) {
+            char code[64];
+            char hmac[96];
+
+            _report.handshake_us.add(now - _stateSince);
+            memcpy(_session, message, sizeof _session);
+            _aes.set_key((byte*)_key, 128);
+            auth_code(_key, _session, code);
+            snprintf(hmac, sizeof hmac, "%s###%s", _id, code);
+            publish("hmac", hmac);
+            _state = STATE_AUTH_SENT;
+            _stateSince = now;
+            armAck();
+        } else {
+            _report.failures++;
+            sendInit();
+        }
+    }
+}
+
+void Reader::tap(const uint8_t* uid, uint8_t size) {
+    Tap tap;
+
+    _report.taps++;
+    if (_pending.size() >= READER_PENDING_TAPS) {
+        _report.dropped++;
+        return;
+    }
+    memcpy(tap.uid, uid, size);
+    tap.size = size;
+    tap.at = _scheduler.now();
+    _pending.push_back(tap);
+    drain();
+}
+
+Reader::Request* Reader::freeRequest() {
+    Request* free = NULL;
+
+    for (int i = 0; i < ACCESS_SLOTS; i++) {
+        if (_requests[i].id != 0 && !_pipelining) {
+            return NULL;
+        }
+        if (_requests[i].id == 0 && free == NULL) {
+            free = &_requests[i];
+        }
+    }
+    return free;
+}
+
+/*  find_answered(): by correlation ID, or the oldest request without one  */
+
+Reader::Request* Reader::answered(uint16_t id) {
+    Request* oldest = NULL;
+
+    for (int i = 0; i < ACCESS_SLOTS; i++) {
+        if (_requests[i].id == 0) {
+            continue;
+        }
+        if (id != 0 && _requests[i].id == id) {
+            return &_requests[i];
+        }
+        if (id == 0 && (oldest == NULL || _requests[i].sent < oldest->sent)) {
+            oldest = &_requests[i];
+        }
+    }
+    return oldest;
+}
+
+/*  Send the pending taps the session and the free requests allow, card reads spaced by READ_GUARD_MS after the  */
+/*  last protocol message until the backend pipelines                                                           */
+
+void Reader::drain() {
+    uint64_t now = _scheduler.now();
+
+    while (_state == STATE_READY && !_pending.empty()) {
+        if (!_pipelining && now - _lastEvent < READ_GUARD_MS * US_PER_MS) {
+            if (!_drainScheduled) {
+                _drainScheduled = true;
+                _scheduler.at(_lastEvent + READ_GUARD_MS * US_PER_MS, [this]() {
+                    _drainScheduled = false;
+                    drain();
+                });
+            }
+            return;
+        }
+        Request* request = freeRequest();
+        if (request == NULL) {
+            return;
+        }
+        request->id = _nextId++;
+        if (_nextId == 0) {
+            _nextId = 1;
+        }
+        request->tap = _pending.front();
+        request->retries = 0;
+        _pending.pop_front();
+        sendAccess(request);
+    }
+}
+
+void Reader::sendAccess(Request* request) {
+    char hex[2 * 10 + 1];
+    char message[256];
+
+    for (uint8_t i = 0; i < request->tap.size; i++) {
+        snprintf(hex + 2 * i, 3, "%02x", request->tap.uid[i]);
+    }
+    int length = snprintf(message, sizeof message, "%s###", _id);
+    length += encrypt_text(_aes, _session, hex, 2 * request->tap.size, message + length);
+    snprintf(message + length, sizeof message - length, "###%u", request->id);
+    publish("access", message);
+    request->sent = _scheduler.now();
+
+    uint16_t id = request->id;
+    _scheduler.after(RESPONSE_TIMEOUT_MS * US_PER_MS, [this, request, id]() { checkResponse(request, id); });
+}
+
+/*  Response timeout: resent ACCESS_MAX_RETRIES times, then lost. Only checked with a session, as protocol_step()  */
+
+void Reader::checkResponse(Request* request, uint16_t id) {
+    if (request->id != id || _scheduler.now() - request->sent < RESPONSE_TIMEOUT_MS * US_PER_MS) {
+        return;
+    }
+    if (_state != STATE_READY) {
+        _scheduler.after(RESPONSE_TIMEOUT_MS * US_PER_MS, [this, request, id]() { checkResponse(request, id); });
+        return;
+    }
+    if (request->retries < ACCESS_MAX_RETRIES) {
+        request->retries++;
+        _report.resent++;
+        sendAccess(request);
+    } else {
+        _report.lost++;
+        request->id = 0;
+        drain();
+    }
+}
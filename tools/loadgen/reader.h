@@ -0,0 +1,86 @@
+/*
+ reader.h - One simulated reader of the fleet, following the protocol state machine of src/main.cpp: INIT, HMAC,
+ then access messages with correlation IDs, at most ACCESS_SLOTS waiting for their response once the backend is
+ known to echo them and one at a time before, with the same timeouts, retries and spacing of the card reads.
+ The RF side is not simulated: a tap hands a UID to the reader, which keeps it until it can be sent.
+*/
+
+#ifndef LOADGEN_READER_H
+#define LOADGEN_READER_H
+
+#include <deque>
+#include "broker.h"
+#include "protocol.h"
+
+#define READER_PENDING_TAPS 8     // Taps a reader keeps while it has no session or no free request
+#define READER_BOOT_MS 3000       // Time a reader takes to come back after a reset
+
+class Reader : public Endpoint {
+public:
+    Reader(Scheduler& scheduler, Broker& broker, Report& report, unsigned index, uint64_t seed);
+
+    const char* id() const { return _id; }
+    const char* key() const { return _key; }
+
+    /*  Connect to the broker and start the handshake  */
+    void start();
+
+    /*  A card presented now  */
+    void tap(const uint8_t* uid, uint8_t size);
+
+    void deliver(const char* topic, const uint8_t* payload, size_t length) override;
+
+private:
+    enum State { STATE_IDLE, STATE_INIT_SENT, STATE_AUTH_SENT, STATE_READY };
+
+    struct Tap {
+        uint8_t uid[10];
+        uint8_t size;
+        uint64_t at;            // When the card was presented
+    };
+
+    struct Request {
+        uint16_t id;            // Correlation ID, 0 if free
+        Tap tap;
+        uint8_t retries;
+        uint64_t sent;
+    };
+
+    void publish(const char* topic, const char* payload);
+    void subscribeShared(bool subscribe);
+    void sendInit();
+    void armAck();
+    void reset();
+    void handle(const char* kind, const char* message);
+    void drain();
+    void sendAccess(Request* request);
+    void checkResponse(Request* request, uint16_t id);
+    void keepAlive();
+    Request* freeRequest();
+    Request* answered(uint16_t id);
+
+    Scheduler& _scheduler;
+    Broker& _broker;
+    Report& _report;
+    char _id[16];
+    char _key[KEY_LENGTH + 1];
+    char _root[32];
+    char _session[SESSION_ID_LENGTH + 1];
+    AES _aes;
+
+    State _state;
+    uint8_t _ackRetries;
+    uint32_t _ackTimer;         // Generation of the ACK timeout, a new one cancels the last
+    uint64_t _stateSince;
+    uint64_t _lastEvent;        // Last protocol message received, spaces the card reads without pipelining
+    uint64_t _lastTraffic;      // Last packet in or out, for the keepalive
+    bool _pipelining;
+    bool _deviceTopics;
+    bool _drainScheduled;
+    bool _connected;
+    uint16_t _nextId;
+    Request _requests[ACCESS_SLOTS];
+    std::deque<Tap> _pending;
+};
+
+#endif
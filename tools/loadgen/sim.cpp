@@ -0,0 +1,57 @@
+/*
+ sim.cpp - Virtual time of the load generator
+*/
+
+#include <math.h>
+#include <time.h>
+#include "sim.h"
+
+void Scheduler::at(uint64_t time, const std::function<void()>& fn) {
+    Event event;
+
+    event.time = time < _now ? _now : time;
+    event.seq = _seq++;
+    event.fn = fn;
+    _events.push(event);
+}
+
+bool Scheduler::step(uint64_t end) {
+    if (_events.empty() || _events.top().time >= end) {
+        return false;
+    }
+    Event event = _events.top();
+    _events.pop();
+    _now = event.time;
+    event.fn();
+    return true;
+}
+
+uint64_t Server::serve(uint64_t arrival, uint64_t cost) {
+    uint64_t start = arrival > _free ? arrival : _free;
+
+    _free = start + cost;
+    _busy += cost;
+    return _free;
+}
+
+uint64_t Prng::next() {
+    _state ^= _state << 13;
+    _state ^= _state >> 7;
+    _state ^= _state << 17;
+    return _state;
+}
+
+double Prng::uniform() {
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double Prng::exponential(double mean) {
+    return -log(1.0 - uniform()) * mean;
+}
+
+uint64_t cpu_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
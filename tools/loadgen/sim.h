@@ -0,0 +1,83 @@
+/*
+ sim.h - Virtual time of the load generator: an event queue that runs events in the order of their time, ties in
+ the order they were scheduled, single threaded servers that make work wait while they are busy, and the random
+ source. A run depends on its options and seed only, plus the CPU time measured for the stand-ins when their cost
+ is not fixed.
+*/
+
+#ifndef LOADGEN_SIM_H
+#define LOADGEN_SIM_H
+
+#include <stdint.h>
+#include <functional>
+#include <queue>
+#include <vector>
+
+#define US_PER_MS 1000ULL
+#define US_PER_S 1000000ULL
+
+class Scheduler {
+public:
+    Scheduler() : _now(0), _seq(0) {}
+
+    /*  Current time in microseconds  */
+    uint64_t now() const { return _now; }
+
+    void at(uint64_t time, const std::function<void()>& fn);
+    void after(uint64_t delay, const std::function<void()>& fn) { at(_now + delay, fn); }
+
+    /*  Run the next event if it is due before end, false once there is none  */
+    bool step(uint64_t end);
+
+private:
+    struct Event {
+        uint64_t time;
+        uint64_t seq;
+        std::function<void()> fn;
+    };
+    struct Later {
+        bool operator()(const Event& a, const Event& b) const {
+            return a.time != b.time ? a.time > b.time : a.seq > b.seq;
+        }
+    };
+
+    std::priority_queue<Event, std::vector<Event>, Later> _events;
+    uint64_t _now;
+    uint64_t _seq;
+};
+
+/*  One worker taking the work in the order it arrives  */
+
+class Server {
+public:
+    Server() : _free(0), _busy(0) {}
+
+    /*  Work of cost microseconds arriving at arrival, returns when it is done  */
+    uint64_t serve(uint64_t arrival, uint64_t cost);
+
+    uint64_t busy() const { return _busy; }  // Time spent working, in microseconds
+
+private:
+    uint64_t _free;
+    uint64_t _busy;
+};
+
+/*  Xorshift64  */
+
+class Prng {
+public:
+    explicit Prng(uint64_t seed) : _state(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+
+    uint64_t next();
+    double uniform();                        // [0, 1)
+    uint64_t below(uint64_t bound) { return next() % bound; }
+    double exponential(double mean);
+
+private:
+    uint64_t _state;
+};
+
+/*  CPU time of the process in nanoseconds, to measure the work done by the stand-ins  */
+uint64_t cpu_ns();
+
+#endif
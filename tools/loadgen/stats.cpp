@@ -0,0 +1,73 @@
+/*
+ stats.cpp - Samples and the report of a run
+*/
+
+#include <string.h>
+#include <algorithm>
+#include "sim.h"
+#include "stats.h"
+
+void Samples::add(uint64_t value) {
+    _values.push_back(value);
+    _sum += value;
+    _sorted = false;
+}
+
+uint64_t Samples::percentile(double p) {
+    if (_values.empty()) {
+        return 0;
+    }
+    if (!_sorted) {
+        std::sort(_values.begin(), _values.end());
+        _sorted = true;
+    }
+    size_t index = (size_t)(p * (_values.size() - 1) + 0.5);
+    return _values[index];
+}
+
+TypeStats& Report::type(const char* topic) {
+    const char* slash = strrchr(topic, '/');
+
+    return types[slash != NULL ? slash + 1 : topic];
+}
+
+static void print_round_trip(FILE* out, const char* name, Samples& samples) {
+    fprintf(out, "  %-10s %9lu %9.1f %9.1f %9.1f %9.1f %9.1f\n", name, (unsigned long)samples.count(),
+            samples.percentile(0.50) / 1000.0, samples.percentile(0.90) / 1000.0, samples.percentile(0.99) / 1000.0,
+            samples.percentile(0.999) / 1000.0, samples.percentile(1.0) / 1000.0);
+}
+
+void Report::print(FILE* out, double seconds, double real, uint64_t broker_busy_us, uint64_t backend_busy_us) {
+    fprintf(out, "loadgen: %.0f s simulated in %.2f s, %lu deliveries\n", seconds, real, (unsigned long)deliveries);
+    fprintf(out, "loadgen: %lu taps, %lu answered, %lu lost, %lu dropped, %lu resent\n", (unsigned long)taps,
+            (unsigned long)answered, (unsigned long)lost, (unsigned long)dropped, (unsigned long)resent);
+    fprintf(out, "loadgen: %lu handshakes, %lu session ends, %lu resets\n", (unsigned long)handshakes,
+            (unsigned long)failures, (unsigned long)resets);
+    fprintf(out, "loadgen: broker busy %.1f%%, backend busy %.1f%%\n",
+            seconds > 0 ? 100.0 * broker_busy_us / (double)US_PER_S / seconds : 0,
+            seconds > 0 ? 100.0 * backend_busy_us / (double)US_PER_S / seconds : 0);
+
+    fprintf(out, "\n  %-10s %9s %9s %9s %9s %9s %9s %9s %9s\n", "type", "count", "msg/s", "bytes/s", "p50 ms",
+            "p99 ms", "max ms", "cpu us", "max/s");
+    for (std::map<std::string, TypeStats>::iterator it = types.begin(); it != types.end(); ++it) {
+        TypeStats& stats = it->second;
+        double cpu_us = stats.cpu_ns.mean() / 1000.0;
+
+        fprintf(out, "  %-10s %9lu %9.1f %9.0f", it->first.c_str(), (unsigned long)stats.count,
+                seconds > 0 ? stats.count / seconds : 0, seconds > 0 ? stats.bytes / seconds : 0);
+        if (stats.delivery_us.count() == 0) {
+            // Control packets, answered by the broker itself
+            fprintf(out, " %9s %9s %9s %9s %9s\n", "-", "-", "-", "-", "-");
+            continue;
+        }
+        fprintf(out, " %9.2f %9.2f %9.2f %9.1f %9.0f\n", stats.delivery_us.percentile(0.50) / 1000.0,
+                stats.delivery_us.percentile(0.99) / 1000.0, stats.delivery_us.percentile(1.0) / 1000.0, cpu_us,
+                cpu_us > 0 ? 1000000.0 / cpu_us : 0);
+    }
+
+    fprintf(out, "\n  %-10s %9s %9s %9s %9s %9s %9s\n", "round trip", "count", "p50 ms", "p90 ms", "p99 ms",
+            "p99.9 ms", "max ms");
+    print_round_trip(out, "handshake", handshake_us);
+    print_round_trip(out, "auth", auth_us);
+    print_round_trip(out, "tap", tap_us);
+}
@@ -0,0 +1,64 @@
+/*
+ stats.h - What the load generator measures: every sample is kept, so the percentiles are exact, and the report
+ groups the messages by type, the last level of their topic (init, hmac, access, ack, response, ...).
+*/
+
+#ifndef LOADGEN_STATS_H
+#define LOADGEN_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class Samples {
+public:
+    Samples() : _sorted(true), _sum(0) {}
+
+    void add(uint64_t value);
+    size_t count() const { return _values.size(); }
+    double mean() const { return _values.empty() ? 0 : (double)_sum / _values.size(); }
+
+    /*  Value below which a fraction p of the samples fall, 0 without samples  */
+    uint64_t percentile(double p);
+
+private:
+    std::vector<uint64_t> _values;
+    bool _sorted;
+    uint64_t _sum;
+};
+
+struct TypeStats {
+    TypeStats() : count(0), bytes(0) {}
+
+    uint64_t count;       // Messages published
+    uint64_t bytes;       // MQTT packet bytes into the broker and out to the subscribers
+    Samples delivery_us;  // From the publish to the subscriber, queues of the broker included
+    Samples cpu_ns;       // Broker routing plus the handling by the subscriber, measured
+};
+
+struct Report {
+    Report() : taps(0), answered(0), lost(0), dropped(0), resent(0), handshakes(0), failures(0), resets(0),
+               deliveries(0) {}
+
+    std::map<std::string, TypeStats> types;
+    Samples handshake_us;  // INIT to the ACK with the session ID
+    Samples auth_us;       // HMAC to the ACK of the authentication
+    Samples tap_us;        // Card presented to the response received, waits for a session included
+
+    uint64_t taps;
+    uint64_t answered;
+    uint64_t lost;         // Access messages without a response after every retry
+    uint64_t dropped;      // Taps a reader could not keep while it waited for a session or a free request
+    uint64_t resent;
+    uint64_t handshakes;   // INIT messages sent
+    uint64_t failures;     // Session ends asked by the backend
+    uint64_t resets;       // Readers reset after ACK_MAX_RETRIES
+    uint64_t deliveries;
+
+    TypeStats& type(const char* topic);
+    void print(FILE* out, double seconds, double real, uint64_t broker_busy_us, uint64_t backend_busy_us);
+};
+
+#endif